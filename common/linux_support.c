@@ -19,10 +19,13 @@
 
 #define _GNU_SOURCE
 #include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <pthread.h>
 #include <sched.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -88,3 +91,27 @@ int linux_isolate_namespace(void)
 
 	return 0;
 }
+
+/*
+ * The futex words are located in memory shared between processes. Thus,
+ * FUTEX_PRIVATE_FLAG must not be used.
+ */
+int linux_futex_wait(uint32_t *uaddr, uint32_t val,
+		     const struct timespec *timeout)
+{
+	if (syscall(SYS_futex, uaddr, FUTEX_WAIT, val, timeout, NULL, 0) < 0) {
+		int errsv = errno;
+
+		/* The futex word changed before going to sleep */
+		if (errsv == EAGAIN || errsv == EINTR)
+			return 0;
+		return -errsv;
+	}
+
+	return 0;
+}
+
+void linux_futex_wake_all(uint32_t *uaddr)
+{
+	syscall(SYS_futex, uaddr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
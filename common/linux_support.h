@@ -20,6 +20,10 @@
 #ifndef LINUX_SUPPORT_H
 #define LINUX_SUPPORT_H
 
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
 #include "config.h"
 
 #ifdef __cplusplus
@@ -30,9 +34,40 @@ extern "C"
 #ifdef ESDM_LINUX
 int linux_isolate_namespace(void);
 int linux_isolate_namespace_prefork(void);
+
+/**
+ * @brief Wait until a futex word in shared memory changes
+ *
+ * @param [in] uaddr Futex word
+ * @param [in] val Value the futex word is expected to hold - the function
+ *		   returns immediately if it does not hold this value
+ * @param [in] timeout Relative timeout or NULL to wait without timeout
+ *
+ * @return 0 when woken up or the word does not hold val, -ETIMEDOUT on
+ *	   timeout, < 0 on other errors
+ */
+int linux_futex_wait(uint32_t *uaddr, uint32_t val,
+		     const struct timespec *timeout);
+
+/**
+ * @brief Wake up all waiters on a futex word in shared memory
+ *
+ * @param [in] uaddr Futex word
+ */
+void linux_futex_wake_all(uint32_t *uaddr);
 #else
 static inline int linux_isolate_namespace(void) { return 0; }
 static inline int linux_isolate_namespace_prefork(void) { return 0; }
+static inline int linux_futex_wait(uint32_t *uaddr, uint32_t val,
+				   const struct timespec *timeout)
+{
+	(void)uaddr;
+	(void)val;
+	if (timeout)
+		nanosleep(timeout, NULL);
+	return -EOPNOTSUPP;
+}
+static inline void linux_futex_wake_all(uint32_t *uaddr) { (void)uaddr; }
 #endif
 
 #ifdef __cplusplus
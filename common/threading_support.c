@@ -25,11 +25,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "atomic_bool.h"
 #include "bool.h"
+#include "build_bug_on.h"
 #include "config.h"
+#include "helper.h"
 #include "logger.h"
 #include "memset_secure.h"
 #include "mutex_w.h"
@@ -43,47 +46,130 @@
  * Threading Support
  * =================
  *
- * Threading support is provided by maintaining a pool of threads which
- * are spawned when they are needed. Once the thread completes its first job
- * it remains idle but alive and waits for the next job. The code first
- * tries to reuse existing idle threads before spawning new threads.
+ * Threading support is provided by a pool of worker threads for each thread
+ * group. A job started with thread_start is handed directly to an idle worker
+ * of its group. If no worker is idle, a new worker is spawned unless the group
+ * reached its maximum size. Otherwise thread_start fails with -EAGAIN as most
+ * jobs never complete (server loops, monitors) and a job waiting for them would
+ * never execute. Only thread groups executing short jobs enable queueing with
+ * thread_group_set_queueing: their jobs are appended to the bounded queue of
+ * the group which the workers drain when they complete their current job.
+ *
+ * Idle workers are parked on their own condition variable. Handing out a job
+ * therefore wakes exactly one thread. Workers exceeding the minimum size of
+ * their group terminate after being idle for THREADING_IDLE_TIMEOUT_SEC
+ * seconds.
  *
  * It is permissible to spawn new threads from different mother threads. When
- * calling thread_wait, only the threads from the caller are waited for.
+ * calling thread_wait, only the jobs started by the caller are waited for. The
+ * accounting of the jobs of a mother thread is reference counted by the jobs as
+ * a mother thread may terminate before its jobs complete.
+ */
+
+/* Number of jobs a thread group queues when all its workers are busy */
+#define THREADING_QUEUE_LEN 32
+
+/* Time after which an idle worker above the minimum pool size terminates */
+#define THREADING_IDLE_TIMEOUT_SEC 10
+
+/*
+ * Jobs of one mother thread
+ */
+struct thread_parent {
+	unsigned int refcnt; /* Mother thread and its pending jobs */
+	unsigned int pending; /* Started jobs not yet completed */
+	int ret; /* Return codes of completed jobs ORed together */
+};
+
+/*
+ * Job to be executed by a worker
  */
+struct thread_job {
+	int (*start_routine)(void *); /* Thread code to be executed */
+	void *data; /* Parameters used by the thread code */
+	struct thread_parent *parent; /* Mother thread */
+};
+
+struct thread_group;
 
 /*
  * Structure for one thread
  */
 struct thread_ctx {
 	pthread_t thread_id; /* Thread ID from pthread_create */
-	pthread_t parent; /* Parent thread ID */
 	unsigned int thread_num; /* Current slot number */
-	int ret_ancestor; /* Return code of ancestor code */
+	struct thread_group *group; /* Thread group the thread belongs to */
 
-	int (*start_routine)(void *); /* Thread code to be executed */
-	void *data; /* Parameters used by the thread code */
+	bool alive; /* Is thread associated with structure? */
+	bool parked; /* Is thread on the idle list of its group? */
+	bool has_job; /* Was a job handed to the thread? */
+	struct thread_job job; /* Job handed to the thread */
 
-	atomic_bool_t thread_pending; /* Is thread associated with structure? */
-	mutex_w_t inuse; /* Is thread data structure used? */
-	atomic_bool_t shutdown; /* Shall the thread be shut down? */
-	bool scheduled; /* Is/was a job executed and return code
-					 * is ready for pickup? */
+	struct thread_ctx *next_idle; /* Idle list of the group */
+	pthread_cond_t worker_cv; /* Wakeup of the parked thread */
+};
+
+/*
+ * Structure for one thread group - all fields are protected by the lock
+ */
+struct thread_group {
+	pthread_mutex_t lock;
+
+	struct thread_job queue[THREADING_QUEUE_LEN];
+	unsigned int head; /* Oldest queued job */
+	unsigned int queued; /* Number of queued jobs */
+
+	struct thread_ctx *idle; /* Parked threads, most recently parked first */
+
+	unsigned int first_slot; /* First thread slot of the group */
+	unsigned int slots; /* Number of thread slots of the group */
+	unsigned int workers; /* Number of alive threads */
+	unsigned int min_workers; /* Threads kept alive when idle */
+	unsigned int max_workers; /* Maximum number of threads */
+	size_t stack_size; /* Stack size of new threads, 0 for the default */
+
+	bool special; /* Special thread group */
+	bool queueing; /* Queue jobs when all threads are busy? */
+	bool shutdown; /* Shall the threads be shut down? */
+	int ret; /* Return codes of completed jobs ORed together */
+};
 
-	pthread_cond_t worker_cv;
-	pthread_mutex_t worker_lock;
+/*
+ * Number of threads reserved for the special thread groups, indexed by
+ * (uint32_t)-1 - thread group.
+ */
+static const unsigned int thread_special_slots[] = {
+	1, /* ESDM_THREAD_CUSE_POLL_GROUP */
+	1, /* ESDM_THREAD_ES_MONITOR */
+	1, /* ESDM_THREAD_RPC_UNPRIV_GROUP */
+	1, /* ESDM_THREAD_DRNG_RESEED */
+	ESDM_THREAD_ES_WORKERS_SLOTS, /* ESDM_THREAD_ES_WORKERS */
 };
 
+#define THREADING_SPECIAL_THREADS (4 + ESDM_THREAD_ES_WORKERS_SLOTS)
+
 /*
  * Total number of all threads, including slaves and system threads.
  */
 #define THREADING_REALLY_ALL_THREADS                                           \
+	(THREADING_MAX_THREADS + THREADING_SPECIAL_THREADS)
+
+/*
+ * Total number of all thread groups, including the special thread groups.
+ */
+#define THREADING_ALL_GROUPS                                                   \
 	(THREADING_MAX_THREADS + ESDM_THREAD_MAX_SPECIAL_GROUPS)
 
 /*
  * Array holding the thread state for all slaves and system threads.
  */
 static struct thread_ctx threads[THREADING_REALLY_ALL_THREADS];
+
+/*
+ * Array holding the regular thread groups followed by the special thread
+ * groups.
+ */
+static struct thread_group thread_groups[THREADING_ALL_GROUPS];
 static uint32_t threads_groups = 0;
 static uint32_t threads_per_threadgroup = 1;
 
@@ -102,71 +188,124 @@ static atomic_bool_t threads_in_cancel = ATOMIC_BOOL_INIT(false);
  */
 static DEFINE_MUTEX_W_UNLOCKED(threads_cleanup);
 
-/* Waiting helper for the thread_schedule function */
-static pthread_cond_t thread_schedule_cv;
-static pthread_mutex_t thread_schedule_lock = PTHREAD_MUTEX_INITIALIZER;
-
 /* Waiting helper for the thread_wait function */
-static pthread_cond_t thread_wait_cv;
+static pthread_cond_t thread_wait_cv = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t thread_wait_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static inline unsigned int thread_get_special_slot(unsigned int thread_group)
-{
-	if (thread_group <= THREADING_MAX_THREADS)
-		return 0;
+/*
+ * Jobs started by the current thread - the key releases the reference of the
+ * mother thread when it terminates.
+ */
+static __thread struct thread_parent *thread_parent = NULL;
+static pthread_key_t thread_parent_key;
 
+static struct thread_group *thread_get_group(uint32_t thread_group)
+{
 	/* Special groups are defined as (uint32_t)-1 and lower */
-	return (THREADING_MAX_THREADS + (UINT_MAX - thread_group));
+	if (UINT_MAX - thread_group < ESDM_THREAD_MAX_SPECIAL_GROUPS) {
+		struct thread_group *grp = &thread_groups[
+			THREADING_MAX_THREADS + (UINT_MAX - thread_group)];
+
+		/* Threading support is not initialized */
+		return grp->slots ? grp : NULL;
+	}
+
+	if (thread_group >= threads_groups)
+		return NULL;
+
+	return &thread_groups[thread_group];
 }
 
-static inline bool thread_is_special(struct thread_ctx *tctx)
+/* Drop a reference to the job accounting - caller holds thread_wait_lock. */
+static void thread_parent_put(struct thread_parent *parent)
 {
-	return (tctx->thread_num >= THREADING_MAX_THREADS) ? true : false;
+	if (!--parent->refcnt)
+		free(parent);
 }
 
-static inline void thread_block(pthread_cond_t *cv, pthread_mutex_t *lock)
+/* Destructor of thread_parent_key invoked when a mother thread terminates. */
+static void thread_parent_release(void *arg)
 {
-	/* Wait */
-	pthread_mutex_lock(lock);
-	pthread_cond_wait(cv, lock);
-	pthread_mutex_unlock(lock);
+	pthread_mutex_lock(&thread_wait_lock);
+	thread_parent_put((struct thread_parent *)arg);
+	pthread_mutex_unlock(&thread_wait_lock);
+}
+
+/*
+ * Get the job accounting of the current thread with a reference for a new
+ * job - caller holds thread_wait_lock.
+ */
+static struct thread_parent *thread_parent_get(void)
+{
+	if (!thread_parent) {
+		thread_parent = calloc(1, sizeof(*thread_parent));
+		if (!thread_parent)
+			return NULL;
+		thread_parent->refcnt = 1;
+		if (pthread_setspecific(thread_parent_key, thread_parent)) {
+			free(thread_parent);
+			thread_parent = NULL;
+			return NULL;
+		}
+	}
+
+	thread_parent->refcnt++;
+	thread_parent->pending++;
+
+	return thread_parent;
 }
 
-static inline bool thread_dirty(unsigned int slot)
+/* Account a completed job with its mother thread. */
+static void thread_parent_done(struct thread_parent *parent, int ret)
 {
-	return (atomic_bool_read(&threads[slot].thread_pending));
+	pthread_mutex_lock(&thread_wait_lock);
+	parent->ret |= ret;
+	if (!--parent->pending)
+		pthread_cond_broadcast(&thread_wait_cv);
+	thread_parent_put(parent);
+	pthread_mutex_unlock(&thread_wait_lock);
 }
 
-/* Thread structure cleanup after execution when thread is kept alive. */
-static inline void thread_cleanup(struct thread_ctx *tctx)
+/* Remove a parked thread from the idle list - caller holds the group lock. */
+static void thread_unpark(struct thread_group *grp, struct thread_ctx *tctx)
 {
-	tctx->data = NULL;
-	tctx->start_routine = NULL;
-	pthread_cond_broadcast(&thread_schedule_cv);
-	pthread_cond_broadcast(&thread_wait_cv);
+	struct thread_ctx **p;
 
-	/* Return values of special threads is irrelevant */
-	if (thread_is_special(tctx))
-		tctx->scheduled = false;
+	if (!tctx->parked)
+		return;
+
+	for (p = &grp->idle; *p; p = &(*p)->next_idle) {
+		if (*p == tctx) {
+			*p = tctx->next_idle;
+			break;
+		}
+	}
+	tctx->parked = false;
 }
 
-/* Thread structure cleanup when thread is terminated. */
-static inline void thread_cleanup_full(struct thread_ctx *tctx)
+/* Wake all parked threads - caller holds the group lock. */
+static void thread_wake_idle(struct thread_group *grp)
 {
-	thread_cleanup(tctx);
-	tctx->thread_num = 0;
-	atomic_bool_set_false(&tctx->thread_pending);
-	tctx->scheduled = false;
-	tctx->ret_ancestor = 0;
-	mutex_w_destroy(&tctx->inuse);
-	pthread_mutex_destroy(&tctx->worker_lock);
+	struct thread_ctx *tctx;
+
+	while (grp->idle) {
+		tctx = grp->idle;
+		grp->idle = tctx->next_idle;
+		tctx->parked = false;
+		pthread_cond_signal(&tctx->worker_cv);
+	}
 }
 
 int thread_init(uint32_t groups)
 {
 	static uint32_t thread_initialized = 0;
-	unsigned int i;
-	int ret;
+	struct thread_group *grp;
+	pthread_condattr_t attr;
+	unsigned int i, special_slot = THREADING_MAX_THREADS;
+	int ret = 0;
+
+	BUILD_BUG_ON(ARRAY_SIZE(thread_special_slots) !=
+		     ESDM_THREAD_MAX_SPECIAL_GROUPS);
 
 	if (groups > (THREADING_MAX_THREADS)) {
 		logger(LOGGER_ERR, LOGGER_C_THREADING,
@@ -184,19 +323,40 @@ int thread_init(uint32_t groups)
 
 	mutex_w_init(&threads_cleanup, 0, 1);
 
+	CKINT(-pthread_key_create(&thread_parent_key, thread_parent_release));
 	CKINT(pthread_attr_init(&pthread_attr));
 	memset(threads, 0, sizeof(threads));
+	memset(thread_groups, 0, sizeof(thread_groups));
 
+	/* Parked threads time out based on the monotonic clock */
+	CKINT(-pthread_condattr_init(&attr));
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
 	for (i = 0; i < THREADING_REALLY_ALL_THREADS; i++) {
-		atomic_bool_set_false(&threads[i].thread_pending);
-		mutex_w_init(&threads[i].inuse, false, 1);
-		atomic_bool_set_false(&threads[i].shutdown);
-		pthread_mutex_init(&threads[i].worker_lock, NULL);
+		threads[i].thread_num = i;
+		pthread_cond_init(&threads[i].worker_cv, &attr);
 	}
+	pthread_condattr_destroy(&attr);
 
 	threads_groups = groups;
 	threads_per_threadgroup = THREADING_MAX_THREADS / threads_groups;
 
+	for (i = 0, grp = thread_groups; i < THREADING_ALL_GROUPS; i++, grp++) {
+		pthread_mutex_init(&grp->lock, NULL);
+
+		if (i >= THREADING_MAX_THREADS) {
+			/* Special groups have their reserved threads */
+			grp->first_slot = special_slot;
+			grp->slots =
+				thread_special_slots[i - THREADING_MAX_THREADS];
+			grp->special = true;
+			special_slot += grp->slots;
+		} else if (i < threads_groups) {
+			grp->first_slot = i * threads_per_threadgroup;
+			grp->slots = threads_per_threadgroup;
+		}
+		grp->max_workers = grp->slots;
+	}
+
 	logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
 	       "Initialized threading support for %u threads\n",
 	       THREADING_MAX_THREADS);
@@ -208,17 +368,40 @@ int thread_init(uint32_t groups)
 	}
 
 out:
-	return 0;
+	return ret;
+}
+
+/*
+ * Cleanup of a thread cancelled while executing a job: the job is completed
+ * and the thread leaves the pool. The slot is released by the thread joining
+ * this thread.
+ */
+static void thread_worker_cancelled(void *arg)
+{
+	struct thread_ctx *tctx = (struct thread_ctx *)arg;
+	struct thread_group *grp = tctx->group;
+
+	thread_parent_done(tctx->job.parent, -ESHUTDOWN);
+
+	pthread_mutex_lock(&grp->lock);
+	grp->workers--;
+	pthread_mutex_unlock(&grp->lock);
 }
 
 /* Worker loop of a thread */
 static void *thread_worker(void *arg)
 {
 	struct thread_ctx *tctx = (struct thread_ctx *)arg;
+	struct thread_group *grp = tctx->group;
+	struct timespec ts;
+	bool retire = false;
+	int ret;
 
-	if (!thread_is_special(tctx)) {
+	/* Only jobs may be cancelled - the pool state must stay consistent */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	if (!grp->special) {
 		sigset_t block, old;
-		int ret;
 
 		/*
 		 * Block all but terminating signals from being processed by
@@ -230,213 +413,167 @@ static void *thread_worker(void *arg)
 		sigdelset(&block, SIGQUIT);
 		sigdelset(&block, SIGTERM);
 		ret = -pthread_sigmask(SIG_BLOCK, &block, &old);
-		if (ret)
-			return NULL;
+		if (ret) {
+			logger(LOGGER_WARN, LOGGER_C_THREADING,
+			       "Blocking signals for thread %u failed: %d\n",
+			       tctx->thread_num, ret);
+		}
 	}
 
-	while (1) {
-		mutex_w_lock(&tctx->inuse);
+	pthread_mutex_lock(&grp->lock);
 
-		if (atomic_bool_read(&tctx->shutdown)) {
+	while (1) {
+		if (tctx->has_job) {
+			/* Job handed over by thread_start */
+			tctx->has_job = false;
+		} else if (grp->queued) {
+			/* Job queued while all threads were busy */
+			tctx->job = grp->queue[grp->head];
+			grp->head = (grp->head + 1) % THREADING_QUEUE_LEN;
+			grp->queued--;
+		} else if (grp->shutdown) {
 			/* Request for termination */
-			mutex_w_unlock(&tctx->inuse);
-			/*
-			 * As the while loop terminates, the thread will
-			 * terminate as well - clean up our structure in case
-			 * the signal handler wants to cancel all threads.
-			 * In this case, it has to identify that this thread
-			 * does not exist any more.
-			 */
-			thread_cleanup_full(tctx);
-			pthread_exit(NULL);
 			break;
-		} else if (tctx->start_routine) {
-			/* Work to do, execute */
-			tctx->ret_ancestor = tctx->start_routine(tctx->data);
-			thread_cleanup(tctx);
-			logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
-			       "Thread %u completed\n", tctx->thread_num);
-			mutex_w_unlock(&tctx->inuse);
-			pthread_cond_broadcast(&thread_wait_cv);
+		} else if ((retire && grp->workers > grp->min_workers) ||
+			   grp->workers > grp->max_workers) {
+			/* Shrink the pool */
+			retire = true;
+			break;
 		} else {
-			mutex_w_unlock(&tctx->inuse);
+			/* Idle - park until a job is handed over */
+			tctx->next_idle = grp->idle;
+			grp->idle = tctx;
+			tctx->parked = true;
+
+			if (grp->workers > grp->min_workers) {
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+				ts.tv_sec += THREADING_IDLE_TIMEOUT_SEC;
+				retire = (pthread_cond_timedwait(
+						  &tctx->worker_cv, &grp->lock,
+						  &ts) == ETIMEDOUT);
+			} else {
+				pthread_cond_wait(&tctx->worker_cv, &grp->lock);
+			}
 
-			/* Idle */
-			thread_block(&tctx->worker_cv, &tctx->worker_lock);
+			thread_unpark(grp, tctx);
+			continue;
 		}
-	}
 
-	return NULL;
-}
+		retire = false;
+		pthread_mutex_unlock(&grp->lock);
 
-/* Spawn a thread */
-static int thread_create(struct thread_ctx *tctx, unsigned int slot)
-{
-	int ret;
+		/* Work to do, execute */
+		pthread_cleanup_push(thread_worker_cancelled, tctx);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		ret = tctx->job.start_routine(tctx->job.data);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_cleanup_pop(0);
 
-	tctx->thread_num = slot;
-	tctx->data = NULL;
-	atomic_bool_set_true(&tctx->thread_pending);
+		logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
+		       "Thread %u completed\n", tctx->thread_num);
+		thread_parent_done(tctx->job.parent, ret);
 
-	ret = -pthread_create(&tctx->thread_id, &pthread_attr, &thread_worker,
-			      tctx);
-	if (ret)
-		goto err;
+		pthread_mutex_lock(&grp->lock);
+		grp->ret |= ret;
+	}
 
-	ret = -pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-	if (ret)
-		goto err;
+	grp->workers--;
 
-	return 0;
+	/*
+	 * A retiring thread releases its slot. During a shutdown, the slot is
+	 * released by the thread joining this thread.
+	 */
+	if (retire) {
+		tctx->alive = false;
+		pthread_detach(pthread_self());
+		logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
+		       "Idle thread %u terminated\n", tctx->thread_num);
+	}
 
-err:
-	thread_cleanup_full(tctx);
-	return ret;
+	pthread_mutex_unlock(&grp->lock);
+
+	return NULL;
 }
 
-/* Find free pthread slot and schedule the job */
-static int thread_schedule(int (*start_routine)(void *), void *tdata,
-			   uint32_t thread_group, int *ret_ancestor)
+/* Spawn a thread executing the job - caller holds the group lock. */
+static int thread_create(struct thread_group *grp, struct thread_job *job)
 {
-	pthread_t self = pthread_self();
-	unsigned int i, upper;
-	unsigned int special_slot = thread_get_special_slot(thread_group);
+	struct thread_ctx *tctx = NULL;
+	unsigned int i;
+	int ret;
 
-	if (threads_groups < thread_group && !special_slot) {
-		logger(LOGGER_ERR, LOGGER_C_THREADING,
-		       "undefined thread group requested (%u, max thread group is %u)\n",
-		       thread_group, threads_groups);
-		return -EINVAL;
+	for (i = grp->first_slot; i < grp->first_slot + grp->slots; i++) {
+		if (!threads[i].alive) {
+			tctx = &threads[i];
+			break;
+		}
 	}
-
-	/* Get the range of slots of the thread_group */
-	if (special_slot) {
-		i = special_slot;
-		upper = special_slot + 1;
+	if (!tctx)
+		return -EAGAIN;
+
+	tctx->group = grp;
+	tctx->job = *job;
+	tctx->has_job = true;
+	tctx->parked = false;
+	tctx->alive = true;
+
+	if (grp->stack_size) {
+		pthread_attr_t attr;
+
+		ret = -pthread_attr_init(&attr);
+		if (!ret) {
+			ret = -pthread_attr_setstacksize(&attr,
+							 grp->stack_size);
+			if (!ret)
+				ret = -pthread_create(&tctx->thread_id, &attr,
+						      &thread_worker, tctx);
+			pthread_attr_destroy(&attr);
+		}
 	} else {
-		i = thread_group * threads_per_threadgroup;
-		upper = (thread_group + 1) * threads_per_threadgroup;
+		ret = -pthread_create(&tctx->thread_id, &pthread_attr,
+				      &thread_worker, tctx);
+	}
+	if (ret) {
+		tctx->has_job = false;
+		tctx->alive = false;
+		return ret;
 	}
 
-	for (; i < upper; i++) {
-		if (atomic_bool_read(&threads_in_cancel))
-			return -ESHUTDOWN;
-
-		if (mutex_w_trylock(&threads[i].inuse)) {
-			/*
-			 * The thread is currently executing a body of code -
-			 * kick the worker.
-			 */
-			if (threads[i].start_routine ||
-			    atomic_bool_read(&threads[i].shutdown)) {
-				mutex_w_unlock(&threads[i].inuse);
-				pthread_cond_broadcast(&threads[i].worker_cv);
-				continue;
-			}
-
-			/*
-			 * Thread is not being picked up by thread_block of the
-			 * mother thread - kick the worker.
-			 */
-			if (threads[i].scheduled &&
-			    !pthread_equal(threads[i].parent, self)) {
-				mutex_w_unlock(&threads[i].inuse);
-				pthread_cond_broadcast(&threads[i].worker_cv);
-				continue;
-			}
-
-			/*
-			 * Create thread as we have a clean slot and all
-			 * existing threads are busy.
-			 */
-			if (!thread_dirty(i)) {
-				int ret = thread_create(&threads[i], i);
-
-				if (ret)
-					return ret;
-
-				logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
-				       "Thread %u for thread group %u allocated\n",
-				       i, thread_group);
-			}
-
-			/* Catch the return code of the ancestor thread */
-			if (ret_ancestor)
-				*ret_ancestor = threads[i].ret_ancestor;
+	grp->workers++;
 
-			/*
-			 * Use the thread from the thread pool and schedule
-			 * job.
-			 */
-			logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
-			       "Thread %u for thread group %u assigned\n", i,
-			       thread_group);
-			threads[i].data = tdata;
-			threads[i].start_routine = start_routine;
-			threads[i].parent = pthread_self();
-			threads[i].scheduled = true;
-			pthread_cond_broadcast(&threads[i].worker_cv);
-			mutex_w_unlock(&threads[i].inuse);
-			pthread_cond_broadcast(&thread_wait_cv);
-
-			return 0;
-		}
-	}
+	logger(LOGGER_VERBOSE, LOGGER_C_THREADING, "Thread %u allocated\n",
+	       tctx->thread_num);
 
-	return -EAGAIN;
+	return 0;
 }
 
 /*
- * Wait for all threads in spawned by calling thread and fetch the return code.
+ * Wait for all jobs started by the calling thread and fetch the return code.
  */
 int thread_wait(void)
 {
-	unsigned int i;
-	pthread_t self = pthread_self();
-	int ret = 0;
-	bool wait = true;
-
-	while (wait) {
-		wait = false;
-
-		/* Only wait for our children */
-		for (i = 0; i < THREADING_MAX_THREADS; i++) {
-			if (atomic_bool_read(&threads[i].shutdown))
-				return -ESHUTDOWN;
-
-			/* Thread is not initialized, skip */
-			if (!thread_dirty(i))
-				continue;
-
-			/* Thread is not one of our children, skip */
-			if (!pthread_equal(threads[i].parent, self))
-				continue;
+	struct thread_parent *parent = thread_parent;
+	int ret;
 
-			/* If the thread executes a job, skip but wait. */
-			if (!mutex_w_trylock(&threads[i].inuse)) {
-				wait = true;
-				continue;
-			}
+	/* No job was ever started by the caller */
+	if (!parent)
+		return 0;
 
-			/*
-			 * If there is a start routine, a job is pending and we
-			 * wait for it to finish.
-			 */
-			if (threads[i].start_routine) {
-				wait = true;
-			} else {
-				/* Collect return code of our threads */
-				ret |= threads[i].ret_ancestor;
-				threads[i].scheduled = false;
-			}
+	pthread_mutex_lock(&thread_wait_lock);
 
-			mutex_w_unlock(&threads[i].inuse);
-		}
+	while (parent->pending && !atomic_bool_read(&threads_in_cancel))
+		pthread_cond_wait(&thread_wait_cv, &thread_wait_lock);
 
-		if (wait)
-			thread_block(&thread_wait_cv, &thread_wait_lock);
+	if (parent->pending) {
+		ret = -ESHUTDOWN;
+	} else {
+		/* Collect return code of our jobs */
+		ret = parent->ret;
+		parent->ret = 0;
 	}
 
+	pthread_mutex_unlock(&thread_wait_lock);
+
 	return ret;
 }
 
@@ -464,6 +601,9 @@ int thread_set_name(enum esdm_request_type type, uint32_t id)
 	case es_kernel_feeder:
 		snprintf(name, sizeof(name), "ESDM krnl_feed");
 		break;
+	case drng_reseed:
+		snprintf(name, sizeof(name), "ESDM reseed");
+		break;
 	default:
 		snprintf(name, sizeof(name), "ESDM %u", id);
 		break;
@@ -482,38 +622,102 @@ int thread_get_name(char *name, size_t len)
 	return -pthread_getname_np(pthread_self(), name, len);
 }
 
+/*
+ * Set the shutdown flag of the thread groups and wake their parked threads.
+ * The IDs of the alive threads are returned for joining.
+ */
+static unsigned int thread_shutdown_groups(bool system_threads,
+					   pthread_t *thread_ids,
+					   unsigned int *slots)
+{
+	struct thread_group *grp;
+	unsigned int i, j, num = 0;
+
+	for (i = 0, grp = thread_groups; i < THREADING_ALL_GROUPS; i++, grp++) {
+		if (!grp->slots || (grp->special && !system_threads))
+			continue;
+
+		pthread_mutex_lock(&grp->lock);
+
+		grp->shutdown = true;
+		thread_wake_idle(grp);
+
+		for (j = grp->first_slot; j < grp->first_slot + grp->slots;
+		     j++) {
+			/* Do not wait for ourselves */
+			if (!threads[j].alive ||
+			    pthread_equal(threads[j].thread_id, pthread_self()))
+				continue;
+			thread_ids[num] = threads[j].thread_id;
+			slots[num] = j;
+			num++;
+		}
+
+		pthread_mutex_unlock(&grp->lock);
+	}
+
+	return num;
+}
+
+/* Release the slots of joined threads and collect the return codes. */
+static int thread_release_groups(bool system_threads, unsigned int *slots,
+				 unsigned int num, bool allow_spawning)
+{
+	struct thread_group *grp;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < num; i++)
+		threads[slots[i]].alive = false;
+
+	for (i = 0, grp = thread_groups; i < THREADING_ALL_GROUPS; i++, grp++) {
+		if (!grp->slots || (grp->special && !system_threads))
+			continue;
+
+		pthread_mutex_lock(&grp->lock);
+		ret |= grp->ret;
+		grp->ret = 0;
+
+		/* Complete the jobs no thread took from the queue */
+		while (grp->queued) {
+			thread_parent_done(grp->queue[grp->head].parent,
+					   -ESHUTDOWN);
+			grp->head = (grp->head + 1) % THREADING_QUEUE_LEN;
+			grp->queued--;
+		}
+		grp->shutdown = !allow_spawning;
+		pthread_mutex_unlock(&grp->lock);
+	}
+
+	return ret;
+}
+
 /* Wait for all threads */
 static int thread_wait_all(bool system_threads)
 {
-	unsigned int i, upper = system_threads ? THREADING_REALLY_ALL_THREADS :
-						       THREADING_MAX_THREADS;
-	int ret = 0;
+	pthread_t thread_ids[THREADING_REALLY_ALL_THREADS];
+	unsigned int slots[THREADING_REALLY_ALL_THREADS];
+	unsigned int i, num;
+	int ret;
 
 	mutex_w_lock(&threads_cleanup);
 
 	/* Ensure that no new thread is spawned. */
-	for (i = 0; i < upper; i++) {
-		atomic_bool_set_true(&threads[i].shutdown);
-		pthread_cond_broadcast(&threads[i].worker_cv);
-	}
-	pthread_cond_broadcast(&thread_wait_cv);
+	num = thread_shutdown_groups(system_threads, thread_ids, slots);
 
 	/* Wait for all worker threads. */
-	for (i = 0; i < upper; i++) {
-		if (atomic_bool_read(&threads_in_cancel))
+	for (i = 0; i < num; i++) {
+		if (atomic_bool_read(&threads_in_cancel)) {
+			mutex_w_unlock(&threads_cleanup);
 			return -ESHUTDOWN;
-		if (thread_dirty(i)) {
-			pthread_join(threads[i].thread_id, NULL);
-			ret |= threads[i].ret_ancestor;
-			thread_cleanup_full(&threads[i]);
-			logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
-			       "Thread %u terminated\n", i);
 		}
+		pthread_join(thread_ids[i], NULL);
+		logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
+		       "Thread %u terminated\n", slots[i]);
 	}
 
 	/* Allow new threads being spawned */
-	for (i = 0; i < upper; i++)
-		atomic_bool_set_false(&threads[i].shutdown);
+	ret = thread_release_groups(system_threads, slots, num, true);
 
 	mutex_w_unlock(&threads_cleanup);
 
@@ -523,34 +727,33 @@ static int thread_wait_all(bool system_threads)
 /* Kill all threads */
 static void thread_cancel(bool system_threads)
 {
-	unsigned int i, upper = system_threads ? THREADING_REALLY_ALL_THREADS :
-						 THREADING_MAX_THREADS;
+	pthread_t thread_ids[THREADING_REALLY_ALL_THREADS];
+	unsigned int slots[THREADING_REALLY_ALL_THREADS];
+	unsigned int i, num;
 
 	atomic_bool_set_true(&threads_in_cancel);
 	mutex_w_lock(&threads_cleanup);
+
 	/* Ensure that no new thread is spawned. */
-	for (i = 0; i < upper; i++) {
-		atomic_bool_set_true(&threads[i].shutdown);
-		threads[i].start_routine = NULL;
-		pthread_cond_broadcast(&threads[i].worker_cv);
-	}
+	num = thread_shutdown_groups(system_threads, thread_ids, slots);
+
+	pthread_mutex_lock(&thread_wait_lock);
 	pthread_cond_broadcast(&thread_wait_cv);
+	pthread_mutex_unlock(&thread_wait_lock);
 
 	/* Kill all worker threads. */
-	for (i = 0; i < upper; i++) {
-		if (thread_dirty(i)) {
-			pthread_cancel(threads[i].thread_id);
-			pthread_join(threads[i].thread_id, NULL);
-			thread_cleanup_full(&threads[i]);
-			logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
-			       "Thread %u killed\n", i);
-		}
+	for (i = 0; i < num; i++) {
+		pthread_cancel(thread_ids[i]);
+		pthread_join(thread_ids[i], NULL);
+		logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
+		       "Thread %u killed\n", slots[i]);
 	}
 
 	/*
-	 * Do not set threads[i].shutdown to false any more as no new
-	 * thread shall be spawned. We are in the process of dying.
+	 * Do not allow spawning again as no new thread shall be spawned. We
+	 * are in the process of dying.
 	 */
+	thread_release_groups(system_threads, slots, num, false);
 
 	mutex_w_unlock(&threads_cleanup);
 }
@@ -559,18 +762,133 @@ DSO_PUBLIC
 int thread_start(int (*start_routine)(void *), void *tdata,
 		 uint32_t thread_group, int *ret_ancestor)
 {
-	int ret;
+	struct thread_group *grp = thread_get_group(thread_group);
+	struct thread_job job = { .start_routine = start_routine,
+				  .data = tdata };
+	struct thread_ctx *tctx;
+	int ret = 0;
 
-	while (1) {
-		ret = thread_schedule(start_routine, tdata, thread_group,
-				      ret_ancestor);
-		if (ret == -EAGAIN)
-			thread_block(&thread_schedule_cv,
-				     &thread_schedule_lock);
-		else
-			return ret;
+	if (!grp) {
+		logger(LOGGER_ERR, LOGGER_C_THREADING,
+		       "undefined thread group requested (%u, max thread group is %u)\n",
+		       thread_group, threads_groups);
+		return -EINVAL;
 	}
 
+	/* The job is accounted before a thread may complete it */
+	pthread_mutex_lock(&thread_wait_lock);
+	job.parent = thread_parent_get();
+	if (job.parent && ret_ancestor)
+		*ret_ancestor = job.parent->ret;
+	pthread_mutex_unlock(&thread_wait_lock);
+	if (!job.parent)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&grp->lock);
+
+	do {
+		if (atomic_bool_read(&threads_in_cancel) || grp->shutdown) {
+			ret = -ESHUTDOWN;
+			break;
+		}
+
+		/* Hand the job to the most recently parked thread */
+		if (grp->idle) {
+			tctx = grp->idle;
+			grp->idle = tctx->next_idle;
+			tctx->parked = false;
+			tctx->job = job;
+			tctx->has_job = true;
+			pthread_cond_signal(&tctx->worker_cv);
+
+			logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
+			       "Thread %u for thread group %u assigned\n",
+			       tctx->thread_num, thread_group);
+			break;
+		}
+
+		/* All threads are busy - grow the pool */
+		if (grp->workers < grp->max_workers) {
+			ret = thread_create(grp, &job);
+			if (!ret || !grp->queueing || !grp->workers)
+				break;
+		}
+
+		/* Queue the job for the next thread completing its job */
+		if (grp->queueing && grp->queued < THREADING_QUEUE_LEN) {
+			grp->queue[(grp->head + grp->queued) %
+				   THREADING_QUEUE_LEN] = job;
+			grp->queued++;
+			ret = 0;
+			break;
+		}
+
+		logger(LOGGER_VERBOSE, LOGGER_C_THREADING,
+		       "No thread for thread group %u available\n",
+		       thread_group);
+		ret = -EAGAIN;
+	} while (0);
+
+	pthread_mutex_unlock(&grp->lock);
+
+	if (ret)
+		thread_parent_done(job.parent, 0);
+
+	return ret;
+}
+
+DSO_PUBLIC
+int thread_group_set_limits(uint32_t thread_group, uint32_t min_threads,
+			    uint32_t max_threads)
+{
+	struct thread_group *grp = thread_get_group(thread_group);
+	struct thread_ctx *tctx;
+
+	if (!grp || !max_threads || max_threads > grp->slots ||
+	    min_threads > max_threads)
+		return -EINVAL;
+
+	pthread_mutex_lock(&grp->lock);
+
+	grp->min_workers = min_threads;
+	grp->max_workers = max_threads;
+
+	/* Let parked threads re-evaluate whether they are still needed */
+	for (tctx = grp->idle; tctx; tctx = tctx->next_idle)
+		pthread_cond_signal(&tctx->worker_cv);
+
+	pthread_mutex_unlock(&grp->lock);
+
+	return 0;
+}
+
+DSO_PUBLIC
+int thread_group_set_stack_size(uint32_t thread_group, size_t stack_size)
+{
+	struct thread_group *grp = thread_get_group(thread_group);
+
+	if (!grp || (stack_size && stack_size < (size_t)PTHREAD_STACK_MIN))
+		return -EINVAL;
+
+	pthread_mutex_lock(&grp->lock);
+	grp->stack_size = stack_size;
+	pthread_mutex_unlock(&grp->lock);
+
+	return 0;
+}
+
+DSO_PUBLIC
+int thread_group_set_queueing(uint32_t thread_group, bool enable)
+{
+	struct thread_group *grp = thread_get_group(thread_group);
+
+	if (!grp)
+		return -EINVAL;
+
+	pthread_mutex_lock(&grp->lock);
+	grp->queueing = enable;
+	pthread_mutex_unlock(&grp->lock);
+
 	return 0;
 }
 
@@ -631,6 +949,32 @@ int thread_start(int (*start_routine)(void *), void *tdata,
 	return start_routine(tdata);
 }
 
+DSO_PUBLIC
+int thread_group_set_limits(uint32_t thread_group, uint32_t min_threads,
+			    uint32_t max_threads)
+{
+	(void)thread_group;
+	(void)min_threads;
+	(void)max_threads;
+	return 0;
+}
+
+DSO_PUBLIC
+int thread_group_set_stack_size(uint32_t thread_group, size_t stack_size)
+{
+	(void)thread_group;
+	(void)stack_size;
+	return 0;
+}
+
+DSO_PUBLIC
+int thread_group_set_queueing(uint32_t thread_group, bool enable)
+{
+	(void)thread_group;
+	(void)enable;
+	return 0;
+}
+
 DSO_PUBLIC
 int thread_set_name(enum acvp_request_type type, uint32_t id)
 {
@@ -53,6 +53,8 @@ extern "C" {
  * Special thread groups ensure that one thread per special thread
  * group is reserved. I.e. for the purpose of the special case, the
  * thread handler will not use such special thread for other purposes.
+ * The ESDM_THREAD_ES_WORKERS group reserves ESDM_THREAD_ES_WORKERS_SLOTS
+ * threads to fetch all entropy sources concurrently.
  *
  * NOTE: When using thread_start for such a special case, make sure to invoke
  *	 this function with the special thread group identifier.
@@ -62,11 +64,26 @@ extern "C" {
  *
  * The ESDM_THREAD_MAX_SPECIAL_GROUPS specifies how many special threading
  * groups are available.
+ *
+ * Queueing
+ * --------
+ *
+ * Only ESDM_THREAD_ES_WORKERS queues jobs as its jobs fetch one entropy
+ * source and complete within the ES timeout. All other thread groups do not
+ * queue: the RPC workers in group 0, the interface thread, the ES monitor,
+ * the DRNG reseed worker, the CUSE poll checker and the kernel feeder execute
+ * loops which only return at shutdown. A job queued behind them would never
+ * execute.
  */
 #define ESDM_THREAD_CUSE_POLL_GROUP ((uint32_t)-1)
 #define ESDM_THREAD_ES_MONITOR ((uint32_t)-2)
 #define ESDM_THREAD_RPC_UNPRIV_GROUP ((uint32_t)-3)
-#define ESDM_THREAD_MAX_SPECIAL_GROUPS 3
+#define ESDM_THREAD_DRNG_RESEED ((uint32_t)-4)
+#define ESDM_THREAD_ES_WORKERS ((uint32_t)-5)
+#define ESDM_THREAD_MAX_SPECIAL_GROUPS 5
+
+/* Threads reserved for ESDM_THREAD_ES_WORKERS - one per entropy source */
+#define ESDM_THREAD_ES_WORKERS_SLOTS 8
 
 enum esdm_request_type {
 	es_monitor,
@@ -75,6 +92,7 @@ enum esdm_request_type {
 	rpc_priv_server,
 	rpc_handler,
 	cuse_poll,
+	drng_reseed,
 };
 
 /**
@@ -109,19 +127,73 @@ int thread_wait(void);
 /**
  * @brief - Start a function in a separate thread
  *
+ * The function is handed to an idle thread of the thread group or to a newly
+ * spawned thread if the thread group did not reach its maximum size. If all
+ * threads are busy, the call fails with -EAGAIN unless the thread group
+ * queues functions (see thread_group_set_queueing).
+ *
  * @param [in] start_routine Function that is invoked in thread (the idea is
  *			     that the return code is 0 for success and != 0 for
  *			     error)
  * @param [in] tdata Argument supplied to function
  * @param [in] thread_group Which thread group the thread belongs to.
- * @param [out] ret_ancestor Return code of garbage-collected ancestor. It may
- *			     be NULL if the return code is not of interest.
+ * @param [out] ret_ancestor Return codes of the functions started by the
+ *			     caller that completed and were not yet collected
+ *			     with thread_wait. It may be NULL if the return code
+ *			     is not of interest.
  *
  * @return 0 on success, < 0 on error
  */
 int thread_start(int (*start_routine)(void *), void *tdata,
 		 uint32_t thread_group, int *ret_ancestor);
 
+/**
+ * @brief - Set the size limits of the pool of a thread group
+ *
+ * Threads are spawned on demand up to the maximum size. Idle threads above
+ * the minimum size terminate after some time. By default, the minimum size is
+ * 0 and the maximum size is the number of threads available to the thread
+ * group.
+ *
+ * @param [in] thread_group Thread group to configure
+ * @param [in] min_threads Number of threads kept alive when idle
+ * @param [in] max_threads Maximum number of threads - it must not exceed the
+ *			   number of threads available to the thread group
+ *
+ * @return 0 on success, < 0 on error
+ */
+int thread_group_set_limits(uint32_t thread_group, uint32_t min_threads,
+			    uint32_t max_threads);
+
+/**
+ * @brief - Set the stack size of the threads of a thread group
+ *
+ * The stack size applies to threads spawned afterwards. Threads with
+ * a small memory footprint may use a stack smaller than the default of the
+ * system to reduce the memory reserved per thread.
+ *
+ * @param [in] thread_group Thread group to configure
+ * @param [in] stack_size Stack size in bytes - 0 selects the default
+ *
+ * @return 0 on success, < 0 on error
+ */
+int thread_group_set_stack_size(uint32_t thread_group, size_t stack_size);
+
+/**
+ * @brief - Queue functions when all threads of a thread group are busy
+ *
+ * A queued function executes when a thread of the thread group completes its
+ * current function. Queueing must therefore only be enabled for thread groups
+ * whose functions all complete in a short time. The queue is bounded - if it
+ * is full, thread_start fails with -EAGAIN. By default, queueing is disabled.
+ *
+ * @param [in] thread_group Thread group to configure
+ * @param [in] enable Queue functions (true) or fail with -EAGAIN (false)
+ *
+ * @return 0 on success, < 0 on error
+ */
+int thread_group_set_queueing(uint32_t thread_group, bool enable);
+
 #define ESDM_THREAD_MAX_NAMELEN 16
 /**
  * @brief - Give a name to a thread that is used for logging
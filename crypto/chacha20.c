@@ -19,7 +19,12 @@
 
 #include <errno.h>
 
+#ifdef __aarch64__
+#include <sys/auxv.h>
+#endif
+
 #include "bitshift.h"
+#include "constructor.h"
 #include "conv_be_le.h"
 #include "rotate.h"
 #include "lc_chacha20.h"
@@ -95,6 +100,156 @@ void cc20_block(struct lc_sym_state *state, uint32_t *stream)
 	state_w[12]++;
 }
 
+/* Multi-block function selected for the current CPU */
+typedef void (*cc20_block_multi_f)(struct lc_sym_state *state, uint8_t *stream);
+static cc20_block_multi_f cc20_block_multi = NULL;
+static size_t cc20_block_multi_num = 1;
+static const char *cc20_block_multi_name = "C";
+
+static int cc20_impl_get(enum lc_cc20_impl impl, cc20_block_multi_f *func,
+			 size_t *num, const char **name)
+{
+	switch (impl) {
+	case lc_cc20_impl_c:
+		*func = NULL;
+		*num = 1;
+		*name = "C";
+		return 0;
+	case lc_cc20_impl_ssse3:
+#ifdef LC_CC20_X86
+		if (__builtin_cpu_supports("ssse3")) {
+			*func = cc20_block_4x_ssse3;
+			*num = 4;
+			*name = "SSSE3";
+			return 0;
+		}
+#endif
+		break;
+	case lc_cc20_impl_avx2:
+#ifdef LC_CC20_X86
+		if (__builtin_cpu_supports("avx2")) {
+			*func = cc20_block_8x_avx2;
+			*num = 8;
+			*name = "AVX2";
+			return 0;
+		}
+#endif
+		break;
+	case lc_cc20_impl_avx512:
+#ifdef LC_CC20_X86
+		if (__builtin_cpu_supports("avx512f")) {
+			*func = cc20_block_16x_avx512;
+			*num = 16;
+			*name = "AVX-512";
+			return 0;
+		}
+#endif
+		break;
+	case lc_cc20_impl_neon:
+#ifdef LC_CC20_NEON
+		if (getauxval(AT_HWCAP) & HWCAP_ASIMD) {
+			*func = cc20_block_4x_neon;
+			*num = 4;
+			*name = "NEON";
+			return 0;
+		}
+#endif
+		break;
+	default:
+		break;
+	}
+
+	return -EOPNOTSUPP;
+}
+
+ESDM_DEFINE_CONSTRUCTOR(cc20_impl_select)
+{
+	/* Ordered by preference */
+	static const enum lc_cc20_impl impls[] = {
+		lc_cc20_impl_avx512,
+		lc_cc20_impl_avx2,
+		lc_cc20_impl_ssse3,
+		lc_cc20_impl_neon,
+	};
+	unsigned int i;
+
+#ifdef LC_CC20_X86
+	__builtin_cpu_init();
+#endif
+
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		if (!cc20_impl_get(impls[i], &cc20_block_multi,
+				   &cc20_block_multi_num,
+				   &cc20_block_multi_name))
+			return;
+	}
+}
+
+static void cc20_blocks_func(cc20_block_multi_f func, size_t num,
+			     struct lc_sym_state *state, uint8_t *stream,
+			     size_t nblocks)
+{
+	uint32_t keystream[LC_CC20_BLOCK_SIZE_WORDS];
+	int zeroize_buf = 0;
+
+	if (func) {
+		while (nblocks >= num) {
+			func(state, stream);
+			stream += num * LC_CC20_BLOCK_SIZE;
+			nblocks -= num;
+		}
+	}
+
+	/* Remaining blocks are processed with the reference implementation */
+	while (nblocks) {
+		if ((unsigned long)stream & (sizeof(keystream[0]) - 1)) {
+			cc20_block(state, keystream);
+			memcpy(stream, keystream, LC_CC20_BLOCK_SIZE);
+			zeroize_buf = 1;
+		} else {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-align"
+			cc20_block(state, (uint32_t *)stream);
+#pragma GCC diagnostic pop
+		}
+
+		stream += LC_CC20_BLOCK_SIZE;
+		nblocks--;
+	}
+
+	if (zeroize_buf)
+		memset_secure(keystream, 0, sizeof(keystream));
+}
+
+DSO_PUBLIC
+void cc20_blocks(struct lc_sym_state *state, uint8_t *stream, size_t nblocks)
+{
+	cc20_blocks_func(cc20_block_multi, cc20_block_multi_num, state, stream,
+			 nblocks);
+}
+
+DSO_PUBLIC
+int cc20_blocks_impl(enum lc_cc20_impl impl, struct lc_sym_state *state,
+		     uint8_t *stream, size_t nblocks)
+{
+	cc20_block_multi_f func;
+	const char *name;
+	size_t num;
+	int ret = cc20_impl_get(impl, &func, &num, &name);
+
+	if (ret)
+		return ret;
+
+	cc20_blocks_func(func, num, state, stream, nblocks);
+	return 0;
+}
+
+DSO_PUBLIC
+const char *cc20_blocks_name(void)
+{
+	return cc20_block_multi_name;
+}
+
 static void cc20_init(struct lc_sym_state *ctx)
 {
 	/* String "expand 32-byte k" */
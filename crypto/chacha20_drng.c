@@ -118,20 +118,13 @@ void lc_cc20_drng_generate(struct lc_chacha20_drng_ctx *cc20_ctx,
 	size_t used = LC_CC20_BLOCK_SIZE_WORDS;
 	int zeroize_buf = 0;
 
-	while (outbuflen >= LC_CC20_BLOCK_SIZE) {
-		if ((unsigned long)outbuf & (sizeof(aligned_buf[0]) - 1)) {
-			cc20_block(chacha20_state, aligned_buf);
-			memcpy(outbuf, aligned_buf, LC_CC20_BLOCK_SIZE);
-			zeroize_buf = 1;
-		} else {
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wcast-align"
-			cc20_block(chacha20_state, (uint32_t *)outbuf);
-#pragma GCC diagnostic pop
-		}
+	if (outbuflen >= LC_CC20_BLOCK_SIZE) {
+		size_t nblocks = outbuflen / LC_CC20_BLOCK_SIZE;
 
-		outbuf += LC_CC20_BLOCK_SIZE;
-		outbuflen -= LC_CC20_BLOCK_SIZE;
+		/* Bulk output is generated with the multi-block function */
+		cc20_blocks(chacha20_state, outbuf, nblocks);
+		outbuf += nblocks * LC_CC20_BLOCK_SIZE;
+		outbuflen -= nblocks * LC_CC20_BLOCK_SIZE;
 	}
 
 	if (outbuflen) {
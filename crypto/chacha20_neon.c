@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Multi-block ChaCha20 block function for ARMv8 CPUs with NEON (ASIMD). Each
+ * vector register holds one state word of four independent ChaCha20 blocks
+ * which only differ in their counter value.
+ */
+
+#include "lc_chacha20_private.h"
+
+#ifdef LC_CC20_NEON
+
+#include <arm_neon.h>
+
+#define CC20_NEON_ROL(v, n)	vsriq_n_u32(vshlq_n_u32(v, n), v, 32 - (n))
+#define CC20_NEON_ROL16(v)						\
+	vreinterpretq_u32_u16(vrev32q_u16(vreinterpretq_u16_u32(v)))
+
+#define CC20_NEON_QR(a, b, c, d)					\
+	a = vaddq_u32(a, b); d = CC20_NEON_ROL16(veorq_u32(d, a));	\
+	c = vaddq_u32(c, d); b = veorq_u32(b, c); b = CC20_NEON_ROL(b, 12);\
+	a = vaddq_u32(a, b); d = veorq_u32(d, a); d = CC20_NEON_ROL(d, 8);\
+	c = vaddq_u32(c, d); b = veorq_u32(b, c); b = CC20_NEON_ROL(b, 7)
+
+void cc20_block_4x_neon(struct lc_sym_state *state, uint8_t *stream)
+{
+	static const uint32_t ctr_add[4] = { 0, 1, 2, 3 };
+	const uint32_t *state_w = &state->constants[0];
+	uint32x4_t x[LC_CC20_BLOCK_SIZE_WORDS], s[LC_CC20_BLOCK_SIZE_WORDS];
+	unsigned int i, j;
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		s[i] = vdupq_n_u32(state_w[i]);
+	s[12] = vaddq_u32(s[12], vld1q_u32(ctr_add));
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		x[i] = s[i];
+
+	for (i = 0; i < 10; i++) {
+		CC20_NEON_QR(x[0], x[4], x[8],  x[12]);
+		CC20_NEON_QR(x[1], x[5], x[9],  x[13]);
+		CC20_NEON_QR(x[2], x[6], x[10], x[14]);
+		CC20_NEON_QR(x[3], x[7], x[11], x[15]);
+		CC20_NEON_QR(x[0], x[5], x[10], x[15]);
+		CC20_NEON_QR(x[1], x[6], x[11], x[12]);
+		CC20_NEON_QR(x[2], x[7], x[8],  x[13]);
+		CC20_NEON_QR(x[3], x[4], x[9],  x[14]);
+	}
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		x[i] = vaddq_u32(x[i], s[i]);
+
+	/* Transpose the 4x4 word matrices to obtain word group i / 4 */
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i += 4) {
+		uint32x4x2_t t01 = vtrnq_u32(x[i], x[i + 1]);
+		uint32x4x2_t t23 = vtrnq_u32(x[i + 2], x[i + 3]);
+		uint32x4_t b[4];
+
+		b[0] = vcombine_u32(vget_low_u32(t01.val[0]),
+				    vget_low_u32(t23.val[0]));
+		b[1] = vcombine_u32(vget_low_u32(t01.val[1]),
+				    vget_low_u32(t23.val[1]));
+		b[2] = vcombine_u32(vget_high_u32(t01.val[0]),
+				    vget_high_u32(t23.val[0]));
+		b[3] = vcombine_u32(vget_high_u32(t01.val[1]),
+				    vget_high_u32(t23.val[1]));
+
+		for (j = 0; j < 4; j++) {
+			vst1q_u8(stream + j * LC_CC20_BLOCK_SIZE +
+				 i * sizeof(uint32_t),
+				 vreinterpretq_u8_u32(b[j]));
+		}
+	}
+
+	state->counter += 4;
+}
+
+#endif /* LC_CC20_NEON */
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * Multi-block ChaCha20 block functions for x86 CPUs with SSSE3, AVX2 and
+ * AVX-512. Each vector register holds one state word of multiple independent
+ * ChaCha20 blocks which only differ in their counter value. Once the rounds
+ * are completed, the registers are transposed to obtain the key stream blocks.
+ *
+ * The functions are compiled with the respective target attribute which
+ * implies that the caller must ensure that the CPU supports the instruction
+ * set before invoking them.
+ */
+
+#include "lc_chacha20_private.h"
+
+#ifdef LC_CC20_X86
+
+#include <immintrin.h>
+
+#define CC20_QR(a, b, c, d, add, xor, rol16, rol12, rol8, rol7)		\
+	a = add(a, b); d = rol16(xor(d, a));				\
+	c = add(c, d); b = rol12(xor(b, c));				\
+	a = add(a, b); d = rol8(xor(d, a));				\
+	c = add(c, d); b = rol7(xor(b, c))
+
+#define CC20_DOUBLEROUND(x, add, xor, rol16, rol12, rol8, rol7)		\
+	CC20_QR(x[0], x[4], x[8],  x[12], add, xor, rol16, rol12, rol8, rol7);\
+	CC20_QR(x[1], x[5], x[9],  x[13], add, xor, rol16, rol12, rol8, rol7);\
+	CC20_QR(x[2], x[6], x[10], x[14], add, xor, rol16, rol12, rol8, rol7);\
+	CC20_QR(x[3], x[7], x[11], x[15], add, xor, rol16, rol12, rol8, rol7);\
+	CC20_QR(x[0], x[5], x[10], x[15], add, xor, rol16, rol12, rol8, rol7);\
+	CC20_QR(x[1], x[6], x[11], x[12], add, xor, rol16, rol12, rol8, rol7);\
+	CC20_QR(x[2], x[7], x[8],  x[13], add, xor, rol16, rol12, rol8, rol7);\
+	CC20_QR(x[3], x[4], x[9],  x[14], add, xor, rol16, rol12, rol8, rol7)
+
+/*
+ * Transpose the 4x4 matrix of 32 bit words within each 128 bit lane: after
+ * the operation, a[i] holds the four words of block i.
+ */
+#define CC20_TRANSPOSE4(a, unpacklo32, unpackhi32, unpacklo64, unpackhi64)\
+	do {								\
+		t[0] = unpacklo32(a[0], a[1]);				\
+		t[1] = unpacklo32(a[2], a[3]);				\
+		t[2] = unpackhi32(a[0], a[1]);				\
+		t[3] = unpackhi32(a[2], a[3]);				\
+		a[0] = unpacklo64(t[0], t[1]);				\
+		a[1] = unpackhi64(t[0], t[1]);				\
+		a[2] = unpacklo64(t[2], t[3]);				\
+		a[3] = unpackhi64(t[2], t[3]);				\
+	} while (0)
+
+/******************************** SSSE3 ***************************************/
+
+#define CC20_SSSE3_ROL(v, n)						\
+	_mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define CC20_SSSE3_ROL16(v)	_mm_shuffle_epi8(v, rot16)
+#define CC20_SSSE3_ROL12(v)	CC20_SSSE3_ROL(v, 12)
+#define CC20_SSSE3_ROL8(v)	_mm_shuffle_epi8(v, rot8)
+#define CC20_SSSE3_ROL7(v)	CC20_SSSE3_ROL(v, 7)
+
+__attribute__((target("ssse3")))
+void cc20_block_4x_ssse3(struct lc_sym_state *state, uint8_t *stream)
+{
+	const uint32_t *state_w = &state->constants[0];
+	const __m128i rot16 = _mm_set_epi8(13, 12, 15, 14, 9, 8, 11, 10,
+					   5, 4, 7, 6, 1, 0, 3, 2);
+	const __m128i rot8 = _mm_set_epi8(14, 13, 12, 15, 10, 9, 8, 11,
+					  6, 5, 4, 7, 2, 1, 0, 3);
+	__m128i x[LC_CC20_BLOCK_SIZE_WORDS], s[LC_CC20_BLOCK_SIZE_WORDS], t[4];
+	unsigned int i, j;
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		s[i] = _mm_set1_epi32((int)state_w[i]);
+	s[12] = _mm_add_epi32(s[12], _mm_set_epi32(3, 2, 1, 0));
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		x[i] = s[i];
+
+	for (i = 0; i < 10; i++) {
+		CC20_DOUBLEROUND(x, _mm_add_epi32, _mm_xor_si128,
+				 CC20_SSSE3_ROL16, CC20_SSSE3_ROL12,
+				 CC20_SSSE3_ROL8, CC20_SSSE3_ROL7);
+	}
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		x[i] = _mm_add_epi32(x[i], s[i]);
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i += 4) {
+		CC20_TRANSPOSE4((x + i), _mm_unpacklo_epi32,
+				_mm_unpackhi_epi32, _mm_unpacklo_epi64,
+				_mm_unpackhi_epi64);
+
+		/* Word group i / 4 of block j */
+		for (j = 0; j < 4; j++) {
+			_mm_storeu_si128(
+				(__m128i *)(stream + j * LC_CC20_BLOCK_SIZE +
+					    i * sizeof(uint32_t)), x[i + j]);
+		}
+	}
+
+	state->counter += 4;
+}
+
+/********************************* AVX2 ***************************************/
+
+#define CC20_AVX2_ROL(v, n)						\
+	_mm256_or_si256(_mm256_slli_epi32(v, n),			\
+			_mm256_srli_epi32(v, 32 - (n)))
+#define CC20_AVX2_ROL16(v)	_mm256_shuffle_epi8(v, rot16)
+#define CC20_AVX2_ROL12(v)	CC20_AVX2_ROL(v, 12)
+#define CC20_AVX2_ROL8(v)	_mm256_shuffle_epi8(v, rot8)
+#define CC20_AVX2_ROL7(v)	CC20_AVX2_ROL(v, 7)
+
+__attribute__((target("avx2")))
+void cc20_block_8x_avx2(struct lc_sym_state *state, uint8_t *stream)
+{
+	const uint32_t *state_w = &state->constants[0];
+	const __m256i rot16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10,
+					      5, 4, 7, 6, 1, 0, 3, 2,
+					      13, 12, 15, 14, 9, 8, 11, 10,
+					      5, 4, 7, 6, 1, 0, 3, 2);
+	const __m256i rot8 = _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11,
+					     6, 5, 4, 7, 2, 1, 0, 3,
+					     14, 13, 12, 15, 10, 9, 8, 11,
+					     6, 5, 4, 7, 2, 1, 0, 3);
+	__m256i x[LC_CC20_BLOCK_SIZE_WORDS], s[LC_CC20_BLOCK_SIZE_WORDS], t[4];
+	unsigned int i, j;
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		s[i] = _mm256_set1_epi32((int)state_w[i]);
+	s[12] = _mm256_add_epi32(s[12],
+				 _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		x[i] = s[i];
+
+	for (i = 0; i < 10; i++) {
+		CC20_DOUBLEROUND(x, _mm256_add_epi32, _mm256_xor_si256,
+				 CC20_AVX2_ROL16, CC20_AVX2_ROL12,
+				 CC20_AVX2_ROL8, CC20_AVX2_ROL7);
+	}
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		x[i] = _mm256_add_epi32(x[i], s[i]);
+
+	/*
+	 * After the lane-wise transposition, the lower lane of x[4 * g + j]
+	 * holds word group g of block j and the upper lane holds word group g
+	 * of block j + 4.
+	 */
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i += 4) {
+		CC20_TRANSPOSE4((x + i), _mm256_unpacklo_epi32,
+				_mm256_unpackhi_epi32, _mm256_unpacklo_epi64,
+				_mm256_unpackhi_epi64);
+	}
+
+	for (j = 0; j < 4; j++) {
+		uint8_t *lo = stream + j * LC_CC20_BLOCK_SIZE;
+		uint8_t *hi = stream + (j + 4) * LC_CC20_BLOCK_SIZE;
+
+		_mm256_storeu_si256((__m256i *)lo,
+			_mm256_permute2x128_si256(x[j], x[4 + j], 0x20));
+		_mm256_storeu_si256((__m256i *)(lo + 32),
+			_mm256_permute2x128_si256(x[8 + j], x[12 + j], 0x20));
+		_mm256_storeu_si256((__m256i *)hi,
+			_mm256_permute2x128_si256(x[j], x[4 + j], 0x31));
+		_mm256_storeu_si256((__m256i *)(hi + 32),
+			_mm256_permute2x128_si256(x[8 + j], x[12 + j], 0x31));
+	}
+
+	state->counter += 8;
+}
+
+/******************************* AVX-512 **************************************/
+
+#define CC20_AVX512_ROL16(v)	_mm512_rol_epi32(v, 16)
+#define CC20_AVX512_ROL12(v)	_mm512_rol_epi32(v, 12)
+#define CC20_AVX512_ROL8(v)	_mm512_rol_epi32(v, 8)
+#define CC20_AVX512_ROL7(v)	_mm512_rol_epi32(v, 7)
+
+__attribute__((target("avx512f")))
+void cc20_block_16x_avx512(struct lc_sym_state *state, uint8_t *stream)
+{
+	const uint32_t *state_w = &state->constants[0];
+	__m512i x[LC_CC20_BLOCK_SIZE_WORDS], s[LC_CC20_BLOCK_SIZE_WORDS], t[4];
+	unsigned int i, j, l;
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		s[i] = _mm512_set1_epi32((int)state_w[i]);
+	s[12] = _mm512_add_epi32(s[12],
+				 _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+						  7, 6, 5, 4, 3, 2, 1, 0));
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		x[i] = s[i];
+
+	for (i = 0; i < 10; i++) {
+		CC20_DOUBLEROUND(x, _mm512_add_epi32, _mm512_xor_si512,
+				 CC20_AVX512_ROL16, CC20_AVX512_ROL12,
+				 CC20_AVX512_ROL8, CC20_AVX512_ROL7);
+	}
+
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i++)
+		x[i] = _mm512_add_epi32(x[i], s[i]);
+
+	/*
+	 * After the lane-wise transposition, lane l of x[4 * g + j] holds
+	 * word group g of block 4 * l + j.
+	 */
+	for (i = 0; i < LC_CC20_BLOCK_SIZE_WORDS; i += 4) {
+		CC20_TRANSPOSE4((x + i), _mm512_unpacklo_epi32,
+				_mm512_unpackhi_epi32, _mm512_unpacklo_epi64,
+				_mm512_unpackhi_epi64);
+	}
+
+	/* Transpose the 128 bit lanes of the four word groups of block j */
+	for (j = 0; j < 4; j++) {
+		__m512i ab_lo = _mm512_shuffle_i32x4(x[j], x[4 + j], 0x44);
+		__m512i ab_hi = _mm512_shuffle_i32x4(x[j], x[4 + j], 0xee);
+		__m512i cd_lo = _mm512_shuffle_i32x4(x[8 + j], x[12 + j],
+						     0x44);
+		__m512i cd_hi = _mm512_shuffle_i32x4(x[8 + j], x[12 + j],
+						     0xee);
+
+		t[0] = _mm512_shuffle_i32x4(ab_lo, cd_lo, 0x88);
+		t[1] = _mm512_shuffle_i32x4(ab_lo, cd_lo, 0xdd);
+		t[2] = _mm512_shuffle_i32x4(ab_hi, cd_hi, 0x88);
+		t[3] = _mm512_shuffle_i32x4(ab_hi, cd_hi, 0xdd);
+
+		for (l = 0; l < 4; l++) {
+			_mm512_storeu_si512(
+				stream + (4 * l + j) * LC_CC20_BLOCK_SIZE,
+				t[l]);
+		}
+	}
+
+	state->counter += 16;
+}
+
+#endif /* LC_CC20_X86 */
@@ -46,6 +46,9 @@ static void drbg_hash(struct lc_drbg_hash_state *drbg,
 /*
  * Increment buffer
  *
+ * The addition is performed on 64 bit big-endian words starting at the least
+ * significant end, the remaining bytes are processed bytewise.
+ *
  * @dst buffer to increment
  * @add value to add
  */
@@ -53,22 +56,40 @@ static void drbg_add_buf(uint8_t *dst, size_t dstlen,
 			 const uint8_t *add, size_t addlen)
 {
 	/* implied: dstlen > addlen */
-	uint8_t *dstptr;
-	const uint8_t *addptr;
+	uint8_t *dstptr = dst + dstlen;
+	const uint8_t *addptr = add + addlen;
 	unsigned int remainder = 0;
 	size_t len = addlen;
 
-	dstptr = dst + (dstlen-1);
-	addptr = add + (addlen-1);
+	while (len >= sizeof(uint64_t)) {
+		uint64_t d, sum;
+		unsigned int carry;
+
+		dstptr -= sizeof(uint64_t);
+		addptr -= sizeof(uint64_t);
+		len -= sizeof(uint64_t);
+
+		d = ptr_to_be64(dstptr);
+		sum = d + ptr_to_be64(addptr);
+		carry = sum < d;
+		sum += remainder;
+		carry |= sum < remainder;
+		remainder = carry;
+		be64_to_ptr(dstptr, sum);
+	}
+
+	dstptr--;
+	addptr--;
 	while (len) {
-		remainder += *dstptr + *addptr;
+		remainder += (unsigned int)*dstptr + *addptr;
 		*dstptr = remainder & 0xff;
 		remainder >>= 8;
 		len--; dstptr--; addptr--;
 	}
+
 	len = dstlen - addlen;
 	while (len && remainder > 0) {
-		remainder = *dstptr + 1;
+		remainder = (unsigned int)*dstptr + 1;
 		*dstptr = remainder & 0xff;
 		remainder >>= 8;
 		len--; dstptr--;
@@ -186,36 +207,64 @@ static void drbg_hash_process_addtl(struct lc_drbg_hash_state *drbg,
 	memset(drbg->scratchpad, 0, LC_DRBG_HASH_BLOCKLEN);
 }
 
+/*
+ * Number of hashgen blocks calculated with one invocation of the multi-message
+ * SHA-512 implementation.
+ */
+#define DRBG_HASHGEN_BLOCKS	8
+
 /* Hashgen defined in 10.1.1.4 */
 static size_t drbg_hash_hashgen(struct lc_drbg_hash_state *drbg,
 				uint8_t *buf, size_t buflen)
 {
-	struct lc_drbg_string data;
-	size_t len = 0;
+	uint8_t data[DRBG_HASHGEN_BLOCKS * LC_DRBG_HASH_STATELEN];
+	uint8_t digest[DRBG_HASHGEN_BLOCKS * LC_DRBG_HASH_BLOCKLEN];
+	size_t len = 0, used = 0;
 	uint8_t *src = drbg->scratchpad;
-	uint8_t *dst = drbg->scratchpad + LC_DRBG_HASH_STATELEN;
 	uint8_t prefix = DRBG_PREFIX1;
 
 	/* 10.1.1.4 step hashgen 2 */
 	memcpy(src, drbg->V, LC_DRBG_HASH_STATELEN);
-	lc_drbg_string_fill(&data, src, LC_DRBG_HASH_STATELEN);
 
+	/*
+	 * The hashgen blocks are independent of each other: the data for
+	 * several blocks is prepared up front and hashed in parallel.
+	 */
 	while (len < buflen) {
-		size_t outlen = 0;
-
-		/* 10.1.1.4 step hashgen 4.1 */
-		drbg_hash(drbg, dst, &data);
-		outlen = (LC_DRBG_HASH_BLOCKLEN < (buflen - len)) ?
-			  LC_DRBG_HASH_BLOCKLEN : (buflen - len);
-
-		/* 10.1.1.4 step hashgen 4.2 */
-		memcpy(buf + len, dst, outlen);
+		size_t i, blocks, outlen = buflen - len;
+
+		blocks = (outlen + LC_DRBG_HASH_BLOCKLEN - 1) /
+			 LC_DRBG_HASH_BLOCKLEN;
+		if (blocks > DRBG_HASHGEN_BLOCKS) {
+			blocks = DRBG_HASHGEN_BLOCKS;
+			outlen = DRBG_HASHGEN_BLOCKS * LC_DRBG_HASH_BLOCKLEN;
+		}
+		if (blocks > used)
+			used = blocks;
+
+		for (i = 0; i < blocks; i++) {
+			memcpy(data + i * LC_DRBG_HASH_STATELEN, src,
+			       LC_DRBG_HASH_STATELEN);
+			/* 10.1.1.4 hashgen step 4.3 */
+			if (len + (i + 1) * LC_DRBG_HASH_BLOCKLEN < buflen)
+				drbg_add_buf(src, LC_DRBG_HASH_STATELEN,
+					     &prefix, 1);
+		}
+
+		/* 10.1.1.4 step hashgen 4.1 and 4.2 */
+		if (outlen == blocks * LC_DRBG_HASH_BLOCKLEN) {
+			lc_sha512_multi(data, LC_DRBG_HASH_STATELEN, blocks,
+					buf + len);
+		} else {
+			lc_sha512_multi(data, LC_DRBG_HASH_STATELEN, blocks,
+					digest);
+			memcpy(buf + len, digest, outlen);
+		}
 		len += outlen;
-		/* 10.1.1.4 hashgen step 4.3 */
-		if (len < buflen)
-			drbg_add_buf(src, LC_DRBG_HASH_STATELEN, &prefix, 1);
 	}
 
+	memset_secure(data, 0, used * LC_DRBG_HASH_STATELEN);
+	memset_secure(digest, 0, used * LC_DRBG_HASH_BLOCKLEN);
 	memset(drbg->scratchpad, 0,
 	       (LC_DRBG_HASH_STATELEN + LC_DRBG_HASH_BLOCKLEN));
 	return len;
@@ -39,6 +39,58 @@ extern const struct lc_sym *lc_chacha20;
  */
 void cc20_block(struct lc_sym_state *state, uint32_t *stream);
 
+/* ChaCha20 block function implementations */
+enum lc_cc20_impl {
+	/** Scalar C implementation - reference */
+	lc_cc20_impl_c,
+	/** 4-way SSSE3 implementation */
+	lc_cc20_impl_ssse3,
+	/** 8-way AVX2 implementation */
+	lc_cc20_impl_avx2,
+	/** 16-way AVX-512 implementation */
+	lc_cc20_impl_avx512,
+	/** 4-way ARMv8 NEON implementation */
+	lc_cc20_impl_neon,
+};
+
+/**
+ * @brief ChaCha20 multi-block function
+ *
+ * Generate multiple ChaCha20 blocks with the fastest block function
+ * implementation supported by the CPU.
+ *
+ * @param [in] state ChaCha20 state from which to derive the block output
+ * @param [out] stream ChaCha20 key stream output of size
+ *		       nblocks * LC_CC20_BLOCK_SIZE which does not need to be
+ *		       aligned
+ * @param [in] nblocks Number of blocks to generate
+ */
+void cc20_blocks(struct lc_sym_state *state, uint8_t *stream, size_t nblocks);
+
+/**
+ * @brief ChaCha20 multi-block function using a given implementation
+ *
+ * This function is intended for testing the different implementations.
+ *
+ * @param [in] impl Block function implementation to use
+ * @param [in] state ChaCha20 state from which to derive the block output
+ * @param [out] stream ChaCha20 key stream output of size
+ *		       nblocks * LC_CC20_BLOCK_SIZE
+ * @param [in] nblocks Number of blocks to generate
+ *
+ * @return 0 on success, -EOPNOTSUPP if the implementation is not supported
+ *	   on the current CPU
+ */
+int cc20_blocks_impl(enum lc_cc20_impl impl, struct lc_sym_state *state,
+		     uint8_t *stream, size_t nblocks);
+
+/**
+ * @brief Name of the ChaCha20 block function implementation
+ *
+ * @return name of the implementation used by cc20_blocks
+ */
+const char *cc20_blocks_name(void);
+
 #ifdef __cplusplus
 }
 #endif
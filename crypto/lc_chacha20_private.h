@@ -44,6 +44,24 @@ struct lc_sym_state {
 #define LC_CC20_BLOCK_SIZE sizeof(struct lc_sym_state)
 #define LC_CC20_BLOCK_SIZE_WORDS (LC_CC20_BLOCK_SIZE / sizeof(uint32_t))
 
+/*
+ * Multi-block ChaCha20 kernels: each kernel generates the number of ChaCha20
+ * blocks indicated in its name starting with the current counter of the
+ * state, writes them in little endian representation into stream which
+ * does not need to be aligned, and advances the counter accordingly.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+# define LC_CC20_X86
+void cc20_block_4x_ssse3(struct lc_sym_state *state, uint8_t *stream);
+void cc20_block_8x_avx2(struct lc_sym_state *state, uint8_t *stream);
+void cc20_block_16x_avx512(struct lc_sym_state *state, uint8_t *stream);
+#endif
+
+#if defined(__aarch64__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+# define LC_CC20_NEON
+void cc20_block_4x_neon(struct lc_sym_state *state, uint8_t *stream);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,6 +32,22 @@ extern "C"
 
 extern const struct lc_hash *lc_sha512;
 
+/**
+ * @brief Calculate the SHA-512 message digests of multiple messages
+ *
+ * All messages must have the same length. Depending on the CPU, multiple
+ * messages are processed in parallel.
+ *
+ * @param [in] in Buffer holding the concatenated messages - message i starts
+ *		  at in + i * inlen
+ * @param [in] inlen Length of one message
+ * @param [in] num Number of messages
+ * @param [out] digest Buffer of size num * LC_SHA512_SIZE_DIGEST receiving
+ *		       the message digests in the order of the messages
+ */
+void lc_sha512_multi(const uint8_t *in, size_t inlen, size_t num,
+		     uint8_t *digest);
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,8 +21,10 @@
 #include <string.h>
 
 #include "bitshift_be.h"
+#include "constructor.h"
 #include "lc_sha512.h"
 #include "memset_secure.h"
+#include "sha512_private.h"
 #include "visibility.h"
 
 struct lc_hash_state {
@@ -31,7 +33,7 @@ struct lc_hash_state {
 	uint8_t partial[LC_SHA512_SIZE_BLOCK];
 };
 
-static const uint64_t sha512_K[] = {
+const uint64_t sha512_K[80] = {
 	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
 	0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
 	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
@@ -75,48 +77,34 @@ static void sha512_init(struct lc_hash_state *ctx)
 	ctx->msg_len = 0;
 }
 
-static inline uint64_t ror(uint64_t x, int n)
+static void sha512_transform_c(uint64_t *H, const uint8_t *in)
 {
-	return ( (x >> (n&(64-1))) | (x << ((64-n)&(64-1))) );
+	sha512_transform_generic(H, in);
 }
 
-#define CH(x, y, z)	((x & y) ^ (~x & z))
-#define MAJ(x, y, z)	((x & y) ^ (x & z) ^ (y & z))
-#define S0(x)		(ror(x, 28) ^ ror(x, 34) ^ ror(x, 39))
-#define S1(x)		(ror(x, 14) ^ ror(x, 18) ^ ror(x, 41))
-#define s0(x)		(ror(x, 1) ^ ror(x, 8) ^ (x >> 7))
-#define s1(x)		(ror(x, 19) ^ ror(x, 61) ^ (x >> 6))
+/*
+ * Transform implementations selected for the current CPU - the C
+ * implementation is set statically as SHA-512 may be used by other
+ * constructors.
+ */
+static void (*sha512_transform_func)(uint64_t *H, const uint8_t *in) =
+	sha512_transform_c;
+static sha512_transform_multi_f sha512_transform_multi = NULL;
 
-static inline void sha512_transform(struct lc_hash_state *ctx, const uint8_t *in)
+ESDM_DEFINE_CONSTRUCTOR(sha512_transform_select)
 {
-	uint64_t W[80], a, b, c, d, e, f, g, h, T1, T2;
-	unsigned int i;
-
-	a = ctx->H[0]; b = ctx->H[1]; c = ctx->H[2]; d = ctx->H[3];
-	e = ctx->H[4]; f = ctx->H[5]; g = ctx->H[6]; h = ctx->H[7];
-
-	for (i = 0; i < 80; i++) {
-		if (i < 16) {
-			W[i] = ptr_to_be64(in);
-			in += 8;
-		} else {
-			W[i] = s1(W[i - 2]) + W[i - 7] + s0(W[i - 15]) + W[i - 16];
-
-			/* Zeroization */
-			W[i - 16] = 0;
-		}
-		T1 = h + S1(e) + CH(e, f, g) + sha512_K[i] + W[i];
-		T2 = S0(a) + MAJ(a, b, c);
-		h = g; g = f; f = e; e = d + T1;
-		d = c; c = b; b = a; a = T1 + T2;
+#ifdef SHA512_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")) {
+		sha512_transform_func = sha512_transform_avx2;
+		sha512_transform_multi = sha512_transform_4x_avx2;
 	}
+#endif
+}
 
-	ctx->H[0] += a; ctx->H[1] += b; ctx->H[2] += c; ctx->H[3] += d;
-	ctx->H[4] += e; ctx->H[5] += f; ctx->H[6] += g; ctx->H[7] += h;
-
-	/* Zeroize intermediate values - register are not zeroized */
-	for (i = 64; i < 80; i++)
-		W[i] = 0;
+static inline void sha512_transform(struct lc_hash_state *ctx, const uint8_t *in)
+{
+	sha512_transform_func(ctx->H, in);
 }
 
 static void sha512_update(struct lc_hash_state *ctx, const uint8_t *in, size_t inlen)
@@ -208,6 +196,86 @@ static size_t sha512_get_digestsize(struct lc_hash_state *ctx)
 	return LC_SHA512_SIZE_DIGEST;
 }
 
+/*
+ * Process up to SHA512_MULTI_LANES messages of equal length in parallel.
+ * Unused lanes process the last message again and their result is discarded.
+ */
+static void sha512_multi_lanes(const uint8_t *in, size_t inlen, size_t num,
+			       uint8_t *digest)
+{
+	uint64_t H[8][SHA512_MULTI_LANES];
+	uint8_t tail[SHA512_MULTI_LANES][2 * LC_SHA512_SIZE_BLOCK];
+	const uint8_t *ptr[SHA512_MULTI_LANES];
+	size_t i, l, blocks = inlen / LC_SHA512_SIZE_BLOCK,
+	       partial = inlen % LC_SHA512_SIZE_BLOCK,
+	       tailblocks = (partial < LC_SHA512_SIZE_BLOCK - 16) ? 1 : 2;
+	struct lc_hash_state iv;
+
+	sha512_init(&iv);
+	for (i = 0; i < 8; i++) {
+		for (l = 0; l < SHA512_MULTI_LANES; l++)
+			H[i][l] = iv.H[i];
+	}
+
+	/* Full blocks are processed directly from the input messages */
+	for (i = 0; i < blocks; i++) {
+		for (l = 0; l < SHA512_MULTI_LANES; l++) {
+			ptr[l] = in + (l < num ? l : num - 1) * inlen +
+				 i * LC_SHA512_SIZE_BLOCK;
+		}
+		sha512_transform_multi(H, ptr);
+	}
+
+	/* Padding of the final block(s) identical to sha512_final */
+	memset(tail, 0, sizeof(tail));
+	for (l = 0; l < SHA512_MULTI_LANES; l++) {
+		uint8_t *t = tail[l];
+
+		memcpy(t, in + (l < num ? l : num - 1) * inlen +
+		       blocks * LC_SHA512_SIZE_BLOCK, partial);
+		t[partial] = 0x80;
+		be64_to_ptr(t + tailblocks * LC_SHA512_SIZE_BLOCK - 8,
+			    (uint64_t)inlen << 3);
+	}
+	for (i = 0; i < tailblocks; i++) {
+		for (l = 0; l < SHA512_MULTI_LANES; l++)
+			ptr[l] = tail[l] + i * LC_SHA512_SIZE_BLOCK;
+		sha512_transform_multi(H, ptr);
+	}
+
+	for (l = 0; l < num; l++) {
+		for (i = 0; i < 8; i++, digest += 8)
+			be64_to_ptr(digest, H[i][l]);
+	}
+
+	memset_secure(tail, 0, sizeof(tail));
+	memset_secure(H, 0, sizeof(H));
+}
+
+DSO_PUBLIC
+void lc_sha512_multi(const uint8_t *in, size_t inlen, size_t num,
+		     uint8_t *digest)
+{
+	struct lc_hash_state ctx;
+
+	while (sha512_transform_multi && num > 1) {
+		size_t todo = (num < SHA512_MULTI_LANES) ?
+			      num : SHA512_MULTI_LANES;
+
+		sha512_multi_lanes(in, inlen, todo, digest);
+		in += todo * inlen;
+		digest += todo * LC_SHA512_SIZE_DIGEST;
+		num -= todo;
+	}
+
+	/* A single message is processed faster with the one-lane transform */
+	for (; num; num--, in += inlen, digest += LC_SHA512_SIZE_DIGEST) {
+		sha512_init(&ctx);
+		sha512_update(&ctx, in, inlen);
+		sha512_final(&ctx, digest);
+	}
+}
+
 static const struct lc_hash _sha512 = {
 	.init		= sha512_init,
 	.update		= sha512_update,
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef SHA512_PRIVATE_H
+#define SHA512_PRIVATE_H
+
+#include <stdint.h>
+
+#include "bitshift_be.h"
+#include "lc_sha512.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+extern const uint64_t sha512_K[80];
+
+/* Number of messages processed in parallel by the multi-lane transform */
+#define SHA512_MULTI_LANES	4
+
+static inline uint64_t ror(uint64_t x, int n)
+{
+	return ( (x >> (n&(64-1))) | (x << ((64-n)&(64-1))) );
+}
+
+#define CH(x, y, z)	((x & y) ^ (~x & z))
+#define MAJ(x, y, z)	((x & y) ^ (x & z) ^ (y & z))
+#define S0(x)		(ror(x, 28) ^ ror(x, 34) ^ ror(x, 39))
+#define S1(x)		(ror(x, 14) ^ ror(x, 18) ^ ror(x, 41))
+#define s0(x)		(ror(x, 1) ^ ror(x, 8) ^ (x >> 7))
+#define s1(x)		(ror(x, 19) ^ ror(x, 61) ^ (x >> 6))
+
+/*
+ * Portable SHA-512 transform. It is provided as inline function such that
+ * it can be compiled for different instruction set extensions.
+ */
+static inline void sha512_transform_generic(uint64_t *H, const uint8_t *in)
+{
+	uint64_t W[80], a, b, c, d, e, f, g, h, T1, T2;
+	unsigned int i;
+
+	a = H[0]; b = H[1]; c = H[2]; d = H[3];
+	e = H[4]; f = H[5]; g = H[6]; h = H[7];
+
+	for (i = 0; i < 80; i++) {
+		if (i < 16) {
+			W[i] = ptr_to_be64(in);
+			in += 8;
+		} else {
+			W[i] = s1(W[i - 2]) + W[i - 7] + s0(W[i - 15]) + W[i - 16];
+
+			/* Zeroization */
+			W[i - 16] = 0;
+		}
+		T1 = h + S1(e) + CH(e, f, g) + sha512_K[i] + W[i];
+		T2 = S0(a) + MAJ(a, b, c);
+		h = g; g = f; f = e; e = d + T1;
+		d = c; c = b; b = a; a = T1 + T2;
+	}
+
+	H[0] += a; H[1] += b; H[2] += c; H[3] += d;
+	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
+
+	/* Zeroize intermediate values - register are not zeroized */
+	for (i = 64; i < 80; i++)
+		W[i] = 0;
+}
+
+/*
+ * Multi-lane transform: H[i][l] holds state word i of lane l, in[l] points
+ * to the block processed by lane l.
+ */
+typedef void (*sha512_transform_multi_f)(uint64_t H[8][SHA512_MULTI_LANES],
+					 const uint8_t *in[SHA512_MULTI_LANES]);
+
+#if defined(__x86_64__) || defined(__i386__)
+# define SHA512_X86
+void sha512_transform_avx2(uint64_t *H, const uint8_t *in);
+void sha512_transform_4x_avx2(uint64_t H[8][SHA512_MULTI_LANES],
+			      const uint8_t *in[SHA512_MULTI_LANES]);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHA512_PRIVATE_H */
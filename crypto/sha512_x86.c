@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * SHA-512 transform implementations for x86 CPUs with AVX2 and BMI2:
+ *
+ *	* a single-buffer transform which is the portable C transform compiled
+ *	  for AVX2 and BMI2 which allows the compiler to use the rorx
+ *	  instruction,
+ *
+ *	* a 4-lane transform where each 64 bit element of an AVX2 register
+ *	  holds the state of an independent message.
+ *
+ * The caller must ensure that the CPU supports the instruction set before
+ * invoking the functions.
+ */
+
+#include "sha512_private.h"
+
+#ifdef SHA512_X86
+
+#include <immintrin.h>
+
+#include "memset_secure.h"
+
+__attribute__((target("avx2,bmi2")))
+void sha512_transform_avx2(uint64_t *H, const uint8_t *in)
+{
+	sha512_transform_generic(H, in);
+}
+
+#define SHA512_AVX2_ROR(x, n)						\
+	_mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - (n)))
+#define SHA512_AVX2_XOR3(x, y, z)					\
+	_mm256_xor_si256(_mm256_xor_si256(x, y), z)
+
+#define SHA512_AVX2_CH(x, y, z)						\
+	_mm256_xor_si256(_mm256_and_si256(x, y), _mm256_andnot_si256(x, z))
+#define SHA512_AVX2_MAJ(x, y, z)					\
+	_mm256_or_si256(_mm256_and_si256(x, y),				\
+			_mm256_and_si256(z, _mm256_or_si256(x, y)))
+#define SHA512_AVX2_S0(x)						\
+	SHA512_AVX2_XOR3(SHA512_AVX2_ROR(x, 28), SHA512_AVX2_ROR(x, 34),\
+			 SHA512_AVX2_ROR(x, 39))
+#define SHA512_AVX2_S1(x)						\
+	SHA512_AVX2_XOR3(SHA512_AVX2_ROR(x, 14), SHA512_AVX2_ROR(x, 18),\
+			 SHA512_AVX2_ROR(x, 41))
+#define SHA512_AVX2_s0(x)						\
+	SHA512_AVX2_XOR3(SHA512_AVX2_ROR(x, 1), SHA512_AVX2_ROR(x, 8),	\
+			 _mm256_srli_epi64(x, 7))
+#define SHA512_AVX2_s1(x)						\
+	SHA512_AVX2_XOR3(SHA512_AVX2_ROR(x, 19), SHA512_AVX2_ROR(x, 61),\
+			 _mm256_srli_epi64(x, 6))
+
+__attribute__((target("avx2")))
+void sha512_transform_4x_avx2(uint64_t H[8][SHA512_MULTI_LANES],
+			      const uint8_t *in[SHA512_MULTI_LANES])
+{
+	/* Convert the big endian 64 bit words into host representation */
+	const __m256i bswap = _mm256_set_epi8(
+		8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+		8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i W[16], s[8], a, b, c, d, e, f, g, h, T1, T2;
+	unsigned int i;
+
+	for (i = 0; i < 8; i++)
+		s[i] = _mm256_loadu_si256((const __m256i *)H[i]);
+
+	a = s[0]; b = s[1]; c = s[2]; d = s[3];
+	e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+	/*
+	 * Load word i of the four lanes: the two lanes of each 128 bit half
+	 * are gathered with one 128 bit load per lane.
+	 */
+	for (i = 0; i < 16; i += 2) {
+		__m256i w01 = _mm256_set_m128i(
+			_mm_loadu_si128((const __m128i *)(in[1] + 8 * i)),
+			_mm_loadu_si128((const __m128i *)(in[0] + 8 * i)));
+		__m256i w23 = _mm256_set_m128i(
+			_mm_loadu_si128((const __m128i *)(in[3] + 8 * i)),
+			_mm_loadu_si128((const __m128i *)(in[2] + 8 * i)));
+
+		/*
+		 * w01 = { in0[i], in0[i+1], in1[i], in1[i+1] }
+		 * w23 = { in2[i], in2[i+1], in3[i], in3[i+1] }
+		 */
+		w01 = _mm256_shuffle_epi8(w01, bswap);
+		w23 = _mm256_shuffle_epi8(w23, bswap);
+
+		/* { in0[i], in1[i], in0[i+1], in1[i+1] } */
+		w01 = _mm256_permute4x64_epi64(w01, 0xd8);
+		/* { in2[i], in3[i], in2[i+1], in3[i+1] } */
+		w23 = _mm256_permute4x64_epi64(w23, 0xd8);
+
+		W[i] = _mm256_permute2x128_si256(w01, w23, 0x20);
+		W[i + 1] = _mm256_permute2x128_si256(w01, w23, 0x31);
+	}
+
+	for (i = 0; i < 80; i++) {
+		__m256i w;
+
+		if (i < 16) {
+			w = W[i];
+		} else {
+			w = _mm256_add_epi64(
+				_mm256_add_epi64(SHA512_AVX2_s1(W[(i - 2) & 15]),
+						 W[(i - 7) & 15]),
+				_mm256_add_epi64(SHA512_AVX2_s0(W[(i - 15) & 15]),
+						 W[i & 15]));
+			W[i & 15] = w;
+		}
+
+		T1 = _mm256_add_epi64(
+			_mm256_add_epi64(h, SHA512_AVX2_S1(e)),
+			_mm256_add_epi64(SHA512_AVX2_CH(e, f, g),
+				_mm256_add_epi64(
+					_mm256_set1_epi64x((long long)sha512_K[i]),
+					w)));
+		T2 = _mm256_add_epi64(SHA512_AVX2_S0(a),
+				      SHA512_AVX2_MAJ(a, b, c));
+		h = g; g = f; f = e; e = _mm256_add_epi64(d, T1);
+		d = c; c = b; b = a; a = _mm256_add_epi64(T1, T2);
+	}
+
+	s[0] = _mm256_add_epi64(s[0], a); s[1] = _mm256_add_epi64(s[1], b);
+	s[2] = _mm256_add_epi64(s[2], c); s[3] = _mm256_add_epi64(s[3], d);
+	s[4] = _mm256_add_epi64(s[4], e); s[5] = _mm256_add_epi64(s[5], f);
+	s[6] = _mm256_add_epi64(s[6], g); s[7] = _mm256_add_epi64(s[7], h);
+
+	for (i = 0; i < 8; i++)
+		_mm256_storeu_si256((__m256i *)H[i], s[i]);
+
+	/* Zeroize intermediate values - register are not zeroized */
+	memset_secure(W, 0, sizeof(W));
+}
+
+#endif /* SHA512_X86 */
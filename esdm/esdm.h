@@ -57,6 +57,22 @@ int esdm_reinit(void);
  */
 int esdm_init_monitor(void);
 
+/**
+ * @brief esdm_init_reseed_worker() - run the DRNG reseed worker
+ *
+ * This call is intended to be invoked from a dedicated thread. While it runs,
+ * the seed for the fully seeded DRNGs is collected ahead of their reseed
+ * threshold without blocking the callers requesting random numbers. The
+ * collected seed is injected with a short critical section. A caller only
+ * reseeds synchronously when the worker falls behind such that the DRNG would
+ * exceed the maximum number of generate operations without reseed.
+ *
+ * The call only returns when the ESDM is finalized with esdm_fini().
+ *
+ * @return: 0 on success, < 0 on error
+ */
+int esdm_init_reseed_worker(void);
+
 /**
  * @brief esdm_fini() - finalize the ESDM library and release all resources
  */
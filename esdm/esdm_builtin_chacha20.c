@@ -26,6 +26,7 @@
 #include "lc_chacha20_drng.h"
 #include "lc_chacha20_private.h"
 #include "esdm_builtin_chacha20.h"
+#include "helper.h"
 #include "logger.h"
 
 static int esdm_chacha20_seed(void *drng, const uint8_t *inbuf,
@@ -90,6 +91,95 @@ static inline void chacha20_bswap32(uint32_t *ptr, uint32_t words)
         }
 }
 
+/*
+ * Known-answer test of all ChaCha20 block function implementations supported
+ * by the CPU. The state is initialized with the test vector from RFC 7539
+ * section 2.3.2 and 19 blocks are generated into an unaligned buffer. This
+ * covers each multi-block function at least once as well as the processing of
+ * the remaining blocks.
+ */
+#define ESDM_CHACHA20_SELFTEST_BLOCKS	19
+static int esdm_chacha20_block_selftest(void)
+{
+	static const enum lc_cc20_impl impls[] = {
+		lc_cc20_impl_c,
+		lc_cc20_impl_ssse3,
+		lc_cc20_impl_avx2,
+		lc_cc20_impl_avx512,
+		lc_cc20_impl_neon,
+	};
+	static const uint8_t key[LC_CC20_KEY_SIZE] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+		0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f };
+	static const uint8_t nonce[12] = {
+		0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x4a,
+		0x00, 0x00, 0x00, 0x00 };
+	/* Block with counter 1 - RFC 7539 section 2.3.2 */
+	static const uint8_t expected_first[LC_CC20_BLOCK_SIZE] = {
+		0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15,
+		0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+		0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03,
+		0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+		0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09,
+		0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+		0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9,
+		0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e };
+	/* Block with counter 19 */
+	static const uint8_t expected_last[LC_CC20_BLOCK_SIZE] = {
+		0x97, 0xc5, 0xe0, 0x93, 0x91, 0x6d, 0xb8, 0x45,
+		0xd5, 0xc7, 0xb0, 0xa8, 0xe5, 0x86, 0xea, 0xfa,
+		0xb9, 0x97, 0x35, 0xd2, 0xbd, 0xaf, 0x84, 0x83,
+		0x90, 0x54, 0xa1, 0xb3, 0xd4, 0xa7, 0xa5, 0xd9,
+		0x0e, 0x68, 0x1f, 0x45, 0x86, 0x65, 0x3d, 0x69,
+		0xcf, 0xd3, 0x9a, 0xb3, 0x00, 0x0f, 0x7c, 0x05,
+		0x88, 0xd0, 0x1f, 0x1d, 0xe9, 0x67, 0x1e, 0x04,
+		0xa6, 0xc8, 0x42, 0x33, 0x10, 0xf8, 0xae, 0x37 };
+	uint8_t ref[ESDM_CHACHA20_SELFTEST_BLOCKS * LC_CC20_BLOCK_SIZE];
+	uint8_t out[ESDM_CHACHA20_SELFTEST_BLOCKS * LC_CC20_BLOCK_SIZE + 1];
+	struct lc_sym_state state;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < ARRAY_SIZE(impls); i++) {
+		uint8_t *buf = (impls[i] == lc_cc20_impl_c) ? ref : out + 1;
+
+		lc_chacha20->init(&state);
+		lc_chacha20->setkey(&state, (uint8_t *)key, sizeof(key));
+		lc_chacha20->setiv(&state, (uint8_t *)nonce, sizeof(nonce));
+
+		ret = cc20_blocks_impl(impls[i], &state, buf,
+				       ESDM_CHACHA20_SELFTEST_BLOCKS);
+		if (ret == -EOPNOTSUPP)
+			continue;
+		if (ret)
+			return ret;
+
+		if (state.counter != ESDM_CHACHA20_SELFTEST_BLOCKS + 1)
+			return -EFAULT;
+
+		if (impls[i] == lc_cc20_impl_c) {
+			if (memcmp(ref, expected_first, sizeof(expected_first)))
+				return -EFAULT;
+			if (memcmp(ref + sizeof(ref) - sizeof(expected_last),
+				   expected_last, sizeof(expected_last)))
+				return -EFAULT;
+		} else if (memcmp(ref, buf, sizeof(ref))) {
+			logger(LOGGER_ERR, LOGGER_C_ANY,
+			       "ChaCha20 block function implementation %u failed\n",
+			       impls[i]);
+			return -EFAULT;
+		}
+	}
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY,
+	       "ChaCha20 block function implementation %s selected\n",
+	       cc20_blocks_name());
+
+	return 0;
+}
+
 static int esdm_chacha20_drng_selftest(void)
 {
 	LC_CC20_DRNG_CTX_ON_STACK(cc20_ctx);
@@ -164,6 +254,9 @@ static int esdm_chacha20_drng_selftest(void)
 		0x38, 0x76, 0xa0, 0x66, 0xec, 0xbb, 0xce, 0xa9,
 		0x9c, 0x95, 0xa1, 0xfd };
 
+	if (esdm_chacha20_block_selftest())
+		return -EFAULT;
+
 	chacha20_bswap32((uint32_t *)seed, sizeof(seed) / sizeof(uint32_t));
 
 	/* Generate with zero state */
@@ -33,12 +33,15 @@
 struct esdm_config {
 	uint32_t esdm_es_cpu_entropy_rate_bits;
 	uint32_t esdm_es_jent_entropy_rate_bits;
+	uint32_t esdm_es_jent_collectors;
 	uint32_t esdm_es_irq_entropy_rate_bits;
 	uint32_t esdm_es_krng_entropy_rate_bits;
 	uint32_t esdm_es_sched_entropy_rate_bits;
 	uint32_t esdm_es_hwrand_entropy_rate_bits;
 	uint32_t esdm_drng_max_wo_reseed;
 	uint32_t esdm_max_nodes;
+	uint32_t esdm_drng_per_thread;
+	uint32_t esdm_es_parallel;
 	enum esdm_config_force_fips force_fips;
 };
 
@@ -61,6 +64,9 @@ static struct esdm_config esdm_config = {
 	 */
 	.esdm_es_jent_entropy_rate_bits = ESDM_JENT_ENTROPY_RATE,
 
+	/* Number of threads pre-filling buffers with Jitter RNG output */
+	.esdm_es_jent_collectors = 0,
+
 	/*
 	 * See documentation of ESDM_IRQ_ENTROPY_RATE
 	 */
@@ -91,6 +97,12 @@ static struct esdm_config esdm_config = {
 	 */
 	.esdm_max_nodes = 0xffffffff,
 
+	/* Serve requests from thread-local DRNG instances? */
+	.esdm_drng_per_thread = 0,
+
+	/* Fetch the slow entropy sources concurrently? */
+	.esdm_es_parallel = 0,
+
 	/* Shall the FIPS mode be forcefully set/unset? */
 	.force_fips = esdm_config_force_fips_unset,
 };
@@ -128,6 +140,18 @@ void esdm_config_es_jent_entropy_rate_set(uint32_t ent)
 	esdm_es_add_entropy();
 }
 
+DSO_PUBLIC
+uint32_t esdm_config_es_jent_collectors(void)
+{
+	return esdm_config.esdm_es_jent_collectors;
+}
+
+DSO_PUBLIC
+void esdm_config_es_jent_collectors_set(uint32_t num)
+{
+	esdm_config.esdm_es_jent_collectors = num;
+}
+
 DSO_PUBLIC
 uint32_t esdm_config_es_irq_entropy_rate(void)
 {
@@ -218,6 +242,30 @@ uint32_t esdm_config_max_nodes(void)
 	return esdm_config.esdm_max_nodes;
 }
 
+DSO_PUBLIC
+void esdm_config_drng_per_thread_set(int enable)
+{
+	esdm_config.esdm_drng_per_thread = !!enable;
+}
+
+DSO_PUBLIC
+int esdm_config_drng_per_thread(void)
+{
+	return (int)esdm_config.esdm_drng_per_thread;
+}
+
+DSO_PUBLIC
+void esdm_config_es_parallel_set(int enable)
+{
+	esdm_config.esdm_es_parallel = !!enable;
+}
+
+DSO_PUBLIC
+int esdm_config_es_parallel(void)
+{
+	return (int)esdm_config.esdm_es_parallel;
+}
+
 #ifdef ESDM_TESTMODE
 void esdm_config_drng_max_wo_reseed_set(uint32_t val)
 {
@@ -56,6 +56,25 @@ void esdm_config_es_jent_entropy_rate_set(uint32_t ent);
  */
 uint32_t esdm_config_es_jent_entropy_rate(void);
 
+/**
+ * @brief JENT ES configuration: set the number of Jitter RNG collectors
+ *
+ * Each collector is an independent Jitter RNG instance executing on its own
+ * thread pinned to a separate CPU which keeps a small buffer of Jitter RNG
+ * output filled. Obtaining data from the Jitter RNG ES then only copies
+ * buffered data. The setting must be applied before esdm_init().
+ *
+ * @param [in] num Number of collectors, 0 disables the collectors (default)
+ */
+void esdm_config_es_jent_collectors_set(uint32_t num);
+
+/**
+ * @brief JENT ES configuration: get the number of Jitter RNG collectors
+ *
+ * @return Number of collectors
+ */
+uint32_t esdm_config_es_jent_collectors(void);
+
 /**
  * @brief Interrupt ES configuration: set the entropy rate
  *
@@ -158,6 +177,47 @@ uint32_t esdm_config_drng_max_wo_reseed(void);
  */
 uint32_t esdm_config_max_nodes(void);
 
+/**
+ * @brief DRNG Manager configuration: enable thread-local DRNG instances
+ *
+ * When enabled, each thread requesting random numbers without prediction
+ * resistance obtains its own DRNG instance which is seeded from the DRNG of
+ * the current node. The generate operation of the thread-local DRNG does not
+ * require any lock. Every reseed of a regular DRNG as well as a forced reseed
+ * causes all thread-local DRNGs to reseed before their next use.
+ *
+ * @param [in] enable 1 to enable, 0 to disable thread-local DRNGs (default)
+ */
+void esdm_config_drng_per_thread_set(int enable);
+
+/**
+ * @brief DRNG Manager configuration: are thread-local DRNG instances used?
+ *
+ * @return 1 if thread-local DRNGs are enabled, 0 if they are disabled
+ */
+int esdm_config_drng_per_thread(void);
+
+/**
+ * @brief ES Manager configuration: fetch entropy sources concurrently
+ *
+ * When enabled, the entropy sources which may take long to deliver data, such
+ * as the Jitter RNG or the kernel-based entropy sources, are fetched
+ * concurrently by ES worker threads during a reseed. The reseed then only
+ * takes as long as the slowest entropy source. An entropy source which does
+ * not deliver its data within its timeout contributes no entropy to the
+ * reseed instead of stalling it.
+ *
+ * @param [in] enable 1 to enable, 0 to disable concurrent fetching (default)
+ */
+void esdm_config_es_parallel_set(int enable);
+
+/**
+ * @brief ES Manager configuration: are entropy sources fetched concurrently?
+ *
+ * @return 1 if concurrent fetching is enabled, 0 if it is disabled
+ */
+int esdm_config_es_parallel(void);
+
 /* FIPS mode enforcement */
 enum esdm_config_force_fips {
 	/** Default: no FIPS enforcement is set, ESDM checks environment */
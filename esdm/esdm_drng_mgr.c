@@ -22,6 +22,7 @@
 #define _POSIX_C_SOURCE 200112L
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 
 #include "build_bug_on.h"
@@ -38,6 +39,7 @@
 #include "esdm_es_mgr.h"
 #include "esdm_gnutls.h"
 #include "esdm_node.h"
+#include "esdm_shm_status.h"
 #include "helper.h"
 #include "queue.h"
 #include "ret_checkers.h"
@@ -100,6 +102,43 @@ DECLARE_WAIT_QUEUE(esdm_init_wait);
 
 static atomic_t esdm_drng_mgr_terminate = ATOMIC_INIT(0);
 
+/* State of the reseed worker */
+static DECLARE_WAIT_QUEUE(esdm_drng_reseed_wait);
+static atomic_t esdm_drng_reseed_pending = ATOMIC_INIT(0);
+static atomic_t esdm_drng_reseed_active = ATOMIC_INIT(0);
+
+/*
+ * Thread-local DRNG instance which is seeded from the node DRNG. It is only
+ * ever accessed by its owning thread and thus requires no lock.
+ */
+struct esdm_drng_thread {
+	void *drng;				/* DRNG handle */
+	const struct esdm_drng_cb *drng_cb;	/* DRNG callbacks */
+	uint32_t requests;			/* Generate calls since seeding */
+	time_t last_seeded;			/* Last time it was seeded */
+	int epoch;				/* Seed epoch of the instance */
+};
+
+/*
+ * Seed epoch of all thread-local DRNGs - any reseed of a regular DRNG
+ * increments it which causes all thread-local DRNGs to reseed before their
+ * next generate operation.
+ */
+static atomic_t esdm_drng_thread_epoch = ATOMIC_INIT(0);
+static __thread struct esdm_drng_thread *esdm_drng_thread = NULL;
+static pthread_key_t esdm_drng_thread_key;
+static pthread_once_t esdm_drng_thread_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Announce a new seed to the thread-local DRNGs and to the clients
+ * observing the status shared memory segment.
+ */
+static void esdm_drng_epoch_inc(void)
+{
+	atomic_inc(&esdm_drng_thread_epoch);
+	esdm_shm_status_reseeded();
+}
+
 /********************************** Helper ************************************/
 
 bool esdm_get_available(void)
@@ -266,9 +305,24 @@ out:
 	return ret;
 }
 
+void esdm_drng_reseed_worker_fini(void)
+{
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 1U << 20 };
+
+	atomic_set(&esdm_drng_mgr_terminate, 1);
+
+	/* Wakeups may be lost while the worker is not waiting - repeat them */
+	while (atomic_read(&esdm_drng_reseed_active)) {
+		thread_wake_all(&esdm_drng_reseed_wait);
+		nanosleep(&ts, NULL);
+	}
+}
+
 void esdm_drng_mgr_finalize(void)
 {
 	atomic_set(&esdm_drng_mgr_terminate, 1);
+	/* Wake up esdm_get_seed callers waiting for entropy */
+	esdm_es_entropy_notify();
 	esdm_drng_dealloc_common(esdm_drng_init_instance());
 	esdm_drng_dealloc_common(&esdm_drng_pr);
 }
@@ -369,6 +423,7 @@ void esdm_drng_inject(struct esdm_drng *drng,
 			atomic_add(&drng->requests_since_fully_seeded, gc);
 
 		drng->last_seeded = time(NULL);
+		drng->reseed_gen++;
 		atomic_set(&drng->requests, ESDM_DRNG_RESEED_THRESH);
 		drng->force_reseed = false;
 
@@ -479,6 +534,9 @@ static void esdm_drng_seed(struct esdm_drng *drng)
 	esdm_drng_seed_es(drng);
 	/* (Re-)Seed atomic DRNG from regular DRNG */
 	esdm_drng_atomic_seed_drng(drng);
+	/* Let the thread-local DRNGs pick up the new seed */
+	if (drng != &esdm_drng_pr)
+		esdm_drng_epoch_inc();
 }
 
 static void esdm_drng_seed_work_one(struct esdm_drng *drng, uint32_t node)
@@ -600,6 +658,8 @@ void esdm_drng_force_reseed(void)
 	esdm_drng_atomic_force_reseed();
 
 out:
+	/* Invalidate all thread-local DRNGs */
+	esdm_drng_epoch_inc();
 	esdm_drng_put_instances();
 }
 
@@ -611,6 +671,159 @@ static bool esdm_drng_must_reseed(struct esdm_drng *drng)
 				    esdm_drng_reseed_max_time));
 }
 
+/*
+ * Reseed worker: When it is running, it collects the seed for the fully seeded
+ * regular DRNGs shortly before their reseed threshold is reached without
+ * holding the DRNG lock. The DRNG lock is only taken to inject the collected
+ * seed. The caller of esdm_drng_get only wakes the worker and falls back to a
+ * synchronous reseed when the worker falls behind so far that the DRNG would
+ * exceed the maximum number of generate operations without reseed.
+ */
+
+/* Distance to the reseed thresholds at which the worker prepares the seed */
+#define ESDM_DRNG_RESEED_AHEAD_REQUESTS (ESDM_DRNG_RESEED_THRESH >> 4)
+#define ESDM_DRNG_RESEED_AHEAD_TIME_SHIFT 4
+
+static bool esdm_drng_reseed_due(struct esdm_drng *drng)
+{
+	uint32_t ahead = esdm_drng_reseed_max_time >>
+			 ESDM_DRNG_RESEED_AHEAD_TIME_SHIFT;
+
+	return (atomic_read(&drng->requests) <=
+		ESDM_DRNG_RESEED_AHEAD_REQUESTS ||
+		esdm_time_after_now(drng->last_seeded +
+				    esdm_drng_reseed_max_time - ahead));
+}
+
+/* Is the reseed of the DRNG handled by the reseed worker? */
+static bool esdm_drng_reseed_async(struct esdm_drng *drng)
+{
+	/* Initial seeding and forced reseeds are always synchronous */
+	return (atomic_read(&esdm_drng_reseed_active) &&
+		drng->fully_seeded && !drng->force_reseed &&
+		esdm_drng_reseed_max_time);
+}
+
+/*
+ * The worker did not reseed the DRNG in time: continuing to generate would
+ * exceed the maximum number of generate operations without reseed.
+ */
+static bool esdm_drng_reseed_deadline(struct esdm_drng *drng)
+{
+	int requests = atomic_read(&drng->requests);
+	int64_t gc = (int64_t)ESDM_DRNG_RESEED_THRESH - requests;
+
+	return (requests <= 0 &&
+		(int64_t)atomic_read_u32(&drng->requests_since_fully_seeded) +
+		gc >= (int64_t)esdm_config_drng_max_wo_reseed());
+}
+
+static void esdm_drng_reseed_wakeup(void)
+{
+	atomic_set(&esdm_drng_reseed_pending, 1);
+	thread_wake(&esdm_drng_reseed_wait);
+}
+
+static void esdm_drng_reseed_prepared(struct esdm_drng *drng)
+{
+	struct entropy_buf seedbuf __aligned(ESDM_KCAPI_ALIGN);
+	uint32_t collected_entropy;
+
+	if (!esdm_drng_reseed_async(drng) || !esdm_drng_reseed_due(drng))
+		return;
+
+	esdm_pool_lock();
+
+	/* A synchronous reseed may have happened in the meantime */
+	if (atomic_read(&esdm_drng_mgr_terminate) ||
+	    !esdm_drng_reseed_async(drng) || !esdm_drng_reseed_due(drng))
+		goto out;
+
+	/*
+	 * This clearing is not strictly needed, but it silences
+	 * valgrind.
+	 */
+	memset(&seedbuf, 0, sizeof(seedbuf));
+
+	/* Collect the seed while the DRNG keeps serving callers */
+	esdm_fill_seed_buffer(&seedbuf,
+			      esdm_get_seed_entropy_osr(drng->fully_seeded),
+			      false);
+	collected_entropy = esdm_entropy_rate_eb(&seedbuf);
+
+	/* Swap in the new seed */
+	mutex_w_lock(&drng->lock);
+	esdm_drng_inject(drng, (uint8_t *)&seedbuf, sizeof(seedbuf),
+			 esdm_fully_seeded(drng->fully_seeded,
+					   collected_entropy, &seedbuf),
+			 "regular");
+	esdm_init_ops(&seedbuf);
+	mutex_w_unlock(&drng->lock);
+
+	esdm_drng_atomic_seed_drng(drng);
+	esdm_drng_epoch_inc();
+
+	memset_secure(&seedbuf, 0, sizeof(seedbuf));
+
+out:
+	esdm_pool_unlock();
+}
+
+static void esdm_drng_reseed_work(void)
+{
+	struct esdm_drng **esdm_drng = esdm_drng_get_instances();
+
+	if (esdm_drng) {
+		uint32_t node;
+
+		for_each_online_node(node) {
+			struct esdm_drng *drng = esdm_drng[node];
+
+			if (drng)
+				esdm_drng_reseed_prepared(drng);
+		}
+	} else {
+		esdm_drng_reseed_prepared(&esdm_drng_init);
+	}
+
+	esdm_drng_put_instances();
+}
+
+static void esdm_drng_reseed_worker_cleanup(void __unused *unused)
+{
+	atomic_set(&esdm_drng_reseed_active, 0);
+	logger(LOGGER_VERBOSE, LOGGER_C_DRNG, "DRNG reseed worker stopped\n");
+}
+
+int esdm_drng_reseed_worker(void)
+{
+	int cancel_state;
+
+	if (atomic_cmpxchg(&esdm_drng_reseed_active, 0, 1))
+		return -EALREADY;
+
+	logger(LOGGER_VERBOSE, LOGGER_C_DRNG, "DRNG reseed worker started\n");
+
+	/* The thread may be canceled while waiting for work */
+	pthread_cleanup_push(esdm_drng_reseed_worker_cleanup, NULL);
+
+	while (!atomic_read(&esdm_drng_mgr_terminate)) {
+		thread_wait_event(&esdm_drng_reseed_wait,
+				  (atomic_read(&esdm_drng_reseed_pending) ||
+				   atomic_read(&esdm_drng_mgr_terminate)));
+		atomic_set(&esdm_drng_reseed_pending, 0);
+
+		/* Do not get canceled while holding the pool or DRNG lock */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+		esdm_drng_reseed_work();
+		pthread_setcancelstate(cancel_state, NULL);
+	}
+
+	pthread_cleanup_pop(1);
+
+	return 0;
+}
+
 /**
  * esdm_drng_get() - Get random data out of the DRNG which is reseeded
  * frequently.
@@ -647,12 +860,31 @@ static ssize_t esdm_drng_get(struct esdm_drng *drng, uint8_t *outbuf,
 		ssize_t ret;
 
 		/* In normal operation, check whether to reseed */
-		if (!pr && esdm_drng_must_reseed(drng)) {
-			if (!esdm_pool_trylock()) {
-				drng->force_reseed = true;
-			} else {
-				esdm_drng_seed(drng);
-				esdm_pool_unlock();
+		if (!pr) {
+			bool reseed = esdm_drng_must_reseed(drng);
+
+			/*
+			 * Leave the reseed to the reseed worker unless it
+			 * missed the deadline.
+			 */
+			if (esdm_drng_reseed_async(drng)) {
+				if (esdm_drng_reseed_deadline(drng)) {
+					reseed = true;
+				} else {
+					if (reseed ||
+					    esdm_drng_reseed_due(drng))
+						esdm_drng_reseed_wakeup();
+					reseed = false;
+				}
+			}
+
+			if (reseed) {
+				if (!esdm_pool_trylock()) {
+					drng->force_reseed = true;
+				} else {
+					esdm_drng_seed(drng);
+					esdm_pool_unlock();
+				}
 			}
 		}
 
@@ -713,6 +945,159 @@ out:
 	return processed;
 }
 
+/************************** Thread-local DRNG *********************************/
+
+static void esdm_drng_thread_free(void *arg)
+{
+	struct esdm_drng_thread *tdrng = arg;
+
+	if (!tdrng)
+		return;
+
+	if (tdrng->drng)
+		tdrng->drng_cb->drng_dealloc(tdrng->drng);
+	memset_secure(tdrng, 0, sizeof(*tdrng));
+	free(tdrng);
+}
+
+static void esdm_drng_thread_key_init(void)
+{
+	if (pthread_key_create(&esdm_drng_thread_key, esdm_drng_thread_free))
+		logger(LOGGER_ERR, LOGGER_C_DRNG,
+		       "Cannot allocate thread-local DRNG key\n");
+}
+
+static struct esdm_drng_thread *esdm_drng_thread_alloc(void)
+{
+	struct esdm_drng_thread *tdrng;
+
+	if (pthread_once(&esdm_drng_thread_once, esdm_drng_thread_key_init))
+		return NULL;
+
+	tdrng = calloc(1, sizeof(*tdrng));
+	if (!tdrng)
+		return NULL;
+
+	tdrng->drng_cb = esdm_default_drng_cb;
+	if (tdrng->drng_cb->drng_alloc(&tdrng->drng,
+				       ESDM_DRNG_SECURITY_STRENGTH_BYTES)) {
+		free(tdrng);
+		return NULL;
+	}
+
+	/* Ensure the destructor is triggered when the thread terminates */
+	if (pthread_setspecific(esdm_drng_thread_key, tdrng)) {
+		esdm_drng_thread_free(tdrng);
+		return NULL;
+	}
+
+	/* Ensure seeding during first use */
+	tdrng->epoch = atomic_read(&esdm_drng_thread_epoch) - 1;
+
+	return tdrng;
+}
+
+/*
+ * Seed the thread-local DRNG with data from the node DRNG. The seed is wiped
+ * right after it was injected which implies that the node DRNG state used to
+ * derive the thread-local DRNG is not retained - fast key erasure.
+ */
+static int esdm_drng_thread_seed(struct esdm_drng_thread *tdrng,
+				 struct esdm_drng *drng, int epoch)
+{
+	uint8_t seed[ESDM_DRNG_INIT_SEED_SIZE_BYTES];
+	ssize_t ret;
+
+	ret = esdm_drng_get(drng, seed, sizeof(seed));
+	if (ret != sizeof(seed)) {
+		ret = (ret < 0) ? ret : -EFAULT;
+		goto out;
+	}
+
+	CKINT(tdrng->drng_cb->drng_seed(tdrng->drng, seed, sizeof(seed)));
+
+	tdrng->requests = 0;
+	tdrng->last_seeded = time(NULL);
+	tdrng->epoch = epoch;
+
+	logger(LOGGER_DEBUG, LOGGER_C_DRNG, "thread-local DRNG seeded\n");
+
+out:
+	memset_secure(seed, 0, sizeof(seed));
+	return (int)ret;
+}
+
+static bool esdm_drng_thread_must_reseed(struct esdm_drng_thread *tdrng,
+					 int epoch)
+{
+	return (tdrng->epoch != epoch ||
+		tdrng->requests >= ESDM_DRNG_RESEED_THRESH ||
+		esdm_time_after_now(tdrng->last_seeded +
+				    esdm_drng_reseed_max_time));
+}
+
+/**
+ * esdm_drng_thread_get() - Get random data from the thread-local DRNG
+ *
+ * @drng: DRNG instance used for seeding the thread-local DRNG
+ * @outbuf: buffer for storing random data
+ * @outbuflen: length of outbuf
+ *
+ * The generate operation does not take any lock. Only the seeding operation
+ * uses the regular DRNG and its locking.
+ *
+ * @return:
+ * * < 0 in error case (DRNG generation or update failed)
+ * * >=0 returning the returned number of bytes
+ */
+static ssize_t esdm_drng_thread_get(struct esdm_drng *drng, uint8_t *outbuf,
+				    size_t outbuflen)
+{
+	struct esdm_drng_thread *tdrng = esdm_drng_thread;
+	ssize_t processed = 0;
+	int ret;
+
+	if (!outbuf || !outbuflen)
+		return 0;
+
+	if (!tdrng) {
+		tdrng = esdm_drng_thread_alloc();
+		if (!tdrng)
+			return -ENOMEM;
+		esdm_drng_thread = tdrng;
+	}
+
+	outbuflen = min_size(outbuflen, SSIZE_MAX);
+
+	while (outbuflen) {
+		uint32_t todo = min_uint32((uint32_t)outbuflen,
+					   ESDM_DRNG_MAX_REQSIZE);
+		int epoch = atomic_read(&esdm_drng_thread_epoch);
+		ssize_t gen;
+
+		if (esdm_drng_thread_must_reseed(tdrng, epoch))
+			CKINT(esdm_drng_thread_seed(tdrng, drng, epoch));
+
+		gen = tdrng->drng_cb->drng_generate(tdrng->drng,
+						    outbuf + processed, todo);
+		if (gen <= 0) {
+			logger(LOGGER_WARN, LOGGER_C_DRNG,
+			       "getting random data from thread-local DRNG failed (%zd)\n",
+			       gen);
+			return -EFAULT;
+		}
+		tdrng->requests++;
+		processed += gen;
+		outbuflen -= (size_t)gen;
+	}
+
+	return processed;
+
+out:
+	/* The failed seeding is retried with the next call */
+	return ret;
+}
+
 static ssize_t esdm_drng_get_sleep(uint8_t *outbuf, size_t outbuflen, bool pr)
 {
 	struct esdm_drng **esdm_drng = esdm_drng_get_instances();
@@ -736,7 +1121,16 @@ static ssize_t esdm_drng_get_sleep(uint8_t *outbuf, size_t outbuflen, bool pr)
 	}
 
 	CKINT(esdm_drng_mgr_initialize());
-	CKINT(esdm_drng_get(drng, outbuf, outbuflen));
+
+	/*
+	 * The thread-local DRNG is only seeded from a fully seeded DRNG, all
+	 * other requests are served by the shared DRNG instance.
+	 */
+	if (!pr && drng->fully_seeded && esdm_config_drng_per_thread()) {
+		CKINT(esdm_drng_thread_get(drng, outbuf, outbuflen));
+	} else {
+		CKINT(esdm_drng_get(drng, outbuf, outbuflen));
+	}
 
 out:
 	esdm_drng_put_instances();
@@ -775,6 +1169,7 @@ void esdm_reset(void)
 	mutex_w_unlock(&esdm_drng_pr.lock);
 
 	esdm_drng_atomic_reset();
+	esdm_drng_epoch_inc();
 	esdm_set_entropy_thresh(ESDM_FULL_SEED_ENTROPY_BITS);
 
 	esdm_reset_state();
@@ -838,6 +1233,7 @@ ssize_t esdm_get_seed(uint64_t *buf, size_t nbytes,
 	uint64_t buflen = sizeof(struct entropy_buf) + 2 * sizeof(uint64_t);
 	uint64_t collected_bits = 0;
 	int ret;
+	bool first = true;
 
 	/* Ensure buffer is aligned as required */
 	BUILD_BUG_ON(sizeof(buflen) < ESDM_KCAPI_ALIGN);
@@ -854,27 +1250,34 @@ ssize_t esdm_get_seed(uint64_t *buf, size_t nbytes,
 	if (ret < 0)
 		return ret;
 
-	/* Try to get the pool lock and sleep on it to get it. */
-	esdm_pool_lock();
-
-	/* If an ESDM DRNG becomes unseeded, give this DRNG precedence. */
-	if (!esdm_pool_all_nodes_seeded_get()) {
-		esdm_pool_unlock();
-		return 0;
-	}
-
 	/*
-	 * Try to get seed data - a rarely used busyloop is cheaper than a wait
-	 * queue that is constantly woken up by the hot code path of
-	 * esdm_init_ops.
+	 * Try to get seed data - the pool lock is only held while collecting
+	 * to not block the reseeding of the DRNGs while waiting for entropy.
 	 */
 	for (;;) {
+		/* Sample before collecting to not miss arriving entropy */
+		int seq = esdm_es_entropy_seq_get();
+
+		/* Try to get the pool lock and sleep on it to get it. */
+		esdm_pool_lock();
+
+		/* If an ESDM DRNG becomes unseeded, give this DRNG precedence. */
+		if (!esdm_pool_all_nodes_seeded_get()) {
+			esdm_pool_unlock();
+			if (first)
+				return 0;
+			break;
+		}
+		first = false;
+
 		esdm_fill_seed_buffer(eb,
 			esdm_get_seed_entropy_osr(flags &
 						  ESDM_GET_SEED_FULLY_SEEDED),
 						  false);
 		collected_bits = esdm_entropy_rate_eb(eb);
 
+		esdm_pool_unlock();
+
 		/* Break the collection loop if we got entropy, ... */
 		if (collected_bits ||
 		    /* ... a DRNG becomes unseeded, give DRNG precedence, ... */
@@ -885,11 +1288,13 @@ ssize_t esdm_get_seed(uint64_t *buf, size_t nbytes,
 		    (flags & ESDM_GET_SEED_NONBLOCK))
 			break;
 
-		nanosleep(&poll_ts, NULL);
+		/*
+		 * Sleep until new entropy arrives - the timeout covers
+		 * entropy sources which do not notify the arrival of entropy.
+		 */
+		esdm_es_entropy_wait(seq, &poll_ts);
 	}
 
-	esdm_pool_unlock();
-
 	/* Write collected entropy size into second word */
 	buf[1] = collected_bits;
 
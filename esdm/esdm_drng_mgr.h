@@ -46,6 +46,7 @@ struct esdm_drng {
 						 * last fully seeded
 						 */
 	time_t last_seeded;			/* Last time it was seeded */
+	uint32_t reseed_gen;			/* Number of (re)seeds */
 	bool fully_seeded;			/* Is DRNG fully seeded? */
 	bool force_reseed;			/* Force a reseed */
 
@@ -61,6 +62,7 @@ struct esdm_drng {
 	.requests			= ATOMIC_INIT(ESDM_DRNG_RESEED_THRESH),\
 	.requests_since_fully_seeded	= ATOMIC_INIT(0), \
 	.last_seeded			= 0, \
+	.reseed_gen			= 0, \
 	.fully_seeded			= false, \
 	.force_reseed			= true, \
 	.hash_lock			= MUTEX_UNLOCKED
@@ -80,6 +82,8 @@ void esdm_drng_inject(struct esdm_drng *drng,
 		      const uint8_t *inbuf, size_t inbuflen,
 		      bool fully_seeded, const char *drng_type);
 void esdm_drng_seed_work(void);
+int esdm_drng_reseed_worker(void);
+void esdm_drng_reseed_worker_fini(void);
 void esdm_force_fully_seeded(void);
 
 static inline uint32_t esdm_compress_osr(void)
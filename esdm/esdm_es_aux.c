@@ -283,6 +283,10 @@ int esdm_pool_insert_aux(const uint8_t *inbuf, size_t inbuflen,
 	ret = esdm_aux_pool_insert_locked(inbuf, inbuflen, entropy_bits);
 	mutex_w_unlock(&pool->lock);
 
+	/* Wake up all waiting for entropy */
+	if (entropy_bits)
+		esdm_es_entropy_notify();
+
 	/*
 	 * As the DRNG is newly seeded, maybe the need entropy flag can be
 	 * unset?
@@ -419,4 +423,5 @@ struct esdm_es_cb esdm_es_aux = {
 	.reset			= esdm_aux_reset,
 	.active			= esdm_aux_active,
 	.switch_hash		= esdm_aux_switch_hash,
+	.parallel_timeout_ms	= 0,
 };
@@ -270,4 +270,5 @@ struct esdm_es_cb esdm_es_cpu = {
 	.reset			= NULL,
 	.active			= esdm_cpu_active,
 	.switch_hash		= esdm_cpu_switch_hash,
+	.parallel_timeout_ms	= 0,
 };
@@ -143,4 +143,5 @@ struct esdm_es_cb esdm_es_hwrand = {
 	.reset			= NULL,
 	.active			= esdm_hwrand_active,
 	.switch_hash		= NULL,
+	.parallel_timeout_ms	= ESDM_ES_PARALLEL_TIMEOUT_MS,
 };
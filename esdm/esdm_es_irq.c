@@ -295,4 +295,5 @@ struct esdm_es_cb esdm_es_irq = {
 	.reset			= esdm_irq_reset,
 	.active			= esdm_irq_active,
 	.switch_hash		= NULL,
+	.parallel_timeout_ms	= ESDM_ES_PARALLEL_TIMEOUT_MS,
 };
@@ -19,7 +19,14 @@
  * DAMAGE.
  */
 
+#define _GNU_SOURCE
+#include <errno.h>
 #include <jitterentropy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "atomic.h"
 #include "config.h"
@@ -29,6 +36,8 @@
 #include "esdm_es_jent.h"
 #include "helper.h"
 #include "logger.h"
+#include "math_helper.h"
+#include "memset_secure.h"
 #include "mutex_w.h"
 
 static DEFINE_MUTEX_W_UNLOCKED(esdm_jent_lock);
@@ -36,6 +45,212 @@ static DEFINE_MUTEX_W_UNLOCKED(esdm_jent_lock);
 static atomic_t esdm_jent_initialized = ATOMIC_INIT(0);
 static struct rand_data *esdm_jent_state = NULL;
 
+/*************************** Jitter RNG collectors ****************************/
+
+/*
+ * Each collector owns a Jitter RNG instance running on its own thread which is
+ * pinned to a separate CPU. It keeps a small single-producer/single-consumer
+ * ring of conditioned Jitter RNG output filled. The consumer side is
+ * serialized by esdm_jent_lock. Thus, obtaining entropy from a collector is a
+ * copy of a ring slot. Only if all rings are empty, the Jitter RNG instance
+ * esdm_jent_state is invoked synchronously.
+ */
+#define ESDM_JENT_COLLECTOR_SLOTS	4
+#define ESDM_JENT_COLLECTOR_MASK	(ESDM_JENT_COLLECTOR_SLOTS - 1)
+#define ESDM_JENT_MAX_COLLECTORS	64
+
+struct esdm_jent_slot {
+	uint8_t e[ESDM_DRNG_INIT_SEED_SIZE_BYTES];
+	uint32_t len;
+};
+
+struct esdm_jent_collector {
+	/* Free-running counters - the head is only written by the collector */
+	uint32_t head __aligned(64);
+	/* ... and the tail is only written by the consumer */
+	uint32_t tail __aligned(64);
+	struct esdm_jent_slot slots[ESDM_JENT_COLLECTOR_SLOTS];
+	struct rand_data *state;
+	pthread_t thread;
+	bool started;
+};
+
+static struct esdm_jent_collector *esdm_jent_collectors = NULL;
+static uint32_t esdm_jent_num_collectors = 0;
+static uint32_t esdm_jent_next_collector = 0;
+/* Process owning the collector threads - they do not survive a fork */
+static pid_t esdm_jent_collectors_pid = 0;
+static bool esdm_jent_collectors_exit = false;
+static pthread_mutex_t esdm_jent_collectors_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t esdm_jent_collectors_cv = PTHREAD_COND_INITIALIZER;
+
+static void *esdm_jent_collector(void *arg)
+{
+	struct esdm_jent_collector *c = arg;
+
+	while (1) {
+		uint32_t head = __atomic_load_n(&c->head, __ATOMIC_RELAXED);
+		struct esdm_jent_slot *slot;
+		ssize_t ret;
+
+		pthread_mutex_lock(&esdm_jent_collectors_lock);
+		while (!esdm_jent_collectors_exit &&
+		       head - __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE) >=
+		       ESDM_JENT_COLLECTOR_SLOTS) {
+			pthread_cond_wait(&esdm_jent_collectors_cv,
+					  &esdm_jent_collectors_lock);
+		}
+		if (esdm_jent_collectors_exit) {
+			pthread_mutex_unlock(&esdm_jent_collectors_lock);
+			break;
+		}
+		pthread_mutex_unlock(&esdm_jent_collectors_lock);
+
+		slot = &c->slots[head & ESDM_JENT_COLLECTOR_MASK];
+		ret = jent_read_entropy_safe(&c->state, (char *)slot->e,
+					     sizeof(slot->e));
+		if (ret < 0) {
+			logger(LOGGER_WARN, LOGGER_C_ES,
+			       "Jitter RNG collector failed with %zd\n", ret);
+			break;
+		}
+		slot->len = (uint32_t)ret;
+
+		/* Publish the slot to the consumer */
+		__atomic_store_n(&c->head, head + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+/* Caller must hold esdm_jent_lock */
+static void esdm_jent_collectors_stop(void)
+{
+	uint32_t i;
+
+	if (!esdm_jent_collectors)
+		return;
+
+	/* Collector threads only exist in the process which started them */
+	if (esdm_jent_collectors_pid == getpid()) {
+		pthread_mutex_lock(&esdm_jent_collectors_lock);
+		esdm_jent_collectors_exit = true;
+		pthread_cond_broadcast(&esdm_jent_collectors_cv);
+		pthread_mutex_unlock(&esdm_jent_collectors_lock);
+	}
+
+	for (i = 0; i < esdm_jent_num_collectors; i++) {
+		struct esdm_jent_collector *c = &esdm_jent_collectors[i];
+
+		if (c->started && esdm_jent_collectors_pid == getpid())
+			pthread_join(c->thread, NULL);
+		if (c->state)
+			jent_entropy_collector_free(c->state);
+	}
+
+	/* Never hand out buffered data twice, e.g. in parent and child */
+	memset_secure(esdm_jent_collectors, 0,
+		      esdm_jent_num_collectors * sizeof(*esdm_jent_collectors));
+	free(esdm_jent_collectors);
+	esdm_jent_collectors = NULL;
+	esdm_jent_num_collectors = 0;
+	esdm_jent_collectors_pid = 0;
+}
+
+/* Caller must hold esdm_jent_lock */
+static void esdm_jent_collectors_start(void)
+{
+	pid_t pid = getpid();
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t i, num = min_uint32(esdm_config_es_jent_collectors(),
+				     ESDM_JENT_MAX_COLLECTORS);
+
+	if (esdm_jent_collectors_pid == pid || !num)
+		return;
+
+	/* Drop the collectors inherited from the parent process */
+	esdm_jent_collectors_stop();
+
+	esdm_jent_collectors = calloc(num, sizeof(*esdm_jent_collectors));
+	if (!esdm_jent_collectors)
+		return;
+	esdm_jent_num_collectors = num;
+	esdm_jent_collectors_pid = pid;
+	esdm_jent_collectors_exit = false;
+
+	if (ncpus < 1)
+		ncpus = 1;
+
+	for (i = 0; i < num; i++) {
+		struct esdm_jent_collector *c = &esdm_jent_collectors[i];
+		cpu_set_t cpuset;
+
+		c->state = jent_entropy_collector_alloc(0, 0);
+		if (!c->state)
+			continue;
+
+		if (pthread_create(&c->thread, NULL, esdm_jent_collector, c)) {
+			logger(LOGGER_WARN, LOGGER_C_ES,
+			       "Starting Jitter RNG collector %u failed\n", i);
+			jent_entropy_collector_free(c->state);
+			c->state = NULL;
+			continue;
+		}
+		c->started = true;
+
+		/* Spread the collectors across the CPUs */
+		CPU_ZERO(&cpuset);
+		CPU_SET(i % (uint32_t)ncpus, &cpuset);
+		pthread_setaffinity_np(c->thread, sizeof(cpuset), &cpuset);
+	}
+
+	logger(LOGGER_DEBUG, LOGGER_C_ES, "%u Jitter RNG collectors started\n",
+	       num);
+}
+
+/*
+ * Obtain buffered Jitter RNG output from one of the collectors - caller must
+ * hold esdm_jent_lock.
+ *
+ * @return number of bytes copied into buf, 0 if all collectors are empty
+ */
+static uint32_t esdm_jent_collectors_get(uint8_t *buf, uint32_t buflen)
+{
+	uint32_t i;
+
+	esdm_jent_collectors_start();
+
+	for (i = 0; i < esdm_jent_num_collectors; i++) {
+		struct esdm_jent_collector *c = &esdm_jent_collectors[
+			(esdm_jent_next_collector + i) %
+			esdm_jent_num_collectors];
+		uint32_t tail = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);
+		struct esdm_jent_slot *slot;
+		uint32_t len;
+
+		if (__atomic_load_n(&c->head, __ATOMIC_ACQUIRE) == tail)
+			continue;
+
+		slot = &c->slots[tail & ESDM_JENT_COLLECTOR_MASK];
+		len = min_uint32(slot->len, buflen);
+		memcpy(buf, slot->e, len);
+		memset_secure(slot, 0, sizeof(*slot));
+
+		/* Release the slot to the collector */
+		__atomic_store_n(&c->tail, tail + 1, __ATOMIC_RELEASE);
+		pthread_mutex_lock(&esdm_jent_collectors_lock);
+		pthread_cond_broadcast(&esdm_jent_collectors_cv);
+		pthread_mutex_unlock(&esdm_jent_collectors_lock);
+
+		esdm_jent_next_collector += i + 1;
+		return len;
+	}
+
+	return 0;
+}
+
+/****************************** Jitter RNG ES *********************************/
+
 static void esdm_jent_finalize(void)
 {
 	if (!atomic_read(&esdm_jent_initialized))
@@ -44,6 +259,7 @@ static void esdm_jent_finalize(void)
 	atomic_set(&esdm_jent_initialized, 0);
 
 	mutex_w_lock(&esdm_jent_lock);
+	esdm_jent_collectors_stop();
 	jent_entropy_collector_free(esdm_jent_state);
 	esdm_jent_state = NULL;
 	mutex_w_unlock(&esdm_jent_lock);
@@ -108,8 +324,13 @@ static void esdm_jent_get(struct entropy_es *eb_es, uint32_t requested_bits,
 		goto err;
 	}
 
-	ret = jent_read_entropy_safe(&esdm_jent_state, (char *)eb_es->e,
-				     requested_bits >> 3);
+	/* Prefer the output buffered by the collectors */
+	ret = esdm_jent_collectors_get(eb_es->e, requested_bits >> 3);
+	if (!ret) {
+		ret = jent_read_entropy_safe(&esdm_jent_state,
+					     (char *)eb_es->e,
+					     requested_bits >> 3);
+	}
 	mutex_w_unlock(&esdm_jent_lock);
 
 	if (ret < 0) {
@@ -132,11 +353,27 @@ err:
 
 static void esdm_jent_es_state(char *buf, size_t buflen)
 {
+	uint32_t i, collectors, buffered = 0;
+
+	/* The collectors are started and stopped under the lock */
+	mutex_w_lock(&esdm_jent_lock);
+	collectors = esdm_jent_num_collectors;
+	for (i = 0; i < collectors; i++) {
+		struct esdm_jent_collector *c = &esdm_jent_collectors[i];
+
+		buffered += __atomic_load_n(&c->head, __ATOMIC_ACQUIRE) -
+			    __atomic_load_n(&c->tail, __ATOMIC_RELAXED);
+	}
+	mutex_w_unlock(&esdm_jent_lock);
+
 	snprintf(buf, buflen,
 		 " Available entropy: %u\n"
-		 " Library version: %u\n",
+		 " Library version: %u\n"
+		 " Collectors: %u\n"
+		 " Buffered blocks: %u\n",
 		 esdm_jent_poolsize(),
-		 jent_version());
+		 jent_version(),
+		 collectors, buffered);
 }
 
 static bool esdm_jent_active(void)
@@ -156,4 +393,5 @@ struct esdm_es_cb esdm_es_jent = {
 	.reset			= NULL,
 	.active			= esdm_jent_active,
 	.switch_hash		= NULL,
+	.parallel_timeout_ms	= ESDM_ES_PARALLEL_TIMEOUT_MS,
 };
@@ -271,4 +271,5 @@ struct esdm_es_cb esdm_es_krng = {
 	.reset			= NULL,
 	.active			= esdm_krng_active,
 	.switch_hash		= NULL,
+	.parallel_timeout_ms	= ESDM_ES_PARALLEL_TIMEOUT_MS,
 };
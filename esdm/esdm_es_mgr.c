@@ -20,11 +20,16 @@
  */
 
 #define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "build_bug_on.h"
 #include "es_cpu/cpu_random.h"
 #include "esdm.h"
+#include "esdm_config.h"
 #include "esdm_drng_mgr.h"
 #include "esdm_es_aux.h"
 #include "esdm_es_cpu.h"
@@ -38,11 +43,13 @@
 #include "esdm_shm_status.h"
 #include "helper.h"
 #include "logger.h"
+#include "math_helper.h"
 #include "memset_secure.h"
 #include "mutex_w.h"
 #include "queue.h"
 #include "ret_checkers.h"
 #include "test_pertubation.h"
+#include "threading_support.h"
 #include "visibility.h"
 
 struct esdm_state {
@@ -108,6 +115,63 @@ struct esdm_es_cb *esdm_es[] = {
 	&esdm_es_aux
 };
 
+/************************* Entropy arrival notification ***********************/
+
+/*
+ * Sequence counter incremented whenever new entropy may be available. Waiters
+ * sample the counter before collecting entropy and sleep until it changes.
+ * The condition variable is only signaled when there are waiters to keep the
+ * notification cheap for the hot code paths.
+ */
+static atomic_t esdm_es_entropy_seq = ATOMIC_INIT(0);
+static atomic_t esdm_es_entropy_waiters = ATOMIC_INIT(0);
+static pthread_mutex_t esdm_es_entropy_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t esdm_es_entropy_cv = PTHREAD_COND_INITIALIZER;
+
+void esdm_es_entropy_notify(void)
+{
+	atomic_inc(&esdm_es_entropy_seq);
+
+	if (!atomic_read(&esdm_es_entropy_waiters))
+		return;
+
+	pthread_mutex_lock(&esdm_es_entropy_lock);
+	pthread_cond_broadcast(&esdm_es_entropy_cv);
+	pthread_mutex_unlock(&esdm_es_entropy_lock);
+}
+
+int esdm_es_entropy_seq_get(void)
+{
+	return atomic_read(&esdm_es_entropy_seq);
+}
+
+int esdm_es_entropy_wait(int seq, const struct timespec *timeout)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout->tv_sec;
+	deadline.tv_nsec += timeout->tv_nsec;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	atomic_inc(&esdm_es_entropy_waiters);
+	pthread_mutex_lock(&esdm_es_entropy_lock);
+	while (atomic_read(&esdm_es_entropy_seq) == seq) {
+		ret = -pthread_cond_timedwait(&esdm_es_entropy_cv,
+					      &esdm_es_entropy_lock, &deadline);
+		if (ret)
+			break;
+	}
+	pthread_mutex_unlock(&esdm_es_entropy_lock);
+	atomic_dec(&esdm_es_entropy_waiters);
+
+	return ret;
+}
+
 /******************************** ES monitor **********************************/
 
 /* Restart the ES monitor if it is sleeping */
@@ -122,10 +186,13 @@ int esdm_es_mgr_monitor_initialize(void)
 	struct timespec ts = { .tv_sec = 0, .tv_nsec = 1U<<29 };
 	uint64_t i;
 	unsigned int avail = 0;
+	/* Entropy availability of the ES found by the last monitor run */
+	bool available[esdm_ext_es_last];
 
 	for_each_esdm_es(i) {
 		if (esdm_es[i]->active())
 			avail += !!esdm_es[i]->monitor_es;
+		available[i] = true;
 	}
 
 	if (!avail) {
@@ -139,17 +206,37 @@ int esdm_es_mgr_monitor_initialize(void)
 #define secs(x) ((uint64_t)(((uint64_t)1UL<<30) / ((uint64_t)ts.tv_nsec) * x))
 	while (!atomic_read(&esdm_es_mgr_terminate)) {
 		unsigned int j;
+		int seq;
 
 		for_each_esdm_es(j) {
-			if (esdm_es[j]->monitor_es)
-				esdm_es[j]->monitor_es();
+			bool full;
+
+			if (!esdm_es[j]->monitor_es)
+				continue;
+
+			/*
+			 * Let waiters know when the ES collected full entropy.
+			 * A disabled ES as well as an ES which already had full
+			 * entropy during the last run do not wake them.
+			 */
+			full = !esdm_es[j]->monitor_es();
+			if (full && !available[j])
+				esdm_es_entropy_notify();
+			available[j] = full;
 		}
 
+		/* Do not wake up on our own notifications */
+		seq = esdm_es_entropy_seq_get();
+
 		thread_wait_event(&esdm_init_wait,
 				  !esdm_pool_all_nodes_seeded_get() &&
 				  !atomic_read(&esdm_es_mgr_terminate));
 
-		nanosleep(&ts, NULL);
+		/*
+		 * Sleep until entropy arrives. The timeout covers the kernel
+		 * ES which cannot notify the arrival of entropy.
+		 */
+		esdm_es_entropy_wait(seq, &ts);
 	}
 #undef secs
 
@@ -366,6 +453,15 @@ uint32_t esdm_avail_entropy_aux(void)
 	return esdm_es[esdm_ext_es_aux]->curr_entropy(ent_thresh);
 }
 
+/* Available entropy of one entropy source */
+uint32_t esdm_avail_entropy_es(uint32_t es)
+{
+	if (es >= esdm_ext_es_last)
+		return 0;
+
+	return esdm_es[es]->curr_entropy(esdm_avail_entropy_thresh());
+}
+
 DSO_PUBLIC
 uint32_t esdm_avail_poolsize_aux(void)
 {
@@ -456,6 +552,296 @@ void esdm_init_ops(struct entropy_buf *eb)
 	}
 }
 
+/************************* Concurrent ES collection ***************************/
+
+/*
+ * Each entropy source with a parallel_timeout_ms is fetched by a job started
+ * with thread_start. The job fetches into the private buffer of its ES worker
+ * slot which is only copied into the caller's entropy_buf when the job
+ * completed in time. Thus, a job exceeding its timeout can never modify the
+ * caller's buffer. Its late result is discarded and the ES is skipped until
+ * the job completed. The jobs execute in the dedicated ESDM_THREAD_ES_WORKERS
+ * thread group as the regular thread group is occupied by the RPC workers
+ * which never return. If no thread is available for the job, the caller
+ * fetches the ES itself.
+ */
+enum esdm_es_worker_state {
+	esdm_es_worker_idle,		/* No job is started for the ES */
+	esdm_es_worker_busy,		/* Job executes get_ent */
+	esdm_es_worker_done,		/* Result is ready for the caller */
+};
+
+struct esdm_es_worker {
+	enum esdm_es_worker_state state;
+	bool abandoned;			/* Caller timed out, discard result */
+	uint32_t requested_bits;
+	bool fully_seeded;
+	struct entropy_es eb;
+};
+
+/* The lock and condition variable are initialized once and never reset */
+static struct esdm_es_worker esdm_es_workers[esdm_ext_es_last];
+static pthread_mutex_t esdm_es_workers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t esdm_es_workers_done;
+static pthread_once_t esdm_es_workers_once = PTHREAD_ONCE_INIT;
+static bool esdm_es_workers_available = false;
+/* Process owning the worker state - jobs do not survive a fork */
+static pid_t esdm_es_workers_pid = 0;
+/* Was the fallback to the serial collection logged? */
+static bool esdm_es_workers_serial_logged = false;
+
+/* Log the fallback to the serial collection once - caller holds the lock */
+static void esdm_es_workers_serial(void)
+{
+	if (esdm_es_workers_serial_logged)
+		return;
+
+	esdm_es_workers_serial_logged = true;
+	logger(LOGGER_WARN, LOGGER_C_ES,
+	       "No ES worker thread available, entropy sources are fetched serially\n");
+}
+
+static int esdm_es_worker(void *arg)
+{
+	struct esdm_es_worker *w = arg;
+	uint32_t i = (uint32_t)(w - esdm_es_workers);
+
+	esdm_es[i]->get_ent(&w->eb, w->requested_bits, w->fully_seeded);
+
+	pthread_mutex_lock(&esdm_es_workers_lock);
+	if (w->abandoned) {
+		memset_secure(&w->eb, 0, sizeof(w->eb));
+		w->abandoned = false;
+		w->state = esdm_es_worker_idle;
+	} else {
+		w->state = esdm_es_worker_done;
+	}
+	pthread_cond_broadcast(&esdm_es_workers_done);
+	pthread_mutex_unlock(&esdm_es_workers_lock);
+
+	return 0;
+}
+
+static void esdm_es_workers_init(void)
+{
+	pthread_condattr_t attr;
+
+	BUILD_BUG_ON(esdm_ext_es_last > ESDM_THREAD_ES_WORKERS_SLOTS);
+
+	/* The threading support may already be initialized by the caller */
+	if (thread_init(1))
+		return;
+
+	/*
+	 * At most one job per ES executes at any time. The jobs are short, so
+	 * a job started while the thread of a completed job did not yet park
+	 * is queued for that thread.
+	 */
+	if (thread_group_set_limits(ESDM_THREAD_ES_WORKERS, 0,
+				    esdm_ext_es_last) ||
+	    thread_group_set_queueing(ESDM_THREAD_ES_WORKERS, true))
+		return;
+
+	if (pthread_condattr_init(&attr))
+		return;
+	if (!pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) &&
+	    !pthread_cond_init(&esdm_es_workers_done, &attr))
+		esdm_es_workers_available = true;
+	pthread_condattr_destroy(&attr);
+}
+
+static void esdm_es_workers_deadline(struct timespec *deadline,
+				     const struct timespec *start,
+				     uint32_t timeout_ms)
+{
+	deadline->tv_sec = start->tv_sec + (time_t)(timeout_ms / 1000);
+	deadline->tv_nsec = start->tv_nsec + (long)(timeout_ms % 1000) * 1000000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+static bool esdm_es_workers_expired(const struct timespec *now,
+				    const struct timespec *deadline)
+{
+	return (now->tv_sec > deadline->tv_sec ||
+		(now->tv_sec == deadline->tv_sec &&
+		 now->tv_nsec >= deadline->tv_nsec));
+}
+
+/*
+ * Reset the worker state after a fork - caller must hold the worker lock.
+ * The jobs of the parent process do not exist in the child.
+ */
+static void esdm_es_workers_reset(void)
+{
+	pid_t pid = getpid();
+
+	if (esdm_es_workers_pid == pid)
+		return;
+
+	memset_secure(esdm_es_workers, 0, sizeof(esdm_es_workers));
+	esdm_es_workers_pid = pid;
+}
+
+/* Wait for running jobs - ES blocking beyond their timeout are abandoned */
+static void esdm_es_workers_stop(void)
+{
+	struct timespec start, deadline;
+	uint32_t i, timeout_ms = 0;
+	bool busy;
+
+	if (!esdm_es_workers_available)
+		return;
+
+	for_each_esdm_es(i)
+		timeout_ms = max_uint32(timeout_ms,
+					esdm_es[i]->parallel_timeout_ms);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	esdm_es_workers_deadline(&deadline, &start, timeout_ms);
+
+	pthread_mutex_lock(&esdm_es_workers_lock);
+	esdm_es_workers_reset();
+
+	do {
+		busy = false;
+		for_each_esdm_es(i) {
+			busy |= (esdm_es_workers[i].state ==
+				 esdm_es_worker_busy);
+		}
+	} while (busy &&
+		 pthread_cond_timedwait(&esdm_es_workers_done,
+					&esdm_es_workers_lock, &deadline) !=
+		 ETIMEDOUT);
+
+	for_each_esdm_es(i) {
+		struct esdm_es_worker *w = &esdm_es_workers[i];
+
+		if (w->state == esdm_es_worker_busy) {
+			logger(LOGGER_WARN, LOGGER_C_ES,
+			       "ES worker for %s does not terminate\n",
+			       esdm_es[i]->name);
+			w->abandoned = true;
+		} else {
+			memset_secure(&w->eb, 0, sizeof(w->eb));
+			w->state = esdm_es_worker_idle;
+		}
+	}
+	pthread_mutex_unlock(&esdm_es_workers_lock);
+}
+
+/*
+ * Fetch the entropy sources - those served by an ES job are fetched
+ * concurrently while the remaining ones are fetched by the caller.
+ */
+static void esdm_es_get_ent_parallel(struct entropy_buf *eb,
+				     uint32_t requested_bits,
+				     bool fully_seeded)
+{
+	struct timespec start, now, next;
+	uint32_t i;
+	bool worker[esdm_ext_es_last] = { false },
+	     scheduled[esdm_ext_es_last] = { false },
+	     pending;
+
+	pthread_once(&esdm_es_workers_once, esdm_es_workers_init);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_mutex_lock(&esdm_es_workers_lock);
+	esdm_es_workers_reset();
+	for_each_esdm_es(i) {
+		struct esdm_es_worker *w = &esdm_es_workers[i];
+
+		if (!esdm_es[i]->parallel_timeout_ms || !esdm_es[i]->active())
+			continue;
+
+		if (!esdm_es_workers_available) {
+			esdm_es_workers_serial();
+			continue;
+		}
+
+		/* Job abandoned earlier is still running */
+		if (w->state != esdm_es_worker_idle) {
+			logger(LOGGER_DEBUG, LOGGER_C_ES,
+			       "ES %s still busy, skipping it\n",
+			       esdm_es[i]->name);
+			eb->entropy_es[i].e_bits = 0;
+			worker[i] = true;
+			continue;
+		}
+
+		w->requested_bits = requested_bits;
+		w->fully_seeded = fully_seeded;
+		w->state = esdm_es_worker_busy;
+		if (thread_start(esdm_es_worker, w, ESDM_THREAD_ES_WORKERS,
+				 NULL)) {
+			/* No thread available, the caller fetches the ES */
+			w->state = esdm_es_worker_idle;
+			esdm_es_workers_serial();
+			continue;
+		}
+
+		worker[i] = true;
+		scheduled[i] = true;
+	}
+	pthread_mutex_unlock(&esdm_es_workers_lock);
+
+	/* The caller fetches the remaining ES in the meantime */
+	for_each_esdm_es(i) {
+		if (!worker[i])
+			esdm_es[i]->get_ent(&eb->entropy_es[i], requested_bits,
+					    fully_seeded);
+	}
+
+	pthread_mutex_lock(&esdm_es_workers_lock);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		pending = false;
+
+		for_each_esdm_es(i) {
+			struct esdm_es_worker *w = &esdm_es_workers[i];
+			struct timespec deadline;
+
+			if (!scheduled[i])
+				continue;
+
+			if (w->state == esdm_es_worker_done) {
+				memcpy(&eb->entropy_es[i], &w->eb,
+				       sizeof(eb->entropy_es[i]));
+				memset_secure(&w->eb, 0, sizeof(w->eb));
+				w->state = esdm_es_worker_idle;
+				scheduled[i] = false;
+				continue;
+			}
+
+			esdm_es_workers_deadline(&deadline, &start,
+					esdm_es[i]->parallel_timeout_ms);
+			if (esdm_es_workers_expired(&now, &deadline)) {
+				logger(LOGGER_WARN, LOGGER_C_ES,
+				       "ES %s did not deliver data within %u ms\n",
+				       esdm_es[i]->name,
+				       esdm_es[i]->parallel_timeout_ms);
+				w->abandoned = true;
+				eb->entropy_es[i].e_bits = 0;
+				scheduled[i] = false;
+				continue;
+			}
+
+			/* Wait at most until the earliest pending deadline */
+			if (!pending || esdm_es_workers_expired(&next, &deadline))
+				next = deadline;
+			pending = true;
+		}
+
+		if (pending)
+			pthread_cond_timedwait(&esdm_es_workers_done,
+					       &esdm_es_workers_lock, &next);
+	} while (pending);
+	pthread_mutex_unlock(&esdm_es_workers_lock);
+}
+
 int esdm_es_mgr_reinitialize(void)
 {
 	unsigned int i;
@@ -532,6 +918,10 @@ void esdm_es_mgr_finalize(void)
 
 	atomic_set(&esdm_es_mgr_terminate, 1);
 	esdm_es_mgr_monitor_wakeup();
+	esdm_es_entropy_notify();
+
+	/* No ES worker must access an ES after its finalization */
+	esdm_es_workers_stop();
 
 	for_each_esdm_es(i) {
 		if (esdm_es[i]->fini)
@@ -563,6 +953,9 @@ bool esdm_es_reseed_wanted(void)
 /* Interface requesting a reseed of the DRNG */
 void esdm_es_add_entropy(void)
 {
+	/* Wake up all waiting for entropy */
+	esdm_es_entropy_notify();
+
 	if (!esdm_es_reseed_wanted())
 		return;
 
@@ -602,6 +995,12 @@ void esdm_fill_seed_buffer(struct entropy_buf *eb, uint32_t requested_bits,
 	}
 
 	/* Concatenate the output of the entropy sources. */
+	if (esdm_config_es_parallel()) {
+		esdm_es_get_ent_parallel(eb, requested_bits,
+					 state->esdm_fully_seeded);
+		goto wakeup;
+	}
+
 	for_each_esdm_es(i) {
 		esdm_es[i]->get_ent(&eb->entropy_es[i], requested_bits,
 				    state->esdm_fully_seeded);
@@ -44,6 +44,12 @@ void esdm_unset_fully_seeded(struct esdm_drng *drng);
 void esdm_fill_seed_buffer(struct entropy_buf *eb, uint32_t requested_bits,
 			   bool force);
 void esdm_init_ops(struct entropy_buf *eb);
+uint32_t esdm_avail_entropy_es(uint32_t es);
+
+/* Entropy arrival notification */
+void esdm_es_entropy_notify(void);
+int esdm_es_entropy_seq_get(void);
+int esdm_es_entropy_wait(int seq, const struct timespec *timeout);
 
 int esdm_es_mgr_reinitialize(void);
 int esdm_es_mgr_initialize(void);
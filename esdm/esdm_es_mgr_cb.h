@@ -88,6 +88,12 @@ struct entropy_buf {
  * @active: Is ES active.
  * @switch_hash: callback to switch from an old hash callback definition to
  *		 a new one. This callback may be NULL.
+ * @parallel_timeout_ms: If non-zero, get_ent may be invoked by an ES worker
+ *			 thread concurrently to the other entropy sources when
+ *			 the ES manager is configured accordingly. If get_ent
+ *			 does not complete within this time in milliseconds, the
+ *			 ES contributes no entropy to the current seed. Zero
+ *			 implies get_ent is always invoked by the caller.
  */
 struct esdm_es_cb {
 	const char *name;
@@ -104,8 +110,12 @@ struct esdm_es_cb {
 	int (*switch_hash)(struct esdm_drng *drng, int node,
 			   const struct esdm_hash_cb *new_cb,
 			   const struct esdm_hash_cb *old_cb);
+	uint32_t parallel_timeout_ms;
 };
 
+/* Default timeout for an ES fetched by an ES worker thread */
+#define ESDM_ES_PARALLEL_TIMEOUT_MS	1000
+
 /* Reseed is desired */
 bool esdm_es_reseed_wanted(void);
 
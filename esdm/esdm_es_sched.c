@@ -288,4 +288,5 @@ struct esdm_es_cb esdm_es_sched = {
 	.reset			= esdm_sched_reset,
 	.active			= esdm_sched_active,
 	.switch_hash		= NULL,
+	.parallel_timeout_ms	= ESDM_ES_PARALLEL_TIMEOUT_MS,
 };
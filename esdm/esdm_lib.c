@@ -81,6 +81,9 @@ void esdm_fini(void)
 	/* Clear up the SHM information */
 	esdm_shm_status_exit();
 
+	/* Stop the reseed worker before the ES are silenced. */
+	esdm_drng_reseed_worker_fini();
+
 	/* Finalize the entropy source manager and all its entropy sources. */
 	esdm_es_mgr_finalize();
 
@@ -96,3 +99,9 @@ int esdm_init_monitor(void)
 {
 	return esdm_es_mgr_monitor_initialize();
 }
+
+DSO_PUBLIC
+int esdm_init_reseed_worker(void)
+{
+	return esdm_drng_reseed_worker();
+}
@@ -21,46 +21,113 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
-#include <semaphore.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/shm.h>
+#include <time.h>
 
 #include "esdm.h"
 #include "esdm_config.h"
+#include "esdm_drng_mgr.h"
 #include "esdm_es_mgr.h"
 #include "esdm_interface_dev_common.h"
+#include "esdm_node.h"
 #include "esdm_rpc_server.h"
 #include "esdm_rpc_service.h"
 #include "helper.h"
+#include "linux_support.h"
 #include "logger.h"
+#include "math_helper.h"
 #include "ret_checkers.h"
 
 static struct esdm_shm_status *esdm_shm_status = NULL;
 static int esdm_shmid = -1;
-static sem_t *esdm_semid = SEM_FAILED;
+/* Serializes the writers of the binary snapshot */
+static pthread_mutex_t esdm_shm_status_snapshot_lock =
+						PTHREAD_MUTEX_INITIALIZER;
 
 static void esdm_shm_status_up(void)
 {
-	int semval = 0;
-
-	if (esdm_semid == SEM_FAILED)
-		return;
-
 	/*
-	 * The purpose of the semaphore is to notify clients. If one
-	 * notification is sent out, a client must answer. We do not increment
-	 * the semaphore again if the client did not "consume" the notification.
-	 * The reason is that "consuming" a notification implies that the
-	 * event is not present any more for others. Hence the semaphore shall
-	 * only toggle between 0 and 1.
+	 * Every waiter compares the change indicator with the value it saw
+	 * before. Thus, all waiters, e.g. multiple CUSE daemons, observe the
+	 * change and can be woken up at the same time.
 	 */
-	sem_getvalue(esdm_semid, &semval);
-	if (semval > 0)
+	__atomic_add_fetch(&esdm_shm_status->change_seq, 1, __ATOMIC_RELEASE);
+	linux_futex_wake_all(&esdm_shm_status->change_seq);
+}
+
+static void esdm_shm_status_snapshot_drng(struct esdm_shm_status_drng *out,
+					  struct esdm_drng *drng)
+{
+	int requests = ESDM_DRNG_RESEED_THRESH - atomic_read(&drng->requests);
+
+	out->reseed_gen = drng->reseed_gen;
+	out->requests = (requests > 0) ? (uint32_t)requests : 0;
+	out->requests_since_fully_seeded =
+		(uint32_t)atomic_read(&drng->requests_since_fully_seeded);
+	out->fully_seeded = drng->fully_seeded;
+	out->last_seeded = drng->last_seeded;
+}
+
+/*
+ * Update the binary snapshot. The data is read without locking the DRNGs
+ * and entropy sources - each value is consistent on its own.
+ */
+static void esdm_shm_status_snapshot_update(void)
+{
+	struct esdm_shm_status_snapshot *snapshot;
+	struct esdm_drng **esdm_drng;
+	uint32_t i, num;
+
+	if (!esdm_shm_status)
 		return;
 
-	if (sem_post(esdm_semid))
-		logger(LOGGER_ERR, LOGGER_C_ANY, "Cannot unlock semaphore\n");
+	snapshot = &esdm_shm_status->snapshot;
+
+	pthread_mutex_lock(&esdm_shm_status_snapshot_lock);
+
+	/* Odd sequence number: update in progress */
+	__atomic_store_n(&snapshot->seq, snapshot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	snapshot->updated = time(NULL);
+
+	num = min_uint32(esdm_ext_es_last, ESDM_SHM_STATUS_MAX_ES);
+	for (i = 0; i < num; i++) {
+		snapshot->es_entropy[i] = esdm_avail_entropy_es(i);
+		strncpy(snapshot->es_name[i], esdm_es[i]->name,
+			ESDM_SHM_STATUS_ES_NAME_SIZE - 1);
+	}
+	snapshot->num_es = num;
+
+	/* The node DRNGs include the initial DRNG if they are allocated */
+	esdm_drng = esdm_drng_get_instances();
+	if (esdm_drng) {
+		uint32_t node;
+
+		num = 0;
+		for_each_online_node(node) {
+			if (num >= ESDM_SHM_STATUS_MAX_DRNGS)
+				break;
+			if (!esdm_drng[node])
+				continue;
+			esdm_shm_status_snapshot_drng(&snapshot->drng[num++],
+						      esdm_drng[node]);
+		}
+	} else {
+		esdm_shm_status_snapshot_drng(&snapshot->drng[0],
+					      esdm_drng_init_instance());
+		num = 1;
+	}
+	esdm_drng_put_instances();
+	snapshot->num_drngs = num;
+
+	/* Even sequence number: snapshot is consistent */
+	__atomic_store_n(&snapshot->seq, snapshot->seq + 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&esdm_shm_status_snapshot_lock);
 }
 
 void esdm_shm_status_set_operational(bool enabled)
@@ -71,6 +138,7 @@ void esdm_shm_status_set_operational(bool enabled)
 	if (atomic_bool_read(&esdm_shm_status->operational) != enabled) {
 		atomic_bool_set(&esdm_shm_status->operational, enabled);
 		esdm_shm_status_up();
+		esdm_shm_status_snapshot_update();
 	}
 }
 
@@ -89,56 +157,22 @@ void esdm_shm_status_set_need_entropy(void)
 		atomic_bool_set(&esdm_shm_status->need_entropy, new);
 		esdm_shm_status_up();
 	}
+
+	/* Entropy was consumed or added */
+	esdm_shm_status_snapshot_update();
 }
 
-static void esdm_shm_status_delete_sem(void)
+void esdm_shm_status_reseeded(void)
 {
-	if (esdm_semid != SEM_FAILED) {
-		sem_t *tmp = esdm_semid;
-
-		esdm_semid = SEM_FAILED;
-		sem_close(tmp);
-	}
+	if (!esdm_shm_status)
+		return;
 
 	/*
-	 * TODO: we do not clean up the SEM as there could be a CUSE client that
-	 * looks at it. IF the server starts again, we want to attach to the
-	 * existing shared memory segment to ensure the client does not need
-	 * to be restarted too.
+	 * Clients only compare the epoch against their last seen value, no
+	 * notification via the change indicator is needed.
 	 */
-#if 0
-	if (sem_unlink(ESDM_SEM_NAME)) {
-		if (errno != ENOENT) {
-			logger(LOGGER_VERBOSE, LOGGER_C_ANY,
-			       "Cannot unlink semaphore: %s\n",
-			       strerror(errno));
-		}
-	}
-#endif
-}
-
-static int esdm_shm_status_create_sem(void)
-{
-	int errsv;
-
-	esdm_semid = sem_open(ESDM_SEM_NAME, O_CREAT, 0644, 0);
-	if (esdm_semid == SEM_FAILED) {
-		if (errno == EEXIST) {
-			esdm_semid = sem_open(ESDM_SEM_NAME, 0, 0644, 0);
-			if (esdm_semid == SEM_FAILED) {
-				errsv = errno;
-				logger(LOGGER_ERR, LOGGER_C_ANY,
-				       "ESDM change indicator semaphore creation failed: %s\n",
-				       strerror(errsv));
-				return -errsv;
-			}
-		}
-	}
-
-	logger(LOGGER_DEBUG, LOGGER_C_ANY,
-	       "ESDM change indicator semaphore initialized\n");
-
-	return 0;
+	atomic_inc(&esdm_shm_status->reseed_epoch);
+	esdm_shm_status_snapshot_update();
 }
 
 static void esdm_shm_status_delete_shm(void)
@@ -231,33 +265,37 @@ int esdm_shm_status_init(void)
 	if (ret)
 		return ret;
 
-	ret = esdm_shm_status_create_sem();
-	if (ret) {
-		esdm_shm_status_delete_shm();
-		return ret;
-	}
-
 	esdm_status(esdm_shm_status->info, sizeof(esdm_shm_status->info));
 	esdm_shm_status->infolen = strlen(esdm_shm_status->info);
 	esdm_shm_status->unpriv_threads = esdm_config_online_nodes();
 
+	/* A previous server instance may have terminated during an update */
+	esdm_shm_status->snapshot.seq &= ~1U;
+
 	esdm_shm_status_set_operational(esdm_state_operational());
 	esdm_shm_status_set_need_entropy();
 
+	/* Let waiting clients pick up the (re-)initialized segment */
+	esdm_shm_status_up();
+
 	return 0;
 }
 
 void esdm_shm_status_exit(void)
 {
+	/*
+	 * The segment outlives the server - tell the clients that the server
+	 * is gone.
+	 */
+	esdm_shm_status_set_operational(false);
 	esdm_shm_status_delete_shm();
-	esdm_shm_status_delete_sem();
 }
 
 int esdm_shm_status_reinit(void)
 {
 	int ret;
 
-	esdm_shm_status_exit();
+	esdm_shm_status_delete_shm();
 	CKINT(esdm_shm_status_init());
 
 out:
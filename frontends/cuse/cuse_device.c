@@ -21,9 +21,10 @@
 #include <errno.h>
 #include <linux/random.h>
 #include <poll.h>
-#include <semaphore.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/shm.h>
 #include <time.h>
@@ -126,69 +127,47 @@ static int esdm_cuse_shm_status_create_shm(void)
 }
 
 /******************************************************************************
- * Semaphore for shared memory segment
+ * Change indicator of shared memory segment
  ******************************************************************************/
 
-static sem_t *esdm_cuse_semid = SEM_FAILED;
+static bool esdm_cuse_poll_thread_shutdown = false;
+static uint32_t esdm_cuse_change_seq = 0;
 
 static void esdm_cuse_shm_status_down(void)
 {
+	/* Wake up regularly to notice the termination of the daemon */
 	struct timespec ts = { .tv_sec = 1, .tv_nsec = 0 };
+	uint32_t *change_seq;
 
-	if (esdm_cuse_semid == SEM_FAILED) {
-		logger(LOGGER_ERR, LOGGER_C_CUSE, "Cannot use semaphore\n");
+	if (!esdm_cuse_shm_status) {
+		logger(LOGGER_ERR, LOGGER_C_CUSE,
+		       "Cannot use shared memory segment\n");
 		return;
 	}
 
-	/* Wait and block until the SHM-Segment becomes available */
-	while (!esdm_cuse_shm_status_avail())
-		nanosleep(&ts, NULL);
-
-	if (sem_wait(esdm_cuse_semid))
-		logger(LOGGER_ERR, LOGGER_C_CUSE, "Cannot use semaphore\n");
-}
-
+	change_seq = &esdm_cuse_shm_status->change_seq;
 
-static void esdm_cuse_shm_status_close_sem(void)
-{
-	if (esdm_cuse_semid != SEM_FAILED) {
-		sem_t *tmp = esdm_cuse_semid;
-
-		esdm_cuse_semid = SEM_FAILED;
-		sem_close(tmp);
-	}
-}
-
-static int esdm_cuse_shm_status_create_sem(void)
-{
-	int errsv;
+	/*
+	 * Wait until the server changed the status after our last check. This
+	 * includes the server initializing the SHM segment.
+	 */
+	while (!esdm_cuse_poll_thread_shutdown) {
+		uint32_t curr = __atomic_load_n(change_seq, __ATOMIC_ACQUIRE);
 
-	esdm_cuse_semid = sem_open(ESDM_SEM_NAME, O_CREAT, 0644, 0);
-	if (esdm_cuse_semid == SEM_FAILED) {
-		if (errno == EEXIST) {
-			esdm_cuse_semid = sem_open(ESDM_SEM_NAME, 0, 0644, 0);
-			if (esdm_cuse_semid == SEM_FAILED) {
-				errsv = errno;
-				logger(LOGGER_ERR, LOGGER_C_ANY,
-				       "ESDM change indicator semaphore creation failed: %s\n",
-				       strerror(errsv));
-				return -errsv;
-			}
+		if (curr != esdm_cuse_change_seq &&
+		    esdm_cuse_shm_status_avail()) {
+			esdm_cuse_change_seq = curr;
+			return;
 		}
-	}
-
-	logger(LOGGER_DEBUG, LOGGER_C_CUSE,
-	       "ESDM change indicator semaphore initialized\n");
 
-	return 0;
+		linux_futex_wait(change_seq, curr, &ts);
+	}
 }
 
 /******************************************************************************
  * Signal handler
  ******************************************************************************/
 
-static bool esdm_cuse_poll_thread_shutdown = false;
-
 static void esdm_cuse_term(void)
 {
 	esdm_cuse_poll_thread_shutdown = true;
@@ -197,7 +176,7 @@ static void esdm_cuse_term(void)
 
 	/*
 	 * We forcefully kill the SHM monitor thread as most likely it is
-	 * waiting in sem_wait.
+	 * waiting for a change of the status.
 	 */
 	thread_release(true, true);
 
@@ -205,7 +184,6 @@ static void esdm_cuse_term(void)
 	esdm_rpcc_fini_unpriv_service();
 
 	esdm_cuse_shm_status_close_shm();
-	esdm_cuse_shm_status_close_sem();
 
 	/* Return code is irrelevant here */
 	esdm_cuse_bind_unmount(&mount_src, &mount_dst);
@@ -405,12 +383,79 @@ static bool esdm_cuse_interrupt(void *data)
 	return !!fuse_req_interrupted(req);
 }
 
+/*
+ * Maximum size of one read request. It is the max_read value libfuse
+ * announces in its CUSE_INIT reply which cannot be changed by the daemon.
+ * The kernel splits larger reads of the device file into requests of at most
+ * this size.
+ */
+#define ESDM_CUSE_MAX_READ		(128UL << 10)
+
+/*
+ * Per-thread buffer gathering the data of one read request. It is wiped
+ * after each request and released when the FUSE worker thread terminates.
+ */
+struct esdm_cuse_readbuf {
+	size_t len;
+	uint8_t buf[];
+};
+
+static __thread struct esdm_cuse_readbuf *esdm_cuse_readbuf = NULL;
+static pthread_key_t esdm_cuse_readbuf_key;
+static pthread_once_t esdm_cuse_readbuf_once = PTHREAD_ONCE_INIT;
+
+static void esdm_cuse_readbuf_free(void *data)
+{
+	struct esdm_cuse_readbuf *readbuf = data;
+
+	if (!readbuf)
+		return;
+
+	munlock(readbuf, sizeof(*readbuf) + readbuf->len);
+	free(readbuf);
+}
+
+static void esdm_cuse_readbuf_init(void)
+{
+	if (pthread_key_create(&esdm_cuse_readbuf_key, esdm_cuse_readbuf_free))
+		logger(LOGGER_ERR, LOGGER_C_CUSE,
+		       "Cannot create read buffer key\n");
+}
+
+static uint8_t *esdm_cuse_readbuf_get(size_t size)
+{
+	struct esdm_cuse_readbuf *readbuf = esdm_cuse_readbuf;
+
+	if (readbuf && readbuf->len >= size)
+		return readbuf->buf;
+
+	pthread_once(&esdm_cuse_readbuf_once, esdm_cuse_readbuf_init);
+
+	/* The old buffer was wiped after its last use */
+	esdm_cuse_readbuf_free(readbuf);
+	esdm_cuse_readbuf = NULL;
+	pthread_setspecific(esdm_cuse_readbuf_key, NULL);
+
+	readbuf = malloc(sizeof(*readbuf) + size);
+	if (!readbuf)
+		return NULL;
+	readbuf->len = size;
+
+	/* Prevent paging out of the random data to swap space */
+	mlock(readbuf, sizeof(*readbuf) + size);
+
+	esdm_cuse_readbuf = readbuf;
+	pthread_setspecific(esdm_cuse_readbuf_key, readbuf);
+
+	return readbuf->buf;
+}
+
 void esdm_cuse_read_internal(fuse_req_t req, size_t size, off_t off,
 			     struct fuse_file_info *fi,
 			     get_func_t get, int fallback_fd)
 {
-	uint8_t tmpbuf[ESDM_RPC_MAX_DATA];
-	size_t cleansize = min_size(sizeof(tmpbuf), size);
+	uint8_t *buf;
+	size_t done = 0;
 	ssize_t ret = 0;
 
 	(void)off;
@@ -420,66 +465,54 @@ void esdm_cuse_read_internal(fuse_req_t req, size_t size, off_t off,
 	if (fi->flags & O_SYNC)
 		get = esdm_rpcc_get_random_bytes_pr_int;
 
-	if (size > sizeof(tmpbuf)) {
-		logger(LOGGER_ERR, LOGGER_C_CUSE,
-		       "Due to FUSE limitation, the maximum request size is %zu\n",
-		       sizeof(tmpbuf));
-		size = sizeof(tmpbuf);
+	/* Returning a short read is permissible in VFS */
+	size = min_size(size, ESDM_CUSE_MAX_READ);
+
+	buf = esdm_cuse_readbuf_get(size);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out;
 	}
 
-//	while (size)
-	{
-		size_t todo = min_size(sizeof(tmpbuf), size);
+	/*
+	 * The FUSE request can only be answered once. Thus, gather the
+	 * entire requested data with multiple RPC calls first.
+	 */
+	while (done < size) {
+		size_t todo = min_size(ESDM_RPC_MAX_DATA, size - done);
 
 		esdm_cuse_unpriv_call_start();
-		esdm_invoke(get(tmpbuf, todo, req));
+		esdm_invoke(get(buf + done, todo, req));
 		esdm_cuse_unpriv_call_end();
 
 		/*
 		 * If call to the ESDM server failed, let us fall back to the
-		 * fallback file descriptor. Yet, we do not cover for short
-		 * reads as this entire CUSE handling is prone to short reads
-		 * as outlined below. Thus, the caller needs to handle this
-		 * appropriately.
+		 * fallback file descriptor.
 		 */
 		if (ret < 0 && fallback_fd > -1) {
 			logger(LOGGER_VERBOSE, LOGGER_C_CUSE,
 			       "Use fallback to provide data due to RPC error code %zd\n",
 			       ret);
-			ret = read(fallback_fd, tmpbuf, todo);
+			ret = read(fallback_fd, buf + done, todo);
 		}
 
-		if (ret < 0)
-			goto out;
-		todo = (size_t)ret;
+		if (ret <= 0)
+			break;
 
-		/*
-		 * This call segfaults when called a 2nd time because req is
-		 * freed. Thus, the while loop is currently disabled.
-		 *
-		 * Thus, we will return a short read here that the caller must
-		 * consider. Returning a short read is permissible in VFS and
-		 * thus it is no error to apply a short read here.
-		 *
-		 * The caller may accommodate that with a while loop around
-		 * its read system call. Another example when using dd is
-		 * the following command that must be used:
-		 *
-		 * dd if=/dev/esdm of=out count=1 bs=65550 iflag=fullblock
-		 */
-		ret = fuse_reply_buf(req, (const char *)tmpbuf, todo);
+		done += (size_t)ret;
+	}
 
+	/* Report a short read if some data was already gathered */
+	if (done)
+		ret = fuse_reply_buf(req, (const char *)buf, done);
 
-// 		if (ret < 0)
-// 			goto out;
-//
-// 		size -= todo;
-	}
+	memset_secure(buf, 0, done);
 
 out:
-	memset_secure(tmpbuf, 0, cleansize);
-	if (ret < 0)
+	if (ret < 0 && !done)
 		fuse_reply_err(req, (int)-ret);
+	else if (!done)
+		fuse_reply_buf(req, NULL, 0);
 }
 
 void esdm_cuse_write_internal(fuse_req_t req, const char *buf, size_t size,
@@ -885,7 +918,6 @@ void esdm_cuse_init_done(void *userdata)
 
 	CKINT(esdm_cuse_bind_mount(mount_src, mount_dst));
 
-	CKINT(esdm_cuse_shm_status_create_sem());
 	CKINT(esdm_cuse_shm_status_create_shm());
 
 	esdm_cuse_drop_privileges();
@@ -18,15 +18,32 @@
  */
 
 #define _GNU_SOURCE
+#include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <linux/random.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/random.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "constructor.h"
 #include "esdm_rpc_client.h"
+#include "esdm_rpc_service.h"
+#include "lc_chacha20_drng.h"
+#include "lc_chacha20_private.h"
+#include "logger.h"
+#include "memset_secure.h"
+#include "ret_checkers.h"
 #include "visibility.h"
 
 /**
@@ -47,6 +64,279 @@
  */
 #define GRND_FULLY_SEEDED	0x0020
 
+/******************************************************************************
+ * Client-side DRNG
+ ******************************************************************************/
+
+/*
+ * When the environment variable ESDM_GETRANDOM_DRNG is set, requests of up to
+ * ESDM_GETRANDOM_DRNG_MAX_REQ bytes for GRND_INSECURE or fully seeded random
+ * numbers are served from a thread-local ChaCha20 DRNG without contacting
+ * the ESDM server. The ChaCha20 DRNG erases its key after each generate
+ * operation. It is seeded with fully seeded random numbers from the ESDM
+ * server and reseeded when
+ *
+ *	* ESDM_GETRANDOM_DRNG_MAX_BYTES were generated since the last seeding,
+ *	* the last seeding is older than ESDM_GETRANDOM_DRNG_MAX_TIME seconds,
+ *	* the ESDM server announces a reseed of its DRNGs with the reseed epoch
+ *	  in the status shared memory segment, or
+ *	* the process forked.
+ *
+ * If the ESDM server cannot deliver the seed, the request is processed as if
+ * the client-side DRNG was not enabled. Requests with GRND_INSECURE or
+ * GRND_NONBLOCK must not block on the seeding. They only (re)seed the DRNG if
+ * the status shared memory segment reports an operational ESDM server, i.e.
+ * fully seeded random numbers are available without waiting. Otherwise they
+ * are processed as if the client-side DRNG was not enabled.
+ */
+#define ESDM_GETRANDOM_DRNG_ENV		"ESDM_GETRANDOM_DRNG"
+#define ESDM_GETRANDOM_DRNG_MAX_REQ	256
+#define ESDM_GETRANDOM_DRNG_MAX_BYTES	(1UL << 20)
+#define ESDM_GETRANDOM_DRNG_MAX_TIME	60
+#define ESDM_GETRANDOM_DRNG_SEED_LEN	(2 * LC_CC20_KEY_SIZE)
+
+/*
+ * The state is located in its own memory mapping marked with
+ * MADV_WIPEONFORK. A child process therefore sees a zeroized state which is
+ * equal to an unseeded DRNG. The ChaCha20 DRNG context follows the structure.
+ */
+struct esdm_getrandom_drng {
+	struct lc_chacha20_drng_ctx *cc20;	/* NULL if unseeded */
+	size_t generated;			/* Bytes since last seeding */
+	time_t last_seeded;			/* Time of last seeding */
+	int epoch;				/* Server reseed epoch */
+	unsigned int fork_gen;			/* Fork generation */
+};
+
+static __thread struct esdm_getrandom_drng *esdm_getrandom_drng = NULL;
+static pthread_key_t esdm_getrandom_drng_key;
+static pthread_once_t esdm_getrandom_drng_once = PTHREAD_ONCE_INIT;
+static bool esdm_getrandom_drng_enabled = false;
+
+/*
+ * Size of the memory mapping of the DRNG state. It is kept outside of the
+ * mapping as MADV_WIPEONFORK zeroizes the mapping in a child process.
+ */
+static size_t esdm_getrandom_drng_maplen = 0;
+
+/* Fallback fork detection if MADV_WIPEONFORK is not supported */
+static unsigned int esdm_getrandom_fork_gen = 0;
+
+static struct esdm_shm_status *esdm_getrandom_shm_status = NULL;
+static pthread_once_t esdm_getrandom_shm_status_once = PTHREAD_ONCE_INIT;
+
+static void esdm_getrandom_drng_free(void *data)
+{
+	struct esdm_getrandom_drng *drng = data;
+
+	if (!drng)
+		return;
+
+	memset_secure(drng, 0, esdm_getrandom_drng_maplen);
+	munmap(drng, esdm_getrandom_drng_maplen);
+}
+
+static void esdm_getrandom_atfork_child(void)
+{
+	esdm_getrandom_fork_gen++;
+}
+
+static void esdm_getrandom_shm_status_attach(void)
+{
+	key_t key = esdm_ftok(ESDM_SHM_NAME, ESDM_SHM_STATUS);
+	void *tmp;
+	int shmid;
+
+	/* The server creates the segment, it is optional for the client */
+	shmid = shmget(key, sizeof(struct esdm_shm_status), 0);
+	if (shmid < 0)
+		return;
+
+	tmp = shmat(shmid, NULL, SHM_RDONLY);
+	if (tmp == (void *)-1)
+		return;
+
+	esdm_getrandom_shm_status = tmp;
+	if (esdm_getrandom_shm_status->version != ESDM_SHM_STATUS_VERSION) {
+		shmdt(tmp);
+		esdm_getrandom_shm_status = NULL;
+	}
+}
+
+/* Does the ESDM server deliver fully seeded data without waiting? */
+static bool esdm_getrandom_operational(void)
+{
+	pthread_once(&esdm_getrandom_shm_status_once,
+		     esdm_getrandom_shm_status_attach);
+
+	if (!esdm_getrandom_shm_status)
+		return false;
+	return atomic_bool_read(&esdm_getrandom_shm_status->operational);
+}
+
+static void esdm_getrandom_drng_init(void)
+{
+	size_t maplen = sizeof(struct esdm_getrandom_drng) +
+			LC_CC20_DRNG_CTX_SIZE;
+	long pagesize = sysconf(_SC_PAGESIZE);
+
+#ifdef HAVE_SECURE_GETENV
+	if (!secure_getenv(ESDM_GETRANDOM_DRNG_ENV))
+#else
+	if (!getenv(ESDM_GETRANDOM_DRNG_ENV))
+#endif
+		return;
+
+	if (pthread_key_create(&esdm_getrandom_drng_key,
+			       esdm_getrandom_drng_free))
+		return;
+	if (pthread_atfork(NULL, NULL, esdm_getrandom_atfork_child)) {
+		pthread_key_delete(esdm_getrandom_drng_key);
+		return;
+	}
+
+	if (pagesize > 0) {
+		maplen = (maplen + (size_t)pagesize - 1) &
+			 ~((size_t)pagesize - 1);
+	}
+	esdm_getrandom_drng_maplen = maplen;
+
+	pthread_once(&esdm_getrandom_shm_status_once,
+		     esdm_getrandom_shm_status_attach);
+	esdm_getrandom_drng_enabled = true;
+}
+
+static int esdm_getrandom_drng_epoch(void)
+{
+	if (!esdm_getrandom_shm_status)
+		return 0;
+	return atomic_read(&esdm_getrandom_shm_status->reseed_epoch);
+}
+
+static struct esdm_getrandom_drng *esdm_getrandom_drng_alloc(void)
+{
+	struct esdm_getrandom_drng *drng;
+	size_t maplen = esdm_getrandom_drng_maplen;
+
+	drng = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (drng == MAP_FAILED)
+		return NULL;
+
+#ifdef MADV_WIPEONFORK
+	/* Failure is covered by the fork generation */
+	madvise(drng, maplen, MADV_WIPEONFORK);
+#endif
+	/* Prevent paging out of the DRNG state to swap space */
+	if (mlock(drng, maplen)) {
+		logger(LOGGER_WARN, LOGGER_C_ANY,
+		       "Locking client-side DRNG state into memory failed: %d\n",
+		       errno);
+	}
+
+	if (pthread_setspecific(esdm_getrandom_drng_key, drng)) {
+		munmap(drng, maplen);
+		return NULL;
+	}
+
+	return drng;
+}
+
+static int esdm_getrandom_drng_seed(struct esdm_getrandom_drng *drng)
+{
+	uint8_t seed[ESDM_GETRANDOM_DRNG_SEED_LEN];
+	/* Obtain the epoch first to not miss a reseed during the RPC */
+	int epoch = esdm_getrandom_drng_epoch();
+	ssize_t ret;
+
+	esdm_invoke(esdm_rpcc_get_random_bytes_full(seed, sizeof(seed)));
+	if (ret < 0)
+		goto out;
+	if ((size_t)ret != sizeof(seed)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	/*
+	 * A wiped state after fork or a new state is set up from scratch,
+	 * otherwise the seed is mixed into the existing state.
+	 */
+	if (!drng->cc20 || drng->fork_gen != esdm_getrandom_fork_gen) {
+		drng->cc20 = (struct lc_chacha20_drng_ctx *)(drng + 1);
+		LC_CC20_DRNG_SET_CTX(drng->cc20);
+		lc_cc20_drng_zero(drng->cc20);
+		drng->fork_gen = esdm_getrandom_fork_gen;
+	}
+
+	lc_cc20_drng_seed(drng->cc20, seed, sizeof(seed));
+	drng->generated = 0;
+	drng->last_seeded = time(NULL);
+	drng->epoch = epoch;
+	ret = 0;
+
+out:
+	memset_secure(seed, 0, sizeof(seed));
+	return (int)ret;
+}
+
+static bool esdm_getrandom_drng_must_seed(struct esdm_getrandom_drng *drng)
+{
+	return (!drng->cc20 ||
+		drng->fork_gen != esdm_getrandom_fork_gen ||
+		drng->generated >= ESDM_GETRANDOM_DRNG_MAX_BYTES ||
+		time(NULL) - drng->last_seeded > ESDM_GETRANDOM_DRNG_MAX_TIME ||
+		drng->epoch != esdm_getrandom_drng_epoch());
+}
+
+/*
+ * Generate random numbers with the thread-local DRNG.
+ *
+ * Returns the number of generated bytes, or < 0 if the request is to be
+ * served by the ESDM server.
+ */
+static ssize_t esdm_getrandom_drng_generate(uint8_t *buffer, size_t length,
+					    unsigned int flags)
+{
+	struct esdm_getrandom_drng *drng;
+	int ret;
+
+	if (length > ESDM_GETRANDOM_DRNG_MAX_REQ)
+		return -EOPNOTSUPP;
+
+	pthread_once(&esdm_getrandom_drng_once, esdm_getrandom_drng_init);
+	if (!esdm_getrandom_drng_enabled)
+		return -EOPNOTSUPP;
+
+	drng = esdm_getrandom_drng;
+	if (!drng) {
+		drng = esdm_getrandom_drng_alloc();
+		if (!drng)
+			return -ENOMEM;
+		esdm_getrandom_drng = drng;
+	}
+
+	if (esdm_getrandom_drng_must_seed(drng)) {
+		if ((flags & (GRND_INSECURE | GRND_NONBLOCK)) &&
+		    !esdm_getrandom_operational())
+			return -EAGAIN;
+		CKINT(esdm_getrandom_drng_seed(drng));
+	}
+
+	lc_cc20_drng_generate(drng->cc20, buffer, length);
+	drng->generated += length;
+
+	return (ssize_t)length;
+
+out:
+	return ret;
+}
+
+/******************************************************************************
+ * Library interface
+ ******************************************************************************/
+
+static pthread_once_t esdm_getrandom_lib_once = PTHREAD_ONCE_INIT;
+
 static void esdm_getrandom_lib_init(void)
 {
 	esdm_rpcc_set_max_online_nodes(1);
@@ -57,6 +347,10 @@ static void esdm_getrandom_lib_init(void)
 ESDM_DEFINE_DESTRUCTOR(esdm_getrandom_lib_exit);
 static void esdm_getrandom_lib_exit(void)
 {
+	if (esdm_getrandom_shm_status) {
+		shmdt(esdm_getrandom_shm_status);
+		esdm_getrandom_shm_status = NULL;
+	}
 	esdm_rpcc_fini_unpriv_service();
 }
 
@@ -67,7 +361,6 @@ DSO_PUBLIC
 ssize_t __wrap_getrandom(void *buffer, size_t length, unsigned int flags)
 {
 	ssize_t ret;
-	static bool initialized = false;
 
 	if (flags & (unsigned int)(~(GRND_NONBLOCK|GRND_RANDOM|GRND_INSECURE|
 				     GRND_SEED|GRND_FULLY_SEEDED)))
@@ -90,9 +383,12 @@ ssize_t __wrap_getrandom(void *buffer, size_t length, unsigned int flags)
 	if (length > INT_MAX)
 		length = INT_MAX;
 
-	if (!initialized) {
-		esdm_getrandom_lib_init();
-		initialized = true;
+	pthread_once(&esdm_getrandom_lib_once, esdm_getrandom_lib_init);
+
+	if (!(flags & (GRND_RANDOM|GRND_SEED))) {
+		ret = esdm_getrandom_drng_generate(buffer, length, flags);
+		if (ret >= 0)
+			return ret;
 	}
 
 	if (flags & GRND_INSECURE) {
@@ -131,15 +427,15 @@ DSO_PUBLIC
 int __wrap_getentropy(void *buffer, size_t length)
 {
 	ssize_t ret = -EFAULT;
-	static bool initialized = false;
 
 	if (length > 256)
 		return -EIO;
 
-	if (!initialized) {
-		esdm_getrandom_lib_init();
-		initialized = true;
-	}
+	pthread_once(&esdm_getrandom_lib_once, esdm_getrandom_lib_init);
+
+	ret = esdm_getrandom_drng_generate(buffer, length, 0);
+	if (ret >= 0)
+		return 0;
 
 	esdm_invoke(esdm_rpcc_get_random_bytes_full(buffer, length));
 	if (ret < 0)
@@ -152,3 +448,468 @@ int getentropy(void *buffer, size_t length)
 {
 	return __wrap_getentropy(buffer, length);
 }
+
+/******************************************************************************
+ * Random device interposition
+ ******************************************************************************/
+
+/*
+ * When the environment variable ESDM_GETRANDOM_DEV is set and the library is
+ * preloaded, reading from /dev/random and /dev/urandom is served by the ESDM
+ * server directly instead of taking the detour via the kernel and the ESDM
+ * CUSE daemons. Like the CUSE daemons, /dev/random provides fully seeded
+ * random numbers while /dev/urandom does not wait until the ESDM is fully
+ * seeded. For this, the libc functions to open, read and close files are
+ * interposed. All other files as well as requests the ESDM server cannot
+ * serve are processed by libc.
+ *
+ * Only the absolute path names of the device files are recognized. The file
+ * descriptors are tracked together with the device number of the opened file
+ * which is verified before each read. This prevents serving random numbers for
+ * a file descriptor that was closed without the interposed close(3), e.g. by
+ * fclose(3), and reused for another file. Streams opened with fopen(3) for
+ * the device files are unbuffered and have no file descriptor, i.e. fileno(3)
+ * returns -1 for them.
+ *
+ * A read from /dev/random opened with O_NONBLOCK does not wait for the ESDM
+ * to become fully seeded: it is processed by libc unless the ESDM server is
+ * operational. The flags are recorded when opening the file, later changes
+ * with fcntl(2) are not considered.
+ *
+ * Programs invoking the system calls directly, such as Go programs, are not
+ * covered.
+ */
+#define ESDM_GETRANDOM_DEV_ENV		"ESDM_GETRANDOM_DEV"
+#define ESDM_GETRANDOM_DEV_MAX_FD	1024
+
+enum esdm_getrandom_dev_type {
+	esdm_getrandom_dev_none,
+	esdm_getrandom_dev_urandom,
+	esdm_getrandom_dev_random,
+};
+
+struct esdm_getrandom_dev_fd {
+	dev_t rdev;		/* Device number of the opened file */
+	int flags;		/* Flags of the open call */
+	unsigned int type;	/* enum esdm_getrandom_dev_type */
+};
+
+struct esdm_getrandom_dev_stream {
+	FILE *fp;		/* Stream of the opened device file */
+	unsigned int type;	/* enum esdm_getrandom_dev_type */
+};
+
+static struct esdm_getrandom_dev_fd
+esdm_getrandom_dev_fds[ESDM_GETRANDOM_DEV_MAX_FD];
+static pthread_once_t esdm_getrandom_dev_once = PTHREAD_ONCE_INIT;
+static bool esdm_getrandom_dev_enabled = false;
+
+/* Interposed libc functions */
+static struct {
+	int (*open)(const char *pathname, int flags, ...);
+	int (*open64)(const char *pathname, int flags, ...);
+	int (*open_2)(const char *pathname, int flags);
+	int (*open64_2)(const char *pathname, int flags);
+	int (*openat)(int dirfd, const char *pathname, int flags, ...);
+	int (*openat64)(int dirfd, const char *pathname, int flags, ...);
+	int (*openat_2)(int dirfd, const char *pathname, int flags);
+	int (*openat64_2)(int dirfd, const char *pathname, int flags);
+	FILE *(*fopen)(const char *pathname, const char *mode);
+	FILE *(*fopen64)(const char *pathname, const char *mode);
+	ssize_t (*read)(int fd, void *buf, size_t count);
+	ssize_t (*read_chk)(int fd, void *buf, size_t count, size_t buflen);
+	int (*close)(int fd);
+} esdm_getrandom_libc;
+
+#define ESDM_GETRANDOM_DEV_SYM(_func, _name)				       \
+	*(void **)(&esdm_getrandom_libc._func) = dlsym(RTLD_NEXT, _name)
+
+static void esdm_getrandom_dev_init(void)
+{
+	ESDM_GETRANDOM_DEV_SYM(open, "open");
+	ESDM_GETRANDOM_DEV_SYM(open64, "open64");
+	ESDM_GETRANDOM_DEV_SYM(open_2, "__open_2");
+	ESDM_GETRANDOM_DEV_SYM(open64_2, "__open64_2");
+	ESDM_GETRANDOM_DEV_SYM(openat, "openat");
+	ESDM_GETRANDOM_DEV_SYM(openat64, "openat64");
+	ESDM_GETRANDOM_DEV_SYM(openat_2, "__openat_2");
+	ESDM_GETRANDOM_DEV_SYM(openat64_2, "__openat64_2");
+	ESDM_GETRANDOM_DEV_SYM(fopen, "fopen");
+	ESDM_GETRANDOM_DEV_SYM(fopen64, "fopen64");
+	ESDM_GETRANDOM_DEV_SYM(read, "read");
+	ESDM_GETRANDOM_DEV_SYM(read_chk, "__read_chk");
+	ESDM_GETRANDOM_DEV_SYM(close, "close");
+
+	/* The large file support variants are not offered by every libc */
+	if (!esdm_getrandom_libc.open64)
+		esdm_getrandom_libc.open64 = esdm_getrandom_libc.open;
+	if (!esdm_getrandom_libc.openat64)
+		esdm_getrandom_libc.openat64 = esdm_getrandom_libc.openat;
+	if (!esdm_getrandom_libc.fopen64)
+		esdm_getrandom_libc.fopen64 = esdm_getrandom_libc.fopen;
+
+#ifdef HAVE_SECURE_GETENV
+	if (secure_getenv(ESDM_GETRANDOM_DEV_ENV))
+#else
+	if (getenv(ESDM_GETRANDOM_DEV_ENV))
+#endif
+		esdm_getrandom_dev_enabled = true;
+}
+
+static unsigned int esdm_getrandom_dev_path_type(const char *pathname)
+{
+	if (!esdm_getrandom_dev_enabled || !pathname)
+		return esdm_getrandom_dev_none;
+	if (!strcmp(pathname, "/dev/urandom"))
+		return esdm_getrandom_dev_urandom;
+	if (!strcmp(pathname, "/dev/random"))
+		return esdm_getrandom_dev_random;
+	return esdm_getrandom_dev_none;
+}
+
+static void esdm_getrandom_dev_untrack(struct esdm_getrandom_dev_fd *dev)
+{
+	if (__atomic_load_n(&dev->type, __ATOMIC_RELAXED) !=
+	    esdm_getrandom_dev_none)
+		__atomic_store_n(&dev->type, esdm_getrandom_dev_none,
+				 __ATOMIC_RELAXED);
+}
+
+/* Track the file descriptor returned by one of the open functions */
+static int esdm_getrandom_dev_opened(int fd, const char *pathname, int flags)
+{
+	struct esdm_getrandom_dev_fd *dev;
+	struct stat sb;
+	unsigned int type;
+
+	if (fd < 0 || fd >= ESDM_GETRANDOM_DEV_MAX_FD)
+		return fd;
+
+	dev = &esdm_getrandom_dev_fds[fd];
+	type = esdm_getrandom_dev_path_type(pathname);
+	if (type == esdm_getrandom_dev_none ||
+	    (flags & O_ACCMODE) == O_WRONLY || (flags & O_PATH) ||
+	    fstat(fd, &sb) || !S_ISCHR(sb.st_mode)) {
+		/* The file descriptor may be reused without close(3) */
+		esdm_getrandom_dev_untrack(dev);
+		return fd;
+	}
+
+	dev->rdev = sb.st_rdev;
+	dev->flags = flags;
+	__atomic_store_n(&dev->type, type, __ATOMIC_RELEASE);
+
+	return fd;
+}
+
+static ssize_t esdm_getrandom_dev_get(unsigned int type, int flags, void *buf,
+				      size_t count)
+{
+	ssize_t ret;
+
+	if (!count)
+		return 0;
+	if (count > INT_MAX)
+		count = INT_MAX;
+
+	pthread_once(&esdm_getrandom_lib_once, esdm_getrandom_lib_init);
+
+	if (type == esdm_getrandom_dev_random) {
+		/* Leave a non-blocking read to libc until the ESDM is seeded */
+		if ((flags & O_NONBLOCK) && !esdm_getrandom_operational())
+			return -EAGAIN;
+		esdm_invoke(esdm_rpcc_get_random_bytes_full(buf, count));
+	} else {
+		esdm_invoke(esdm_rpcc_get_random_bytes(buf, count));
+	}
+
+	return ret;
+}
+
+/*
+ * Serve a read request for a tracked file descriptor.
+ *
+ * Returns the number of read bytes, or < 0 if the request is to be processed
+ * by libc.
+ */
+static ssize_t esdm_getrandom_dev_read(int fd, void *buf, size_t count)
+{
+	struct esdm_getrandom_dev_fd *dev;
+	struct stat sb;
+	unsigned int type;
+
+	if (fd < 0 || fd >= ESDM_GETRANDOM_DEV_MAX_FD)
+		return -EBADF;
+
+	dev = &esdm_getrandom_dev_fds[fd];
+	type = __atomic_load_n(&dev->type, __ATOMIC_ACQUIRE);
+	if (type == esdm_getrandom_dev_none)
+		return -EBADF;
+
+	if (fstat(fd, &sb) || !S_ISCHR(sb.st_mode) || sb.st_rdev != dev->rdev) {
+		esdm_getrandom_dev_untrack(dev);
+		return -EBADF;
+	}
+
+	return esdm_getrandom_dev_get(type, dev->flags, buf, count);
+}
+
+static ssize_t esdm_getrandom_dev_stream_read(void *cookie, char *buf,
+					      size_t size)
+{
+	struct esdm_getrandom_dev_stream *stream = cookie;
+	ssize_t ret = esdm_getrandom_dev_get(stream->type, 0, buf, size);
+
+	if (ret >= 0)
+		return ret;
+
+	ret = (ssize_t)fread(buf, 1, size, stream->fp);
+	if (!ret && ferror(stream->fp))
+		return -1;
+	return ret;
+}
+
+static int esdm_getrandom_dev_stream_close(void *cookie)
+{
+	struct esdm_getrandom_dev_stream *stream = cookie;
+	int ret = fclose(stream->fp);
+
+	free(stream);
+	return ret;
+}
+
+/* Replace the stream returned by one of the fopen functions */
+static FILE *esdm_getrandom_dev_fopened(FILE *fp, const char *pathname,
+					const char *mode)
+{
+	static const cookie_io_functions_t funcs = {
+		.read = esdm_getrandom_dev_stream_read,
+		.close = esdm_getrandom_dev_stream_close,
+	};
+	struct esdm_getrandom_dev_stream *stream;
+	FILE *dev_fp;
+	unsigned int type = esdm_getrandom_dev_path_type(pathname);
+
+	if (!fp || type == esdm_getrandom_dev_none || mode[0] != 'r' ||
+	    strchr(mode, '+'))
+		return fp;
+
+	stream = malloc(sizeof(*stream));
+	if (!stream)
+		return fp;
+	stream->fp = fp;
+	stream->type = type;
+
+	dev_fp = fopencookie(stream, "r", funcs);
+	if (!dev_fp) {
+		free(stream);
+		return fp;
+	}
+
+	/* Do not keep random numbers in stream buffers */
+	setvbuf(fp, NULL, _IONBF, 0);
+	setvbuf(dev_fp, NULL, _IONBF, 0);
+
+	return dev_fp;
+}
+
+/* The mode argument is only present when a file may be created */
+#define ESDM_GETRANDOM_DEV_MODE(_flags, _mode)				       \
+	do {								       \
+		va_list __ap;						       \
+									       \
+		va_start(__ap, _flags);					       \
+		_mode = ((_flags & O_CREAT) ||				       \
+			 (_flags & O_TMPFILE) == O_TMPFILE) ?		       \
+			va_arg(__ap, mode_t) : 0;			       \
+		va_end(__ap);						       \
+	} while (0)
+
+/*
+ * The interposed functions are defined with the libc symbol names as the
+ * libc headers may redirect or fortify the declarations of these functions.
+ */
+DSO_PUBLIC
+int esdm_getrandom_open(const char *pathname, int flags, ...) __asm__("open");
+DSO_PUBLIC
+int esdm_getrandom_open64(const char *pathname, int flags, ...)
+	__asm__("open64");
+DSO_PUBLIC
+int esdm_getrandom_open_2(const char *pathname, int flags)
+	__asm__("__open_2");
+DSO_PUBLIC
+int esdm_getrandom_open64_2(const char *pathname, int flags)
+	__asm__("__open64_2");
+DSO_PUBLIC
+int esdm_getrandom_openat(int dirfd, const char *pathname, int flags, ...)
+	__asm__("openat");
+DSO_PUBLIC
+int esdm_getrandom_openat64(int dirfd, const char *pathname, int flags, ...)
+	__asm__("openat64");
+DSO_PUBLIC
+int esdm_getrandom_openat_2(int dirfd, const char *pathname, int flags)
+	__asm__("__openat_2");
+DSO_PUBLIC
+int esdm_getrandom_openat64_2(int dirfd, const char *pathname, int flags)
+	__asm__("__openat64_2");
+DSO_PUBLIC
+FILE *esdm_getrandom_fopen(const char *pathname, const char *mode)
+	__asm__("fopen");
+DSO_PUBLIC
+FILE *esdm_getrandom_fopen64(const char *pathname, const char *mode)
+	__asm__("fopen64");
+DSO_PUBLIC
+ssize_t esdm_getrandom_read(int fd, void *buf, size_t count) __asm__("read");
+DSO_PUBLIC
+ssize_t esdm_getrandom_read_chk(int fd, void *buf, size_t count,
+				size_t buflen) __asm__("__read_chk");
+DSO_PUBLIC
+int esdm_getrandom_close(int fd) __asm__("close");
+
+int esdm_getrandom_open(const char *pathname, int flags, ...)
+{
+	mode_t mode;
+
+	ESDM_GETRANDOM_DEV_MODE(flags, mode);
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	return esdm_getrandom_dev_opened(
+		esdm_getrandom_libc.open(pathname, flags, mode),
+		pathname, flags);
+}
+
+int esdm_getrandom_open64(const char *pathname, int flags, ...)
+{
+	mode_t mode;
+
+	ESDM_GETRANDOM_DEV_MODE(flags, mode);
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	return esdm_getrandom_dev_opened(
+		esdm_getrandom_libc.open64(pathname, flags, mode),
+		pathname, flags);
+}
+
+int esdm_getrandom_open_2(const char *pathname, int flags)
+{
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	if (!esdm_getrandom_libc.open_2)
+		return esdm_getrandom_open(pathname, flags);
+	return esdm_getrandom_dev_opened(
+		esdm_getrandom_libc.open_2(pathname, flags), pathname, flags);
+}
+
+int esdm_getrandom_open64_2(const char *pathname, int flags)
+{
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	if (!esdm_getrandom_libc.open64_2)
+		return esdm_getrandom_open64(pathname, flags);
+	return esdm_getrandom_dev_opened(
+		esdm_getrandom_libc.open64_2(pathname, flags), pathname, flags);
+}
+
+int esdm_getrandom_openat(int dirfd, const char *pathname, int flags, ...)
+{
+	mode_t mode;
+
+	ESDM_GETRANDOM_DEV_MODE(flags, mode);
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	return esdm_getrandom_dev_opened(
+		esdm_getrandom_libc.openat(dirfd, pathname, flags, mode),
+		pathname, flags);
+}
+
+int esdm_getrandom_openat64(int dirfd, const char *pathname, int flags, ...)
+{
+	mode_t mode;
+
+	ESDM_GETRANDOM_DEV_MODE(flags, mode);
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	return esdm_getrandom_dev_opened(
+		esdm_getrandom_libc.openat64(dirfd, pathname, flags, mode),
+		pathname, flags);
+}
+
+int esdm_getrandom_openat_2(int dirfd, const char *pathname, int flags)
+{
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	if (!esdm_getrandom_libc.openat_2)
+		return esdm_getrandom_openat(dirfd, pathname, flags);
+	return esdm_getrandom_dev_opened(
+		esdm_getrandom_libc.openat_2(dirfd, pathname, flags),
+		pathname, flags);
+}
+
+int esdm_getrandom_openat64_2(int dirfd, const char *pathname, int flags)
+{
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	if (!esdm_getrandom_libc.openat64_2)
+		return esdm_getrandom_openat64(dirfd, pathname, flags);
+	return esdm_getrandom_dev_opened(
+		esdm_getrandom_libc.openat64_2(dirfd, pathname, flags),
+		pathname, flags);
+}
+
+FILE *esdm_getrandom_fopen(const char *pathname, const char *mode)
+{
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	return esdm_getrandom_dev_fopened(
+		esdm_getrandom_libc.fopen(pathname, mode), pathname, mode);
+}
+
+FILE *esdm_getrandom_fopen64(const char *pathname, const char *mode)
+{
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	return esdm_getrandom_dev_fopened(
+		esdm_getrandom_libc.fopen64(pathname, mode), pathname, mode);
+}
+
+ssize_t esdm_getrandom_read(int fd, void *buf, size_t count)
+{
+	ssize_t ret;
+
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	ret = esdm_getrandom_dev_read(fd, buf, count);
+	if (ret >= 0)
+		return ret;
+
+	return esdm_getrandom_libc.read(fd, buf, count);
+}
+
+ssize_t esdm_getrandom_read_chk(int fd, void *buf, size_t count,
+				size_t buflen)
+{
+	ssize_t ret;
+
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	/* An overflowing request is left to libc which aborts the program */
+	if (count <= buflen) {
+		ret = esdm_getrandom_dev_read(fd, buf, count);
+		if (ret >= 0)
+			return ret;
+	}
+
+	if (!esdm_getrandom_libc.read_chk)
+		return esdm_getrandom_libc.read(fd, buf, count);
+	return esdm_getrandom_libc.read_chk(fd, buf, count, buflen);
+}
+
+int esdm_getrandom_close(int fd)
+{
+	pthread_once(&esdm_getrandom_dev_once, esdm_getrandom_dev_init);
+
+	if (fd >= 0 && fd < ESDM_GETRANDOM_DEV_MAX_FD)
+		esdm_getrandom_dev_untrack(&esdm_getrandom_dev_fds[fd]);
+
+	return esdm_getrandom_libc.close(fd);
+}
@@ -22,12 +22,14 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "binhexbin.h"
 #include "esdm.h"
+#include "esdm_config.h"
 #include "esdm_rpc_server.h"
 #include "logger.h"
 #include "ret_checkers.h"
@@ -60,9 +62,44 @@ static void usage(void)
 	fprintf(stderr, "\t-p --pid\tWrite daemon PID to file\n");
 	fprintf(stderr, "\t-u --username\tUnprivileged user name to switch to (default: \"nobody\")\n");
 	fprintf(stderr, "\t-f --foreground\tExecute in foreground\n");
+	fprintf(stderr, "\t-t --thread-drng\tUse lock-free thread-local DRNG instances\n");
+	fprintf(stderr, "\t-e --es-parallel\tFetch entropy sources concurrently\n");
+	fprintf(stderr, "\t-j --jent-collectors <NUM>\tNumber of threads pre-filling Jitter RNG output\n");
+	fprintf(stderr, "\t   --limit-requests <NUM>\tRequests per second per unprivileged client\n");
+	fprintf(stderr, "\t   --limit-bytes <NUM>\tBytes per second per unprivileged client\n");
+	fprintf(stderr, "\t   --acct-cgroup\tAccount unprivileged clients per cgroup instead of per UID\n");
+	fprintf(stderr, "\t   --weight <UID>:<WEIGHT>\tScheduling weight of the clients with the given UID\n");
+	fprintf(stderr, "\t   --stack-size <KIB>\tStack size of the RPC worker threads (0: system default)\n");
 	exit(1);
 }
 
+/* Parse a decimal number - negative numbers and overflows are rejected */
+static int parse_uint32(const char *arg, char **end, uint32_t *val)
+{
+	unsigned long tmp;
+
+	errno = 0;
+	tmp = strtoul(arg, end, 10);
+	if (*end == arg || errno || tmp > UINT32_MAX ||
+	    memchr(arg, '-', (size_t)(*end - arg)))
+		return -ERANGE;
+
+	*val = (uint32_t)tmp;
+	return 0;
+}
+
+static void parse_weight(const char *arg)
+{
+	char *end;
+	uint32_t uid, weight;
+
+	if (parse_uint32(arg, &end, &uid) || *end != ':')
+		usage();
+	if (parse_uint32(end + 1, &end, &weight) || *end ||
+	    esdm_rpc_server_acct_weight_set(uid, weight))
+		usage();
+}
+
 static void parse_opts(int argc, char *argv[])
 {
 	int c = 0;
@@ -77,9 +114,17 @@ static void parse_opts(int argc, char *argv[])
 			{"version", 0, 0, 0},
 			{"username", 0, 0, 0},
 			{"foreground", 0, 0, 0},
+			{"thread-drng", 0, 0, 0},
+			{"es-parallel", 0, 0, 0},
+			{"jent-collectors", 1, 0, 0},
+			{"limit-requests", 1, 0, 0},
+			{"limit-bytes", 1, 0, 0},
+			{"acct-cgroup", 0, 0, 0},
+			{"weight", 1, 0, 0},
+			{"stack-size", 1, 0, 0},
 			{0, 0, 0, 0}
 		};
-		c = getopt_long(argc, argv, "hvp:u:f", opts, &opt_index);
+		c = getopt_long(argc, argv, "hvp:u:ftej:", opts, &opt_index);
 		if (-1 == c)
 			break;
 		switch (c) {
@@ -105,6 +150,35 @@ static void parse_opts(int argc, char *argv[])
 			case 5:
 				foreground = 1;
 				break;
+			case 6:
+				esdm_config_drng_per_thread_set(1);
+				break;
+			case 7:
+				esdm_config_es_parallel_set(1);
+				break;
+			case 8:
+				esdm_config_es_jent_collectors_set(
+					(uint32_t)strtoul(optarg, NULL, 10));
+				break;
+			case 9:
+				esdm_rpc_server_limit_requests_set(
+					(uint32_t)strtoul(optarg, NULL, 10));
+				break;
+			case 10:
+				esdm_rpc_server_limit_bytes_set(
+					(uint32_t)strtoul(optarg, NULL, 10));
+				break;
+			case 11:
+				esdm_rpc_server_acct_cgroup_set(1);
+				break;
+			case 12:
+				parse_weight(optarg);
+				break;
+			case 13:
+				if (esdm_rpc_server_stack_size_set(
+					strtoul(optarg, NULL, 10) * 1024))
+					usage();
+				break;
 			default:
 				usage();
 			}
@@ -124,6 +198,16 @@ static void parse_opts(int argc, char *argv[])
 		case 'f':
 			foreground = 1;
 			break;
+		case 't':
+			esdm_config_drng_per_thread_set(1);
+			break;
+		case 'e':
+			esdm_config_es_parallel_set(1);
+			break;
+		case 'j':
+			esdm_config_es_jent_collectors_set(
+				(uint32_t)strtoul(optarg, NULL, 10));
+			break;
 
 		default:
 			usage();
@@ -19,9 +19,11 @@
  */
 
 #include <errno.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
@@ -31,6 +33,10 @@
 #include "atomic.h"
 #include "conv_be_le.h"
 #include "esdm_rpc_client.h"
+#include "esdm_rpc_client_breaker.h"
+#include "esdm_rpc_client_helper.h"
+#include "esdm_rpc_client_raw.h"
+#include "esdm_rpc_client_shm.h"
 #include "esdm_rpc_protocol.h"
 #include "esdm_rpc_service.h"
 #include "helper.h"
@@ -42,46 +48,339 @@
 #include "test_pertubation.h"
 #include "visibility.h"
 
-struct esdm_rpcc_write_buf {
-	ProtobufCBuffer base;
-	struct esdm_rpc_client_connection *rpc_conn;
+/* Receive and send timeout of the socket in nanoseconds */
+#define ESDM_RPCC_IO_TIMEOUT_NS		(1UL << 28)
+
+/*
+ * A pipelined request not answered within this number of I/O timeouts fails
+ * with -ETIMEDOUT. The server never blocks while processing a request, the
+ * bound is in the order of the I/O timeout of the server.
+ */
+#define ESDM_RPCC_PIPE_TIMEOUTS		8
+
+/*
+ * Request waiting for its response on a pipelined connection. The entry is
+ * located on the stack of the waiting caller.
+ */
+struct esdm_rpcc_pending {
+	struct esdm_rpcc_pending *next;
+	uint32_t request_id;
+	unsigned int method_index;
+	bool raw;
+	const ProtobufCMessageDescriptor *message_desc;
+	const ProtobufCMessage *input;
+	ProtobufCClosure closure;
+	void *closure_data;
+	int ret;
+	bool done;
 };
 
-static void esdm_fini_proto_service(struct esdm_rpc_client_connection *rpc_conn)
+/* Interrupt data of the caller using the connection in the current thread */
+static __thread void *esdm_rpcc_interrupt_data = NULL;
+
+bool esdm_rpcc_interrupted(struct esdm_rpc_client_connection *rpc_conn)
 {
-	ProtobufCService *service;
+	return (rpc_conn->interrupt_func &&
+		rpc_conn->interrupt_func(esdm_rpcc_interrupt_data));
+}
 
-	if (!rpc_conn)
-		return;
+void esdm_rpcc_throttle(struct esdm_rpc_client_connection *rpc_conn,
+			const struct esdm_rpc_proto_sc_header *header,
+			const uint8_t *data)
+{
+	struct esdm_rpc_proto_throttle throttle = { .retry_ms = 0 };
+	struct timespec ts;
+	uint32_t retry_ms;
+
+	if (header->message_length == sizeof(throttle))
+		memcpy(&throttle, data, sizeof(throttle));
+	retry_ms = le_bswap32(throttle.retry_ms);
+
+	logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+	       "Server throttles requests for %u ms\n", retry_ms);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += (time_t)(retry_ms / 1000);
+	ts.tv_nsec += (long)(retry_ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&rpc_conn->pending_lock);
+	if (!atomic_read(&rpc_conn->throttled) ||
+	    ts.tv_sec > rpc_conn->throttled_until.tv_sec ||
+	    (ts.tv_sec == rpc_conn->throttled_until.tv_sec &&
+	     ts.tv_nsec > rpc_conn->throttled_until.tv_nsec))
+		rpc_conn->throttled_until = ts;
+	atomic_set(&rpc_conn->throttled, 1);
+	pthread_mutex_unlock(&rpc_conn->pending_lock);
+}
+
+bool esdm_rpcc_throttled(struct esdm_rpc_client_connection *rpc_conn)
+{
+	struct timespec ts;
+	bool ret;
+
+	if (!atomic_read(&rpc_conn->throttled))
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	pthread_mutex_lock(&rpc_conn->pending_lock);
+	ret = (ts.tv_sec < rpc_conn->throttled_until.tv_sec ||
+	       (ts.tv_sec == rpc_conn->throttled_until.tv_sec &&
+		ts.tv_nsec < rpc_conn->throttled_until.tv_nsec));
+	if (!ret)
+		atomic_set(&rpc_conn->throttled, 0);
+	pthread_mutex_unlock(&rpc_conn->pending_lock);
+
+	return ret;
+}
+
+static void esdm_rpcc_pipe_init(struct esdm_rpc_client_connection *rpc_conn)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&rpc_conn->pending_cv, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&rpc_conn->pending_lock, NULL);
+
+	rpc_conn->request_id = 0;
+	rpc_conn->pending = NULL;
+	rpc_conn->reader_active = false;
+	rpc_conn->severed = false;
+	rpc_conn->abandoned = false;
+	atomic_set(&rpc_conn->throttled, 0);
+}
+
+/* Caller must hold pending_lock */
+static int esdm_rpcc_pending_add(struct esdm_rpc_client_connection *rpc_conn,
+				 struct esdm_rpcc_pending *req)
+{
+	struct esdm_rpcc_pending **p;
+
+	if (rpc_conn->severed)
+		return -ECONNRESET;
+
+	/* The list is ordered by the submission of the requests */
+	for (p = &rpc_conn->pending; *p; p = &(*p)->next)
+		;
+
+	req->next = NULL;
+	*p = req;
+
+	return 0;
+}
+
+/* Caller must hold pending_lock */
+static bool
+esdm_rpcc_pending_unlink(struct esdm_rpc_client_connection *rpc_conn,
+			 struct esdm_rpcc_pending *req)
+{
+	struct esdm_rpcc_pending **p;
+
+	for (p = &rpc_conn->pending; *p; p = &(*p)->next) {
+		if (*p == req) {
+			*p = req->next;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Caller must hold pending_lock */
+static void
+esdm_rpcc_pending_fail_all(struct esdm_rpc_client_connection *rpc_conn,
+			   int err)
+{
+	struct esdm_rpcc_pending *req;
+
+	while (rpc_conn->pending) {
+		req = rpc_conn->pending;
+		rpc_conn->pending = req->next;
+		req->ret = err;
+		req->done = true;
+	}
+
+	pthread_cond_broadcast(&rpc_conn->pending_cv);
+}
+
+/*
+ * The connection broke while requests are pipelined: all pending requests
+ * fail and the connection is not used for further requests. An old server
+ * closes the connection when receiving a request with the raw encoding -
+ * the request is resubmitted with the Protobuf-C encoding on the new
+ * connection. As the connection may have been reset for other reasons, the
+ * raw encoding is tried again on the connection after.
+ */
+static void esdm_rpcc_sever(struct esdm_rpc_client_connection *rpc_conn,
+			    int err)
+{
+	struct esdm_rpcc_pending *oldest;
+
+	pthread_mutex_lock(&rpc_conn->pending_lock);
+
+	oldest = rpc_conn->pending;
+	esdm_rpcc_pending_fail_all(rpc_conn, err);
+
+	if (err == -ECONNRESET && oldest && oldest->raw &&
+	    !rpc_conn->raw_confirmed) {
+		logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+		       "Server may not support the raw encoding\n");
+		rpc_conn->raw_rejected = true;
+		oldest->ret = EAGAIN;
+	}
+
+	rpc_conn->severed = true;
+	shutdown(rpc_conn->fd, SHUT_RDWR);
+
+	pthread_mutex_unlock(&rpc_conn->pending_lock);
+}
+
+/*
+ * Close the connection to the server. The caller must hold the lock. Pending
+ * requests fail and the function waits until no caller reads from the
+ * connection any more.
+ */
+void esdm_rpcc_disconnect(struct esdm_rpc_client_connection *rpc_conn)
+{
+	pthread_mutex_lock(&rpc_conn->pending_lock);
+
+	esdm_rpcc_pending_fail_all(rpc_conn, -ECONNRESET);
+
+	/* A connection inherited from the parent must not be shut down */
+	if (rpc_conn->fd >= 0 && rpc_conn->pid == getpid())
+		shutdown(rpc_conn->fd, SHUT_RDWR);
+
+	while (rpc_conn->reader_active)
+		pthread_cond_wait(&rpc_conn->pending_cv,
+				  &rpc_conn->pending_lock);
+
+	esdm_rpcc_shm_free(rpc_conn);
 
 	if (rpc_conn->fd >= 0) {
 		close(rpc_conn->fd);
 		rpc_conn->fd = -1;
 	}
 
+	rpc_conn->severed = false;
+	rpc_conn->abandoned = false;
+	rpc_conn->raw_confirmed = false;
+
+	pthread_mutex_unlock(&rpc_conn->pending_lock);
+}
+
+void esdm_fini_proto_service(struct esdm_rpc_client_connection *rpc_conn)
+{
+	ProtobufCService *service;
+
+	if (!rpc_conn)
+		return;
+
 	service = &rpc_conn->service;
 	if (service->descriptor) {
+		esdm_rpcc_disconnect(rpc_conn);
+		pthread_cond_destroy(&rpc_conn->pending_cv);
+		pthread_mutex_destroy(&rpc_conn->pending_lock);
+
 		protobuf_c_service_destroy(service);
 		service->descriptor = NULL;
 	}
 }
 
-static int
-esdm_connect_proto_service(struct esdm_rpc_client_connection *rpc_conn)
+/*
+ * Health check of an established connection before it is reused.
+ *
+ * A connection with pipelined requests is in use and expected to receive
+ * data. An idle connection must not be closed by the server - unread data
+ * on it are answers to abandoned requests which are discarded by their
+ * request ID. The check does not block. A connection inherited from the
+ * parent process after a fork is considered unusable as well.
+ */
+static bool
+esdm_rpcc_connection_healthy(struct esdm_rpc_client_connection *rpc_conn)
+{
+	struct pollfd pfd = { .fd = rpc_conn->fd,
+			      .events = POLLIN };
+	bool severed, busy;
+
+	if (rpc_conn->fd < 0)
+		return false;
+
+	if (rpc_conn->pid != getpid())
+		return false;
+
+	pthread_mutex_lock(&rpc_conn->pending_lock);
+	severed = rpc_conn->severed;
+	busy = rpc_conn->pending || rpc_conn->reader_active;
+	pthread_mutex_unlock(&rpc_conn->pending_lock);
+
+	if (severed)
+		return false;
+	if (busy)
+		return true;
+
+	if (poll(&pfd, 1, 0) < 0)
+		return false;
+
+	if (pfd.revents) {
+		logger(LOGGER_DEBUG, LOGGER_C_RPC,
+		       "Connection to server on FD %d is stale\n",
+		       rpc_conn->fd);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Wait until all pipelined requests are answered before the caller uses the
+ * connection exclusively. The caller must hold the lock. If the answer to an
+ * abandoned request may still arrive, the connection is dropped and EAGAIN
+ * asks the caller to establish a new one.
+ */
+static int esdm_rpcc_drain(struct esdm_rpc_client_connection *rpc_conn)
+{
+	bool abandoned;
+
+	pthread_mutex_lock(&rpc_conn->pending_lock);
+	while (rpc_conn->pending || rpc_conn->reader_active)
+		pthread_cond_wait(&rpc_conn->pending_cv,
+				  &rpc_conn->pending_lock);
+	abandoned = rpc_conn->abandoned;
+	pthread_mutex_unlock(&rpc_conn->pending_lock);
+
+	if (!abandoned)
+		return 0;
+
+	esdm_rpcc_disconnect(rpc_conn);
+	return EAGAIN;
+}
+
+/*
+ * Attempts to connect to a server whose listen queue is full. The back-off
+ * time between the attempts grows exponentially starting with
+ * ESDM_RPCC_CONNECT_BACKOFF_MS. A non-blocking connection attempt is made
+ * only once.
+ */
+#define ESDM_RPCC_CONNECT_ATTEMPTS	5
+#define ESDM_RPCC_CONNECT_BACKOFF_MS	2
+
+static int esdm_rpcc_connect_unix(struct esdm_rpc_client_connection *rpc_conn,
+				  bool nonblock)
 {
 	const char *socketname = rpc_conn->socketname;
-	struct timespec ts = { .tv_sec = 0, .tv_nsec = 1U<<28 };
-	struct timeval tv = { .tv_sec = 0, .tv_usec = (ts.tv_nsec)>>10 };
+	struct timeval tv = { .tv_sec = 0,
+			      .tv_usec = ESDM_RPCC_IO_TIMEOUT_NS >> 10 };
 	struct stat statbuf;
 	struct sockaddr_un addr;
 	unsigned int attempts = 0;
 	int errsv;
 
-	if (rpc_conn->fd >= 0) {
-		close(rpc_conn->fd);
-		rpc_conn->fd = -1;
-	}
-
 	/* Does the path exist? */
 	if (stat(socketname, &statbuf) == -1) {
 		errsv = errno;
@@ -102,7 +401,9 @@ esdm_connect_proto_service(struct esdm_rpc_client_connection *rpc_conn)
 	/* Connect to the Unix domain socket */
 	addr.sun_family = AF_UNIX;
 	strncpy(addr.sun_path, socketname, sizeof(addr.sun_path));
-	rpc_conn->fd = socket(addr.sun_family, SOCK_SEQPACKET, 0);
+	rpc_conn->fd = socket(addr.sun_family,
+			      SOCK_SEQPACKET | (nonblock ? SOCK_NONBLOCK : 0),
+			      0);
 	if (rpc_conn->fd < 0) {
 		errsv = errno;
 
@@ -126,13 +427,26 @@ esdm_connect_proto_service(struct esdm_rpc_client_connection *rpc_conn)
 
 	do {
 		/* If we have another attempt, try to wait a bit */
-		if (attempts)
+		if (attempts) {
+			uint32_t backoff = esdm_rpcc_backoff_ms(
+				ESDM_RPCC_CONNECT_BACKOFF_MS, UINT32_MAX,
+				attempts);
+			struct timespec ts = {
+				.tv_sec = 0,
+				.tv_nsec = (long)backoff * 1000000L
+			};
+
 			nanosleep(&ts, NULL);
+		}
 
 		if (connect(rpc_conn->fd, (struct sockaddr *)&addr,
 			    sizeof(addr)) < 0) {
 			errsv = errno;
 
+			/* Completion is reported by the writability */
+			if (nonblock && errsv == EINPROGRESS)
+				break;
+
 			logger(LOGGER_ERR, LOGGER_C_RPC,
 			       "Error connecting socket: %s\n",
 			       strerror(errsv));
@@ -140,18 +454,116 @@ esdm_connect_proto_service(struct esdm_rpc_client_connection *rpc_conn)
 		} else {
 			errsv = 0;
 		}
-	} while (attempts < 10 && (errsv == EAGAIN || errsv == ECONNREFUSED ||
-				   errsv == EINTR));
 
-	if (errsv) {
+		/*
+		 * A server not listening is not waited for - the circuit
+		 * breaker lets the callers fail over until it is back.
+		 */
+	} while (!nonblock && attempts < ESDM_RPCC_CONNECT_ATTEMPTS &&
+		 (errsv == EAGAIN || errsv == EINTR));
+
+	if (errsv == EINPROGRESS) {
+		rpc_conn->pid = getpid();
+	} else if (errsv) {
 		logger(LOGGER_ERR, LOGGER_C_RPC,
 		       "Connection attempt using socket %s failed\n",
 		       socketname);
+		esdm_rpcc_disconnect(rpc_conn);
+	} else {
+		rpc_conn->pid = getpid();
 	}
 
 	return -errsv;
 }
 
+int esdm_rpcc_connect_socket(struct esdm_rpc_client_connection *rpc_conn)
+{
+	int ret = esdm_rpcc_breaker_enter();
+
+	if (ret)
+		return ret;
+
+	ret = esdm_rpcc_connect_unix(rpc_conn, false);
+	esdm_rpcc_breaker_leave(ret);
+
+	return ret;
+}
+
+int esdm_rpcc_connect_socket_nonblock(
+				struct esdm_rpc_client_connection *rpc_conn)
+{
+	int ret = esdm_rpcc_breaker_enter();
+
+	if (ret)
+		return ret;
+
+	ret = esdm_rpcc_connect_unix(rpc_conn, true);
+	/* A pending connection attempt reached the server */
+	esdm_rpcc_breaker_leave((ret == -EINPROGRESS) ? 0 : ret);
+
+	return ret;
+}
+
+/*
+ * Establish the connection or reuse the existing one. The reused flag tells
+ * the caller whether the connection was established by an earlier request.
+ */
+static int
+esdm_connect_proto_service(struct esdm_rpc_client_connection *rpc_conn,
+			   bool *reused)
+{
+	int ret;
+
+	*reused = false;
+
+	/*
+	 * The pipelining state of a connection inherited by a forked child is
+	 * a copy of the parent's state which the child must not use.
+	 */
+	if (rpc_conn->fd >= 0 && rpc_conn->pid != getpid())
+		esdm_rpcc_pipe_init(rpc_conn);
+
+	/* Reuse the existing connection if it is still usable */
+	if (esdm_rpcc_connection_healthy(rpc_conn)) {
+		*reused = true;
+		return 0;
+	}
+
+	/*
+	 * Drop the unusable connection. For a connection inherited by a forked
+	 * child, this only closes the child's copy of the file descriptor.
+	 */
+	esdm_rpcc_disconnect(rpc_conn);
+
+	CKINT(esdm_rpcc_connect_socket(rpc_conn));
+	esdm_rpcc_raw_connected(rpc_conn);
+
+	if (rpc_conn->transport != esdm_rpcc_transport_shm)
+		return 0;
+
+	ret = esdm_rpcc_shm_negotiate(rpc_conn);
+	if (!ret)
+		return 0;
+
+	/* The server does not offer the transport, do not ask again */
+	if (ret == -EOPNOTSUPP || ret == -ECONNRESET) {
+		logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+		       "Shared memory transport not available, using socket %s\n",
+		       rpc_conn->socketname);
+		rpc_conn->transport = esdm_rpcc_transport_socket;
+	}
+
+	if (ret == -EOPNOTSUPP)
+		return 0;
+
+	/* The negotiation left the socket in an undefined state */
+	esdm_rpcc_disconnect(rpc_conn);
+	ret = esdm_rpcc_connect_socket(rpc_conn);
+
+out:
+	return ret;
+}
+
 static int
 esdm_rpc_client_write_data(struct esdm_rpc_client_connection *rpc_conn,
 			   const uint8_t *data, size_t len)
@@ -163,18 +575,30 @@ esdm_rpc_client_write_data(struct esdm_rpc_client_connection *rpc_conn,
 		return -EINVAL;
 
 	do {
-		ret = write(rpc_conn->fd, data, len);
+		ret = write(rpc_conn->fd, data + written, len - written);
 		if (ret < 0) {
 			int errsv = errno;
 
-			if (errsv == EPIPE) {
+			/*
+			 * The server closed the connection - the caller
+			 * re-establishes it and resends the entire request.
+			 */
+			if (errsv == EPIPE || errsv == ECONNRESET) {
 				logger(LOGGER_DEBUG, LOGGER_C_RPC,
 				       "Connection to server needs to be re-established\n");
+				return -errsv;
+			}
 
-				int rc = esdm_connect_proto_service(rpc_conn);
-				if (rc)
-					return rc;
-				continue;
+			/*
+			 * A non-blocking socket is full - the request is
+			 * a single packet which is either sent entirely or
+			 * not at all.
+			 */
+			if (errsv == EAGAIN || errsv == EWOULDBLOCK) {
+				logger(LOGGER_DEBUG, LOGGER_C_RPC,
+				       "Writing to file descriptor %d would block\n",
+				       rpc_conn->fd);
+				return -EAGAIN;
 			}
 
 			logger(LOGGER_ERR, LOGGER_C_RPC,
@@ -192,62 +616,74 @@ esdm_rpc_client_write_data(struct esdm_rpc_client_connection *rpc_conn,
 	return 0;
 }
 
-static void
-esdm_rpc_client_append_data(ProtobufCBuffer *buffer, size_t len,
-			   const uint8_t *data)
-{
-	struct esdm_rpcc_write_buf *buf = (struct esdm_rpcc_write_buf *) buffer;
-	int ret = esdm_rpc_client_write_data(buf->rpc_conn, data, len);
-
-	if (ret < 0)
-		logger(LOGGER_ERR, LOGGER_C_RPC,
-		       "Submission of payload data failed with error %d\n",
-		       ret);
-}
-
-static int
-esdm_rpc_client_pack(const ProtobufCMessage *message,
-		     unsigned int method_index,
-		     struct esdm_rpc_client_connection *rpc_conn)
+/*
+ * Pack the message behind the header into one buffer which is sent with one
+ * system call.
+ */
+int esdm_rpc_client_pack(const ProtobufCMessage *message,
+			 unsigned int method_index, uint32_t request_id,
+			 struct esdm_rpc_client_connection *rpc_conn)
 {
 	struct esdm_rpc_proto_cs_header cs_header;
-	struct esdm_rpcc_write_buf tmp = { 0 };
+	uint8_t buf[sizeof(cs_header) + ESDM_RPC_MAX_MSG_SIZE]
+						__aligned(sizeof(uint64_t));
 	size_t message_length;
 	int ret;
 
 	message_length = protobuf_c_message_get_packed_size(message);
-	tmp.base.append = esdm_rpc_client_append_data;
-	tmp.rpc_conn = rpc_conn;
+	if (message_length > ESDM_RPC_MAX_MSG_SIZE) {
+		logger(LOGGER_ERR, LOGGER_C_RPC,
+		       "Request message too large: %zu bytes\n",
+		       message_length);
+		return -EMSGSIZE;
+	}
 
 	cs_header.method_index = le_bswap32(method_index);
-	cs_header.message_length = le_bswap32(message_length);
-	cs_header.request_id = le_bswap32(0);
+	cs_header.message_length = le_bswap32((uint32_t)message_length);
+	cs_header.request_id = le_bswap32(request_id);
 
 	logger(LOGGER_DEBUG, LOGGER_C_RPC,
 	       "Client sending: message length %u, message index %u, request ID %u\n",
 	       cs_header.message_length, cs_header.method_index,
 	       cs_header.request_id);
 
-	CKINT_LOG(esdm_rpc_client_write_data(rpc_conn,
-					     (uint8_t *)&cs_header,
-					     sizeof(cs_header)),
-		  "Submission of header data failed with error %d\n", ret);
-
-	if (protobuf_c_message_pack_to_buffer(message, &tmp.base) !=
+	memcpy(buf, &cs_header, sizeof(cs_header));
+	if (protobuf_c_message_pack(message, buf + sizeof(cs_header)) !=
 	    message_length) {
 		logger(LOGGER_VERBOSE, LOGGER_C_RPC,
-		       "Short write of data to file descriptor \n");
+		       "Packing of the request message failed\n");
 		ret = -EFAULT;
+		goto out;
 	}
 
+	CKINT_LOG(esdm_rpc_client_write_data(rpc_conn, buf,
+					     sizeof(cs_header) +
+					     message_length),
+		  "Submission of request data failed with error %d\n", ret);
+
 out:
+	memset_secure(buf, 0, sizeof(cs_header) + message_length);
 	return ret;
 }
 
-static int
-esdm_rpc_client_read_handler(struct esdm_rpc_client_connection *rpc_conn,
-			     const ProtobufCMessageDescriptor *message_desc,
-			     ProtobufCClosure closure, void *closure_data)
+/*
+ * Is the error caused by the server closing the connection? A request which
+ * could not be sent on a reused connection is resent on a new connection.
+ */
+static bool esdm_rpcc_conn_severed(int ret)
+{
+	return (ret == -EPIPE || ret == -ECONNRESET);
+}
+
+/*
+ * Read one response from the connection and hand it to the pending request it
+ * belongs to.
+ *
+ * Returns 0 when a response was processed, -EAGAIN when no response arrived
+ * within the receive timeout and < 0 when the connection broke - in this case
+ * all pending requests failed.
+ */
+static int esdm_rpcc_pipe_read(struct esdm_rpc_client_connection *rpc_conn)
 {
 	ProtobufCAllocator esdm_rpc_client_allocator = {
 		.alloc = &esdm_rpc_alloc,
@@ -256,20 +692,14 @@ esdm_rpc_client_read_handler(struct esdm_rpc_client_connection *rpc_conn,
 	};
 	BUFFER_INIT(tls);
 	struct esdm_rpc_proto_sc *received_data;
-	struct esdm_rpc_proto_sc_header *header = NULL;
+	struct esdm_rpc_proto_sc_header *header;
+	struct esdm_rpcc_pending *req;
 	uint8_t buf[ESDM_RPC_MAX_MSG_SIZE + sizeof(*received_data)]
 						__aligned(sizeof(uint64_t));
 	uint8_t unpacked[ESDM_RPC_MAX_MSG_SIZE + 128]
 						__aligned(sizeof(uint64_t));
-	size_t total_received = 0;
 	ssize_t received;
-	uint32_t data_to_fetch = 0;
 	int ret = 0;
-	uint8_t *buf_p = buf;
-	bool interrupted = false;
-
-	if (rpc_conn->fd < 0)
-		return -EINVAL;
 
 	tls.buf = unpacked;
 	tls.len = sizeof(unpacked);
@@ -277,99 +707,82 @@ esdm_rpc_client_read_handler(struct esdm_rpc_client_connection *rpc_conn,
 
 	/* The cast is appropriate as the buffer is aligned to 64 bits. */
 	received_data = (struct esdm_rpc_proto_sc *)buf;
+	header = &received_data->header;
 
-	/* Read the data into the local buffer storage */
-	do {
-		received = read(rpc_conn->fd, buf_p,
-				sizeof(buf) - total_received);
-		if (received < 0) {
-			/* Handle a read timeout due to SO_RCVTIMEO */
-			if (errno == EAGAIN || errno == EWOULDBLOCK) {
-				/* Does the caller wants us to interrupt? */
-				if (rpc_conn->interrupt_func &&
-				    rpc_conn->interrupt_func(
-					rpc_conn->interrupt_data)) {
-					interrupted = true;
-					break;
-				}
-
-				/* Trigger the re-submission of the request */
-				ret = EAGAIN;
-				goto out;
-			}
-
-			ret = -errno;
-			logger(LOGGER_DEBUG, LOGGER_C_RPC, "Read failed: %s\n",
-			       strerror(errno));
-			break;
-		}
-
-		/* Received EOF */
-		if (received == 0) {
-			ret = 0;
-			break;
-		}
-
-		total_received += (size_t)received;
-		buf_p += (size_t)received;
-
-		if (total_received < sizeof(*received_data))
-			continue;
+	/* Every response is one packet */
+	received = recv(rpc_conn->fd, buf, sizeof(buf), MSG_TRUNC);
+	if (received < 0) {
+		ret = -errno;
 
-		if (!data_to_fetch) {
-			header = &received_data->header;
+		/* Handle a read timeout due to SO_RCVTIMEO */
+		if (ret == -EAGAIN || ret == -EWOULDBLOCK || ret == -EINTR)
+			return -EAGAIN;
 
-			/* Convert incoming data to LE */
-			header->status_code = le_bswap32(header->status_code);
-			header->message_length =
-				le_bswap32(header->message_length);
-			header->method_index = le_bswap32(header->method_index);
-			header->request_id = le_bswap32(header->request_id);
+		logger(LOGGER_DEBUG, LOGGER_C_RPC, "Read failed: %s\n",
+		       strerror(-ret));
+		esdm_rpcc_sever(rpc_conn, ret);
+		return ret;
+	}
 
-			logger(LOGGER_DEBUG, LOGGER_C_RPC,
-			       "Client received: server status %u, message length %u, message index %u, request ID %u\n",
-			       header->status_code, header->message_length,
-			       header->method_index, header->request_id);
+	/* Server closed the connection before answering */
+	if (received == 0) {
+		esdm_rpcc_sever(rpc_conn, -ECONNRESET);
+		return -ECONNRESET;
+	}
 
-			/*
-			 * Truncate the buffer length if client specified
-			 * too much buffer data.
-			 */
-			if (header->message_length > ESDM_RPC_MAX_MSG_SIZE)
-				header->message_length = ESDM_RPC_MAX_MSG_SIZE;
+	if ((size_t)received > sizeof(buf) ||
+	    (size_t)received < sizeof(*received_data))
+		goto invalid;
 
-			/* How much data are we expecting to fetch? */
-			data_to_fetch = header->message_length;
+	/* Convert incoming data to LE */
+	header->status_code = le_bswap32(header->status_code);
+	header->message_length = le_bswap32(header->message_length);
+	header->method_index = le_bswap32(header->method_index);
+	header->request_id = le_bswap32(header->request_id);
 
-			/* If we are not expecting anything, simply stop now */
-			if (!data_to_fetch)
-				break;
+	logger(LOGGER_DEBUG, LOGGER_C_RPC,
+	       "Client received: server status %u, message length %u, message index %u, request ID %u\n",
+	       header->status_code, header->message_length,
+	       header->method_index, header->request_id);
 
-			/*
-			 * To allow comparison with total_received, let us
-			 * add the header length to the data to fetch value.
-			 */
-			data_to_fetch += sizeof(*received_data);
-		}
+	if (header->message_length !=
+	    (size_t)received - sizeof(*received_data))
+		goto invalid;
 
-		/* Now, we received enough and can stop the reading */
-		if (total_received >= data_to_fetch)
+	pthread_mutex_lock(&rpc_conn->pending_lock);
+	for (req = rpc_conn->pending; req; req = req->next) {
+		if (req->request_id == header->request_id)
 			break;
+	}
+	if (req)
+		esdm_rpcc_pending_unlink(rpc_conn, req);
+	pthread_mutex_unlock(&rpc_conn->pending_lock);
+
+	if (!req) {
+		logger(LOGGER_DEBUG, LOGGER_C_RPC,
+		       "Response to abandoned request ID %u discarded\n",
+		       header->request_id);
+		goto out;
+	}
 
-	} while (total_received < sizeof(buf));
-
-	if (header &&
-	    header->status_code == PROTOBUF_C_RPC_STATUS_CODE_SUCCESS) {
-		/*
-		 * We now have a filled buffer that has a header and received
-		 * as much data as the header defined. We also start the
-		 * processing of data which returns it to the caller.
-		 */
+	/*
+	 * The request is not in the list any more, so its caller waits until
+	 * it is marked as done.
+	 */
+	if (header->status_code == PROTOBUF_C_RPC_STATUS_CODE_TOO_MANY_PENDING) {
+		esdm_rpcc_throttle(rpc_conn, header, received_data->data);
+		req->closure(ERR_PTR(-EBUSY), req->closure_data);
+	} else if (req->raw) {
+		req->ret = esdm_rpcc_raw_deliver(req->method_index, req->input,
+						 header, received_data->data,
+						 req->closure,
+						 req->closure_data);
+	} else if (header->status_code == PROTOBUF_C_RPC_STATUS_CODE_SUCCESS) {
 		ProtobufCMessage *msg = protobuf_c_message_unpack(
-			message_desc, &esdm_rpc_client_allocator,
+			req->message_desc, &esdm_rpc_client_allocator,
 			header->message_length, received_data->data);
 		if (msg) {
-			closure(msg, closure_data);
+			req->closure(msg, req->closure_data);
 			protobuf_c_message_free_unpacked(
 				msg, &esdm_rpc_client_allocator);
 			logger(LOGGER_DEBUG, LOGGER_C_RPC,
@@ -378,58 +791,474 @@ esdm_rpc_client_read_handler(struct esdm_rpc_client_connection *rpc_conn,
 		} else {
 			logger(LOGGER_ERR, LOGGER_C_RPC,
 			       "Response message not found\n");
-			msg = ERR_PTR(-EFAULT);
-			closure(msg, closure_data);
+			req->closure(ERR_PTR(-EFAULT), req->closure_data);
 		}
-	} else if (interrupted) {
-		ProtobufCMessage *msg;
-
-		logger(LOGGER_VERBOSE, LOGGER_C_RPC, "Request interrupted\n");
-		msg = ERR_PTR(-EINTR);
-		closure(msg, closure_data);
 	} else {
-		ProtobufCMessage *msg;
-
 		logger(LOGGER_VERBOSE, LOGGER_C_RPC,
 		       "Server returned with an error\n");
-		msg = ERR_PTR(-EINTR);
-		closure(msg, closure_data);
+		req->closure(ERR_PTR(-EINTR), req->closure_data);
+	}
+
+	pthread_mutex_lock(&rpc_conn->pending_lock);
+	if (req->raw && !req->ret)
+		rpc_conn->raw_confirmed = true;
+
+	/*
+	 * The server did not process the request, resend it with the
+	 * Protobuf-C encoding.
+	 */
+	if (req->raw && req->ret == -EOPNOTSUPP) {
+		rpc_conn->raw_unsupported = true;
+		req->ret = EAGAIN;
 	}
+	req->done = true;
+	pthread_cond_broadcast(&rpc_conn->pending_cv);
+	pthread_mutex_unlock(&rpc_conn->pending_lock);
+
+	goto out;
+
+invalid:
+	logger(LOGGER_ERR, LOGGER_C_RPC, "Invalid response received\n");
+	esdm_rpcc_sever(rpc_conn, -EFAULT);
+	ret = -EFAULT;
 
 out:
-	memset_secure(buf, 0, total_received);
+	memset_secure(buf, 0, min_size((size_t)received, sizeof(buf)));
 	memset_secure(tls.buf, 0, tls.consumed);
 	return ret;
 }
 
+static void esdm_rpcc_ts_add_ns(struct timespec *ts, uint64_t ns)
+{
+	ts->tv_sec += (time_t)(ns / 1000000000ULL);
+	ts->tv_nsec += (long)(ns % 1000000000ULL);
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+static bool esdm_rpcc_ts_expired(const struct timespec *deadline)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec > deadline->tv_sec ||
+		(ts.tv_sec == deadline->tv_sec &&
+		 ts.tv_nsec >= deadline->tv_nsec));
+}
+
+/*
+ * Wait for the response to the pipelined request. If no other caller reads
+ * from the connection, the caller reads the responses itself until its own
+ * arrived. The interrupt function is checked whenever no response arrived for
+ * the receive timeout. If the response does not arrive within
+ * ESDM_RPCC_PIPE_TIMEOUTS receive timeouts, the request is abandoned and
+ * -ETIMEDOUT is returned.
+ */
+static int esdm_rpcc_pipe_wait(struct esdm_rpc_client_connection *rpc_conn,
+			       struct esdm_rpcc_pending *req)
+{
+	struct timespec ts, deadline;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	esdm_rpcc_ts_add_ns(&deadline, (uint64_t)ESDM_RPCC_PIPE_TIMEOUTS *
+				       ESDM_RPCC_IO_TIMEOUT_NS);
+
+	pthread_mutex_lock(&rpc_conn->pending_lock);
+
+	while (!req->done) {
+		/*
+		 * The deadline is checked independently of the progress of
+		 * other requests as their responses may keep the reader busy.
+		 */
+		if (esdm_rpcc_ts_expired(&deadline) &&
+		    esdm_rpcc_pending_unlink(rpc_conn, req)) {
+			rpc_conn->abandoned = true;
+			req->ret = -ETIMEDOUT;
+			req->done = true;
+			break;
+		}
+
+		if (!rpc_conn->reader_active && !rpc_conn->severed) {
+			rpc_conn->reader_active = true;
+			pthread_mutex_unlock(&rpc_conn->pending_lock);
+
+			ret = esdm_rpcc_pipe_read(rpc_conn);
+
+			pthread_mutex_lock(&rpc_conn->pending_lock);
+			rpc_conn->reader_active = false;
+			pthread_cond_broadcast(&rpc_conn->pending_cv);
+
+			if (ret != -EAGAIN)
+				continue;
+		} else {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			esdm_rpcc_ts_add_ns(&ts, ESDM_RPCC_IO_TIMEOUT_NS);
+
+			if (pthread_cond_timedwait(&rpc_conn->pending_cv,
+						   &rpc_conn->pending_lock,
+						   &ts) != ETIMEDOUT)
+				continue;
+		}
+
+		/* Does the caller wants us to interrupt? */
+		if (!req->done && esdm_rpcc_interrupted(rpc_conn) &&
+		    esdm_rpcc_pending_unlink(rpc_conn, req)) {
+			rpc_conn->abandoned = true;
+			req->ret = -EINTR;
+			req->done = true;
+		}
+	}
+
+	ret = req->ret;
+
+	pthread_mutex_unlock(&rpc_conn->pending_lock);
+
+	if (ret == -EINTR) {
+		logger(LOGGER_VERBOSE, LOGGER_C_RPC, "Request interrupted\n");
+		req->closure(ERR_PTR(-EINTR), req->closure_data);
+		ret = 0;
+	} else if (ret == -ETIMEDOUT) {
+		logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+		       "Request ID %u timed out\n", req->request_id);
+		req->closure(ERR_PTR(-ETIMEDOUT), req->closure_data);
+	}
+
+	return ret;
+}
+
+/*
+ * Send the request on the connection and wait for the response. The caller
+ * must hold the lock which is released once the request is sent so that
+ * other callers can send their requests while this caller waits. The unsent
+ * flag is set when the request did not leave the client - a request is one
+ * packet which is sent entirely or not at all.
+ */
+static int esdm_rpcc_pipe_invoke(struct esdm_rpc_client_connection *rpc_conn,
+				 unsigned int method_index,
+				 const ProtobufCMessage *input,
+				 ProtobufCClosure closure, void *closure_data,
+				 bool *unsent)
+{
+	const ProtobufCServiceDescriptor *desc = rpc_conn->service.descriptor;
+	struct esdm_rpcc_pending req = {
+		.method_index = method_index,
+		.raw = esdm_rpcc_raw_supported(rpc_conn, method_index),
+		.message_desc = desc->methods[method_index].output,
+		.input = input,
+		.closure = closure,
+		.closure_data = closure_data,
+		.ret = 0,
+		.done = false,
+	};
+	int ret;
+
+	/* Request ID 0 is used by streams and the shared memory negotiation */
+	if (!++rpc_conn->request_id)
+		rpc_conn->request_id++;
+	req.request_id = rpc_conn->request_id;
+
+	pthread_mutex_lock(&rpc_conn->pending_lock);
+	ret = esdm_rpcc_pending_add(rpc_conn, &req);
+	pthread_mutex_unlock(&rpc_conn->pending_lock);
+
+	if (!ret) {
+		if (req.raw) {
+			/* Send the request without Protobuf-C encoding */
+			ret = esdm_rpcc_raw_send(rpc_conn, method_index,
+						 req.request_id, input);
+		} else {
+			/* Pack the protobuf-c data and send it over the wire */
+			ret = esdm_rpc_client_pack(input, method_index,
+						   req.request_id, rpc_conn);
+		}
+
+		if (ret) {
+			pthread_mutex_lock(&rpc_conn->pending_lock);
+			esdm_rpcc_pending_unlink(rpc_conn, &req);
+			pthread_mutex_unlock(&rpc_conn->pending_lock);
+
+			*unsent = true;
+
+			if (esdm_rpcc_conn_severed(ret))
+				esdm_rpcc_disconnect(rpc_conn);
+		}
+	}
+
+	mutex_w_unlock(&rpc_conn->lock);
+
+	if (ret)
+		return ret;
+
+	return esdm_rpcc_pipe_wait(rpc_conn, &req);
+}
+
 static void
 esdm_client_invoke(ProtobufCService *service, unsigned int method_index,
                    const ProtobufCMessage *input, ProtobufCClosure closure,
                    void *closure_data)
 {
-	const ProtobufCServiceDescriptor *desc = service->descriptor;
-	const ProtobufCMethodDescriptor *method = desc->methods + method_index;
 	struct esdm_rpc_client_connection *rpc_conn =
 		(struct esdm_rpc_client_connection *)service;
+	unsigned int reconnects = 0;
+	bool reused, unsent;
 	int ret;
 
-	mutex_w_lock(&rpc_conn->lock);
+	/* Back off while the server throttles the client */
+	if (esdm_rpcc_throttled(rpc_conn)) {
+		closure(ERR_PTR(-EBUSY), closure_data);
+		return;
+	}
 
 	do {
-		CKINT(esdm_connect_proto_service(rpc_conn));
+		unsent = false;
+
+		mutex_w_lock(&rpc_conn->lock);
+
+		/* Establish connection or reuse the existing one */
+		ret = esdm_connect_proto_service(rpc_conn, &reused);
+		if (ret) {
+			mutex_w_unlock(&rpc_conn->lock);
+		} else if (esdm_rpcc_shm_supported(rpc_conn, method_index)) {
+			/* The ring uses the socket exclusively */
+			ret = esdm_rpcc_drain(rpc_conn);
+			if (!ret) {
+				/* Process the request via the shared memory ring */
+				ret = esdm_rpcc_shm_invoke(rpc_conn, method_index,
+							   input, closure,
+							   closure_data);
+				if (ret)
+					esdm_rpcc_disconnect(rpc_conn);
+
+				/* The closure was informed about the interruption */
+				if (ret == -EINTR)
+					ret = 0;
+			}
 
-		/* Pack the protobuf-c data and send it over the wire */
-		CKINT_LOG(esdm_rpc_client_pack(input, method_index, rpc_conn),
-			  "Sending of data failed: %d\n", ret);
+			mutex_w_unlock(&rpc_conn->lock);
+		} else {
+			/* Pipeline the request - the lock is released */
+			ret = esdm_rpcc_pipe_invoke(rpc_conn, method_index, input,
+						    closure, closure_data,
+						    &unsent);
+		}
+
+		/*
+		 * The server may have closed the idle connection in the mean
+		 * time. Try once to resend the request on a new connection if
+		 * it was not sent. A request the server may have received is
+		 * never sent twice as not all requests are idempotent.
+		 */
+		if (reused && unsent && esdm_rpcc_conn_severed(ret) &&
+		    !reconnects) {
+			reconnects++;
+			ret = EAGAIN;
+			continue;
+		}
 
-		/* Receive data */
-		CKINT_LOG(esdm_rpc_client_read_handler(rpc_conn, method->output,
-						       closure, closure_data),
-			  "Receiving of data failed: %d\n", ret);
+		if (ret == -EHOSTDOWN) {
+			/* The server is unavailable, let the caller fail over */
+			closure(ERR_PTR(ret), closure_data);
+		} else if (ret < 0) {
+			logger(LOGGER_ERR, LOGGER_C_ANY,
+			       "Sending or receiving of data failed: %d\n", ret);
+		}
 	} while (ret == EAGAIN);
+}
+
+/* Send the request for a stream or further credits for it. */
+static int esdm_rpcc_stream_send(struct esdm_rpc_client_connection *rpc_conn,
+				 uint32_t method_index, const void *data,
+				 size_t len)
+{
+	uint8_t buf[sizeof(struct esdm_rpc_proto_cs_header) +
+		    sizeof(struct esdm_rpc_stream_req)];
+	struct esdm_rpc_proto_cs_header cs_header;
+
+	cs_header.method_index = le_bswap32(method_index);
+	cs_header.message_length = le_bswap32((uint32_t)len);
+	cs_header.request_id = le_bswap32(0);
+
+	/* Header and payload are sent as one packet */
+	memcpy(buf, &cs_header, sizeof(cs_header));
+	memcpy(buf + sizeof(cs_header), data, len);
+
+	return esdm_rpc_client_write_data(rpc_conn, buf,
+					  sizeof(cs_header) + len);
+}
+
+/*
+ * Receive the fragments of a stream.
+ *
+ * The random bytes are received directly into the caller's buffer. Every
+ * fragment has the size the server generates for the remaining length, so
+ * the number of fragments still needed is known to both sides. Credits are
+ * granted ahead of time when half of the window is used up, but never for
+ * more fragments than needed.
+ *
+ * Returns the number of bytes received. The connection remains usable only if
+ * all fragments or the error terminating the stream were received.
+ */
+static size_t
+esdm_rpcc_stream_recv(struct esdm_rpc_client_connection *rpc_conn,
+		      uint8_t *buf, size_t len)
+{
+	struct esdm_rpc_proto_sc_header header;
+	struct esdm_rpc_stream_credit credit;
+	struct esdm_rpc_stream_err err;
+	struct iovec iov[2];
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+	size_t received = 0, datalen, needed;
+	ssize_t ret;
+	uint32_t outstanding = ESDM_RPC_STREAM_WINDOW;
+
+	while (received < len) {
+		iov[0].iov_base = &header;
+		iov[0].iov_len = sizeof(header);
+		iov[1].iov_base = buf + received;
+		iov[1].iov_len = min_size(len - received, ESDM_RPC_MAX_DATA);
+		msg.msg_flags = 0;
+
+		ret = recvmsg(rpc_conn->fd, &msg, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			/*
+			 * A read timeout due to SO_RCVTIMEO is treated like
+			 * an interruption - the remainder is requested again.
+			 */
+			logger(LOGGER_DEBUG, LOGGER_C_RPC,
+			       "Receiving stream failed: %s\n",
+			       strerror(errno));
+			goto disconnect;
+		}
+
+		if (ret == 0) {
+			if (!received) {
+				logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+				       "Server does not support streaming\n");
+				rpc_conn->stream_unsupported = true;
+			}
+			goto disconnect;
+		}
+
+		if ((msg.msg_flags & MSG_TRUNC) ||
+		    (size_t)ret < sizeof(header))
+			goto protocol;
+
+		datalen = (size_t)ret - sizeof(header);
+		if (le_bswap32(header.method_index) != ESDM_RPC_STREAM ||
+		    le_bswap32(header.message_length) != datalen ||
+		    le_bswap32(header.request_id) != 0)
+			goto protocol;
+
+		/* The server terminated the stream */
+		if (le_bswap32(header.status_code) !=
+		    PROTOBUF_C_RPC_STATUS_CODE_SUCCESS) {
+			if (datalen != sizeof(err))
+				goto protocol;
+
+			memcpy(&err, buf + received, sizeof(err));
+			memset_secure(buf + received, 0, sizeof(err));
+			logger(LOGGER_DEBUG, LOGGER_C_RPC,
+			       "Stream terminated by server with error %d\n",
+			       (int32_t)le_bswap32((uint32_t)err.ret));
+			break;
+		}
+
+		if (!datalen || !outstanding)
+			goto protocol;
+
+		received += datalen;
+		outstanding--;
+
+		/* Grant further fragments if they are needed */
+		needed = (len - received + ESDM_RPC_MAX_DATA - 1) /
+			 ESDM_RPC_MAX_DATA;
+		if (outstanding <= ESDM_RPC_STREAM_WINDOW / 2 &&
+		    needed > outstanding) {
+			credit.credits = (uint32_t)min_size(
+				ESDM_RPC_STREAM_WINDOW - outstanding,
+				needed - outstanding);
+			outstanding += credit.credits;
+			credit.credits = le_bswap32(credit.credits);
+
+			if (esdm_rpcc_stream_send(rpc_conn,
+						  ESDM_RPC_STREAM_CREDIT,
+						  &credit, sizeof(credit)))
+				goto disconnect;
+		}
+	}
+
+	return received;
+
+protocol:
+	logger(LOGGER_ERR, LOGGER_C_RPC, "Invalid stream data received\n");
+	memset_secure(buf + received, 0, iov[1].iov_len);
+disconnect:
+	/* Remaining fragments must not be taken as answer to a later request */
+	esdm_rpcc_disconnect(rpc_conn);
+	return received;
+}
+
+size_t esdm_rpcc_stream(struct esdm_rpc_client_connection *rpc_conn,
+			enum esdm_rpc_stream_method method,
+			uint8_t *buf, size_t buflen)
+{
+	struct esdm_rpc_stream_req req;
+	size_t received = 0, len = min_size(buflen, ESDM_RPC_STREAM_MAX_LEN);
+	unsigned int reconnects = 0;
+	bool reused;
+	int ret;
+
+	if (len <= ESDM_RPC_MAX_DATA || rpc_conn->stream_unsupported ||
+	    esdm_rpcc_throttled(rpc_conn))
+		return 0;
+
+	req.method_index = le_bswap32(method);
+	req.window = le_bswap32(ESDM_RPC_STREAM_WINDOW);
+	req.len = le_bswap64((uint64_t)len);
+
+	mutex_w_lock(&rpc_conn->lock);
+
+	do {
+		CKINT(esdm_connect_proto_service(rpc_conn, &reused));
+
+		/* The shared memory transport is used instead */
+		if (rpc_conn->shm)
+			goto out;
+
+		/* The stream uses the connection exclusively */
+		ret = esdm_rpcc_drain(rpc_conn);
+		if (ret)
+			continue;
+
+		ret = esdm_rpcc_stream_send(rpc_conn, ESDM_RPC_STREAM, &req,
+					    sizeof(req));
+
+		/*
+		 * The request was not sent as the server closed the idle
+		 * connection, resend it once on a new connection.
+		 */
+		if (reused && esdm_rpcc_conn_severed(ret) && !reconnects) {
+			esdm_rpcc_disconnect(rpc_conn);
+			reconnects++;
+			continue;
+		}
+		CKINT(ret);
+	} while (ret);
+
+	received = esdm_rpcc_stream_recv(rpc_conn, buf, len);
+
+	logger(LOGGER_DEBUG, LOGGER_C_RPC,
+	       "Stream delivered %zu of %zu bytes\n", received, len);
 
 out:
 	mutex_w_unlock(&rpc_conn->lock);
+	return received;
 }
 
 static void esdm_client_destroy(ProtobufCService *service)
@@ -438,17 +1267,15 @@ static void esdm_client_destroy(ProtobufCService *service)
 		(struct esdm_rpc_client_connection *)service;
 
 	mutex_w_lock(&rpc_conn->lock);
-	if (rpc_conn->fd >= 0) {
-		close(rpc_conn->fd);
-		rpc_conn->fd = -1;
-	}
+	esdm_rpcc_disconnect(rpc_conn);
 	mutex_w_unlock(&rpc_conn->lock);
 }
 
-static int esdm_init_proto_service(const ProtobufCServiceDescriptor *descriptor,
-				   const char *socketname,
-				   esdm_rpcc_interrupt_func_t interrupt_func,
-				   struct esdm_rpc_client_connection *rpc_conn)
+int esdm_init_proto_service(const ProtobufCServiceDescriptor *descriptor,
+			    const char *socketname,
+			    esdm_rpcc_interrupt_func_t interrupt_func,
+			    enum esdm_rpcc_transport transport,
+			    struct esdm_rpc_client_connection *rpc_conn)
 {
 	ProtobufCService *service;
 	int ret = 0;
@@ -468,7 +1295,11 @@ static int esdm_init_proto_service(const ProtobufCServiceDescriptor *descriptor,
 	WAIT_QUEUE_INIT(rpc_conn->completion);
 	atomic_set(&rpc_conn->ref_cnt, 0);
 	rpc_conn->fd = -1;
+	rpc_conn->pid = 0;
+	rpc_conn->transport = transport;
+	rpc_conn->shm = NULL;
 	mutex_w_init(&rpc_conn->lock, 0, 1);
+	esdm_rpcc_pipe_init(rpc_conn);
 	atomic_set(&rpc_conn->state, esdm_rpcc_initialized);
 
 out:
@@ -532,6 +1363,7 @@ static int
 esdm_rpcc_init_service(const ProtobufCServiceDescriptor *descriptor,
 		       const char *socketname,
 		       esdm_rpcc_interrupt_func_t interrupt_func,
+		       enum esdm_rpcc_transport transport,
 		       struct esdm_rpc_client_connection **rpc_conn)
 {
 	struct esdm_rpc_client_connection *tmp, *tmp_p;
@@ -543,7 +1375,8 @@ esdm_rpcc_init_service(const ProtobufCServiceDescriptor *descriptor,
 
 	for (i = 0, tmp_p = tmp; i < nodes; i++, tmp_p++) {
 		CKINT(esdm_init_proto_service(descriptor, socketname,
-					      interrupt_func, tmp_p));
+					      interrupt_func, transport,
+					      tmp_p));
 	}
 
 	*rpc_conn = tmp;
@@ -567,6 +1400,17 @@ out:
 	return ret;
 }
 
+static void
+esdm_rpcc_put_service(struct esdm_rpc_client_connection *rpc_conn)
+{
+	if (!rpc_conn)
+		return;
+
+	/* Notify the termination that the last caller is gone */
+	if (atomic_dec_and_test(&rpc_conn->ref_cnt))
+		thread_wake_all(&rpc_conn->completion);
+}
+
 static int
 esdm_rpcc_get_service(struct esdm_rpc_client_connection *rpc_conn_array,
 		      struct esdm_rpc_client_connection **ret_rpc_conn,
@@ -581,37 +1425,24 @@ esdm_rpcc_get_service(struct esdm_rpc_client_connection *rpc_conn_array,
 	rpc_conn_p = rpc_conn_array + esdm_rpcc_curr_node();
 
 	/*
-	 * Wait until the previous call completed - each connection handle is
-	 * has only one caller at one given time. Set the ref_cnt to 1 if
-	 * we obtained the connection handle.
+	 * The connection handle is shared by all callers which pipeline their
+	 * requests on it. The reference prevents its release during the
+	 * termination.
 	 */
-	do {
-		thread_wait_event(&rpc_conn_p->completion,
-				  !atomic_read(&rpc_conn_p->ref_cnt));
-	} while (atomic_cmpxchg(&rpc_conn_p->ref_cnt, 0, 1) != 0);
+	atomic_inc(&rpc_conn_p->ref_cnt);
 
-	if (atomic_read(&rpc_conn_p->state) != esdm_rpcc_initialized)
+	if (atomic_read(&rpc_conn_p->state) != esdm_rpcc_initialized) {
+		esdm_rpcc_put_service(rpc_conn_p);
 		return -ESHUTDOWN;
+	}
 
 	*ret_rpc_conn = rpc_conn_p;
-	rpc_conn_p->interrupt_data = int_data;
+	esdm_rpcc_interrupt_data = int_data;
 
 out:
 	return ret;
 }
 
-static void
-esdm_rpcc_put_service(struct esdm_rpc_client_connection *rpc_conn)
-{
-	if (!rpc_conn)
-		return;
-
-	atomic_set(&rpc_conn->ref_cnt, 0);
-
-	/* Notify all unpriv handler threads that they can become active */
-	thread_wake_all(&rpc_conn->completion);
-}
-
 /******************************************************************************
  * Unprivileged connection
  ******************************************************************************/
@@ -631,11 +1462,20 @@ void esdm_rpcc_put_unpriv_service(struct esdm_rpc_client_connection *rpc_conn)
 }
 
 DSO_PUBLIC
-int esdm_rpcc_init_unpriv_service(esdm_rpcc_interrupt_func_t interrupt_func)
+int esdm_rpcc_init_unpriv_service_transport(
+			esdm_rpcc_interrupt_func_t interrupt_func,
+			enum esdm_rpcc_transport transport)
 {
 	return esdm_rpcc_init_service(&unpriv_access__descriptor,
 				      ESDM_RPC_UNPRIV_SOCKET, interrupt_func,
-				      &unpriv_rpc_conn);
+				      transport, &unpriv_rpc_conn);
+}
+
+DSO_PUBLIC
+int esdm_rpcc_init_unpriv_service(esdm_rpcc_interrupt_func_t interrupt_func)
+{
+	return esdm_rpcc_init_unpriv_service_transport(
+				interrupt_func, esdm_rpcc_transport_socket);
 }
 
 DSO_PUBLIC
@@ -667,6 +1507,7 @@ int esdm_rpcc_init_priv_service(esdm_rpcc_interrupt_func_t interrupt_func)
 {
 	return esdm_rpcc_init_service(&priv_access__descriptor,
 				      ESDM_RPC_PRIV_SOCKET, interrupt_func,
+				      esdm_rpcc_transport_socket,
 				      &priv_rpc_conn);
 }
 
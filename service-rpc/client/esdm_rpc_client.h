@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include "atomic.h"
 #include "mutex_w.h"
@@ -43,19 +44,92 @@ enum {
 
 typedef bool (*esdm_rpcc_interrupt_func_t)(void *interrupt_data);
 
+/*
+ * Transport used for the unprivileged connection:
+ *
+ * esdm_rpcc_transport_socket: All requests are sent via the Unix domain
+ *			       socket.
+ * esdm_rpcc_transport_shm: Random bytes are requested and returned via a
+ *			    shared memory ring negotiated with the server. All
+ *			    other requests use the socket. If the server does
+ *			    not offer the shared memory transport, the socket
+ *			    is used transparently.
+ */
+enum esdm_rpcc_transport {
+	esdm_rpcc_transport_socket,
+	esdm_rpcc_transport_shm,
+};
+
+struct esdm_rpcc_shm;
+struct esdm_rpcc_pending;
+
 struct esdm_rpc_client_connection {
 	ProtobufCService service;
 	char socketname[FILENAME_MAX];
 	int fd;
 
+	/*
+	 * The connection is kept open across invocations. The PID of the
+	 * process that established it allows detecting a fork where the child
+	 * must not share the connection with its parent.
+	 */
+	pid_t pid;
+
+	/* Requested transport and the shared memory transport if established */
+	enum esdm_rpcc_transport transport;
+	struct esdm_rpcc_shm *shm;
+
+	/* Server does not support streamed random bytes */
+	bool stream_unsupported;
+
+	/*
+	 * The server of the current connection does not support the raw
+	 * encoding of random bytes requests.
+	 */
+	bool raw_unsupported;
+
+	/*
+	 * The connection was reset by a raw request, the next connection uses
+	 * the Protobuf-C encoding.
+	 */
+	bool raw_rejected;
+
+	/* The server of the current connection answered a raw request */
+	bool raw_confirmed;
+
+	/*
+	 * The server throttles the client: no requests are sent before
+	 * throttled_until (CLOCK_MONOTONIC) which is protected by pending_lock.
+	 */
+	atomic_t throttled;
+	struct timespec throttled_until;
+
 	/*
 	 * Caller can register function that is invoked to check whether call
 	 * should be interrupted.
 	 */
 	esdm_rpcc_interrupt_func_t interrupt_func;
-	void *interrupt_data;
 
+	/*
+	 * The lock serializes establishing the connection and sending requests.
+	 * The connection is shared by all callers and requests are pipelined:
+	 * every request carries a unique request ID and the caller waits for
+	 * the response after sending it without holding the lock. One of the
+	 * waiting callers reads the responses and hands them to the callers
+	 * they belong to. The list of pending requests and the reader role are
+	 * protected by pending_lock. A request abandoned due to an interruption
+	 * may still be answered - the connection must not be used exclusively
+	 * for a stream or the shared memory transport afterwards.
+	 */
 	mutex_w_t lock;
+	uint32_t request_id;
+	pthread_mutex_t pending_lock;
+	pthread_cond_t pending_cv;
+	struct esdm_rpcc_pending *pending;
+	bool reader_active;
+	bool severed;
+	bool abandoned;
+
 	atomic_t ref_cnt;
 	atomic_t state;
 	struct thread_wait_queue completion;
@@ -72,11 +146,12 @@ static const struct timespec esdm_client_poll_ts = { .tv_sec = 1,
 /**
  * @brief Set maximum number of online nodes
  *
- * The number of online nodes imply the number of parallel service requests.
+ * The number of online nodes imply the number of connections to the server.
  * During initialization of the services with esdm_rpcc_init_unpriv_service
- * and esdm_rpcc_init_priv_service, the memory allowing as many parallel
- * requests to be processed as CPUs are available to be allocated. To limit
- * this, set maximum number of online nodes here.
+ * and esdm_rpcc_init_priv_service, the memory allowing as many connections
+ * as CPUs are available to be allocated. Requests of several threads using
+ * the same connection are pipelined. To limit this, set maximum number of
+ * online nodes here.
  *
  * @param [in] nodes Number of maximum online nodes
  *
@@ -118,6 +193,15 @@ void esdm_rpcc_put_unpriv_service(struct esdm_rpc_client_connection *rpc_conn);
 /**
  * @brief Initiate the memory for accessing the unprivileged RPC connection.
  *
+ * The server may limit the rate of requests of a client. A throttled request
+ * returns -EBUSY. Further requests on the connection return -EBUSY without
+ * contacting the server until the back-off time given by the server passed.
+ *
+ * If the server does not accept connections, requests needing a new
+ * connection return -EHOSTDOWN without contacting the server. One request
+ * probes the server after a back-off time or when the status shared memory
+ * segment reports that the server is operational again.
+ *
  * @param [in] interrupt_func Function pointer invoked to check when the
  *			      operation shall be interrupted.
  *
@@ -125,6 +209,23 @@ void esdm_rpcc_put_unpriv_service(struct esdm_rpc_client_connection *rpc_conn);
  */
 int esdm_rpcc_init_unpriv_service(esdm_rpcc_interrupt_func_t interrupt_func);
 
+/**
+ * @brief Initiate the memory for accessing the unprivileged RPC connection
+ *	  using the given transport.
+ *
+ * This call is identical to esdm_rpcc_init_unpriv_service but allows the
+ * selection of the transport for random bytes.
+ *
+ * @param [in] interrupt_func Function pointer invoked to check when the
+ *			      operation shall be interrupted.
+ * @param [in] transport Transport to be used
+ *
+ * @return 0 on success, < 0 on error
+ */
+int esdm_rpcc_init_unpriv_service_transport(
+			esdm_rpcc_interrupt_func_t interrupt_func,
+			enum esdm_rpcc_transport transport);
+
 /**
  * @brief Release all resources around the RPC connection.
  */
@@ -370,6 +471,135 @@ int esdm_rpcc_write_data(const uint8_t *data_buf, size_t data_buf_len);
 int esdm_rpcc_write_data_int(const uint8_t *data_buf, size_t data_buf_len,
 			     void *int_data);
 
+/******************************************************************************
+ * Asynchronous unprivileged ESDM interface
+ ******************************************************************************/
+
+struct esdm_rpcc_async;
+
+/**
+ * @brief Completion callback of an asynchronous request
+ *
+ * @param [in] ret Number of random bytes written into the buffer of the
+ *		   request or < 0 on error (-ECONNRESET means the connection
+ *		   to the server broke, -EINTR means the server failed to
+ *		   process the request, -EAGAIN means the server does not
+ *		   support the request encoding - in these cases the caller
+ *		   may submit the request again)
+ * @param [in] cb_data Data provided with the submission of the request
+ */
+typedef void (*esdm_rpcc_async_cb_t)(ssize_t ret, void *cb_data);
+
+/**
+ * @brief Allocate a context for asynchronous requests
+ *
+ * The context owns a connection to the unprivileged RPC endpoint of the
+ * ESDM server on which all its requests are pipelined. It is intended for
+ * event-driven callers: requests are submitted without blocking and their
+ * completion callbacks are invoked by esdm_rpcc_async_process when the file
+ * descriptor returned by esdm_rpcc_async_get_fd is readable. A context must
+ * only be used by one thread at a time.
+ *
+ * @param [out] ctx Allocated context
+ * @param [in] max_outstanding Maximum number of submitted requests which
+ *			       did not complete yet - at most 65536
+ *
+ * @return 0 on success, < 0 on error
+ */
+int esdm_rpcc_async_init(struct esdm_rpcc_async **ctx,
+			 unsigned int max_outstanding);
+
+/**
+ * @brief Release the context
+ *
+ * The callbacks of all outstanding requests are invoked with -ECANCELED.
+ *
+ * @param [in] ctx Context to be released
+ */
+void esdm_rpcc_async_fini(struct esdm_rpcc_async *ctx);
+
+/**
+ * @brief Obtain the file descriptor signalling completed requests
+ *
+ * The file descriptor remains the same for the life time of the context,
+ * even if the connection to the server is re-established. It can be
+ * registered with epoll, poll or select for readability.
+ *
+ * @param [in] ctx Context
+ *
+ * @return file descriptor
+ */
+int esdm_rpcc_async_get_fd(struct esdm_rpcc_async *ctx);
+
+/**
+ * @brief Process the responses received for the context
+ *
+ * The function does not block. It completes a pending connection attempt,
+ * sends the requests queued since the socket was full and invokes the
+ * completion callbacks of all requests whose responses were received. The
+ * callbacks may submit new requests.
+ *
+ * @param [in] ctx Context
+ *
+ * @return number of completed requests, < 0 on error
+ */
+int esdm_rpcc_async_process(struct esdm_rpcc_async *ctx);
+
+/**
+ * @brief Asynchronous RPC-version of esdm_get_random_bytes_full
+ *
+ * The buffer must remain accessible until the callback is invoked. A request
+ * delivers at most 65520 bytes, i.e. the callback may report fewer bytes than
+ * requested.
+ *
+ * @param [in] ctx Context
+ * @param [out] buf Buffer to be filled with random bytes
+ * @param [in] buflen Length of buffer
+ * @param [in] cb Completion callback
+ * @param [in] cb_data Data handed to the completion callback
+ *
+ * A request which cannot be sent without blocking is queued and sent by
+ * esdm_rpcc_async_process once the socket is writable.
+ *
+ * @return 0 on successful submission, < 0 on error (-EAGAIN means the server
+ *	   cannot accept the connection without blocking and the caller should
+ *	   retry later, -EBUSY means the maximum number of outstanding requests
+ *	   is reached or the server throttles the client)
+ */
+int esdm_rpcc_async_get_random_bytes_full(struct esdm_rpcc_async *ctx,
+					  uint8_t *buf, size_t buflen,
+					  esdm_rpcc_async_cb_t cb,
+					  void *cb_data);
+
+/**
+ * @brief Asynchronous RPC-version of esdm_get_random_bytes_min
+ *
+ * See esdm_rpcc_async_get_random_bytes_full for the parameters.
+ */
+int esdm_rpcc_async_get_random_bytes_min(struct esdm_rpcc_async *ctx,
+					 uint8_t *buf, size_t buflen,
+					 esdm_rpcc_async_cb_t cb,
+					 void *cb_data);
+
+/**
+ * @brief Asynchronous RPC-version of esdm_get_random_bytes_pr
+ *
+ * See esdm_rpcc_async_get_random_bytes_full for the parameters.
+ */
+int esdm_rpcc_async_get_random_bytes_pr(struct esdm_rpcc_async *ctx,
+					uint8_t *buf, size_t buflen,
+					esdm_rpcc_async_cb_t cb,
+					void *cb_data);
+
+/**
+ * @brief Asynchronous RPC-version of esdm_get_random_bytes
+ *
+ * See esdm_rpcc_async_get_random_bytes_full for the parameters.
+ */
+int esdm_rpcc_async_get_random_bytes(struct esdm_rpcc_async *ctx,
+				     uint8_t *buf, size_t buflen,
+				     esdm_rpcc_async_cb_t cb, void *cb_data);
+
 /******************************************************************************
  * IOCTL handlers
  ******************************************************************************/
@@ -0,0 +1,662 @@
+/* RPC Client: Asynchronous requests for random bytes
+ *
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/*
+ * The asynchronous context pipelines its requests on a non-blocking
+ * connection. Each outstanding request occupies a slot of a table allocated
+ * with the context. The request ID sent to the server combines the slot
+ * index with a generation counter so that the response to a request of a
+ * broken connection is never mistaken for the response to a later request
+ * using the same slot.
+ *
+ * The socket is registered with an epoll instance owned by the context. Its
+ * file descriptor is handed to the caller and remains valid when the
+ * connection is re-established.
+ *
+ * Neither connecting nor sending blocks. A request which cannot be sent
+ * because the connection is still being established or the socket is full is
+ * queued in the order of submission. The socket is then also polled for
+ * writability and esdm_rpcc_async_process sends the queued requests. As the
+ * socket transmits packets, every request is either sent entirely or not at
+ * all.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "conv_be_le.h"
+#include "esdm_rpc_client.h"
+#include "esdm_rpc_client_helper.h"
+#include "esdm_rpc_client_raw.h"
+#include "esdm_rpc_protocol.h"
+#include "esdm_rpc_raw.h"
+#include "esdm_rpc_service.h"
+#include "helper.h"
+#include "logger.h"
+#include "math_helper.h"
+#include "memset_secure.h"
+#include "ptr_err.h"
+#include "ret_checkers.h"
+#include "visibility.h"
+
+#define ESDM_RPCC_ASYNC_SLOT_BITS	16
+#define ESDM_RPCC_ASYNC_SLOT_MASK	((1U << ESDM_RPCC_ASYNC_SLOT_BITS) - 1)
+#define ESDM_RPCC_ASYNC_MAX_OUTSTANDING	(1U << ESDM_RPCC_ASYNC_SLOT_BITS)
+#define ESDM_RPCC_ASYNC_NO_SLOT		UINT32_MAX
+
+struct esdm_rpcc_async_req {
+	/* All random bytes requests share the same layout and wire format */
+	GetRandomBytesRequest msg;
+	uint8_t *buf;
+	size_t buflen;
+	esdm_rpcc_async_cb_t cb;
+	void *cb_data;
+	ssize_t ret;
+	uint32_t request_id;
+	uint32_t next_free;
+	uint32_t next_queued;
+	unsigned int method_index;
+	bool raw;
+	bool cancelled;
+};
+
+struct esdm_rpcc_async {
+	struct esdm_rpc_client_connection rpc_conn;
+	int epfd;
+	uint32_t events;		/* Events the socket is polled for */
+	bool connecting;		/* Connection attempt in progress */
+	uint16_t generation;
+	uint32_t max_outstanding;
+	uint32_t free_slot;
+	uint32_t queue_head;		/* Requests not sent yet */
+	uint32_t queue_tail;
+	struct esdm_rpcc_async_req reqs[];
+};
+
+static void esdm_rpcc_async_closure(const ProtobufCMessage *message,
+				    void *closure_data)
+{
+	struct esdm_rpcc_async_req *req =
+				(struct esdm_rpcc_async_req *)closure_data;
+	/* All random bytes responses share the same layout */
+	const GetRandomBytesResponse *response =
+				(const GetRandomBytesResponse *)message;
+
+	esdm_rpcc_error_check(response, req);
+
+	if (response->ret < 0) {
+		req->ret = response->ret;
+		return;
+	}
+
+	req->ret = (ssize_t)min_size(response->randval.len, req->buflen);
+	memcpy(req->buf, response->randval.data, (size_t)req->ret);
+}
+
+/* Release the slot and invoke the completion callback of the request. */
+static void esdm_rpcc_async_complete(struct esdm_rpcc_async *ctx,
+				     struct esdm_rpcc_async_req *req)
+{
+	esdm_rpcc_async_cb_t cb = req->cb;
+	void *cb_data = req->cb_data;
+	ssize_t ret = req->ret;
+
+	/* The slot is free before the callback which may submit a request */
+	req->request_id = 0;
+	req->cb = NULL;
+	req->cb_data = NULL;
+	req->buf = NULL;
+	req->cancelled = false;
+	req->next_free = ctx->free_slot;
+	ctx->free_slot = (uint32_t)(req - ctx->reqs);
+
+	cb(ret, cb_data);
+}
+
+/*
+ * The connection broke: close it and complete all outstanding requests with
+ * the error. Requests submitted by the callbacks use a new connection.
+ *
+ * Returns the number of completed requests.
+ */
+static int esdm_rpcc_async_sever(struct esdm_rpcc_async *ctx, int err)
+{
+	struct esdm_rpc_client_connection *rpc_conn = &ctx->rpc_conn;
+	struct esdm_rpcc_async_req *req;
+	uint32_t i;
+	int completed = 0;
+	bool raw_pending = false;
+
+	for (i = 0, req = ctx->reqs; i < ctx->max_outstanding; i++, req++) {
+		if (!req->request_id)
+			continue;
+		req->cancelled = true;
+		req->ret = err;
+		raw_pending |= req->raw;
+	}
+
+	/*
+	 * An old server closes the connection on a raw request, the next
+	 * connection uses the Protobuf-C encoding.
+	 */
+	if (err == -ECONNRESET && raw_pending && !rpc_conn->raw_confirmed) {
+		logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+		       "Server may not support the raw encoding\n");
+		rpc_conn->raw_rejected = true;
+	}
+
+	/* Closing the socket removes it from the epoll instance */
+	mutex_w_lock(&rpc_conn->lock);
+	esdm_rpcc_disconnect(rpc_conn);
+	mutex_w_unlock(&rpc_conn->lock);
+	ctx->connecting = false;
+	ctx->events = 0;
+	ctx->queue_head = ESDM_RPCC_ASYNC_NO_SLOT;
+	ctx->queue_tail = ESDM_RPCC_ASYNC_NO_SLOT;
+
+	for (i = 0, req = ctx->reqs; i < ctx->max_outstanding; i++, req++) {
+		if (!req->cancelled)
+			continue;
+		esdm_rpcc_async_complete(ctx, req);
+		completed++;
+	}
+
+	return completed;
+}
+
+/*
+ * Poll the socket for writability only while the connection is established
+ * or requests are queued - a writable socket would wake up the caller
+ * permanently otherwise.
+ */
+static int esdm_rpcc_async_events(struct esdm_rpcc_async *ctx)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = ctx };
+
+	if (ctx->connecting || ctx->queue_head != ESDM_RPCC_ASYNC_NO_SLOT)
+		ev.events |= EPOLLOUT;
+
+	if (ev.events == ctx->events)
+		return 0;
+
+	if (epoll_ctl(ctx->epfd, ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+		      ctx->rpc_conn.fd, &ev) < 0) {
+		int ret = -errno;
+
+		logger(LOGGER_ERR, LOGGER_C_RPC,
+		       "Registering FD %d with epoll failed: %s\n",
+		       ctx->rpc_conn.fd, strerror(-ret));
+		return ret;
+	}
+
+	ctx->events = ev.events;
+	return 0;
+}
+
+static int esdm_rpcc_async_connect(struct esdm_rpcc_async *ctx)
+{
+	struct esdm_rpc_client_connection *rpc_conn = &ctx->rpc_conn;
+	int ret;
+
+	if (rpc_conn->fd >= 0)
+		return 0;
+
+	ret = esdm_rpcc_connect_socket_nonblock(rpc_conn);
+	if (!ret || ret == -EINPROGRESS)
+		esdm_rpcc_raw_connected(rpc_conn);
+	if (ret == -EINPROGRESS) {
+		ctx->connecting = true;
+		ret = 0;
+	} else if (ret) {
+		goto out;
+	}
+
+	ret = esdm_rpcc_async_events(ctx);
+	if (ret) {
+		mutex_w_lock(&rpc_conn->lock);
+		esdm_rpcc_disconnect(rpc_conn);
+		mutex_w_unlock(&rpc_conn->lock);
+		ctx->connecting = false;
+		ctx->events = 0;
+	}
+
+out:
+	return ret;
+}
+
+/* Check whether a pending connection attempt completed */
+static int esdm_rpcc_async_connected(struct esdm_rpcc_async *ctx)
+{
+	struct pollfd pfd = { .fd = ctx->rpc_conn.fd, .events = POLLOUT };
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	if (!ctx->connecting)
+		return 0;
+
+	if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & (POLLOUT | POLLERR |
+						       POLLHUP)))
+		return -EINPROGRESS;
+
+	if (getsockopt(ctx->rpc_conn.fd, SOL_SOCKET, SO_ERROR, &err,
+		       &len) < 0)
+		return -errno;
+	if (err)
+		return -err;
+
+	ctx->connecting = false;
+	return 0;
+}
+
+static int esdm_rpcc_async_send(struct esdm_rpcc_async *ctx,
+				struct esdm_rpcc_async_req *req)
+{
+	int ret;
+
+	if (req->raw) {
+		ret = esdm_rpcc_raw_send(&ctx->rpc_conn, req->method_index,
+					 req->request_id, &req->msg.base);
+	} else {
+		ret = esdm_rpc_client_pack(&req->msg.base, req->method_index,
+					   req->request_id, &ctx->rpc_conn);
+	}
+
+	return (ret == -EWOULDBLOCK) ? -EAGAIN : ret;
+}
+
+static void esdm_rpcc_async_enqueue(struct esdm_rpcc_async *ctx,
+				    struct esdm_rpcc_async_req *req)
+{
+	uint32_t slot = (uint32_t)(req - ctx->reqs);
+
+	req->next_queued = ESDM_RPCC_ASYNC_NO_SLOT;
+	if (ctx->queue_tail == ESDM_RPCC_ASYNC_NO_SLOT)
+		ctx->queue_head = slot;
+	else
+		ctx->reqs[ctx->queue_tail].next_queued = slot;
+	ctx->queue_tail = slot;
+}
+
+/*
+ * Send the queued requests until the socket is full.
+ *
+ * Returns 0 if the connection is usable, < 0 if it broke.
+ */
+static int esdm_rpcc_async_flush(struct esdm_rpcc_async *ctx)
+{
+	struct esdm_rpcc_async_req *req;
+	int ret = esdm_rpcc_async_connected(ctx);
+
+	if (ret == -EINPROGRESS)
+		return 0;
+	if (ret)
+		return ret;
+
+	while (ctx->queue_head != ESDM_RPCC_ASYNC_NO_SLOT) {
+		req = &ctx->reqs[ctx->queue_head];
+
+		ret = esdm_rpcc_async_send(ctx, req);
+		if (ret == -EAGAIN)
+			break;
+		if (ret)
+			return ret;
+
+		ctx->queue_head = req->next_queued;
+		if (ctx->queue_head == ESDM_RPCC_ASYNC_NO_SLOT)
+			ctx->queue_tail = ESDM_RPCC_ASYNC_NO_SLOT;
+	}
+
+	return esdm_rpcc_async_events(ctx);
+}
+
+static int esdm_rpcc_async_submit(struct esdm_rpcc_async *ctx,
+				  unsigned int method_index,
+				  uint8_t *buf, size_t buflen,
+				  esdm_rpcc_async_cb_t cb, void *cb_data)
+{
+	GetRandomBytesRequest msg = GET_RANDOM_BYTES_REQUEST__INIT;
+	struct esdm_rpcc_async_req *req;
+	uint32_t slot;
+	int ret;
+	bool queued;
+
+	CKNULL(ctx, -EINVAL);
+	CKNULL(buf, -EINVAL);
+	CKNULL(cb, -EINVAL);
+
+	if (ctx->free_slot >= ctx->max_outstanding ||
+	    esdm_rpcc_throttled(&ctx->rpc_conn))
+		return -EBUSY;
+
+	CKINT(esdm_rpcc_async_connect(ctx));
+
+	/* Keep the order of submission behind already queued requests */
+	queued = (ctx->connecting ||
+		  ctx->queue_head != ESDM_RPCC_ASYNC_NO_SLOT);
+
+	slot = ctx->free_slot;
+	req = &ctx->reqs[slot];
+
+	/* Request ID 0 is used by streams and the shared memory negotiation */
+	if (!++ctx->generation)
+		ctx->generation++;
+
+	msg.len = min_size(buflen, ESDM_RPC_MAX_DATA);
+	req->msg = msg;
+	req->buf = buf;
+	req->buflen = buflen;
+	req->method_index = method_index;
+	req->raw = esdm_rpcc_raw_supported(&ctx->rpc_conn, method_index);
+	req->request_id = ((uint32_t)ctx->generation <<
+			   ESDM_RPCC_ASYNC_SLOT_BITS) | slot;
+
+	ret = queued ? -EAGAIN : esdm_rpcc_async_send(ctx, req);
+	if (ret == -EAGAIN) {
+		/* Sent by esdm_rpcc_async_process */
+		esdm_rpcc_async_enqueue(ctx, req);
+		ret = esdm_rpcc_async_events(ctx);
+	}
+
+	/*
+	 * A broken connection is detected by esdm_rpcc_async_process which
+	 * completes the outstanding requests.
+	 */
+	if (ret) {
+		if (!queued && ctx->queue_tail == slot) {
+			ctx->queue_head = ESDM_RPCC_ASYNC_NO_SLOT;
+			ctx->queue_tail = ESDM_RPCC_ASYNC_NO_SLOT;
+		}
+		req->request_id = 0;
+		req->buf = NULL;
+		goto out;
+	}
+
+	ctx->free_slot = req->next_free;
+	req->cb = cb;
+	req->cb_data = cb_data;
+	req->ret = -EFAULT;
+
+out:
+	return ret;
+}
+
+DSO_PUBLIC
+int esdm_rpcc_async_process(struct esdm_rpcc_async *ctx)
+{
+	ProtobufCAllocator esdm_rpc_client_allocator = {
+		.alloc = &esdm_rpc_alloc,
+		.free = &esdm_rpc_free,
+		.allocator_data = NULL,
+	};
+	BUFFER_INIT(tls);
+	struct esdm_rpc_proto_sc *received_data;
+	struct esdm_rpc_proto_sc_header *header;
+	struct esdm_rpcc_async_req *req;
+	uint8_t buf[ESDM_RPC_MAX_MSG_SIZE + sizeof(*received_data)]
+						__aligned(sizeof(uint64_t));
+	uint8_t unpacked[ESDM_RPC_MAX_MSG_SIZE + 128]
+						__aligned(sizeof(uint64_t));
+	ssize_t received;
+	uint32_t slot;
+	int completed = 0;
+
+	if (!ctx)
+		return -EINVAL;
+
+	tls.buf = unpacked;
+	tls.len = sizeof(unpacked);
+	esdm_rpc_client_allocator.allocator_data = &tls;
+
+	/* The cast is appropriate as the buffer is aligned to 64 bits. */
+	received_data = (struct esdm_rpc_proto_sc *)buf;
+	header = &received_data->header;
+
+	/* Complete the connection attempt and send the queued requests */
+	if (ctx->rpc_conn.fd >= 0) {
+		int ret = esdm_rpcc_async_flush(ctx);
+
+		if (ret) {
+			logger(LOGGER_DEBUG, LOGGER_C_RPC,
+			       "Sending queued requests failed: %s\n",
+			       strerror(-ret));
+			return esdm_rpcc_async_sever(ctx, ret);
+		}
+	}
+
+	while (ctx->rpc_conn.fd >= 0 && !ctx->connecting) {
+		received = recv(ctx->rpc_conn.fd, buf, sizeof(buf),
+				MSG_TRUNC | MSG_DONTWAIT);
+		if (received < 0) {
+			int errsv = errno;
+
+			if (errsv == EINTR)
+				continue;
+			if (errsv == EAGAIN || errsv == EWOULDBLOCK)
+				break;
+
+			logger(LOGGER_DEBUG, LOGGER_C_RPC, "Read failed: %s\n",
+			       strerror(errsv));
+			completed += esdm_rpcc_async_sever(ctx, -errsv);
+			break;
+		}
+
+		/* Server closed the connection */
+		if (received == 0) {
+			completed += esdm_rpcc_async_sever(ctx, -ECONNRESET);
+			break;
+		}
+
+		if ((size_t)received > sizeof(buf) ||
+		    (size_t)received < sizeof(*received_data) ||
+		    le_bswap32(header->message_length) !=
+		    (size_t)received - sizeof(*received_data)) {
+			logger(LOGGER_ERR, LOGGER_C_RPC,
+			       "Invalid response received\n");
+			memset_secure(buf, 0,
+				      min_size((size_t)received, sizeof(buf)));
+			completed += esdm_rpcc_async_sever(ctx, -EFAULT);
+			break;
+		}
+
+		/* Convert incoming data to LE */
+		header->status_code = le_bswap32(header->status_code);
+		header->message_length = le_bswap32(header->message_length);
+		header->method_index = le_bswap32(header->method_index);
+		header->request_id = le_bswap32(header->request_id);
+
+		slot = header->request_id & ESDM_RPCC_ASYNC_SLOT_MASK;
+		if (!header->request_id || slot >= ctx->max_outstanding ||
+		    ctx->reqs[slot].request_id != header->request_id) {
+			logger(LOGGER_DEBUG, LOGGER_C_RPC,
+			       "Response to unknown request ID %u discarded\n",
+			       header->request_id);
+			memset_secure(buf, 0, (size_t)received);
+			continue;
+		}
+
+		req = &ctx->reqs[slot];
+		if (header->status_code ==
+		    PROTOBUF_C_RPC_STATUS_CODE_TOO_MANY_PENDING) {
+			esdm_rpcc_throttle(&ctx->rpc_conn, header,
+					   received_data->data);
+			esdm_rpcc_async_closure(ERR_PTR(-EBUSY), req);
+		} else if (req->raw) {
+			int ret = esdm_rpcc_raw_deliver(req->method_index,
+							&req->msg.base, header,
+							received_data->data,
+							esdm_rpcc_async_closure,
+							req);
+
+			if (ret == -EOPNOTSUPP) {
+				/* The caller may resubmit the request */
+				ctx->rpc_conn.raw_unsupported = true;
+				req->ret = -EAGAIN;
+			} else if (ret) {
+				req->ret = -EFAULT;
+			} else {
+				ctx->rpc_conn.raw_confirmed = true;
+			}
+		} else if (header->status_code ==
+			   PROTOBUF_C_RPC_STATUS_CODE_SUCCESS) {
+			const ProtobufCMessageDescriptor *desc =
+				unpriv_access__descriptor.methods[
+					req->method_index].output;
+			ProtobufCMessage *msg = protobuf_c_message_unpack(
+				desc, &esdm_rpc_client_allocator,
+				header->message_length, received_data->data);
+
+			esdm_rpcc_async_closure(msg ? msg : ERR_PTR(-EFAULT),
+						req);
+			if (msg) {
+				protobuf_c_message_free_unpacked(
+					msg, &esdm_rpc_client_allocator);
+			}
+		} else {
+			logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+			       "Server returned with an error\n");
+			esdm_rpcc_async_closure(ERR_PTR(-EINTR), req);
+		}
+
+		memset_secure(buf, 0, (size_t)received);
+		memset_secure(tls.buf, 0, tls.consumed);
+		tls.consumed = 0;
+
+		esdm_rpcc_async_complete(ctx, req);
+		completed++;
+	}
+
+	return completed;
+}
+
+DSO_PUBLIC
+int esdm_rpcc_async_get_fd(struct esdm_rpcc_async *ctx)
+{
+	if (!ctx)
+		return -EINVAL;
+
+	return ctx->epfd;
+}
+
+DSO_PUBLIC
+int esdm_rpcc_async_get_random_bytes_full(struct esdm_rpcc_async *ctx,
+					  uint8_t *buf, size_t buflen,
+					  esdm_rpcc_async_cb_t cb,
+					  void *cb_data)
+{
+	return esdm_rpcc_async_submit(ctx, esdm_rpc_raw_get_random_bytes_full,
+				      buf, buflen, cb, cb_data);
+}
+
+DSO_PUBLIC
+int esdm_rpcc_async_get_random_bytes_min(struct esdm_rpcc_async *ctx,
+					 uint8_t *buf, size_t buflen,
+					 esdm_rpcc_async_cb_t cb,
+					 void *cb_data)
+{
+	return esdm_rpcc_async_submit(ctx, esdm_rpc_raw_get_random_bytes_min,
+				      buf, buflen, cb, cb_data);
+}
+
+DSO_PUBLIC
+int esdm_rpcc_async_get_random_bytes_pr(struct esdm_rpcc_async *ctx,
+					uint8_t *buf, size_t buflen,
+					esdm_rpcc_async_cb_t cb,
+					void *cb_data)
+{
+	return esdm_rpcc_async_submit(ctx, esdm_rpc_raw_get_random_bytes_pr,
+				      buf, buflen, cb, cb_data);
+}
+
+DSO_PUBLIC
+int esdm_rpcc_async_get_random_bytes(struct esdm_rpcc_async *ctx,
+				     uint8_t *buf, size_t buflen,
+				     esdm_rpcc_async_cb_t cb, void *cb_data)
+{
+	return esdm_rpcc_async_submit(ctx, esdm_rpc_raw_get_random_bytes,
+				      buf, buflen, cb, cb_data);
+}
+
+DSO_PUBLIC
+void esdm_rpcc_async_fini(struct esdm_rpcc_async *ctx)
+{
+	if (!ctx)
+		return;
+
+	esdm_rpcc_async_sever(ctx, -ECANCELED);
+	esdm_fini_proto_service(&ctx->rpc_conn);
+
+	if (ctx->epfd >= 0)
+		close(ctx->epfd);
+
+	free(ctx);
+}
+
+DSO_PUBLIC
+int esdm_rpcc_async_init(struct esdm_rpcc_async **ctx,
+			 unsigned int max_outstanding)
+{
+	struct esdm_rpcc_async *tmp = NULL;
+	uint32_t i;
+	int ret = 0;
+
+	CKNULL(ctx, -EINVAL);
+
+	if (!max_outstanding ||
+	    max_outstanding > ESDM_RPCC_ASYNC_MAX_OUTSTANDING)
+		return -EINVAL;
+
+	tmp = calloc(1, sizeof(*tmp) + max_outstanding * sizeof(tmp->reqs[0]));
+	CKNULL(tmp, -ENOMEM);
+
+	tmp->max_outstanding = max_outstanding;
+	tmp->free_slot = 0;
+	tmp->queue_head = ESDM_RPCC_ASYNC_NO_SLOT;
+	tmp->queue_tail = ESDM_RPCC_ASYNC_NO_SLOT;
+	for (i = 0; i < max_outstanding; i++)
+		tmp->reqs[i].next_free = i + 1;
+
+	tmp->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (tmp->epfd < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	/* The connection is established with the first request */
+	CKINT(esdm_init_proto_service(&unpriv_access__descriptor,
+				      ESDM_RPC_UNPRIV_SOCKET, NULL,
+				      esdm_rpcc_transport_socket,
+				      &tmp->rpc_conn));
+
+	*ctx = tmp;
+
+out:
+	if (ret && tmp) {
+		if (tmp->epfd >= 0)
+			close(tmp->epfd);
+		free(tmp);
+	}
+	return ret;
+}
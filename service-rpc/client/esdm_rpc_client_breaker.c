@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/shm.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atomic.h"
+#include "atomic_bool.h"
+#include "bool.h"
+#include "esdm_rpc_client_breaker.h"
+#include "esdm_rpc_service.h"
+#include "logger.h"
+
+/* Back-off time of the open breaker in milliseconds */
+#define ESDM_RPCC_BREAKER_MIN_MS	10
+#define ESDM_RPCC_BREAKER_MAX_MS	2000
+
+enum esdm_rpcc_breaker_state {
+	esdm_rpcc_breaker_closed,
+	esdm_rpcc_breaker_open,
+	esdm_rpcc_breaker_half_open,
+};
+
+static atomic_t esdm_rpcc_breaker_state =
+				ATOMIC_INIT(esdm_rpcc_breaker_closed);
+
+/* The following variables are protected by esdm_rpcc_breaker_lock */
+static pthread_mutex_t esdm_rpcc_breaker_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec esdm_rpcc_breaker_retry_at;
+static uint32_t esdm_rpcc_breaker_failures = 0;
+static uint64_t esdm_rpcc_breaker_jitter = 0;
+static const struct esdm_shm_status *esdm_rpcc_breaker_status = NULL;
+static int esdm_rpcc_breaker_shmid = -1;
+/* Was a segment attached since the breaker opened? */
+static bool esdm_rpcc_breaker_status_new = false;
+
+/* Was the attached segment removed by a terminated server? */
+static bool esdm_rpcc_breaker_status_removed(void)
+{
+	struct shmid_ds ds;
+
+	if (shmctl(esdm_rpcc_breaker_shmid, IPC_STAT, &ds) < 0)
+		return true;
+#ifdef SHM_DEST
+	if (ds.shm_perm.mode & SHM_DEST)
+		return true;
+#endif
+
+	return false;
+}
+
+/*
+ * Attach the status shared memory segment of the server. It is optional: if
+ * it is not available, the breaker only relies on the back-off time.
+ *
+ * A restarted server removes the segment of its predecessor and creates a new
+ * one. Thus, a segment of a server that is not operational is checked for
+ * being replaced and the new segment is attached.
+ */
+static void esdm_rpcc_breaker_status_attach(void)
+{
+	const struct esdm_shm_status *status = esdm_rpcc_breaker_status;
+	bool removed = false;
+	key_t key;
+	void *tmp;
+	int shmid;
+
+	if (status) {
+		removed = esdm_rpcc_breaker_status_removed();
+		if (!removed && atomic_bool_read(&status->operational))
+			return;
+	}
+
+	key = esdm_ftok(ESDM_SHM_NAME, ESDM_SHM_STATUS);
+	shmid = shmget(key, sizeof(struct esdm_shm_status), 0);
+
+	if (status) {
+		/* The server did not yet become operational */
+		if (!removed && shmid == esdm_rpcc_breaker_shmid)
+			return;
+
+		shmdt(status);
+		esdm_rpcc_breaker_status = NULL;
+		esdm_rpcc_breaker_shmid = -1;
+	}
+
+	if (shmid < 0)
+		return;
+
+	tmp = shmat(shmid, NULL, SHM_RDONLY);
+	if (tmp == (void *)-1)
+		return;
+
+	status = tmp;
+	if (status->version != ESDM_SHM_STATUS_VERSION) {
+		shmdt(tmp);
+		return;
+	}
+
+	esdm_rpcc_breaker_status = status;
+	esdm_rpcc_breaker_shmid = shmid;
+	esdm_rpcc_breaker_status_new = true;
+}
+
+/*
+ * A restarted server creates a new status segment. An operational server with
+ * a new segment since the breaker opened is likely to accept connections
+ * again. The change indicator of the segment is not considered: it is
+ * incremented by a running server for every status change and would let
+ * the callers bypass the back-off time.
+ */
+static bool esdm_rpcc_breaker_server_restarted(void)
+{
+	const struct esdm_shm_status *status;
+
+	esdm_rpcc_breaker_status_attach();
+	status = esdm_rpcc_breaker_status;
+
+	return (status && esdm_rpcc_breaker_status_new &&
+		atomic_bool_read(&status->operational));
+}
+
+uint32_t esdm_rpcc_backoff_ms(uint32_t min_ms, uint32_t max_ms,
+			      uint32_t attempt)
+{
+	struct timespec ts;
+	uint64_t x;
+	uint32_t backoff = min_ms;
+
+	while (attempt-- > 1 && backoff < max_ms)
+		backoff <<= 1;
+	if (backoff > max_ms)
+		backoff = max_ms;
+
+	/*
+	 * The jitter only desynchronizes the clients - a xorshift generator
+	 * seeded with the time suffices as the ESDM may not be available.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	x = __atomic_load_n(&esdm_rpcc_breaker_jitter, __ATOMIC_RELAXED);
+	x ^= (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 32);
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	__atomic_store_n(&esdm_rpcc_breaker_jitter, x, __ATOMIC_RELAXED);
+
+	return backoff / 2 + (uint32_t)(x % (backoff / 2 + 1));
+}
+
+int esdm_rpcc_breaker_enter(void)
+{
+	struct timespec ts;
+	bool due;
+
+	switch (atomic_read(&esdm_rpcc_breaker_state)) {
+	case esdm_rpcc_breaker_closed:
+		return 0;
+	case esdm_rpcc_breaker_open:
+		break;
+	default:
+		/* Another caller probes the server */
+		return -EHOSTDOWN;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	pthread_mutex_lock(&esdm_rpcc_breaker_lock);
+	due = (ts.tv_sec > esdm_rpcc_breaker_retry_at.tv_sec ||
+	       (ts.tv_sec == esdm_rpcc_breaker_retry_at.tv_sec &&
+		ts.tv_nsec >= esdm_rpcc_breaker_retry_at.tv_nsec) ||
+	       esdm_rpcc_breaker_server_restarted());
+	pthread_mutex_unlock(&esdm_rpcc_breaker_lock);
+
+	if (!due)
+		return -EHOSTDOWN;
+
+	/* Only one caller becomes the probe */
+	if (atomic_cmpxchg(&esdm_rpcc_breaker_state, esdm_rpcc_breaker_open,
+			   esdm_rpcc_breaker_half_open) !=
+	    esdm_rpcc_breaker_open)
+		return -EHOSTDOWN;
+
+	logger(LOGGER_DEBUG, LOGGER_C_RPC, "Probing ESDM server\n");
+
+	return 0;
+}
+
+/*
+ * Errors of the connection attempt indicating that the server is down. A full
+ * listen backlog (-EAGAIN) shows a server which is busy but running.
+ */
+static bool esdm_rpcc_breaker_unavailable(int ret)
+{
+	return (ret == -ENOENT || ret == -ECONNREFUSED || ret == -ETIMEDOUT);
+}
+
+void esdm_rpcc_breaker_leave(int ret)
+{
+	struct timespec ts;
+	uint32_t backoff;
+
+	if (!esdm_rpcc_breaker_unavailable(ret)) {
+		/* The server is reachable, the breaker closes */
+		if (atomic_xchg(&esdm_rpcc_breaker_state,
+				esdm_rpcc_breaker_closed) !=
+		    esdm_rpcc_breaker_closed) {
+			pthread_mutex_lock(&esdm_rpcc_breaker_lock);
+			esdm_rpcc_breaker_failures = 0;
+			pthread_mutex_unlock(&esdm_rpcc_breaker_lock);
+
+			logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+			       "ESDM server available again\n");
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&esdm_rpcc_breaker_lock);
+
+	/* Another caller already opened the breaker */
+	if (atomic_read(&esdm_rpcc_breaker_state) == esdm_rpcc_breaker_open)
+		goto out;
+
+	esdm_rpcc_breaker_failures++;
+	backoff = esdm_rpcc_backoff_ms(ESDM_RPCC_BREAKER_MIN_MS,
+				       ESDM_RPCC_BREAKER_MAX_MS,
+				       esdm_rpcc_breaker_failures);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += (time_t)(backoff / 1000);
+	ts.tv_nsec += (long)(backoff % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	esdm_rpcc_breaker_retry_at = ts;
+
+	esdm_rpcc_breaker_status_attach();
+	esdm_rpcc_breaker_status_new = false;
+
+	atomic_set(&esdm_rpcc_breaker_state, esdm_rpcc_breaker_open);
+
+	logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+	       "ESDM server unavailable (%d), failing over for %u ms\n", ret,
+	       backoff);
+
+out:
+	pthread_mutex_unlock(&esdm_rpcc_breaker_lock);
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef ESDM_RPC_CLIENT_BREAKER_H
+#define ESDM_RPC_CLIENT_BREAKER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Circuit breaker for establishing connections to the ESDM server
+ * ================================================================
+ *
+ * The breaker is shared by all connections of the process:
+ *
+ *	* closed: connections are established normally.
+ *
+ *	* open: the server was found unavailable. Connection attempts fail
+ *	  immediately with -EHOSTDOWN which lets callers use their fallback
+ *	  without delay. The breaker stays open for an exponentially growing
+ *	  back-off time with jitter.
+ *
+ *	* half-open: one caller probes the server after the back-off time
+ *	  passed while all others keep failing immediately. A successful probe
+ *	  closes the breaker, a failed one opens it again.
+ *
+ * The probe is started before the back-off time passed when a new status
+ * shared memory segment indicates that the server was restarted and is
+ * operational.
+ *
+ * A server with a full listen backlog is busy but not down - it does not
+ * open the breaker.
+ */
+
+/**
+ * @brief Check whether a connection to the server may be attempted
+ *
+ * If 0 is returned, the caller must report the result of its connection
+ * attempt with esdm_rpcc_breaker_leave.
+ *
+ * @return 0 if the connection may be attempted, -EHOSTDOWN while the server
+ *	   is considered unavailable
+ */
+int esdm_rpcc_breaker_enter(void);
+
+/**
+ * @brief Report the result of a connection attempt
+ *
+ * @param [in] ret Result of the connection attempt - an error indicating that
+ *		   the server does not accept connections opens the breaker
+ */
+void esdm_rpcc_breaker_leave(int ret);
+
+/**
+ * @brief Exponential back-off time with jitter
+ *
+ * @param [in] min_ms Back-off time of the first attempt
+ * @param [in] max_ms Upper bound of the back-off time
+ * @param [in] attempt Number of the failed attempt starting with 1
+ *
+ * @return Back-off time in milliseconds between half and full of the
+ *	   exponential back-off time
+ */
+uint32_t esdm_rpcc_backoff_ms(uint32_t min_ms, uint32_t max_ms,
+			      uint32_t attempt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESDM_RPC_CLIENT_BREAKER_H */
@@ -20,6 +20,10 @@
 #ifndef ESDM_RPC_CLIENT_HELPER_H
 #define ESDM_RPC_CLIENT_HELPER_H
 
+#include "esdm_rpc_client.h"
+#include "esdm_rpc_protocol.h"
+#include "esdm_rpc_stream.h"
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -38,6 +42,130 @@ extern "C"
 		return;							\
 	}
 
+/**
+ * @brief Initialize a connection handle for the given service
+ *
+ * @param [in] descriptor Service descriptor
+ * @param [in] socketname Unix domain socket of the server
+ * @param [in] interrupt_func Interrupt function - may be NULL
+ * @param [in] transport Transport for random bytes
+ * @param [in] rpc_conn Connection handle to be initialized
+ *
+ * @return 0 on success, < 0 on error
+ */
+int esdm_init_proto_service(const ProtobufCServiceDescriptor *descriptor,
+			    const char *socketname,
+			    esdm_rpcc_interrupt_func_t interrupt_func,
+			    enum esdm_rpcc_transport transport,
+			    struct esdm_rpc_client_connection *rpc_conn);
+
+/**
+ * @brief Close the connection and release the connection handle
+ *
+ * @param [in] rpc_conn Connection handle
+ */
+void esdm_fini_proto_service(struct esdm_rpc_client_connection *rpc_conn);
+
+/**
+ * @brief Connect the socket of the connection handle to the server
+ *
+ * @param [in] rpc_conn Connection handle
+ *
+ * @return 0 on success, < 0 on error
+ */
+int esdm_rpcc_connect_socket(struct esdm_rpc_client_connection *rpc_conn);
+
+/**
+ * @brief Connect the socket of the connection handle without blocking
+ *
+ * The socket is non-blocking. The connection attempt is not repeated if the
+ * server cannot accept it immediately.
+ *
+ * @param [in] rpc_conn Connection handle
+ *
+ * @return 0 on success, -EINPROGRESS if the connection is established
+ *	   asynchronously - the socket becomes writable when the attempt
+ *	   completed and SO_ERROR reports its result, < 0 on error (-EAGAIN
+ *	   means the listen queue of the server is full)
+ */
+int esdm_rpcc_connect_socket_nonblock(
+				struct esdm_rpc_client_connection *rpc_conn);
+
+/**
+ * @brief Close the connection to the server
+ *
+ * The caller must hold the lock of the connection handle.
+ *
+ * @param [in] rpc_conn Connection handle
+ */
+void esdm_rpcc_disconnect(struct esdm_rpc_client_connection *rpc_conn);
+
+/**
+ * @brief Send a Protobuf-C encoded request with one system call
+ *
+ * @param [in] message Request message
+ * @param [in] method_index Method of the service
+ * @param [in] request_id ID of the request returned with the response
+ * @param [in] rpc_conn Connection handle
+ *
+ * @return 0 on success, < 0 on error
+ */
+int esdm_rpc_client_pack(const ProtobufCMessage *message,
+			 unsigned int method_index, uint32_t request_id,
+			 struct esdm_rpc_client_connection *rpc_conn);
+
+/**
+ * @brief Check whether the caller wants to interrupt the current request
+ *
+ * The interrupt function registered for the connection is invoked with the
+ * interrupt data the calling thread handed to the service request.
+ *
+ * @param [in] rpc_conn Connection handle
+ *
+ * @return true if the request shall be interrupted
+ */
+bool esdm_rpcc_interrupted(struct esdm_rpc_client_connection *rpc_conn);
+
+/**
+ * @brief Record that the server throttles the client
+ *
+ * @param [in] rpc_conn Connection handle
+ * @param [in] header Header of the PROTOBUF_C_RPC_STATUS_CODE_TOO_MANY_PENDING
+ *		      response in host byte order
+ * @param [in] data Payload of the response
+ */
+void esdm_rpcc_throttle(struct esdm_rpc_client_connection *rpc_conn,
+			const struct esdm_rpc_proto_sc_header *header,
+			const uint8_t *data);
+
+/**
+ * @brief Check whether the client has to back off
+ *
+ * @param [in] rpc_conn Connection handle
+ *
+ * @return true while the server throttles the client
+ */
+bool esdm_rpcc_throttled(struct esdm_rpc_client_connection *rpc_conn);
+
+/**
+ * @brief Obtain random bytes with one streamed request
+ *
+ * Requests not exceeding ESDM_RPC_MAX_DATA are not streamed. If the server
+ * does not support streaming, the DRNG cannot deliver random bytes or the
+ * stream is interrupted, fewer bytes than requested are returned. The caller
+ * obtains the remainder with individual requests which also report the error.
+ *
+ * @param [in] rpc_conn Connection handle
+ * @param [in] method Requested random bytes
+ * @param [out] buf Buffer to be filled
+ * @param [in] buflen Length of the buffer
+ *
+ * @return number of bytes received
+ */
+size_t esdm_rpcc_stream(struct esdm_rpc_client_connection *rpc_conn,
+			enum esdm_rpc_stream_method method,
+			uint8_t *buf, size_t buflen);
+
 #ifdef __cplusplus
 }
 #endif
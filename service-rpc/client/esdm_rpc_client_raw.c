@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "conv_be_le.h"
+#include "esdm_rpc_client_raw.h"
+#include "esdm_rpc_protocol.h"
+#include "esdm_rpc_raw.h"
+#include "helper.h"
+#include "logger.h"
+
+bool esdm_rpcc_raw_supported(struct esdm_rpc_client_connection *rpc_conn,
+			     unsigned int method_index)
+{
+	if (rpc_conn->raw_unsupported ||
+	    rpc_conn->service.descriptor != &unpriv_access__descriptor)
+		return false;
+
+	switch (method_index) {
+	case esdm_rpc_raw_get_random_bytes_full:
+	case esdm_rpc_raw_get_random_bytes_min:
+	case esdm_rpc_raw_get_random_bytes_pr:
+	case esdm_rpc_raw_get_random_bytes:
+	case esdm_rpc_raw_get_seed:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void esdm_rpcc_raw_connected(struct esdm_rpc_client_connection *rpc_conn)
+{
+	rpc_conn->raw_unsupported = rpc_conn->raw_rejected;
+	rpc_conn->raw_rejected = false;
+}
+
+static void esdm_rpcc_raw_closure(unsigned int method_index, int64_t ret,
+				  uint8_t *buf, size_t len,
+				  ProtobufCClosure closure, void *closure_data)
+{
+	GetRandomBytesFullResponse full = GET_RANDOM_BYTES_FULL_RESPONSE__INIT;
+	GetRandomBytesMinResponse min = GET_RANDOM_BYTES_MIN_RESPONSE__INIT;
+	GetRandomBytesPrResponse pr = GET_RANDOM_BYTES_PR_RESPONSE__INIT;
+	GetRandomBytesResponse plain = GET_RANDOM_BYTES_RESPONSE__INIT;
+	GetSeedResponse seed = GET_SEED_RESPONSE__INIT;
+
+	switch (method_index) {
+	case esdm_rpc_raw_get_random_bytes_full:
+		full.ret = ret;
+		full.randval.data = buf;
+		full.randval.len = len;
+		closure(&full.base, closure_data);
+		break;
+	case esdm_rpc_raw_get_random_bytes_min:
+		min.ret = ret;
+		min.randval.data = buf;
+		min.randval.len = len;
+		closure(&min.base, closure_data);
+		break;
+	case esdm_rpc_raw_get_random_bytes_pr:
+		pr.ret = ret;
+		pr.randval.data = buf;
+		pr.randval.len = len;
+		closure(&pr.base, closure_data);
+		break;
+	case esdm_rpc_raw_get_seed:
+		seed.ret = ret;
+		seed.randval.data = buf;
+		seed.randval.len = len;
+		closure(&seed.base, closure_data);
+		break;
+	case esdm_rpc_raw_get_random_bytes:
+	default:
+		plain.ret = ret;
+		plain.randval.data = buf;
+		plain.randval.len = len;
+		closure(&plain.base, closure_data);
+		break;
+	}
+}
+
+int esdm_rpcc_raw_send(struct esdm_rpc_client_connection *rpc_conn,
+		       unsigned int method_index, uint32_t request_id,
+		       const ProtobufCMessage *input)
+{
+	/* All supported requests start with the same layout */
+	const GetRandomBytesFullRequest *request =
+				(const GetRandomBytesFullRequest *)input;
+	struct esdm_rpc_proto_cs_header cs_header;
+	struct esdm_rpc_raw_req req;
+	struct iovec iov[2];
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+	ssize_t rc;
+
+	cs_header.method_index = le_bswap32(ESDM_RPC_RAW);
+	cs_header.message_length = le_bswap32(sizeof(req));
+	cs_header.request_id = le_bswap32(request_id);
+
+	req.method_index = le_bswap32(method_index);
+	req.flags = (method_index == esdm_rpc_raw_get_seed) ?
+		le_bswap32(((const GetSeedRequest *)input)->flags) : 0;
+	req.len = le_bswap64(request->len);
+
+	/* Header and request are sent as one packet */
+	iov[0].iov_base = &cs_header;
+	iov[0].iov_len = sizeof(cs_header);
+	iov[1].iov_base = &req;
+	iov[1].iov_len = sizeof(req);
+
+	do {
+		rc = sendmsg(rpc_conn->fd, &msg, MSG_NOSIGNAL);
+	} while (rc < 0 && errno == EINTR);
+
+	/* EPIPE or ECONNRESET let the caller resend on a new connection */
+	if (rc < 0)
+		return -errno;
+	if ((size_t)rc != sizeof(cs_header) + sizeof(req))
+		return -EIO;
+
+	return 0;
+}
+
+int esdm_rpcc_raw_deliver(unsigned int method_index,
+			  const ProtobufCMessage *input,
+			  const struct esdm_rpc_proto_sc_header *header,
+			  uint8_t *data, ProtobufCClosure closure,
+			  void *closure_data)
+{
+	const GetRandomBytesFullRequest *request =
+				(const GetRandomBytesFullRequest *)input;
+	struct esdm_rpc_raw_resp resp;
+	size_t datalen;
+	int64_t ret;
+
+	if (header->method_index != ESDM_RPC_RAW)
+		goto invalid;
+
+	/* The server does not offer the method in the raw encoding */
+	if (header->status_code == PROTOBUF_C_RPC_STATUS_CODE_SERVICE_FAILED &&
+	    !header->message_length) {
+		logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+		       "Server rejected the raw encoding\n");
+		return -EOPNOTSUPP;
+	}
+
+	if (header->status_code != PROTOBUF_C_RPC_STATUS_CODE_SUCCESS ||
+	    header->message_length < sizeof(resp))
+		goto invalid;
+
+	memcpy(&resp, data, sizeof(resp));
+	datalen = header->message_length - sizeof(resp);
+	ret = (int64_t)le_bswap64((uint64_t)resp.ret);
+
+	/* Random bytes are only returned as requested */
+	if (method_index != esdm_rpc_raw_get_seed &&
+	    (datalen != ((ret > 0) ? (uint64_t)ret : 0) ||
+	     datalen > request->len))
+		goto invalid;
+
+	logger(LOGGER_DEBUG, LOGGER_C_RPC,
+	       "Client received raw response: return code %" PRId64 ", length %zu\n",
+	       ret, datalen);
+
+	esdm_rpcc_raw_closure(method_index, ret, data + sizeof(resp), datalen,
+			      closure, closure_data);
+
+	return 0;
+
+invalid:
+	logger(LOGGER_ERR, LOGGER_C_RPC, "Raw encoding response invalid\n");
+	return -EFAULT;
+}
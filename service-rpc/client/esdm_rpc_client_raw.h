@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef ESDM_RPC_CLIENT_RAW_H
+#define ESDM_RPC_CLIENT_RAW_H
+
+#include "esdm_rpc_client.h"
+#include "esdm_rpc_protocol.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Is the request sent with the raw encoding?
+ */
+bool esdm_rpcc_raw_supported(struct esdm_rpc_client_connection *rpc_conn,
+			     unsigned int method_index);
+
+/**
+ * @brief A new connection to the server is established
+ *
+ * The raw encoding is tried again on the new connection unless the previous
+ * connection was reset by a raw request - the request is resent on the new
+ * connection which therefore uses the Protobuf-C encoding.
+ *
+ * @param [in] rpc_conn Connection handle
+ */
+void esdm_rpcc_raw_connected(struct esdm_rpc_client_connection *rpc_conn);
+
+/**
+ * @brief Send the request with the raw encoding
+ *
+ * @param [in] rpc_conn Connection handle
+ * @param [in] method_index Method of the unprivileged service
+ * @param [in] request_id ID of the request returned with the response
+ * @param [in] input Request message
+ *
+ * @return 0 on success, < 0 on error
+ */
+int esdm_rpcc_raw_send(struct esdm_rpc_client_connection *rpc_conn,
+		       unsigned int method_index, uint32_t request_id,
+		       const ProtobufCMessage *input);
+
+/**
+ * @brief Hand the response in the raw encoding to the closure
+ *
+ * @param [in] method_index Method of the unprivileged service
+ * @param [in] input Request message
+ * @param [in] header Response header in host byte order
+ * @param [in] data Response data following the header
+ * @param [in] closure Closure to be invoked with the response
+ * @param [in] closure_data Data handed to the closure
+ *
+ * @return 0 on success, -EOPNOTSUPP if the server does not offer the method
+ *	   in the raw encoding, -EFAULT if the response is invalid - in both
+ *	   error cases the closure was not invoked
+ */
+int esdm_rpcc_raw_deliver(unsigned int method_index,
+			  const ProtobufCMessage *input,
+			  const struct esdm_rpc_proto_sc_header *header,
+			  uint8_t *data, ProtobufCClosure closure,
+			  void *closure_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESDM_RPC_CLIENT_RAW_H */
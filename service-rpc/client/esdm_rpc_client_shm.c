@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "conv_be_le.h"
+#include "esdm_rpc_client_helper.h"
+#include "esdm_rpc_client_shm.h"
+#include "esdm_rpc_protocol.h"
+#include "esdm_rpc_shm.h"
+#include "logger.h"
+#include "memset_secure.h"
+#include "ptr_err.h"
+#include "ret_checkers.h"
+
+/*
+ * Time in milliseconds to wait for a response before checking for an
+ * interrupt - it is in the order of the receive timeout of the socket. As
+ * long as the socket is not closed by the server, the response is waited
+ * for.
+ */
+#define ESDM_RPCC_SHM_POLL_MS 256
+
+struct esdm_rpcc_shm {
+	struct esdm_rpc_shm *mem;
+	int cs_efd;
+	int sc_efd;
+	uint32_t request_id;
+};
+
+void esdm_rpcc_shm_free(struct esdm_rpc_client_connection *rpc_conn)
+{
+	struct esdm_rpcc_shm *shm = rpc_conn->shm;
+
+	if (!shm)
+		return;
+
+	if (shm->mem)
+		munmap(shm->mem, sizeof(*shm->mem));
+	if (shm->cs_efd >= 0)
+		close(shm->cs_efd);
+	if (shm->sc_efd >= 0)
+		close(shm->sc_efd);
+	free(shm);
+	rpc_conn->shm = NULL;
+}
+
+/* Map the memory and take ownership of the received file descriptors */
+static int esdm_rpcc_shm_attach(struct esdm_rpc_client_connection *rpc_conn,
+				const int *fds)
+{
+	struct esdm_rpcc_shm *shm;
+	struct stat sb;
+	void *mem;
+	int ret = 0;
+
+	if (fstat(fds[0], &sb) < 0 ||
+	    (size_t)sb.st_size < sizeof(struct esdm_rpc_shm))
+		return -EINVAL;
+
+	mem = mmap(NULL, sizeof(struct esdm_rpc_shm), PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fds[0], 0);
+	if (mem == MAP_FAILED)
+		return -errno;
+
+	shm = calloc(1, sizeof(*shm));
+	if (!shm) {
+		munmap(mem, sizeof(struct esdm_rpc_shm));
+		return -ENOMEM;
+	}
+
+	shm->mem = mem;
+	shm->cs_efd = fds[1];
+	shm->sc_efd = fds[2];
+	rpc_conn->shm = shm;
+
+	if (shm->mem->version != ESDM_RPC_SHM_VERSION) {
+		logger(LOGGER_WARN, LOGGER_C_RPC,
+		       "Shared memory transport version mismatch\n");
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	/* The memory stays mapped, the memfd is not needed any more */
+	close(fds[0]);
+	madvise(shm->mem, sizeof(*shm->mem), MADV_DONTDUMP);
+
+out:
+	if (ret) {
+		/* File descriptors are closed by the caller */
+		shm->cs_efd = -1;
+		shm->sc_efd = -1;
+		esdm_rpcc_shm_free(rpc_conn);
+	}
+	return ret;
+}
+
+int esdm_rpcc_shm_negotiate(struct esdm_rpc_client_connection *rpc_conn)
+{
+	struct esdm_rpc_proto_cs_header cs_header = {
+		.method_index = le_bswap32(ESDM_RPC_SHM_NEGOTIATE),
+		.message_length = 0,
+		.request_id = 0,
+	};
+	struct esdm_rpc_proto_sc_header sc_header;
+	int fds[ESDM_RPC_SHM_NUM_FDS], nfds = 0, i, ret = 0;
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { .iov_base = &sc_header,
+			     .iov_len = sizeof(sc_header) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+			      .msg_control = control.buf,
+			      .msg_controllen = sizeof(control.buf) };
+	struct cmsghdr *cmsg;
+	ssize_t rc;
+
+	if (write(rpc_conn->fd, &cs_header, sizeof(cs_header)) !=
+	    sizeof(cs_header))
+		return (errno == EPIPE) ? -ECONNRESET : -EIO;
+
+	do {
+		rc = recvmsg(rpc_conn->fd, &msg, MSG_CMSG_CLOEXEC);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc < 0)
+		return (errno == ECONNRESET) ? -ECONNRESET : -ETIMEDOUT;
+
+	/* A server not knowing the transport closes the connection */
+	if (rc == 0)
+		return -ECONNRESET;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		nfds = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+		if (nfds > ESDM_RPC_SHM_NUM_FDS)
+			nfds = ESDM_RPC_SHM_NUM_FDS;
+		memcpy(fds, CMSG_DATA(cmsg), (size_t)nfds * sizeof(int));
+		break;
+	}
+
+	if (rc != sizeof(sc_header) ||
+	    le_bswap32(sc_header.status_code) !=
+	    PROTOBUF_C_RPC_STATUS_CODE_SUCCESS) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	if (nfds != ESDM_RPC_SHM_NUM_FDS || (msg.msg_flags & MSG_CTRUNC)) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	CKINT(esdm_rpcc_shm_attach(rpc_conn, fds));
+	nfds = 0;
+
+	logger(LOGGER_DEBUG, LOGGER_C_RPC,
+	       "Shared memory transport for socket %s established\n",
+	       rpc_conn->socketname);
+
+out:
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+	return ret;
+}
+
+bool esdm_rpcc_shm_supported(struct esdm_rpc_client_connection *rpc_conn,
+			     unsigned int method_index)
+{
+	if (!rpc_conn->shm)
+		return false;
+
+	switch (method_index) {
+	case esdm_rpc_shm_get_random_bytes_full:
+	case esdm_rpc_shm_get_random_bytes_min:
+	case esdm_rpc_shm_get_random_bytes:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Wait for the doorbell of the server or for the socket being severed */
+static int esdm_rpcc_shm_wait(struct esdm_rpc_client_connection *rpc_conn)
+{
+	struct esdm_rpcc_shm *shm = rpc_conn->shm;
+	struct pollfd pfd[2] = {
+		{ .fd = shm->sc_efd, .events = POLLIN },
+		{ .fd = rpc_conn->fd, .events = POLLIN },
+	};
+	uint64_t val;
+	int ret;
+
+	do {
+		ret = poll(pfd, 2, ESDM_RPCC_SHM_POLL_MS);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+	if (ret == 0)
+		return -ETIMEDOUT;
+
+	/* The server closed the connection */
+	if (pfd[1].revents)
+		return -ECONNRESET;
+
+	/* Reset the doorbell */
+	if (read(shm->sc_efd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		return -errno;
+
+	return 0;
+}
+
+static void esdm_rpcc_shm_closure(unsigned int method_index, int64_t ret,
+				  uint8_t *buf, ProtobufCClosure closure,
+				  void *closure_data)
+{
+	GetRandomBytesFullResponse full = GET_RANDOM_BYTES_FULL_RESPONSE__INIT;
+	GetRandomBytesMinResponse min = GET_RANDOM_BYTES_MIN_RESPONSE__INIT;
+	GetRandomBytesResponse plain = GET_RANDOM_BYTES_RESPONSE__INIT;
+	size_t len = (ret > 0) ? (size_t)ret : 0;
+
+	switch (method_index) {
+	case esdm_rpc_shm_get_random_bytes_full:
+		full.ret = ret;
+		full.randval.data = buf;
+		full.randval.len = len;
+		closure(&full.base, closure_data);
+		break;
+	case esdm_rpc_shm_get_random_bytes_min:
+		min.ret = ret;
+		min.randval.data = buf;
+		min.randval.len = len;
+		closure(&min.base, closure_data);
+		break;
+	case esdm_rpc_shm_get_random_bytes:
+	default:
+		plain.ret = ret;
+		plain.randval.data = buf;
+		plain.randval.len = len;
+		closure(&plain.base, closure_data);
+		break;
+	}
+}
+
+int esdm_rpcc_shm_invoke(struct esdm_rpc_client_connection *rpc_conn,
+			 unsigned int method_index,
+			 const ProtobufCMessage *input,
+			 ProtobufCClosure closure, void *closure_data)
+{
+	/* All supported requests share the same layout */
+	const GetRandomBytesFullRequest *request =
+				(const GetRandomBytesFullRequest *)input;
+	struct esdm_rpcc_shm *shm = rpc_conn->shm;
+	struct esdm_rpc_shm *mem = shm->mem;
+	struct esdm_rpc_shm_req req = {
+		.method_index = method_index,
+		.request_id = ++shm->request_id,
+		.len = request->len,
+	};
+	struct esdm_rpc_shm_resp resp = { 0 };
+	uint8_t buf[ESDM_RPC_MAX_DATA];
+	uint64_t val = 1;
+	uint32_t off = 0;
+	int ret;
+
+	/* Submit the request and ring the doorbell */
+	CKINT(esdm_rpc_shm_ring_write(&mem->cs, mem->cs_data,
+				      ESDM_RPC_SHM_CS_MASK, (uint8_t *)&req,
+				      sizeof(req), true, &off));
+	if (write(shm->cs_efd, &val, sizeof(val)) < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	/*
+	 * Wait for the response. A slow server is not a reason to resubmit
+	 * the request on a new connection: it would only add to the load of
+	 * the server. The wait only ends when the server closes the socket.
+	 */
+	while ((ret = esdm_rpc_shm_ring_read(&mem->sc, mem->sc_data,
+					     ESDM_RPC_SHM_SC_MASK,
+					     (uint8_t *)&resp,
+					     sizeof(resp))) == -EAGAIN) {
+		ret = esdm_rpcc_shm_wait(rpc_conn);
+		if (ret != -ETIMEDOUT) {
+			CKINT(ret);
+			continue;
+		}
+
+		/* Does the caller wants us to interrupt? */
+		if (esdm_rpcc_interrupted(rpc_conn)) {
+			logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+			       "Request interrupted\n");
+			closure(ERR_PTR(-EINTR), closure_data);
+
+			/* The connection must be dropped by the caller */
+			ret = -EINTR;
+			goto out;
+		}
+	}
+	CKINT(ret);
+
+	if (resp.request_id != req.request_id ||
+	    resp.method_index != req.method_index ||
+	    (resp.ret > 0 && (uint64_t)resp.ret > req.len) ||
+	    resp.ret > (int64_t)sizeof(buf)) {
+		logger(LOGGER_ERR, LOGGER_C_RPC,
+		       "Shared memory transport response invalid\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	if (resp.ret > 0) {
+		CKINT(esdm_rpc_shm_ring_read(&mem->sc, mem->sc_data,
+					     ESDM_RPC_SHM_SC_MASK, buf,
+					     (uint32_t)resp.ret));
+	}
+
+	esdm_rpcc_shm_closure(method_index, resp.ret, buf, closure,
+			      closure_data);
+
+out:
+	if (resp.ret > 0)
+		memset_secure(buf, 0, (size_t)resp.ret);
+	return ret;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef ESDM_RPC_CLIENT_SHM_H
+#define ESDM_RPC_CLIENT_SHM_H
+
+#include "esdm_rpc_client.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Request the shared memory transport on a freshly connected socket
+ *
+ * @param [in] rpc_conn Connection handle
+ *
+ * @return 0 on success, -EOPNOTSUPP if the server rejected the transport and
+ *	   the socket remains usable, -ECONNRESET if the server does not know
+ *	   the transport, any other error leaves the socket in an undefined state
+ */
+int esdm_rpcc_shm_negotiate(struct esdm_rpc_client_connection *rpc_conn);
+
+/**
+ * @brief Release the shared memory transport of the connection
+ */
+void esdm_rpcc_shm_free(struct esdm_rpc_client_connection *rpc_conn);
+
+/**
+ * @brief Is the request served by the shared memory transport?
+ */
+bool esdm_rpcc_shm_supported(struct esdm_rpc_client_connection *rpc_conn,
+			     unsigned int method_index);
+
+/**
+ * @brief Process the request via the shared memory transport
+ *
+ * @param [in] rpc_conn Connection handle
+ * @param [in] method_index Method of the unprivileged service
+ * @param [in] input Request message
+ * @param [in] closure Closure to be invoked with the response
+ * @param [in] closure_data Data handed to the closure
+ *
+ * The function waits for the response until it arrives, the server closes
+ * the connection (-ECONNRESET) or the interrupt callback of the connection
+ * requests to stop waiting (-EINTR).
+ *
+ * @return 0 on success, < 0 on error - in case of an error the connection
+ *	   must be closed
+ */
+int esdm_rpcc_shm_invoke(struct esdm_rpc_client_connection *rpc_conn,
+			 unsigned int method_index,
+			 const ProtobufCMessage *input,
+			 ProtobufCClosure closure, void *closure_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESDM_RPC_CLIENT_SHM_H */
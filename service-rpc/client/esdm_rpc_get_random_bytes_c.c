@@ -64,11 +64,20 @@ ssize_t esdm_rpcc_get_random_bytes_int(uint8_t *buf, size_t buflen,
 	GetRandomBytesRequest msg = GET_RANDOM_BYTES_REQUEST__INIT;
 	struct esdm_rpc_client_connection *rpc_conn = NULL;
 	struct esdm_get_random_bytes_buf buffer;
-	size_t maxbuflen = buflen, orig_buflen = buflen;
+	size_t maxbuflen = buflen, orig_buflen = buflen, received;
 	ssize_t ret = 0;
 
 	CKINT(esdm_rpcc_get_unpriv_service(&rpc_conn, int_data));
 
+	/* Large requests are streamed, the remainder is requested below */
+	do {
+		received = esdm_rpcc_stream(rpc_conn, esdm_rpc_stream_get_random_bytes,
+					    buf, buflen);
+		esdm_test_shm_status_add_rpc_client_written(received);
+		buflen -= received;
+		buf += received;
+	} while (received);
+
 	while (buflen) {
 		buffer.ret = -ETIMEDOUT;
 		buffer.buf = buf;
@@ -37,11 +37,11 @@ void esdm_rpc_get_random_bytes_full(UnprivAccess_Service *service,
 {
 	GetRandomBytesFullResponse response =
 					GET_RANDOM_BYTES_FULL_RESPONSE__INIT;
-	uint8_t rndval[ESDM_RPC_MAX_DATA];
+	uint8_t *rndval = esdm_rpc_server_data_buf(closure_data);
 	(void) service;
 
-	if (request == NULL || request->len > sizeof(rndval)) {
-		response.ret = -(int32_t)sizeof(rndval);
+	if (request == NULL || request->len > ESDM_RPC_MAX_DATA) {
+		response.ret = -(int32_t)ESDM_RPC_MAX_DATA;
 		closure(&response, closure_data);
 	} else {
 		response.ret = esdm_get_random_bytes_full_noblock(
@@ -55,6 +55,6 @@ void esdm_rpc_get_random_bytes_full(UnprivAccess_Service *service,
 		}
 		closure(&response, closure_data);
 
-		memset_secure(rndval, 0, sizeof(rndval));
+		memset_secure(rndval, 0, request->len);
 	}
 }
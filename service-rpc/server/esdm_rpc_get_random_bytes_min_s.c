@@ -19,6 +19,7 @@
 
 #include "esdm.h"
 #include "esdm_rpc_protocol.h"
+#include "esdm_rpc_server.h"
 #include "esdm_rpc_service.h"
 #include "memset_secure.h"
 #include "unpriv_access.pb-c.h"
@@ -30,11 +31,11 @@ void esdm_rpc_get_random_bytes_min(UnprivAccess_Service *service,
 {
 	GetRandomBytesMinResponse response =
 					GET_RANDOM_BYTES_MIN_RESPONSE__INIT;
-	uint8_t rndval[ESDM_RPC_MAX_DATA];
+	uint8_t *rndval = esdm_rpc_server_data_buf(closure_data);
 	(void) service;
 
-	if (request == NULL || request->len > sizeof(rndval)) {
-		response.ret = -(int32_t)sizeof(rndval);
+	if (request == NULL || request->len > ESDM_RPC_MAX_DATA) {
+		response.ret = -(int32_t)ESDM_RPC_MAX_DATA;
 		closure (&response, closure_data);
 	} else {
 		response.ret = (int)esdm_get_random_bytes_min_noblock(
@@ -48,6 +49,6 @@ void esdm_rpc_get_random_bytes_min(UnprivAccess_Service *service,
 		}
 		closure(&response, closure_data);
 
-		memset_secure(rndval, 0, sizeof(rndval));
+		memset_secure(rndval, 0, request->len);
 	}
 }
@@ -19,6 +19,7 @@
 
 #include "esdm.h"
 #include "esdm_rpc_protocol.h"
+#include "esdm_rpc_server.h"
 #include "esdm_rpc_service.h"
 #include "memset_secure.h"
 #include "unpriv_access.pb-c.h"
@@ -29,11 +30,11 @@ void esdm_rpc_get_random_bytes(UnprivAccess_Service *service,
 			       void *closure_data)
 {
 	GetRandomBytesResponse response = GET_RANDOM_BYTES_RESPONSE__INIT;
-	uint8_t rndval[ESDM_RPC_MAX_DATA];
+	uint8_t *rndval = esdm_rpc_server_data_buf(closure_data);
 	(void) service;
 
-	if (request == NULL || request->len > sizeof(rndval)) {
-		response.ret = -(int32_t)sizeof(rndval);
+	if (request == NULL || request->len > ESDM_RPC_MAX_DATA) {
+		response.ret = -(int32_t)ESDM_RPC_MAX_DATA;
 		closure (&response, closure_data);
 	} else {
 		response.ret = (int)esdm_get_random_bytes(rndval, request->len);
@@ -46,6 +47,6 @@ void esdm_rpc_get_random_bytes(UnprivAccess_Service *service,
 		}
 		closure(&response, closure_data);
 
-		memset_secure(rndval, 0, sizeof(rndval));
+		memset_secure(rndval, 0, request->len);
 	}
 }
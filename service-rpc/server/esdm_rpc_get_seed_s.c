@@ -36,15 +36,20 @@ void esdm_rpc_get_seed(UnprivAccess_Service *service,
 		       void *closure_data)
 {
 	GetSeedResponse response = GET_SEED_RESPONSE__INIT;
-	uint64_t rndval[ESDM_RPC_MAX_DATA / sizeof(uint64_t)];
+	uint64_t *rndval = esdm_rpc_server_data_buf(closure_data);
 	(void) service;
 
-	if (request == NULL || request->len > sizeof(rndval)) {
-		response.ret = -(int32_t)sizeof(rndval);
+	if (request == NULL || request->len > ESDM_RPC_MAX_DATA) {
+		response.ret = -(int32_t)ESDM_RPC_MAX_DATA;
 		closure(&response, closure_data);
 	} else {
+		size_t used = request->len;
+
 		/* TODO: make 280 dependent on output size */
 		memset(rndval, 0, 280);
+		if (used < 280)
+			used = 280;
+
 		response.ret = esdm_get_seed(rndval, request->len,
 					     request->flags |
 					     ESDM_GET_SEED_NONBLOCK);
@@ -60,6 +65,6 @@ void esdm_rpc_get_seed(UnprivAccess_Service *service,
 
 		closure(&response, closure_data);
 
-		memset_secure(rndval, 0, sizeof(rndval));
+		memset_secure(rndval, 0, used);
 	}
 }
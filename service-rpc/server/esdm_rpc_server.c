@@ -20,19 +20,24 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <protobuf-c/protobuf-c.h>
-#include <semaphore.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
 #include <sys/shm.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "atomic.h"
@@ -41,34 +46,92 @@
 #include "esdm.h"
 #include "esdm_config.h"
 #include "esdm_rpc_protocol.h"
+#include "esdm_rpc_raw.h"
 #include "esdm_rpc_server.h"
+#include "esdm_rpc_server_acct.h"
 #include "esdm_rpc_server_linux.h"
+#include "esdm_rpc_server_shm.h"
 #include "esdm_rpc_service.h"
+#include "esdm_rpc_shm.h"
+#include "esdm_rpc_stream.h"
 #include "helper.h"
 #include "linux_support.h"
 #include "logger.h"
+#include "math_helper.h"
 #include "memset_secure.h"
 #include "privileges.h"
 #include "ret_checkers.h"
 #include "queue.h"
 #include "threading_support.h"
 
+/*
+ * Both, the listening sockets and the connected sockets are registered with
+ * the epoll reactor. The type field is the first member of both structures
+ * to allow the reactor to identify the object referenced by an event.
+ */
+enum esdm_rpcs_epoll_type {
+	esdm_rpcs_epoll_listener,
+	esdm_rpcs_epoll_connection,
+};
+
 struct esdm_rpcs {
+	enum esdm_rpcs_epoll_type type;
 	ProtobufCService *service;
 	int server_listening_fd;
 };
 
 struct esdm_rpcs_connection {
+	enum esdm_rpcs_epoll_type type;
 	struct esdm_rpcs *proto;
 	int child_fd;
-	ProtobufCAllocator *rpc_allocator;
-	uint32_t method_index;
-	uint32_t request_id;
+
+	/*
+	 * One reference is held by the epoll registration, another one by
+	 * every worker still processing a request after it handed the
+	 * connection back to the reactor. The last one releases the connection.
+	 */
+	atomic_t ref_cnt;
+
+	/*
+	 * Optional shared memory transport: if present, the socket and the
+	 * doorbell of the transport are combined in shm_epfd which is
+	 * registered with the reactor instead of the socket.
+	 */
+	struct esdm_rpcs_shm *shm;
+	int shm_epfd;
+
+	/*
+	 * Account of an unprivileged peer used for fair scheduling and rate
+	 * limiting. The link is used while the connection is parked.
+	 */
+	struct esdm_rpcs_acct *acct;
+	struct esdm_rpcs_acct_wait acct_wait;
+};
+
+/*
+ * I/O arena of one RPC worker holding all buffers needed to process a
+ * request. The buffers are used in the following order:
+ *	req: received request including its header
+ *	unpacked: allocator backing the unpacked Protobuf-C request message
+ *	data: random bytes or other data generated by the service handler
+ *	resp: packed response message or fragment of a stream
+ */
+struct esdm_rpcs_arena {
+	uint8_t req[sizeof(struct esdm_rpc_proto_cs) + ESDM_RPC_MAX_MSG_SIZE]
+						__aligned(sizeof(uint64_t));
+	uint8_t unpacked[ESDM_RPC_MAX_MSG_SIZE + 128]
+						__aligned(sizeof(uint64_t));
+	uint64_t data[ESDM_RPC_MAX_DATA / sizeof(uint64_t)];
+	uint8_t resp[ESDM_RPC_MAX_MSG_SIZE] __aligned(sizeof(uint64_t));
 };
 
-struct esdm_rpcs_write_buf {
-	ProtobufCBuffer base;
+/* Request being processed - it is the closure data of the service handlers */
+struct esdm_rpcs_request {
 	struct esdm_rpcs_connection *rpc_conn;
+	struct esdm_rpcs_arena *arena;
+	ProtobufCAllocator *rpc_allocator;
+	uint32_t method_index;
+	uint32_t request_id;
 };
 
 enum esdm_rpcs_init_state {
@@ -81,9 +144,136 @@ static atomic_t
 esdm_rpc_init_state = ATOMIC_INIT(esdm_rpcs_state_uninitialized);
 static DECLARE_WAIT_QUEUE(esdm_rpc_thread_init_wait);
 
+/* Epoll reactor shared by the privileged and unprivileged interface */
+static int esdm_rpcs_epfd = -1;
+static atomic_t esdm_rpcs_workers = ATOMIC_INIT(0);
+
+/*
+ * Maximum time in milliseconds a worker waits for the remainder of a
+ * partially received request or for the peer to accept response data.
+ */
+#define ESDM_RPCS_IO_TIMEOUT_MS 2000
+
+/*
+ * Minimum rate in bytes per second at which a client must consume a stream
+ * after the initial I/O timeout. A client granting credits more slowly is
+ * disconnected as it would occupy a worker thread for a long time.
+ */
+#define ESDM_RPCS_STREAM_MIN_RATE (4UL << 20)
+
+/*
+ * Default stack size of the RPC worker threads. All I/O buffers of a worker
+ * are held in its arena which allows a stack much smaller than the default
+ * of the system.
+ */
+#define ESDM_RPCS_STACK_SIZE (256 * 1024)
+static size_t esdm_rpcs_stack_size = ESDM_RPCS_STACK_SIZE;
+
+/*
+ * Pool of I/O arenas allocated before the privileges are dropped to lock them
+ * into memory irrespective of the memory lock limit of the server user. Every
+ * worker claims one arena from the pool and uses it for all connections it
+ * serves. A worker exceeding the pool allocates its own arena.
+ */
+static struct esdm_rpcs_arena *esdm_rpcs_arenas = NULL;
+static uint32_t esdm_rpcs_arenas_num = 0;
+static atomic_t esdm_rpcs_arenas_used = ATOMIC_INIT(0);
+static __thread struct esdm_rpcs_arena *esdm_rpcs_arena = NULL;
+
 static pid_t server_pid = -1;
 static atomic_t server_exit = ATOMIC_INIT(0);
 
+int esdm_rpc_server_stack_size_set(size_t stack_size)
+{
+	if (stack_size && stack_size < (size_t)PTHREAD_STACK_MIN)
+		return -EINVAL;
+
+	esdm_rpcs_stack_size = stack_size;
+	return 0;
+}
+
+/* Size of one arena rounded up to full pages */
+static size_t esdm_rpcs_arena_len(void)
+{
+	size_t len = sizeof(struct esdm_rpcs_arena);
+	long pagesize = sysconf(_SC_PAGESIZE);
+
+	if (pagesize > 0)
+		len = (len + (size_t)pagesize - 1) & ~((size_t)pagesize - 1);
+
+	return len;
+}
+
+/*
+ * Map memory for the given number of arenas. The memory is excluded from core
+ * dumps and locked to prevent paging out of the random data to swap space.
+ * Locking the memory also faults in all pages up front.
+ */
+static struct esdm_rpcs_arena *esdm_rpcs_arena_map(uint32_t num)
+{
+	struct esdm_rpcs_arena *arenas;
+	size_t len = esdm_rpcs_arena_len() * num;
+
+	arenas = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (arenas == MAP_FAILED)
+		return NULL;
+
+#ifdef MADV_DONTDUMP
+	madvise(arenas, len, MADV_DONTDUMP);
+#endif
+	if (mlock(arenas, len)) {
+		logger(LOGGER_WARN, LOGGER_C_RPC,
+		       "Locking RPC I/O arenas of %zu bytes failed: %s\n", len,
+		       strerror(errno));
+	}
+
+	return arenas;
+}
+
+/* Allocate the pool of I/O arenas for the given number of workers. */
+static void esdm_rpcs_arena_init(uint32_t workers)
+{
+	esdm_rpcs_arenas = esdm_rpcs_arena_map(workers);
+	if (!esdm_rpcs_arenas) {
+		logger(LOGGER_WARN, LOGGER_C_RPC,
+		       "Allocation of RPC I/O arena pool failed\n");
+		return;
+	}
+	esdm_rpcs_arenas_num = workers;
+
+	logger(LOGGER_DEBUG, LOGGER_C_RPC,
+	       "RPC I/O arena pool for %u workers allocated\n", workers);
+}
+
+/* Obtain the I/O arena of the calling worker. */
+static struct esdm_rpcs_arena *esdm_rpcs_arena_get(void)
+{
+	uint32_t idx;
+
+	if (esdm_rpcs_arena)
+		return esdm_rpcs_arena;
+
+	idx = (uint32_t)atomic_inc(&esdm_rpcs_arenas_used) - 1;
+	if (idx < esdm_rpcs_arenas_num) {
+		esdm_rpcs_arena = (struct esdm_rpcs_arena *)
+			((uint8_t *)esdm_rpcs_arenas +
+			 (size_t)idx * esdm_rpcs_arena_len());
+	} else {
+		/* Workers live as long as the server, the arena is not freed */
+		esdm_rpcs_arena = esdm_rpcs_arena_map(1);
+	}
+
+	return esdm_rpcs_arena;
+}
+
+void *esdm_rpc_server_data_buf(void *closure_data)
+{
+	struct esdm_rpcs_request *request = closure_data;
+
+	return request->arena->data;
+}
+
 /* Remove a potentially left-over old Unix Domain socket. */
 static void esdm_rpcs_stale_socket(const char *path, struct sockaddr *addr,
 				   unsigned addr_len)
@@ -116,6 +306,39 @@ static void esdm_rpcs_stale_socket(const char *path, struct sockaddr *addr,
 	unlink(path);
 }
 
+/*
+ * Wait for the non-blocking connection to become ready for the given events.
+ *
+ * The connected sockets are non-blocking as they are served by the epoll
+ * reactor. Yet, once a request is partially received or a response is
+ * partially sent, the worker completes the operation. The timeout ensures
+ * that a client cannot occupy a worker by starting but never completing the
+ * transmission.
+ */
+static int esdm_rpcs_poll_fd(int fd, short events, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = events };
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+	if (ret == 0)
+		return -ETIMEDOUT;
+	if (pfd.revents & (POLLERR | POLLNVAL))
+		return -EPIPE;
+
+	return 0;
+}
+
+static int esdm_rpcs_wait_fd(int fd, short events)
+{
+	return esdm_rpcs_poll_fd(fd, events, ESDM_RPCS_IO_TIMEOUT_MS);
+}
+
 /* Write data into an RPC connection. */
 static int esdm_rpcs_write_data(struct esdm_rpcs_connection *rpc_conn,
 				const uint8_t *data, size_t len)
@@ -127,10 +350,19 @@ static int esdm_rpcs_write_data(struct esdm_rpcs_connection *rpc_conn,
 		return -EINVAL;
 
 	do {
-		ret = write(rpc_conn->child_fd, data, len);
+		ret = write(rpc_conn->child_fd, data + written, len - written);
 		if (ret < 0) {
 			int errsv = errno;
 
+			if (errsv == EAGAIN || errsv == EINTR) {
+				int ret2 = esdm_rpcs_wait_fd(rpc_conn->child_fd,
+							     POLLOUT);
+
+				if (!ret2)
+					continue;
+				errsv = -ret2;
+			}
+
 			logger(LOGGER_VERBOSE, LOGGER_C_RPC,
 			       "Writting of data to file descriptor %d failed: %s\n",
 			       rpc_conn->child_fd, strerror(errsv));
@@ -140,173 +372,761 @@ static int esdm_rpcs_write_data(struct esdm_rpcs_connection *rpc_conn,
 		written += (size_t)ret;
 	} while (written < len);
 
+	esdm_rpcs_acct_charge(rpc_conn->acct, len);
 	logger(LOGGER_DEBUG2, LOGGER_C_ANY, "%zu bytes written\n", len);
 
 	return 0;
 }
 
-/* Write out data from a ProtobufC buffer. */
-static void esdm_rpcs_append_data(ProtobufCBuffer *buffer, size_t len,
-				  const uint8_t *data)
+/*
+ * Write the data referenced by the I/O vector into an RPC connection with as
+ * few system calls as possible. The vector is modified.
+ */
+static int esdm_rpcs_write_iov(struct esdm_rpcs_connection *rpc_conn,
+			       struct iovec *iov, int iovcnt)
 {
-	struct esdm_rpcs_write_buf *buf = (struct esdm_rpcs_write_buf *)buffer;
-	int ret = esdm_rpcs_write_data(buf->rpc_conn, data, len);
+	size_t len = 0;
+	ssize_t ret;
+	int i;
 
-	if (ret < 0)
-		logger(LOGGER_ERR, LOGGER_C_RPC,
-		       "Submission of payload data failed with error %d\n",
-		       ret);
+	if (rpc_conn->child_fd < 0)
+		return -EINVAL;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	while (iovcnt) {
+		ret = writev(rpc_conn->child_fd, iov, iovcnt);
+		if (ret < 0) {
+			int errsv = errno;
+
+			if (errsv == EAGAIN || errsv == EINTR) {
+				int ret2 = esdm_rpcs_wait_fd(rpc_conn->child_fd,
+							     POLLOUT);
+
+				if (!ret2)
+					continue;
+				errsv = -ret2;
+			}
+
+			logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+			       "Writting of data to file descriptor %d failed: %s\n",
+			       rpc_conn->child_fd, strerror(errsv));
+			return -errsv;
+		}
+
+		/* Skip the fully written entries and adjust a partial one */
+		while (iovcnt && (size_t)ret >= iov->iov_len) {
+			ret -= (ssize_t)iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (uint8_t *)iov->iov_base + ret;
+			iov->iov_len -= (size_t)ret;
+		}
+	}
+
+	esdm_rpcs_acct_charge(rpc_conn->acct, len);
+	logger(LOGGER_DEBUG2, LOGGER_C_ANY, "%zu bytes written\n", len);
+
+	return 0;
 }
 
-/* Pack the message into a ProtobufC structure and write it to the receiver. */
+/*
+ * Pack the message into a ProtobufC structure and write it together with the
+ * header to the receiver with one system call.
+ */
 static int esdm_rpcs_pack(const ProtobufCMessage *message,
-			  struct esdm_rpcs_connection *rpc_conn)
+			  struct esdm_rpcs_request *request)
 {
+	struct esdm_rpcs_connection *rpc_conn = request->rpc_conn;
 	struct esdm_rpc_proto_sc_header sc_header;
-	struct esdm_rpcs_write_buf tmp = { 0 };
-	size_t message_length;
+	uint8_t *buf = request->arena->resp;
+	struct iovec iov[2];
+	size_t message_length = 0;
+	int ret;
+
+	sc_header.method_index = le_bswap32(request->method_index);
+	sc_header.request_id = le_bswap32(request->request_id);
+
+	if (!protobuf_c_message_check(message))
+		goto failed;
+
+	message_length = protobuf_c_message_get_packed_size(message);
+	if (message_length > sizeof(request->arena->resp)) {
+		logger(LOGGER_ERR, LOGGER_C_RPC,
+		       "Response message too large: %zu bytes\n",
+		       message_length);
+		message_length = 0;
+		goto failed;
+	}
+
+	if (protobuf_c_message_pack(message, buf) != message_length) {
+		logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+		       "Packing of the response message failed\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	sc_header.status_code = le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SUCCESS);
+	sc_header.message_length = le_bswap32((uint32_t)message_length);
+
+	logger(LOGGER_DEBUG, LOGGER_C_RPC,
+	       "Server sending: server status %u, message length %u, message index %u, request ID %u\n",
+	       sc_header.status_code, sc_header.message_length,
+	       sc_header.method_index, sc_header.request_id);
+
+	iov[0].iov_base = &sc_header;
+	iov[0].iov_len = sizeof(sc_header);
+	iov[1].iov_base = buf;
+	iov[1].iov_len = message_length;
+
+	CKINT_LOG(esdm_rpcs_write_iov(rpc_conn, iov, message_length ? 2 : 1),
+		  "Submission of response data failed with error %d\n", ret);
+
+	goto out;
+
+failed:
+	sc_header.status_code =
+		le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SERVICE_FAILED);
+	sc_header.message_length = 0;
+	ret = esdm_rpcs_write_data(rpc_conn, (uint8_t *)&sc_header,
+				   sizeof(sc_header));
+
+out:
+	memset_secure(buf, 0, message_length);
+	return ret;
+}
+
+/* Is the calling RPC client a privileged user? */
+bool esdm_rpc_client_is_privileged(void *closure_data)
+{
+	struct esdm_rpcs_request *request = closure_data;
+	struct esdm_rpcs_connection *rpc_conn = request->rpc_conn;
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(rpc_conn->child_fd, SOL_SOCKET, SO_PEERCRED, &cred,
+		       &len) < 0)
+		return false;
+
+	if (cred.uid == 0) {
+		logger(LOGGER_DEBUG, LOGGER_C_ANY,
+		       "Remote client is privileged\n");
+		return true;
+	}
+
+	logger(LOGGER_DEBUG, LOGGER_C_ANY,
+	       "Remote client is not privileged\n");
+	return false;
+}
+
+static void esdm_rpcs_response_closure(const ProtobufCMessage *message,
+				       void *closure_data)
+{
+	struct esdm_rpcs_request *request = closure_data;
 	int ret;
 
-	if (!protobuf_c_message_check(message)) {
-		sc_header.status_code =
-			le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SERVICE_FAILED);
-		sc_header.method_index = le_bswap32(rpc_conn->method_index);
+	CKINT_LOG(esdm_rpcs_pack(message, request),
+		  "Failed to serialize response: %d\n", ret);
+
+out:
+	return;
+}
+
+/* Unpack the received data and invoke the intended ProtobufC handler. */
+static int esdm_rpcs_unpack(struct esdm_rpcs_request *request,
+			    struct esdm_rpc_proto_cs *received_data)
+{
+	const ProtobufCMessageDescriptor *desc;
+	struct esdm_rpcs *proto = request->rpc_conn->proto;
+	ProtobufCService *service = proto->service;
+	ProtobufCMessage *message = NULL;
+	struct esdm_rpc_proto_cs_header *header = &received_data->header;
+	uint32_t method_index = header->method_index;
+	int ret;
+
+	CKINT(esdm_rpc_proto_get_descriptor(service, received_data, &desc));
+	message = protobuf_c_message_unpack(desc, request->rpc_allocator,
+					    header->message_length,
+					    received_data->data);
+
+	CKNULL(message, -ENOMEM);
+
+	request->method_index = method_index;
+	request->request_id = header->request_id;
+
+	/* Invoke the RPC call */
+	service->invoke(service, method_index, message,
+			esdm_rpcs_response_closure, request);
+
+out:
+	if (message)
+		protobuf_c_message_free_unpacked(message,
+						 request->rpc_allocator);
+
+	return ret;
+}
+
+/*
+ * Set up the shared memory transport for an unprivileged client connection.
+ *
+ * The connection is currently processed by the calling worker which implies
+ * that the reactor cannot deliver events for it in the mean time. If the
+ * transport cannot be set up, the client is informed and continues to use
+ * the socket.
+ */
+static int esdm_rpcs_shm_negotiate(struct esdm_rpcs_connection *rpc_conn,
+				   uint32_t request_id)
+{
+	struct esdm_rpc_proto_sc_header sc_header;
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct esdm_rpcs_shm *shm = NULL;
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	int epfd = -1, ret = 0;
+
+	sc_header.method_index = le_bswap32(ESDM_RPC_SHM_NEGOTIATE);
+	sc_header.message_length = 0;
+	sc_header.request_id = le_bswap32(request_id);
+
+	/* Only the unprivileged interface offers the transport once */
+	if (rpc_conn->proto->service !=
+	    (ProtobufCService *)&unpriv_access_service || rpc_conn->shm) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	/* The file descriptors are only handed to an identifiable peer */
+	if (getsockopt(rpc_conn->child_fd, SOL_SOCKET, SO_PEERCRED, &cred,
+		       &len) < 0 || len != sizeof(cred) || cred.pid <= 0) {
+		ret = -EPERM;
+		goto out;
+	}
+
+	CKINT(esdm_rpcs_shm_alloc(&shm));
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	ev.data.fd = rpc_conn->child_fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, rpc_conn->child_fd, &ev) < 0) {
+		ret = -errno;
+		goto out;
+	}
+	ev.data.fd = esdm_rpcs_shm_doorbell(shm);
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	/*
+	 * Replace the registration of the socket with the combined epoll
+	 * instance. It is registered disarmed - the worker arms it when it
+	 * hands the connection back to the reactor.
+	 */
+	ev.events = EPOLLET | EPOLLONESHOT;
+	ev.data.ptr = rpc_conn;
+	if (epoll_ctl(esdm_rpcs_epfd, EPOLL_CTL_ADD, epfd, &ev) < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	sc_header.status_code = le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SUCCESS);
+	ret = esdm_rpcs_shm_send(shm, rpc_conn->child_fd, &sc_header,
+				 sizeof(sc_header));
+	if (ret) {
+		epoll_ctl(esdm_rpcs_epfd, EPOLL_CTL_DEL, epfd, NULL);
+		goto out;
+	}
+
+	epoll_ctl(esdm_rpcs_epfd, EPOLL_CTL_DEL, rpc_conn->child_fd, NULL);
+	rpc_conn->shm = shm;
+	rpc_conn->shm_epfd = epfd;
+
+	logger(LOGGER_DEBUG, LOGGER_C_RPC,
+	       "Shared memory transport for FD %d (UID %u, PID %d) enabled\n",
+	       rpc_conn->child_fd, cred.uid, cred.pid);
+
+	return 0;
+
+out:
+	if (epfd >= 0)
+		close(epfd);
+	esdm_rpcs_shm_free(shm);
+
+	logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+	       "Shared memory transport for FD %d rejected: %d\n",
+	       rpc_conn->child_fd, ret);
+
+	/* Inform the client to continue using the socket */
+	sc_header.status_code =
+		le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SERVICE_FAILED);
+	return esdm_rpcs_write_data(rpc_conn, (uint8_t *)&sc_header,
+				    sizeof(sc_header));
+}
+
+/*
+ * Time in milliseconds the client may take to grant further fragments of a
+ * stream. The client must consume the stream with ESDM_RPCS_STREAM_MIN_RATE
+ * after the initial I/O timeout.
+ */
+static int esdm_rpcs_stream_timeout(const struct timespec *start,
+				    uint64_t delivered, int *timeout_ms)
+{
+	struct timespec now;
+	uint64_t allowed_ms, elapsed_ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed_ms = (uint64_t)(now.tv_sec - start->tv_sec) * 1000 +
+		     (uint64_t)(now.tv_nsec / 1000000) -
+		     (uint64_t)(start->tv_nsec / 1000000);
+	allowed_ms = ESDM_RPCS_IO_TIMEOUT_MS +
+		     delivered * 1000 / ESDM_RPCS_STREAM_MIN_RATE;
+
+	if (elapsed_ms >= allowed_ms)
+		return -ETIMEDOUT;
+
+	*timeout_ms = (int)min_uint64(allowed_ms - elapsed_ms,
+				      ESDM_RPCS_IO_TIMEOUT_MS);
+	return 0;
+}
+
+/* Wait for the client granting further fragments of a stream. */
+static int esdm_rpcs_stream_credit(struct esdm_rpcs_connection *rpc_conn,
+				   uint32_t request_id, int timeout_ms,
+				   uint32_t *credits)
+{
+	struct {
+		struct esdm_rpc_proto_cs_header header;
+		struct esdm_rpc_stream_credit credit;
+	} __attribute__((packed)) msg;
+	ssize_t received;
+	int ret = 0;
+
+	for (;;) {
+		/* MSG_TRUNC reports the real size of an oversized packet */
+		received = recv(rpc_conn->child_fd, &msg, sizeof(msg),
+				MSG_TRUNC);
+		if (received >= 0)
+			break;
+
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			return -errno;
+
+		CKINT(esdm_rpcs_poll_fd(rpc_conn->child_fd, POLLIN,
+					timeout_ms));
+	}
+
+	if (received == 0)
+		return -ECONNRESET;
+
+	if ((size_t)received != sizeof(msg) ||
+	    le_bswap32(msg.header.method_index) != ESDM_RPC_STREAM_CREDIT ||
+	    le_bswap32(msg.header.message_length) != sizeof(msg.credit) ||
+	    le_bswap32(msg.header.request_id) != request_id) {
+		logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+		       "Unexpected data received for stream on FD %d\n",
+		       rpc_conn->child_fd);
+		return -EINVAL;
+	}
+
+	*credits = le_bswap32(msg.credit.credits);
+
+out:
+	return ret;
+}
+
+/*
+ * Serve a streamed request for random bytes.
+ *
+ * The random bytes are generated directly into the fragment buffer which is
+ * sent with one write. An error of the DRNG, a window of 0 or an account
+ * exceeding its concurrent streams ends the stream but leaves the connection
+ * intact, whereas an error of the transport or a violation of the flow
+ * control closes the connection.
+ */
+static int esdm_rpcs_stream(struct esdm_rpcs_connection *rpc_conn,
+			    struct esdm_rpcs_arena *arena,
+			    const struct esdm_rpc_proto_cs *received_data)
+{
+	struct esdm_rpc_stream_req req;
+	struct esdm_rpc_stream_err err;
+	struct esdm_rpc_proto_sc *frag;
+	struct timespec start;
+	uint8_t *buf = arena->resp;
+	size_t used = sizeof(frag->header);
+	uint64_t len, delivered = 0;
+	uint32_t credits, request_id = received_data->header.request_id;
+	uint32_t requests = 1, retry_ms;
+	ssize_t gen = 0;
+	int ret = 0, timeout_ms;
+	bool accounted = false;
+
+	/* The cast is appropriate as the buffer is aligned to 64 bits. */
+	frag = (struct esdm_rpc_proto_sc *)buf;
+	frag->header.status_code =
+		le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SUCCESS);
+	frag->header.method_index = le_bswap32(ESDM_RPC_STREAM);
+	frag->header.request_id = le_bswap32(request_id);
+
+	if (received_data->header.message_length != sizeof(req))
+		return -EINVAL;
+
+	memcpy(&req, received_data->data, sizeof(req));
+	len = le_bswap64(req.len);
+	credits = min_uint32(le_bswap32(req.window), ESDM_RPC_STREAM_WINDOW);
+
+	logger(LOGGER_DEBUG, LOGGER_C_RPC,
+	       "Server streaming: method index %u, length %" PRIu64 ", window %u, request ID %u\n",
+	       le_bswap32(req.method_index), len, credits, request_id);
+
+	/* Only the unprivileged interface offers random bytes */
+	if (rpc_conn->proto->service !=
+	    (ProtobufCService *)&unpriv_access_service) {
+		gen = -EOPNOTSUPP;
+		goto err;
+	}
+
+	if (len > ESDM_RPC_STREAM_MAX_LEN || !credits) {
+		gen = -EINVAL;
+		goto err;
+	}
+
+	if (rpc_conn->acct) {
+		if (esdm_rpcs_acct_stream_enter(rpc_conn->acct)) {
+			gen = -EBUSY;
+			goto err;
+		}
+		accounted = true;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (len) {
+		size_t todo = min_size((size_t)len, ESDM_RPC_MAX_DATA);
+
+		while (!credits) {
+			CKINT_LOG(esdm_rpcs_stream_timeout(&start, delivered,
+							   &timeout_ms),
+				  "Client on FD %d consumes the stream too slowly\n",
+				  rpc_conn->child_fd);
+			CKINT(esdm_rpcs_stream_credit(rpc_conn, request_id,
+						      timeout_ms, &credits));
+		}
+
+		/*
+		 * The stream is accounted as one request, the rate of the
+		 * bytes is checked for every fragment.
+		 */
+		if (rpc_conn->acct &&
+		    esdm_rpcs_acct_admit(rpc_conn->acct, requests, &retry_ms)) {
+			gen = -EBUSY;
+			goto err;
+		}
+		requests = 0;
+
+		/* Only the largest fragment needs to be zeroized */
+		if (used < sizeof(frag->header) + todo)
+			used = sizeof(frag->header) + todo;
+
+		switch (le_bswap32(req.method_index)) {
+		case esdm_rpc_stream_get_random_bytes_full:
+			gen = esdm_get_random_bytes_full_noblock(frag->data,
+								 todo);
+			break;
+		case esdm_rpc_stream_get_random_bytes_min:
+			gen = esdm_get_random_bytes_min_noblock(frag->data,
+								todo);
+			break;
+		case esdm_rpc_stream_get_random_bytes:
+			gen = esdm_get_random_bytes(frag->data, todo);
+			break;
+		default:
+			gen = -EOPNOTSUPP;
+			break;
+		}
+
+		if (gen <= 0) {
+			if (!gen)
+				gen = -EAGAIN;
+			goto err;
+		}
+
+		frag->header.message_length = le_bswap32((uint32_t)gen);
+		CKINT(esdm_rpcs_write_data(rpc_conn, buf,
+					   sizeof(frag->header) +
+					   (size_t)gen));
+		esdm_test_shm_status_add_rpc_server_written((size_t)gen);
+
+		len -= (uint64_t)gen;
+		delivered += (uint64_t)gen;
+		credits--;
+	}
+
+	goto out;
+
+err:
+	logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+	       "Stream on FD %d terminated with error %zd\n",
+	       rpc_conn->child_fd, gen);
+
+	err.ret = (int32_t)le_bswap32((uint32_t)gen);
+	frag->header.status_code =
+		le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SERVICE_FAILED);
+	frag->header.message_length = le_bswap32(sizeof(err));
+	memcpy(frag->data, &err, sizeof(err));
+	if (used < sizeof(frag->header) + sizeof(err))
+		used = sizeof(frag->header) + sizeof(err);
+	ret = esdm_rpcs_write_data(rpc_conn, buf,
+				   sizeof(frag->header) + sizeof(err));
+
+out:
+	if (accounted)
+		esdm_rpcs_acct_stream_leave(rpc_conn->acct);
+	memset_secure(buf, 0, used);
+	return ret;
+}
+
+/*
+ * Serve a request in the raw encoding.
+ *
+ * The semantics of the requests are identical to their Protobuf-C
+ * counterparts. The response header, the return code and the generated data
+ * are sent with one system call.
+ */
+static int esdm_rpcs_raw(struct esdm_rpcs_connection *rpc_conn,
+			 struct esdm_rpcs_arena *arena,
+			 const struct esdm_rpc_proto_cs *received_data)
+{
+	struct esdm_rpc_proto_sc_header sc_header;
+	struct esdm_rpc_raw_req req;
+	struct esdm_rpc_raw_resp resp;
+	uint64_t *rndval = arena->data;
+	uint8_t *rnd = (uint8_t *)rndval;
+	struct iovec iov[3];
+	size_t len, datalen = 0, used = 0;
+	int64_t gen;
+	uint32_t status = PROTOBUF_C_RPC_STATUS_CODE_SUCCESS;
+	int ret;
+
+	if (received_data->header.message_length != sizeof(req))
+		return -EINVAL;
+
+	memcpy(&req, received_data->data, sizeof(req));
+	len = (size_t)le_bswap64(req.len);
+
+	logger(LOGGER_DEBUG, LOGGER_C_RPC,
+	       "Server raw request: method index %u, length %zu, request ID %u\n",
+	       le_bswap32(req.method_index), len,
+	       received_data->header.request_id);
+
+	/* Only the unprivileged interface offers random bytes */
+	if (rpc_conn->proto->service !=
+	    (ProtobufCService *)&unpriv_access_service) {
+		gen = -EOPNOTSUPP;
+		status = PROTOBUF_C_RPC_STATUS_CODE_SERVICE_FAILED;
+	} else if (len > sizeof(arena->data)) {
+		gen = -(int64_t)sizeof(arena->data);
+	} else {
+		/* The generated data is at most as large as requested */
+		used = len;
+
+		switch (le_bswap32(req.method_index)) {
+		case esdm_rpc_raw_get_random_bytes_full:
+			gen = esdm_get_random_bytes_full_noblock(rnd, len);
+			break;
+		case esdm_rpc_raw_get_random_bytes_min:
+			gen = esdm_get_random_bytes_min_noblock(rnd, len);
+			break;
+		case esdm_rpc_raw_get_random_bytes_pr:
+			gen = esdm_get_random_bytes_pr(rnd, len);
+			break;
+		case esdm_rpc_raw_get_random_bytes:
+			gen = esdm_get_random_bytes(rnd, len);
+			break;
+		case esdm_rpc_raw_get_seed:
+			/* Unfilled parts of the seed buffer are sent as well */
+			memset(rndval, 0, len);
+			gen = esdm_get_seed(rndval, len,
+					    le_bswap32(req.flags) |
+					    ESDM_GET_SEED_NONBLOCK);
+			break;
+		default:
+			gen = -EOPNOTSUPP;
+			status = PROTOBUF_C_RPC_STATUS_CODE_SERVICE_FAILED;
+			break;
+		}
+	}
+
+	/* The client falls back to the Protobuf-C encoding */
+	if (status != PROTOBUF_C_RPC_STATUS_CODE_SUCCESS) {
+		sc_header.status_code = le_bswap32(status);
+		sc_header.method_index = le_bswap32(ESDM_RPC_RAW);
 		sc_header.message_length = 0;
-		sc_header.request_id = le_bswap32(rpc_conn->request_id);
+		sc_header.request_id =
+			le_bswap32(received_data->header.request_id);
+
 		return esdm_rpcs_write_data(rpc_conn, (uint8_t *)&sc_header,
 					    sizeof(sc_header));
 	}
 
-	message_length = protobuf_c_message_get_packed_size(message);
-	tmp.base.append = esdm_rpcs_append_data;
-	tmp.rpc_conn = rpc_conn;
-
-	sc_header.status_code = le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SUCCESS);
-	sc_header.method_index = le_bswap32(rpc_conn->method_index);
-	sc_header.message_length = le_bswap32(message_length);
-	sc_header.request_id = le_bswap32(rpc_conn->request_id);
-
-	logger(LOGGER_DEBUG, LOGGER_C_RPC,
-	       "Server sending: server status %u, message length %u, message index %u, request ID %u\n",
-	       sc_header.status_code, sc_header.message_length,
-	       sc_header.method_index, sc_header.request_id);
-
-	CKINT_LOG(esdm_rpcs_write_data(rpc_conn,
-				       (uint8_t *)&sc_header,
-				       sizeof(sc_header)),
-		  "Submission of header data failed with error %d\n", ret);
-
-	if (protobuf_c_message_pack_to_buffer(message, &tmp.base) !=
-	    message_length) {
-		logger(LOGGER_VERBOSE, LOGGER_C_RPC,
-		       "Short write of data to file descriptor \n");
-		ret = -EFAULT;
+	/* Like the Protobuf-C handler, a seed carries its length in front */
+	if (le_bswap32(req.method_index) == esdm_rpc_raw_get_seed) {
+		if (gen >= 0) {
+			datalen = min_size((size_t)rndval[0] + sizeof(uint64_t),
+					   sizeof(arena->data));
+			esdm_test_shm_status_add_rpc_server_written(
+							(size_t)rndval[0]);
+		} else if (gen == -EMSGSIZE) {
+			datalen = sizeof(uint64_t);
+		}
+	} else if (gen > 0) {
+		datalen = (size_t)gen;
+		esdm_test_shm_status_add_rpc_server_written(datalen);
 	}
 
-out:
+	sc_header.status_code = le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SUCCESS);
+	sc_header.method_index = le_bswap32(ESDM_RPC_RAW);
+	sc_header.message_length = le_bswap32((uint32_t)(sizeof(resp) +
+							 datalen));
+	sc_header.request_id = le_bswap32(received_data->header.request_id);
+	resp.ret = (int64_t)le_bswap64((uint64_t)gen);
+
+	iov[0].iov_base = &sc_header;
+	iov[0].iov_len = sizeof(sc_header);
+	iov[1].iov_base = &resp;
+	iov[1].iov_len = sizeof(resp);
+	iov[2].iov_base = rnd;
+	iov[2].iov_len = datalen;
+
+	ret = esdm_rpcs_write_iov(rpc_conn, iov, datalen ? 3 : 2);
+
+	memset_secure(rndval, 0, used);
 	return ret;
 }
 
-/* Is the calling RPC client a privileged user? */
-bool esdm_rpc_client_is_privileged(void *closure_data)
+/* Drop a reference to the connection and release it with the last one. */
+static void esdm_rpcs_put_conn(struct esdm_rpcs_connection *rpc_conn)
 {
-	struct esdm_rpcs_connection *rpc_conn = closure_data;
-	struct ucred cred;
-	socklen_t len = sizeof(cred);
+	if (!rpc_conn || !atomic_dec_and_test(&rpc_conn->ref_cnt))
+		return;
+	if (rpc_conn->shm_epfd >= 0)
+		close(rpc_conn->shm_epfd);
+	esdm_rpcs_shm_free(rpc_conn->shm);
+	if (rpc_conn->child_fd >= 0)
+		close(rpc_conn->child_fd);
+	esdm_rpcs_acct_put(rpc_conn->acct);
+	free(rpc_conn);
+}
 
-	if (getsockopt(rpc_conn->child_fd, SOL_SOCKET, SO_PEERCRED, &cred,
-		       &len) < 0)
-		return false;
+/* Re-arm the one-shot epoll registration of a listener or connection. */
+static int esdm_rpcs_epoll_arm(int fd, void *ptr, int op)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT,
+		.data.ptr = ptr,
+	};
 
-	if (cred.uid == 0) {
-		logger(LOGGER_DEBUG, LOGGER_C_ANY,
-		       "Remote client is privileged\n");
-		return true;
+	if (epoll_ctl(esdm_rpcs_epfd, op, fd, &ev) < 0) {
+		int errsv = errno;
+
+		logger(LOGGER_ERR, LOGGER_C_RPC,
+		       "Registering FD %d with epoll failed: %s\n", fd,
+		       strerror(errsv));
+		return -errsv;
 	}
 
-	logger(LOGGER_DEBUG, LOGGER_C_ANY,
-	       "Remote client is not privileged\n");
-	return false;
+	return 0;
 }
 
-static void esdm_rpcs_response_closure(const ProtobufCMessage *message,
-				       void *closure_data)
+/*
+ * Hand the connection back to the reactor before a request is processed that
+ * is answered with exactly one response. Another worker may then read and
+ * process the next request of the same connection in parallel, i.e. responses
+ * may be sent out of order. The client correlates them with the request ID.
+ * The calling worker keeps a reference until it completed the request.
+ */
+static void esdm_rpcs_handback(struct esdm_rpcs_connection *rpc_conn,
+			       bool *handed_back)
 {
-	struct esdm_rpcs_connection *rpc_conn = closure_data;
-	int ret;
+	if (*handed_back)
+		return;
 
-	CKINT_LOG(esdm_rpcs_pack(message, rpc_conn),
-		  "Failed to serialize response: %d\n", ret);
+	atomic_inc(&rpc_conn->ref_cnt);
+	if (esdm_rpcs_epoll_arm(rpc_conn->shm ? rpc_conn->shm_epfd :
+						rpc_conn->child_fd,
+				rpc_conn, EPOLL_CTL_MOD)) {
+		atomic_dec(&rpc_conn->ref_cnt);
+		return;
+	}
 
-out:
-	return;
+	*handed_back = true;
 }
 
-/* Unpack the received data and invoke the intended ProtobufC handler. */
-static int esdm_rpcs_unpack(struct esdm_rpcs_connection *rpc_conn,
-			    struct esdm_rpc_proto_cs *received_data)
+/*
+ * Reject a request of a peer exceeding its rate limits. The response tells the
+ * client when it may try again.
+ */
+static int esdm_rpcs_throttle(struct esdm_rpcs_connection *rpc_conn,
+			      const struct esdm_rpc_proto_cs_header *header,
+			      uint32_t retry_ms)
 {
-	const ProtobufCMessageDescriptor *desc;
-	struct esdm_rpcs *proto = rpc_conn->proto;
-	ProtobufCService *service = proto->service;
-	ProtobufCMessage *message = NULL;
-	struct esdm_rpc_proto_cs_header *header = &received_data->header;
-	uint32_t method_index = header->method_index;
-	int ret;
-
-	CKINT(esdm_rpc_proto_get_descriptor(service, received_data, &desc));
-	message = protobuf_c_message_unpack(desc, rpc_conn->rpc_allocator,
-					    header->message_length,
-					    received_data->data);
-
-	CKNULL(message, -ENOMEM);
-
-	rpc_conn->method_index = method_index;
-	rpc_conn->request_id = header->request_id;
-
-	/* Invoke the RPC call */
-	service->invoke(service, method_index, message,
-			esdm_rpcs_response_closure, rpc_conn);
-
-out:
-	if (message)
-		protobuf_c_message_free_unpacked(message,
-						 rpc_conn->rpc_allocator);
-
-	return ret;
+	struct {
+		struct esdm_rpc_proto_sc_header header;
+		struct esdm_rpc_proto_throttle throttle;
+	} __attribute__((packed)) msg;
+
+	msg.header.status_code =
+		le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_TOO_MANY_PENDING);
+	msg.header.method_index = le_bswap32(header->method_index);
+	msg.header.message_length = le_bswap32(sizeof(msg.throttle));
+	msg.header.request_id = le_bswap32(header->request_id);
+	msg.throttle.retry_ms = le_bswap32(retry_ms);
+
+	return esdm_rpcs_write_data(rpc_conn, (uint8_t *)&msg, sizeof(msg));
 }
 
-/* Read data from the RPC connection into a local buffer. */
-static int esdm_rpcs_read(struct esdm_rpcs_connection *rpc_conn)
+/*
+ * Read one request from the RPC connection into a local buffer and process
+ * it. If the connection was handed back to the reactor, handed_back is set.
+ */
+static int esdm_rpcs_read(struct esdm_rpcs_connection *rpc_conn,
+			  struct esdm_rpcs_arena *arena, bool *handed_back)
 {
-	/* Read the data into a stack buffer to avoid mallocs. */
+	/* Read the data into the arena of the worker to avoid mallocs. */
 	ProtobufCAllocator esdm_rpc_allocator = {
 		.alloc = &esdm_rpc_alloc,
 		.free = &esdm_rpc_free,
 		.allocator_data = NULL,
 	};
 	BUFFER_INIT(tls);
+	struct esdm_rpcs_request request = {
+		.rpc_conn = rpc_conn,
+		.arena = arena,
+		.rpc_allocator = &esdm_rpc_allocator,
+	};
 	struct esdm_rpc_proto_cs *received_data;
-	uint8_t buf[ESDM_RPC_MAX_MSG_SIZE + sizeof(*received_data)]
-						__aligned(sizeof(uint64_t));
-	uint8_t unpacked[ESDM_RPC_MAX_MSG_SIZE + 128]
-						__aligned(sizeof(uint64_t));
+	uint8_t *buf = arena->req;
 	size_t total_received = 0;
 	ssize_t received;
-	uint32_t data_to_fetch = 0;
+	uint32_t data_to_fetch = 0, retry_ms;
 	int ret;
 	uint8_t *buf_p = buf;
 
 	if (rpc_conn->child_fd < 0)
 		return -EINVAL;
 
-	thread_set_name(rpc_handler, (uint32_t)rpc_conn->child_fd);
-
-	/* Prepare the allocator to use the stack buffer. */
-	tls.buf = unpacked;
-	tls.len = sizeof(unpacked);
+	/* Prepare the allocator to use the arena. */
+	tls.buf = arena->unpacked;
+	tls.len = sizeof(arena->unpacked);
 	esdm_rpc_allocator.allocator_data = &tls;
-	rpc_conn->rpc_allocator = &esdm_rpc_allocator;
 
 	/* The cast is appropriate as the buffer is aligned to 64 bits. */
 	received_data = (struct esdm_rpc_proto_cs *)buf;
@@ -314,15 +1134,28 @@ static int esdm_rpcs_read(struct esdm_rpcs_connection *rpc_conn)
 	/* Read the data into the thread-local storage */
 	do {
 		received = read(rpc_conn->child_fd, buf_p,
-				sizeof(buf) - total_received);
+				sizeof(arena->req) - total_received);
 		if (received < 0) {
 			ret = -errno;
-			goto out;
+
+			if (ret == -EINTR)
+				continue;
+
+			/*
+			 * No request is pending: return -EAGAIN to let the
+			 * reactor re-arm the connection.
+			 */
+			if (ret != -EAGAIN || !total_received)
+				goto out;
+
+			/* Wait for the remainder of a started request. */
+			CKINT(esdm_rpcs_wait_fd(rpc_conn->child_fd, POLLIN));
+			continue;
 		}
 
 		/* Received EOF */
 		if (received == 0) {
-			ret = -EAGAIN;
+			ret = -ECONNRESET;
 			goto out;
 		}
 
@@ -378,7 +1211,7 @@ static int esdm_rpcs_read(struct esdm_rpcs_connection *rpc_conn)
 		if (total_received >= data_to_fetch)
 			break;
 
-	} while (total_received < sizeof(buf));
+	} while (total_received < sizeof(arena->req));
 
 	/* If we have received insufficient data, bail out now. */
 	if (total_received < sizeof(*received_data) ||
@@ -387,12 +1220,54 @@ static int esdm_rpcs_read(struct esdm_rpcs_connection *rpc_conn)
 		goto out;
 	}
 
+	/* Request for the shared memory transport */
+	if (received_data->header.method_index == ESDM_RPC_SHM_NEGOTIATE) {
+		ret = esdm_rpcs_shm_negotiate(rpc_conn,
+					      received_data->header.request_id);
+		goto out;
+	}
+
+	/* Streamed request for random bytes */
+	if (received_data->header.method_index == ESDM_RPC_STREAM) {
+		ret = esdm_rpcs_stream(rpc_conn, arena, received_data);
+		goto out;
+	}
+
+	/*
+	 * The client may grant credits for a stream the server already
+	 * terminated - they are stale and can be dropped.
+	 */
+	if (received_data->header.method_index == ESDM_RPC_STREAM_CREDIT) {
+		ret = 0;
+		goto out;
+	}
+
+	/*
+	 * The shared memory transport and streams use the connection
+	 * exclusively. All other requests are answered with one response and
+	 * the next request can be processed in parallel.
+	 */
+	esdm_rpcs_handback(rpc_conn, handed_back);
+
+	if (rpc_conn->acct &&
+	    esdm_rpcs_acct_admit(rpc_conn->acct, 1, &retry_ms)) {
+		ret = esdm_rpcs_throttle(rpc_conn, &received_data->header,
+					 retry_ms);
+		goto out;
+	}
+
+	/* Random bytes or seed requested with the raw encoding */
+	if (received_data->header.method_index == ESDM_RPC_RAW) {
+		ret = esdm_rpcs_raw(rpc_conn, arena, received_data);
+		goto out;
+	}
+
 	/*
 	 * We now have a filled buffer that has a header and received
 	 * as much data as the header defined. We also start the
 	 * processing of data and the subsequent submission of the answer here.
 	 */
-	CKINT(esdm_rpcs_unpack(rpc_conn, received_data));
+	CKINT(esdm_rpcs_unpack(&request, received_data));
 
 out:
 	/* Clear the memory after processing one request. */
@@ -401,128 +1276,273 @@ out:
 	return ret;
 }
 
-static void esdm_rpcs_release_conn(struct esdm_rpcs_connection *rpc_conn)
+/*
+ * Process all requests pending on a connection.
+ *
+ * The connection is registered edge-triggered. Thus, all data must be
+ * consumed until the socket reports -EAGAIN before the connection is handed
+ * back to the reactor. As the registration is one-shot, only one worker
+ * reads from a given connection at any time. Once a request is read that is
+ * answered with one response, the connection is handed back early to let
+ * another worker read and process the next request in parallel.
+ */
+static void esdm_rpcs_serve(struct esdm_rpcs_connection *rpc_conn)
 {
-	if (!rpc_conn)
-		return;
-	if (rpc_conn->child_fd >= 0)
-		close(rpc_conn->child_fd);
-	free(rpc_conn);
-}
+	struct esdm_rpcs_arena *arena = esdm_rpcs_arena_get();
+	struct epoll_event ev[2];
+	bool read_socket = true, handed_back = false;
+	int i, n, ret = 0;
 
-/* Thread main for receiving a new connection and process it. */
-static int esdm_rpcs_handler(void *args)
-{
-	struct esdm_rpcs_connection *rpc_conn = args;
-	int ret;
+	if (!arena) {
+		logger(LOGGER_ERR, LOGGER_C_RPC,
+		       "RPC I/O arena not available\n");
+		ret = -ENOMEM;
+	}
 
 	/*
-	 * Loop reusing the existing connection. When an error is received,
-	 * the communication is considered to be severed and the child FD can
-	 * be released.
+	 * With the shared memory transport, find out whether the doorbell,
+	 * the socket or both triggered the event.
 	 */
-	do {
-		ret = esdm_rpcs_read(rpc_conn);
-	} while (!ret);
+	if (!ret && rpc_conn->shm) {
+		n = epoll_wait(rpc_conn->shm_epfd, ev, ARRAY_SIZE(ev), 0);
+
+		read_socket = (n <= 0);
+		for (i = 0; i < n && !ret; i++) {
+			if (ev[i].data.fd == rpc_conn->child_fd)
+				read_socket = true;
+			else
+				ret = esdm_rpcs_shm_process(
+					rpc_conn->shm, rpc_conn->acct,
+					(uint8_t *)arena->data);
+		}
 
+		if (!ret && !read_socket)
+			ret = -EAGAIN;
+	}
+
+	while (!ret && !handed_back)
+		ret = esdm_rpcs_read(rpc_conn, arena, &handed_back);
+
+	if (handed_back) {
+		/*
+		 * Another worker owns the registration now - let it notice
+		 * that the connection is severed.
+		 */
+		if (ret && ret != -EAGAIN)
+			shutdown(rpc_conn->child_fd, SHUT_RDWR);
+		esdm_rpcs_put_conn(rpc_conn);
+		return;
+	}
+
+	if (ret == -EAGAIN &&
+	    !esdm_rpcs_epoll_arm(rpc_conn->shm ? rpc_conn->shm_epfd :
+						 rpc_conn->child_fd,
+				 rpc_conn, EPOLL_CTL_MOD))
+		return;
+
+	/*
+	 * When an error is received, the communication is considered to be
+	 * severed and the reference of the registration is dropped. The
+	 * registration stays disarmed until the last worker still processing a
+	 * request releases the connection. Closing the FD implicitly removes it
+	 * from the epoll set.
+	 */
 	logger(LOGGER_DEBUG, LOGGER_C_RPC,
 	       "Closing incoming connection for FD %d\n", rpc_conn->child_fd);
-	esdm_rpcs_release_conn(rpc_conn);
-	return 0;
+	esdm_rpcs_put_conn(rpc_conn);
 }
 
-/* The ESDM RPC server main worker loop. */
-static int esdm_rpcs_workerloop(struct esdm_rpcs *proto)
+/*
+ * Serve a ready connection. A connection of an unprivileged peer using up its
+ * share of the workers stays disarmed until a worker serving the same peer
+ * completes and resumes it. This way, a peer with many concurrent requests
+ * cannot occupy all workers.
+ */
+static void esdm_rpcs_handler(struct esdm_rpcs_connection *rpc_conn)
 {
-	/*
-	 * The reason for using a timeout here is to only wait for a
-	 * given amount of time for activity on the FD. After the
-	 * timeout, the file descriptor is closed. If an attacker
-	 * starts connections, he could leave them open and thus
-	 * starve other callers. By timing out on a read the server
-	 * tries to avert such attack scenarios. This is the price
-	 * to pay for not using malloc and a thread-local storage
-	 * buffer.
-	 */
-	struct timeval tv = { .tv_sec = 2, .tv_usec = 0 };
-	struct esdm_rpcs_connection *rpc_conn = NULL;
-	struct sockaddr addr;
-	socklen_t addr_len = sizeof (addr);
-	int ret;
+	struct esdm_rpcs_acct *acct = rpc_conn->acct;
+	struct esdm_rpcs_acct_wait *wait;
 
-	if (proto->server_listening_fd < 0)
-		return -EINVAL;
-	CKNULL(proto->service, -EINVAL);
+	if (!acct) {
+		esdm_rpcs_serve(rpc_conn);
+		return;
+	}
+
+	if (!esdm_rpcs_acct_enter(acct, &rpc_conn->acct_wait))
+		return;
+
+	/* The connection may be released, the account is still valid */
+	esdm_rpcs_serve(rpc_conn);
+
+	wait = esdm_rpcs_acct_leave(acct);
+	if (!wait)
+		return;
+
+	/* The reactor delivers the pending requests of the resumed connection */
+	rpc_conn = wait->data;
+	if (esdm_rpcs_epoll_arm(rpc_conn->shm ? rpc_conn->shm_epfd :
+						rpc_conn->child_fd,
+				rpc_conn, EPOLL_CTL_MOD))
+		esdm_rpcs_put_conn(rpc_conn);
+}
+
+/* Accept all pending incoming connections on a listening socket. */
+static void esdm_rpcs_accept(struct esdm_rpcs *proto)
+{
+	struct esdm_rpcs_connection *rpc_conn;
+	int fd;
 
 	for (;;) {
+		fd = accept4(proto->server_listening_fd, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN) {
+				logger(LOGGER_WARN, LOGGER_C_ANY,
+				       "Accepting incoming connections failed: %s\n",
+				       strerror(errno));
+			}
+			break;
+		}
+
 		/*
-		 * Allocate the memory for the thread invocation. This is done
-		 * before the accept() call as now we should have time but
-		 * after the accept() call, we want to be fast.
-		 *
-		 * Note, valgrind will report this buffer as leaked. We accept
-		 * this leak of one block.
+		 * Note, valgrind may report this buffer as leaked for
+		 * connections still open during shutdown.
 		 */
 		rpc_conn = calloc(1, sizeof(struct esdm_rpcs_connection));
 		if (!rpc_conn) {
-			/* If we are out of memory, terminate our server */
-			if (errno == ENOMEM)
-				return -errno;
-
-			/* Other errors are handled as transient errors */
+			close(fd);
 			continue;
 		}
 
+		rpc_conn->type = esdm_rpcs_epoll_connection;
 		rpc_conn->proto = proto;
-
-		/* Wait for incoming connection */
-		rpc_conn->child_fd = accept(proto->server_listening_fd, &addr,
-					    &addr_len);
-		if (rpc_conn->child_fd < 0) {
-			free(rpc_conn);
-			logger(LOGGER_WARN, LOGGER_C_ANY,
-			       "Accepting incoming connections failed: %s\n",
-			       strerror(errno));
+		rpc_conn->child_fd = fd;
+		rpc_conn->shm_epfd = -1;
+		rpc_conn->acct_wait.data = rpc_conn;
+		atomic_set(&rpc_conn->ref_cnt, 1);
+
+		/* Peers of the unprivileged interface are accounted */
+		if (proto->service ==
+		    (ProtobufCService *)&unpriv_access_service &&
+		    esdm_rpcs_acct_get(fd, &rpc_conn->acct)) {
+			logger(LOGGER_WARN, LOGGER_C_RPC,
+			       "Accounting of the peer of FD %d failed\n", fd);
+			esdm_rpcs_put_conn(rpc_conn);
 			continue;
 		}
 
-		if (setsockopt(rpc_conn->child_fd, SOL_SOCKET, SO_RCVTIMEO,
-			       (const char*)&tv, sizeof(tv)) < 0 ||
-		    setsockopt(rpc_conn->child_fd, SOL_SOCKET, SO_SNDTIMEO,
-			       (const char*)&tv, sizeof(tv)) < 0) {
-			int errsv = errno;
+		logger(LOGGER_DEBUG, LOGGER_C_RPC,
+		       "Processing new incoming connection for FD %d\n", fd);
+
+		if (esdm_rpcs_epoll_arm(fd, rpc_conn, EPOLL_CTL_ADD))
+			esdm_rpcs_put_conn(rpc_conn);
+	}
 
+	esdm_rpcs_epoll_arm(proto->server_listening_fd, proto, EPOLL_CTL_MOD);
+}
+
+/*
+ * The epoll reactor: every worker waits for the next ready listener or
+ * connection and processes it. A worker fetches only one event at a time
+ * to distribute ready connections evenly across all workers.
+ */
+static int esdm_rpcs_reactor(void)
+{
+	struct epoll_event ev;
+	int ret;
+
+	esdm_rpcs_acct_add_worker();
+
+	for (;;) {
+		ret = epoll_wait(esdm_rpcs_epfd, &ev, 1, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
 			logger(LOGGER_ERR, LOGGER_C_RPC,
-			       "Error setting timeout on socket: %s\n",
-			       strerror(errsv));
-			esdm_rpcs_release_conn(rpc_conn);
+			       "Waiting for RPC events failed: %s\n",
+			       strerror(-ret));
+			return ret;
+		}
+		if (!ret)
 			continue;
+
+		switch (*(enum esdm_rpcs_epoll_type *)ev.data.ptr) {
+		case esdm_rpcs_epoll_listener:
+			esdm_rpcs_accept(ev.data.ptr);
+			break;
+		case esdm_rpcs_epoll_connection:
+			esdm_rpcs_handler(ev.data.ptr);
+			break;
+		default:
+			break;
 		}
+	}
 
-		logger(LOGGER_DEBUG, LOGGER_C_RPC,
-		       "Processing new incoming connection for FD %d\n",
-		       rpc_conn->child_fd);
+	return 0;
+}
 
-		/* Handle new incoming connection */
-#ifdef DEBUG
-		/*
-		 * If compiled with debug settings, do not spawn a thread
-		 * to allow proper GDB use.
-		 */
-		esdm_rpcs_handler(rpc_conn);
-#else /* DEBUG */
-		if (thread_start(esdm_rpcs_handler, rpc_conn, 0, NULL)) {
-			logger(LOGGER_ERR, LOGGER_C_RPC,
-			       "Starting new thread for incoming connection failed\n");
-			esdm_rpcs_release_conn(rpc_conn);
-			continue;
+/* Thread main of an RPC worker thread. */
+static int esdm_rpcs_worker(void __unused *unused)
+{
+	thread_set_name(rpc_handler,
+			(uint32_t)atomic_inc(&esdm_rpcs_workers));
+
+	return esdm_rpcs_reactor();
+}
+
+/*
+ * Spawn the pool of RPC worker threads.
+ *
+ * The pool is sized to the number of online CPUs. The threads processing the
+ * privileged and unprivileged interface act as workers as well and are
+ * therefore accounted for.
+ */
+static void esdm_rpcs_start_workers(void)
+{
+#ifndef DEBUG
+	/*
+	 * If compiled with debug settings, do not spawn worker threads
+	 * to allow proper GDB use.
+	 */
+	uint32_t i, workers = esdm_online_nodes();
+
+	for (i = 2; i < workers; i++) {
+		if (thread_start(esdm_rpcs_worker, NULL, 0, NULL)) {
+			logger(LOGGER_WARN, LOGGER_C_RPC,
+			       "Starting RPC worker thread failed\n");
+			break;
 		}
-#endif /* DEBUG */
-		rpc_conn = NULL;
 	}
 
+	logger(LOGGER_VERBOSE, LOGGER_C_RPC,
+	       "RPC server uses %u additional worker threads\n", i - 2);
+#endif /* DEBUG */
+}
+
+/* The ESDM RPC server main worker loop. */
+static int esdm_rpcs_workerloop(struct esdm_rpcs *proto)
+{
+	int ret;
+
+	if (proto->server_listening_fd < 0 || esdm_rpcs_epfd < 0)
+		return -EINVAL;
+	CKNULL(proto->service, -EINVAL);
+
+	/*
+	 * Register the listening socket with the reactor. The calling thread
+	 * then serves as one of the workers processing all interfaces.
+	 */
+	proto->type = esdm_rpcs_epoll_listener;
+	set_fd_nonblocking(proto->server_listening_fd);
+	CKINT(esdm_rpcs_epoll_arm(proto->server_listening_fd, proto,
+				  EPOLL_CTL_ADD));
+
+	ret = esdm_rpcs_reactor();
+
 out:
-	esdm_rpcs_release_conn(rpc_conn);
 	return ret;
 }
 
@@ -688,6 +1708,35 @@ static int esdm_rpcs_interfaces_init(const char *username)
 		goto out;
 	}
 
+	/*
+	 * Allocate the I/O arenas for the worker pool and the two interface
+	 * threads while the memory lock limit does not apply.
+	 */
+#ifdef DEBUG
+	esdm_rpcs_arena_init(2);
+#else
+	esdm_rpcs_arena_init(max_uint32(esdm_online_nodes(), 2));
+#endif
+
+	/* The I/O arenas allow a reduced stack of the RPC threads */
+	CKINT_LOG(thread_group_set_stack_size(0, esdm_rpcs_stack_size),
+		  "Setting the RPC worker stack size failed\n");
+	CKINT_LOG(thread_group_set_stack_size(ESDM_THREAD_RPC_UNPRIV_GROUP,
+					      esdm_rpcs_stack_size),
+		  "Setting the RPC worker stack size failed\n");
+
+	/* Create the epoll reactor shared by all RPC interfaces */
+	esdm_rpcs_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (esdm_rpcs_epfd < 0) {
+		int errsv = errno;
+
+		logger(LOGGER_ERR, LOGGER_C_RPC,
+		       "Failed to create epoll instance: %s\n",
+		       strerror(errsv));
+		ret = -errsv;
+		goto out;
+	}
+
 	/* Spawn the thread handling the unprivileged interface */
 	CKINT_LOG(thread_start(esdm_rpcs_unpriv_init, NULL,
 			      ESDM_THREAD_RPC_UNPRIV_GROUP, NULL),
@@ -708,6 +1757,9 @@ static int esdm_rpcs_interfaces_init(const char *username)
 	       "Privileged server thread for %s available\n",
 	       ESDM_RPC_PRIV_SOCKET);
 
+	/* Spawn the worker pool serving the RPC reactor */
+	esdm_rpcs_start_workers();
+
 	/* Server handing privileged interface in current thread */
 	CKINT(esdm_rpcs_workerloop(&priv_proto));
 
@@ -744,7 +1796,7 @@ static void esdm_rpcs_cleanup(void)
 	}
 
 	/*
-	 * TODO: we do not clean up the SEM/SHM as there could be a CUSE client
+	 * TODO: we do not clean up the SHM as there could be a CUSE client
 	 * that looks at it. IF the server starts again, we want to attach to
 	 * the existing shared memory segment to ensure the client does not need
 	 * to be restarted too.
@@ -770,15 +1822,6 @@ static void esdm_rpcs_cleanup(void)
 			       "ESDM shared memory segment deleted\n");
 		}
 	}
-
-	/* Clean up the status semaphore */
-	if (sem_unlink(ESDM_SEM_NAME)) {
-		logger(LOGGER_VERBOSE, LOGGER_C_SERVER,
-		       "Cannot unlink semaphore: %s\n", strerror(errno));
-	} else {
-		logger(LOGGER_DEBUG, LOGGER_C_SERVER,
-		       "ESDM semaphore deleted\n");
-	}
 #endif
 }
 
@@ -807,6 +1850,13 @@ static int esdm_rpc_server_es_monitor(void __unused *unused)
 	return esdm_init_monitor();
 }
 
+static int esdm_rpc_server_drng_reseed(void __unused *unused)
+{
+	thread_set_name(drng_reseed, 0);
+
+	return esdm_init_reseed_worker();
+}
+
 int esdm_rpc_server_init(const char *username)
 {
 	pid_t pid;
@@ -835,6 +1885,12 @@ int esdm_rpc_server_init(const char *username)
 			logger(LOGGER_WARN, LOGGER_C_RPC,
 			       "Starting ES monitor thread failed\n");
 		}
+		/* Create thread for the DRNG reseed worker */
+		if (thread_start(esdm_rpc_server_drng_reseed, NULL,
+				 ESDM_THREAD_DRNG_RESEED, NULL)) {
+			logger(LOGGER_WARN, LOGGER_C_RPC,
+			       "Starting DRNG reseed worker thread failed\n");
+		}
 		/* Fork the server process */
 		esdm_rpcs_interfaces_init(username);
 	} else {
@@ -42,6 +42,92 @@ extern "C"
  */
 bool esdm_rpc_client_is_privileged(void *closure_data);
 
+/**
+ * @brief Obtain the data buffer of the request being processed
+ *
+ * The buffer is part of the I/O arena of the RPC worker thread processing the
+ * request. It is reused for all requests served by the worker and therefore
+ * must not be referenced after the response closure returned. It is locked
+ * into memory and excluded from core dumps. The handler must zeroize the
+ * bytes it used before returning.
+ *
+ * @param [in] closure_data Closure data handed to the service handler
+ *
+ * @return Buffer of ESDM_RPC_MAX_DATA bytes aligned to 64 bits
+ */
+void *esdm_rpc_server_data_buf(void *closure_data);
+
+/**
+ * @brief Limit the number of requests of unprivileged clients
+ *
+ * The requests on the unprivileged interface are accounted per peer, i.e.
+ * per UID of the client or per cgroup if enabled with
+ * esdm_rpc_server_acct_cgroup_set. A peer exceeding the limit receives a
+ * PROTOBUF_C_RPC_STATUS_CODE_TOO_MANY_PENDING response which the client
+ * library reports as -EBUSY. A peer which was idle may issue the requests of
+ * one second at once. Clients with UID 0 are not limited.
+ *
+ * The limits must be set before esdm_rpc_server_init is called.
+ *
+ * @param [in] requests_per_sec Requests per second, 0 disables the limit
+ *			       (default)
+ */
+void esdm_rpc_server_limit_requests_set(uint32_t requests_per_sec);
+
+/**
+ * @brief Limit the number of bytes sent to unprivileged clients
+ *
+ * Like esdm_rpc_server_limit_requests_set, but limiting the number of bytes
+ * of all responses sent to a peer. A response is charged after it was sent,
+ * i.e. a large response delays the following requests accordingly.
+ *
+ * @param [in] bytes_per_sec Bytes per second, 0 disables the limit (default)
+ */
+void esdm_rpc_server_limit_bytes_set(uint32_t bytes_per_sec);
+
+/**
+ * @brief Account unprivileged clients per cgroup instead of per UID
+ *
+ * A client whose cgroup v2 membership cannot be obtained is accounted per
+ * UID.
+ *
+ * @param [in] enable 1 to account per cgroup, 0 to account per UID (default)
+ */
+void esdm_rpc_server_acct_cgroup_set(int enable);
+
+/**
+ * @brief Set the scheduling weight of the clients with the given UID
+ *
+ * When the RPC worker threads are contended, every peer served by them
+ * obtains a share of the workers proportional to its weight. Connections of
+ * a peer using up its share wait until one of its requests completes. This
+ * prevents a peer issuing many concurrent requests from delaying the
+ * requests of other peers. The default weight is 1.
+ *
+ * @param [in] uid UID of the clients
+ * @param [in] weight Weight of the clients
+ *
+ * @return 0 on success, < 0 on error
+ */
+int esdm_rpc_server_acct_weight_set(uint32_t uid, uint32_t weight);
+
+/**
+ * @brief Set the stack size of the RPC worker threads
+ *
+ * The I/O buffers of the RPC worker threads are held in pre-allocated
+ * arenas. Thus, the stack of the workers only holds the processing state
+ * and can be smaller than the default of the system which reduces the memory
+ * reserved for every worker. The default is 256 KiB.
+ *
+ * The stack size must be set before esdm_rpc_server_init is called.
+ *
+ * @param [in] stack_size Stack size in bytes, 0 selects the default of the
+ *			 system
+ *
+ * @return 0 on success, < 0 on error
+ */
+int esdm_rpc_server_stack_size_set(size_t stack_size);
+
 int esdm_rpc_server_init(const char *username);
 void esdm_rpc_server_fini(void);
 
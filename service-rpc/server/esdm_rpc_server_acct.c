@@ -0,0 +1,520 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "esdm_rpc_server.h"
+#include "esdm_rpc_server_acct.h"
+#include "logger.h"
+#include "mutex_w.h"
+#include "ret_checkers.h"
+
+/* Number of hash buckets of the account table - must be a power of 2 */
+#define ESDM_RPCS_ACCT_BUCKETS		64
+
+/* Maximum number of UIDs with an individual weight */
+#define ESDM_RPCS_ACCT_MAX_WEIGHTS	16
+
+/* An idle account may consume the tokens of one second at once */
+#define ESDM_RPCS_ACCT_BURST_NS		1000000000ULL
+
+/* Maximum number of concurrent streams of one account */
+#define ESDM_RPCS_ACCT_MAX_STREAMS	2
+
+struct esdm_rpcs_acct {
+	struct esdm_rpcs_acct *next;
+	uint32_t hash;
+	uid_t uid;
+	char *cgroup;
+	uint32_t weight;
+
+	/* Connections referencing the account */
+	unsigned int ref_cnt;
+
+	/* Workers serving connections of the account */
+	unsigned int inflight;
+
+	/* Streams served for the account */
+	unsigned int streams;
+
+	/* Connections waiting for a worker in FIFO order */
+	struct esdm_rpcs_acct_wait *parked;
+	struct esdm_rpcs_acct_wait **parked_tail;
+
+	/*
+	 * The token buckets are kept as the point in time at which they are
+	 * full again. A bucket has tokens left as long as this point in time
+	 * is less than the burst duration ahead.
+	 */
+	uint64_t requests_full;
+	uint64_t bytes_full;
+};
+
+static struct {
+	uint32_t requests_per_sec;
+	uint32_t bytes_per_sec;
+	bool cgroup;
+	unsigned int num_weights;
+	struct {
+		uint32_t uid;
+		uint32_t weight;
+	} weights[ESDM_RPCS_ACCT_MAX_WEIGHTS];
+} esdm_rpcs_acct_config;
+
+/* The lock protects the account table and the scheduling state */
+static DEFINE_MUTEX_W_UNLOCKED(esdm_rpcs_acct_lock);
+static struct esdm_rpcs_acct *esdm_rpcs_acct_table[ESDM_RPCS_ACCT_BUCKETS];
+static uint32_t esdm_rpcs_acct_workers = 0;
+
+/* Sum of the weights of all accounts served by workers */
+static uint64_t esdm_rpcs_acct_active_weight = 0;
+
+void esdm_rpc_server_limit_requests_set(uint32_t requests_per_sec)
+{
+	esdm_rpcs_acct_config.requests_per_sec = requests_per_sec;
+}
+
+void esdm_rpc_server_limit_bytes_set(uint32_t bytes_per_sec)
+{
+	esdm_rpcs_acct_config.bytes_per_sec = bytes_per_sec;
+}
+
+void esdm_rpc_server_acct_cgroup_set(int enable)
+{
+	esdm_rpcs_acct_config.cgroup = !!enable;
+}
+
+int esdm_rpc_server_acct_weight_set(uint32_t uid, uint32_t weight)
+{
+	unsigned int i;
+
+	if (!weight)
+		return -EINVAL;
+
+	for (i = 0; i < esdm_rpcs_acct_config.num_weights; i++) {
+		if (esdm_rpcs_acct_config.weights[i].uid == uid)
+			break;
+	}
+
+	if (i >= ESDM_RPCS_ACCT_MAX_WEIGHTS)
+		return -EOVERFLOW;
+
+	esdm_rpcs_acct_config.weights[i].uid = uid;
+	esdm_rpcs_acct_config.weights[i].weight = weight;
+	if (i == esdm_rpcs_acct_config.num_weights)
+		esdm_rpcs_acct_config.num_weights++;
+
+	return 0;
+}
+
+static uint32_t esdm_rpcs_acct_weight(uid_t uid)
+{
+	unsigned int i;
+
+	for (i = 0; i < esdm_rpcs_acct_config.num_weights; i++) {
+		if (esdm_rpcs_acct_config.weights[i].uid == uid)
+			return esdm_rpcs_acct_config.weights[i].weight;
+	}
+
+	return 1;
+}
+
+#ifdef ESDM_TESTMODE
+/* Clock of the accounting set by the test - 0 uses the monotonic clock */
+static uint64_t esdm_rpcs_acct_test_clock = 0;
+
+void esdm_rpcs_acct_test_clock_set(uint64_t now_ns)
+{
+	esdm_rpcs_acct_test_clock = now_ns;
+}
+
+unsigned int esdm_rpcs_acct_test_accounts(void)
+{
+	struct esdm_rpcs_acct *acct;
+	unsigned int i, num = 0;
+
+	mutex_w_lock(&esdm_rpcs_acct_lock);
+	for (i = 0; i < ESDM_RPCS_ACCT_BUCKETS; i++) {
+		for (acct = esdm_rpcs_acct_table[i]; acct; acct = acct->next)
+			num++;
+	}
+	mutex_w_unlock(&esdm_rpcs_acct_lock);
+
+	return num;
+}
+#endif
+
+static uint64_t esdm_rpcs_acct_now(void)
+{
+	struct timespec ts;
+
+#ifdef ESDM_TESTMODE
+	if (esdm_rpcs_acct_test_clock)
+		return esdm_rpcs_acct_test_clock;
+#endif
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* FNV-1a hash */
+static uint32_t esdm_rpcs_acct_hash(const uint8_t *data, size_t len)
+{
+	uint32_t hash = 2166136261U;
+
+	while (len--) {
+		hash ^= *data++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/*
+ * Obtain the cgroup v2 path of the given process. If it cannot be obtained,
+ * the caller accounts the peer by its UID.
+ */
+static char *esdm_rpcs_acct_cgroup(pid_t pid)
+{
+	char path[32], *line = NULL, *cgroup = NULL;
+	size_t linelen = 0;
+	ssize_t len;
+	FILE *f;
+
+	if (pid <= 0)
+		return NULL;
+
+	snprintf(path, sizeof(path), "/proc/%d/cgroup", (int)pid);
+	f = fopen(path, "re");
+	if (!f)
+		return NULL;
+
+	while ((len = getline(&line, &linelen, f)) > 0) {
+		if (strncmp(line, "0::", 3))
+			continue;
+
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		cgroup = strdup(line + 3);
+		break;
+	}
+
+	free(line);
+	fclose(f);
+	return cgroup;
+}
+
+/*
+ * An account is only kept while it is referenced or while its token buckets
+ * are not full - otherwise a client could reset its limits by reconnecting.
+ */
+static bool esdm_rpcs_acct_unused(const struct esdm_rpcs_acct *acct,
+				  uint64_t now)
+{
+	return !acct->ref_cnt && !acct->inflight && !acct->parked &&
+	       !acct->streams && acct->requests_full <= now &&
+	       acct->bytes_full <= now;
+}
+
+static void esdm_rpcs_acct_free(struct esdm_rpcs_acct *acct)
+{
+	free(acct->cgroup);
+	free(acct);
+}
+
+/* Release an unused account - the caller must hold the lock */
+static void esdm_rpcs_acct_reclaim(struct esdm_rpcs_acct *acct, uint64_t now)
+{
+	struct esdm_rpcs_acct **p =
+		&esdm_rpcs_acct_table[acct->hash & (ESDM_RPCS_ACCT_BUCKETS - 1)];
+
+	if (!esdm_rpcs_acct_unused(acct, now))
+		return;
+
+	for (; *p; p = &(*p)->next) {
+		if (*p == acct) {
+			*p = acct->next;
+			esdm_rpcs_acct_free(acct);
+			return;
+		}
+	}
+}
+
+int esdm_rpcs_acct_get(int fd, struct esdm_rpcs_acct **acct)
+{
+	struct esdm_rpcs_acct **p, *tmp;
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	char *cgroup = NULL;
+	uint64_t now;
+	uint32_t hash;
+
+	*acct = NULL;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return -errno;
+	if (!cred.uid)
+		return 0;
+
+	if (esdm_rpcs_acct_config.cgroup)
+		cgroup = esdm_rpcs_acct_cgroup(cred.pid);
+
+	if (cgroup) {
+		hash = esdm_rpcs_acct_hash((uint8_t *)cgroup, strlen(cgroup));
+	} else {
+		hash = esdm_rpcs_acct_hash((uint8_t *)&cred.uid,
+					   sizeof(cred.uid));
+	}
+
+	now = esdm_rpcs_acct_now();
+
+	mutex_w_lock(&esdm_rpcs_acct_lock);
+
+	p = &esdm_rpcs_acct_table[hash & (ESDM_RPCS_ACCT_BUCKETS - 1)];
+	while (*p) {
+		tmp = *p;
+
+		if (tmp->hash == hash &&
+		    (cgroup ? (tmp->cgroup && !strcmp(tmp->cgroup, cgroup)) :
+			      (!tmp->cgroup && tmp->uid == cred.uid))) {
+			tmp->ref_cnt++;
+			*acct = tmp;
+			goto out;
+		}
+
+		/* Drop accounts of peers which went away on the way */
+		if (esdm_rpcs_acct_unused(tmp, now)) {
+			*p = tmp->next;
+			esdm_rpcs_acct_free(tmp);
+			continue;
+		}
+
+		p = &tmp->next;
+	}
+
+	tmp = calloc(1, sizeof(*tmp));
+	if (!tmp) {
+		mutex_w_unlock(&esdm_rpcs_acct_lock);
+		free(cgroup);
+		return -ENOMEM;
+	}
+
+	tmp->hash = hash;
+	tmp->uid = cred.uid;
+	tmp->cgroup = cgroup;
+	tmp->weight = esdm_rpcs_acct_weight(cred.uid);
+	tmp->ref_cnt = 1;
+	tmp->parked_tail = &tmp->parked;
+	cgroup = NULL;
+
+	*p = tmp;
+	*acct = tmp;
+
+	logger(LOGGER_DEBUG, LOGGER_C_RPC,
+	       "New account for UID %u, cgroup %s, weight %u\n",
+	       (unsigned int)tmp->uid, tmp->cgroup ? tmp->cgroup : "<none>",
+	       tmp->weight);
+
+out:
+	mutex_w_unlock(&esdm_rpcs_acct_lock);
+	free(cgroup);
+	return 0;
+}
+
+void esdm_rpcs_acct_put(struct esdm_rpcs_acct *acct)
+{
+	if (!acct)
+		return;
+
+	mutex_w_lock(&esdm_rpcs_acct_lock);
+	acct->ref_cnt--;
+	esdm_rpcs_acct_reclaim(acct, esdm_rpcs_acct_now());
+	mutex_w_unlock(&esdm_rpcs_acct_lock);
+}
+
+void esdm_rpcs_acct_add_worker(void)
+{
+	mutex_w_lock(&esdm_rpcs_acct_lock);
+	esdm_rpcs_acct_workers++;
+	mutex_w_unlock(&esdm_rpcs_acct_lock);
+}
+
+/*
+ * Does the account use its share of the workers? The share is proportional
+ * to the weight of the account among all active accounts but at least one
+ * worker. The caller must hold the lock.
+ */
+static bool esdm_rpcs_acct_saturated(const struct esdm_rpcs_acct *acct)
+{
+	if (!acct->inflight)
+		return false;
+
+	return (uint64_t)acct->inflight * esdm_rpcs_acct_active_weight >=
+	       (uint64_t)esdm_rpcs_acct_workers * acct->weight;
+}
+
+bool esdm_rpcs_acct_enter(struct esdm_rpcs_acct *acct,
+			  struct esdm_rpcs_acct_wait *wait)
+{
+	bool ret = true;
+
+	mutex_w_lock(&esdm_rpcs_acct_lock);
+
+	if (esdm_rpcs_acct_saturated(acct)) {
+		/*
+		 * A parked connection is resumed when a worker of the account
+		 * completes. As the account has workers, this is guaranteed.
+		 */
+		wait->next = NULL;
+		*acct->parked_tail = wait;
+		acct->parked_tail = &wait->next;
+		ret = false;
+		goto out;
+	}
+
+	if (!acct->inflight)
+		esdm_rpcs_acct_active_weight += acct->weight;
+	acct->inflight++;
+
+out:
+	mutex_w_unlock(&esdm_rpcs_acct_lock);
+	return ret;
+}
+
+struct esdm_rpcs_acct_wait *esdm_rpcs_acct_leave(struct esdm_rpcs_acct *acct)
+{
+	struct esdm_rpcs_acct_wait *wait = NULL;
+
+	mutex_w_lock(&esdm_rpcs_acct_lock);
+
+	acct->inflight--;
+
+	if (acct->parked && !esdm_rpcs_acct_saturated(acct)) {
+		wait = acct->parked;
+		acct->parked = wait->next;
+		if (!acct->parked)
+			acct->parked_tail = &acct->parked;
+		wait->next = NULL;
+	}
+
+	if (!acct->inflight) {
+		esdm_rpcs_acct_active_weight -= acct->weight;
+		esdm_rpcs_acct_reclaim(acct, esdm_rpcs_acct_now());
+	}
+
+	mutex_w_unlock(&esdm_rpcs_acct_lock);
+	return wait;
+}
+
+int esdm_rpcs_acct_admit(struct esdm_rpcs_acct *acct, uint32_t requests,
+			 uint32_t *retry_ms)
+{
+	uint64_t now, full, wait = 0;
+	uint32_t requests_per_sec = esdm_rpcs_acct_config.requests_per_sec;
+	uint32_t bytes_per_sec = esdm_rpcs_acct_config.bytes_per_sec;
+
+	if (!requests_per_sec && !bytes_per_sec)
+		return 0;
+
+	now = esdm_rpcs_acct_now();
+
+	mutex_w_lock(&esdm_rpcs_acct_lock);
+
+	full = acct->requests_full;
+	if (requests_per_sec) {
+		if (full < now)
+			full = now;
+		full += (uint64_t)requests * 1000000000ULL / requests_per_sec;
+		if (full > now + ESDM_RPCS_ACCT_BURST_NS)
+			wait = full - now - ESDM_RPCS_ACCT_BURST_NS;
+	}
+
+	/* The bytes of the previous responses are paid for after the fact */
+	if (bytes_per_sec &&
+	    acct->bytes_full > now + ESDM_RPCS_ACCT_BURST_NS &&
+	    acct->bytes_full - now - ESDM_RPCS_ACCT_BURST_NS > wait)
+		wait = acct->bytes_full - now - ESDM_RPCS_ACCT_BURST_NS;
+
+	if (!wait)
+		acct->requests_full = full;
+
+	mutex_w_unlock(&esdm_rpcs_acct_lock);
+
+	if (!wait)
+		return 0;
+
+	wait = (wait + 999999) / 1000000;
+	*retry_ms = (wait > UINT32_MAX) ? UINT32_MAX : (uint32_t)wait;
+
+	logger(LOGGER_DEBUG, LOGGER_C_RPC,
+	       "Throttling client with UID %u for %u ms\n",
+	       (unsigned int)acct->uid, *retry_ms);
+
+	return -EBUSY;
+}
+
+int esdm_rpcs_acct_stream_enter(struct esdm_rpcs_acct *acct)
+{
+	int ret = 0;
+
+	mutex_w_lock(&esdm_rpcs_acct_lock);
+	if (acct->streams >= ESDM_RPCS_ACCT_MAX_STREAMS)
+		ret = -EBUSY;
+	else
+		acct->streams++;
+	mutex_w_unlock(&esdm_rpcs_acct_lock);
+
+	if (ret) {
+		logger(LOGGER_DEBUG, LOGGER_C_RPC,
+		       "Client with UID %u exceeds its concurrent streams\n",
+		       (unsigned int)acct->uid);
+	}
+
+	return ret;
+}
+
+void esdm_rpcs_acct_stream_leave(struct esdm_rpcs_acct *acct)
+{
+	mutex_w_lock(&esdm_rpcs_acct_lock);
+	acct->streams--;
+	mutex_w_unlock(&esdm_rpcs_acct_lock);
+}
+
+void esdm_rpcs_acct_charge(struct esdm_rpcs_acct *acct, size_t bytes)
+{
+	uint32_t bytes_per_sec = esdm_rpcs_acct_config.bytes_per_sec;
+	uint64_t now;
+
+	if (!acct || !bytes_per_sec)
+		return;
+
+	now = esdm_rpcs_acct_now();
+
+	mutex_w_lock(&esdm_rpcs_acct_lock);
+	if (acct->bytes_full < now)
+		acct->bytes_full = now;
+	acct->bytes_full += (uint64_t)bytes * 1000000000ULL / bytes_per_sec;
+	mutex_w_unlock(&esdm_rpcs_acct_lock);
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef ESDM_RPC_SERVER_ACCT_H
+#define ESDM_RPC_SERVER_ACCT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bool.h"
+#include "config.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Accounting of unprivileged RPC clients
+ * ======================================
+ *
+ * All connections of one peer, identified by the UID or the cgroup obtained
+ * with SO_PEERCRED, share one account. The account is used for:
+ *
+ *	* Fair scheduling: every active account obtains a share of the RPC
+ *	  worker threads proportional to its weight. A connection of an
+ *	  account already using its share is parked until one of the workers
+ *	  serving the account completes.
+ *
+ *	* Rate limiting: token buckets limit the requests and the bytes sent
+ *	  per second. A request exceeding the limits is rejected.
+ *
+ *	* Streams: the number of concurrent streams of an account is limited
+ *	  as every stream occupies a worker thread until it completes.
+ */
+struct esdm_rpcs_acct;
+
+/* Link of a connection parked on its account */
+struct esdm_rpcs_acct_wait {
+	struct esdm_rpcs_acct_wait *next;
+	void *data;
+};
+
+/**
+ * @brief Obtain the account of the peer of a connection
+ *
+ * Peers with UID 0 are not accounted, for them acct is set to NULL.
+ *
+ * @param [in] fd Unix Domain Socket of the connection
+ * @param [out] acct Account to be released with esdm_rpcs_acct_put
+ *
+ * @return 0 on success, < 0 on error
+ */
+int esdm_rpcs_acct_get(int fd, struct esdm_rpcs_acct **acct);
+
+/**
+ * @brief Release the account obtained with esdm_rpcs_acct_get
+ */
+void esdm_rpcs_acct_put(struct esdm_rpcs_acct *acct);
+
+/**
+ * @brief Register a worker thread serving the accounted connections
+ */
+void esdm_rpcs_acct_add_worker(void);
+
+/**
+ * @brief Start serving a connection of the account
+ *
+ * If the account already uses its share of the workers, the connection is
+ * parked and the caller must not serve it.
+ *
+ * @param [in] acct Account of the connection
+ * @param [in] wait Link of the connection used for parking
+ *
+ * @return true if the connection may be served, false if it was parked
+ */
+bool esdm_rpcs_acct_enter(struct esdm_rpcs_acct *acct,
+			  struct esdm_rpcs_acct_wait *wait);
+
+/**
+ * @brief Complete serving a connection of the account
+ *
+ * @param [in] acct Account of the connection
+ *
+ * @return Link of a parked connection the caller must resume or NULL
+ */
+struct esdm_rpcs_acct_wait *esdm_rpcs_acct_leave(struct esdm_rpcs_acct *acct);
+
+/**
+ * @brief Check the rate limits of the account before serving a request
+ *
+ * @param [in] acct Account of the connection
+ * @param [in] requests Number of request tokens to take if admitted
+ * @param [out] retry_ms Time after which the client may try again
+ *
+ * @return 0 if admitted, -EBUSY if the account is throttled
+ */
+int esdm_rpcs_acct_admit(struct esdm_rpcs_acct *acct, uint32_t requests,
+			 uint32_t *retry_ms);
+
+/**
+ * @brief Start serving a stream of the account
+ *
+ * @param [in] acct Account of the connection
+ *
+ * @return 0 if admitted, -EBUSY if the account has too many streams
+ */
+int esdm_rpcs_acct_stream_enter(struct esdm_rpcs_acct *acct);
+
+/**
+ * @brief Complete serving a stream admitted with esdm_rpcs_acct_stream_enter
+ */
+void esdm_rpcs_acct_stream_leave(struct esdm_rpcs_acct *acct);
+
+/**
+ * @brief Charge the bytes sent to the peer to the account
+ */
+void esdm_rpcs_acct_charge(struct esdm_rpcs_acct *acct, size_t bytes);
+
+#ifdef ESDM_TESTMODE
+void esdm_rpcs_acct_test_clock_set(uint64_t now_ns);
+unsigned int esdm_rpcs_acct_test_accounts(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESDM_RPC_SERVER_ACCT_H */
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "esdm.h"
+#include "esdm_rpc_server_acct.h"
+#include "esdm_rpc_server_shm.h"
+#include "esdm_rpc_shm.h"
+#include "logger.h"
+#include "memset_secure.h"
+#include "ret_checkers.h"
+
+struct esdm_rpcs_shm {
+	struct esdm_rpc_shm *mem;
+	int memfd;
+	int cs_efd;
+	int sc_efd;
+};
+
+void esdm_rpcs_shm_free(struct esdm_rpcs_shm *shm)
+{
+	if (!shm)
+		return;
+
+	if (shm->mem && shm->mem != MAP_FAILED) {
+		memset_secure(shm->mem, 0, sizeof(*shm->mem));
+		munmap(shm->mem, sizeof(*shm->mem));
+	}
+	if (shm->memfd >= 0)
+		close(shm->memfd);
+	if (shm->cs_efd >= 0)
+		close(shm->cs_efd);
+	if (shm->sc_efd >= 0)
+		close(shm->sc_efd);
+	free(shm);
+}
+
+int esdm_rpcs_shm_alloc(struct esdm_rpcs_shm **shm)
+{
+	struct esdm_rpcs_shm *tmp;
+	int ret = 0;
+
+	tmp = calloc(1, sizeof(*tmp));
+	CKNULL(tmp, -ENOMEM);
+	tmp->memfd = -1;
+	tmp->cs_efd = -1;
+	tmp->sc_efd = -1;
+
+	tmp->memfd = memfd_create("esdm-rpc-shm",
+				  MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (tmp->memfd < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	if (ftruncate(tmp->memfd, sizeof(*tmp->mem)) < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	/*
+	 * The client must not be able to change the size of the memory as
+	 * otherwise accessing the memory could trigger a SIGBUS in the server.
+	 */
+	if (fcntl(tmp->memfd, F_ADD_SEALS,
+		  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	tmp->mem = mmap(NULL, sizeof(*tmp->mem), PROT_READ | PROT_WRITE,
+			MAP_SHARED, tmp->memfd, 0);
+	if (tmp->mem == MAP_FAILED) {
+		ret = -errno;
+		goto out;
+	}
+	madvise(tmp->mem, sizeof(*tmp->mem), MADV_DONTDUMP);
+	tmp->mem->version = ESDM_RPC_SHM_VERSION;
+
+	tmp->cs_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (tmp->cs_efd < 0) {
+		ret = -errno;
+		goto out;
+	}
+	tmp->sc_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (tmp->sc_efd < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	*shm = tmp;
+	tmp = NULL;
+
+out:
+	if (ret) {
+		logger(LOGGER_WARN, LOGGER_C_RPC,
+		       "Allocation of shared memory transport failed: %s\n",
+		       strerror(-ret));
+	}
+	esdm_rpcs_shm_free(tmp);
+	return ret;
+}
+
+int esdm_rpcs_shm_send(struct esdm_rpcs_shm *shm, int fd,
+		       const void *header, size_t headerlen)
+{
+	int fds[ESDM_RPC_SHM_NUM_FDS] = { shm->memfd, shm->cs_efd,
+					  shm->sc_efd };
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { .iov_base = (void *)header,
+			     .iov_len = headerlen };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+			      .msg_control = control.buf,
+			      .msg_controllen = sizeof(control.buf) };
+	struct cmsghdr *cmsg;
+	ssize_t sent;
+
+	memset(&control, 0, sizeof(control));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	do {
+		sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while (sent < 0 && errno == EINTR);
+
+	if (sent < 0)
+		return -errno;
+	if ((size_t)sent != headerlen)
+		return -EFAULT;
+
+	/* The mapping is kept, the memfd is not needed by the server any more */
+	close(shm->memfd);
+	shm->memfd = -1;
+
+	return 0;
+}
+
+int esdm_rpcs_shm_doorbell(struct esdm_rpcs_shm *shm)
+{
+	return shm->cs_efd;
+}
+
+static int esdm_rpcs_shm_one(struct esdm_rpcs_shm *shm,
+			     struct esdm_rpcs_acct *acct, uint8_t *rndval,
+			     const struct esdm_rpc_shm_req *req)
+{
+	struct esdm_rpc_shm *mem = shm->mem;
+	struct esdm_rpc_shm_resp resp = { .method_index = req->method_index,
+					  .request_id = req->request_id };
+	uint32_t off = 0, retry_ms, used = 0;
+	int ret;
+
+	if (acct && esdm_rpcs_acct_admit(acct, 1, &retry_ms)) {
+		resp.ret = -EBUSY;
+	} else if (req->len > ESDM_RPC_MAX_DATA) {
+		resp.ret = -(int64_t)ESDM_RPC_MAX_DATA;
+	} else {
+		used = (uint32_t)req->len;
+
+		switch (req->method_index) {
+		case esdm_rpc_shm_get_random_bytes_full:
+			resp.ret = esdm_get_random_bytes_full_noblock(
+							rndval, req->len);
+			break;
+		case esdm_rpc_shm_get_random_bytes_min:
+			resp.ret = esdm_get_random_bytes_min_noblock(
+							rndval, req->len);
+			break;
+		case esdm_rpc_shm_get_random_bytes:
+			resp.ret = esdm_get_random_bytes(rndval, req->len);
+			break;
+		default:
+			resp.ret = -EOPNOTSUPP;
+			break;
+		}
+	}
+
+	if (resp.ret > 0) {
+		esdm_rpcs_acct_charge(acct, (size_t)resp.ret);
+		esdm_test_shm_status_add_rpc_server_written((size_t)resp.ret);
+		CKINT(esdm_rpc_shm_ring_write(&mem->sc, mem->sc_data,
+					      ESDM_RPC_SHM_SC_MASK,
+					      (uint8_t *)&resp, sizeof(resp),
+					      false, &off));
+		CKINT(esdm_rpc_shm_ring_write(&mem->sc, mem->sc_data,
+					      ESDM_RPC_SHM_SC_MASK, rndval,
+					      (uint32_t)resp.ret, true, &off));
+	} else {
+		CKINT(esdm_rpc_shm_ring_write(&mem->sc, mem->sc_data,
+					      ESDM_RPC_SHM_SC_MASK,
+					      (uint8_t *)&resp, sizeof(resp),
+					      true, &off));
+	}
+
+out:
+	memset_secure(rndval, 0, used);
+	return ret;
+}
+
+int esdm_rpcs_shm_process(struct esdm_rpcs_shm *shm,
+			  struct esdm_rpcs_acct *acct, uint8_t *buf)
+{
+	struct esdm_rpc_shm *mem = shm->mem;
+	struct esdm_rpc_shm_req req;
+	uint64_t val = 1;
+	unsigned int processed = 0;
+	int ret;
+
+	/* Reset the doorbell before looking at the ring */
+	if (read(shm->cs_efd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		return -errno;
+
+	for (;;) {
+		ret = esdm_rpc_shm_ring_read(&mem->cs, mem->cs_data,
+					     ESDM_RPC_SHM_CS_MASK,
+					     (uint8_t *)&req, sizeof(req));
+		if (ret == -EAGAIN)
+			break;
+		CKINT(ret);
+
+		/*
+		 * A client not consuming its responses cannot make the server
+		 * wait - the transport is considered broken.
+		 */
+		CKINT_LOG(esdm_rpcs_shm_one(shm, acct, buf, &req),
+			  "Shared memory response ring full\n");
+		processed++;
+	}
+
+	ret = 0;
+	if (processed) {
+		val = 1;
+		if (write(shm->sc_efd, &val, sizeof(val)) < 0 &&
+		    errno != EAGAIN)
+			ret = -errno;
+	}
+
+out:
+	return ret;
+}
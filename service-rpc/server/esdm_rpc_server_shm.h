@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef ESDM_RPC_SERVER_SHM_H
+#define ESDM_RPC_SERVER_SHM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct esdm_rpcs_acct;
+struct esdm_rpcs_shm;
+
+/**
+ * @brief Allocate the shared memory transport for one connection
+ *
+ * @param [out] shm Allocated transport
+ *
+ * @return 0 on success, < 0 on error
+ */
+int esdm_rpcs_shm_alloc(struct esdm_rpcs_shm **shm);
+
+/**
+ * @brief Release the shared memory transport
+ */
+void esdm_rpcs_shm_free(struct esdm_rpcs_shm *shm);
+
+/**
+ * @brief Hand the shared memory transport to the client
+ *
+ * The given header is sent to the client together with the file descriptors
+ * of the transport.
+ *
+ * @param [in] shm Shared memory transport
+ * @param [in] fd Socket of the client connection
+ * @param [in] header Header data to send
+ * @param [in] headerlen Length of the header
+ *
+ * @return 0 on success, < 0 on error
+ */
+int esdm_rpcs_shm_send(struct esdm_rpcs_shm *shm, int fd,
+		       const void *header, size_t headerlen);
+
+/**
+ * @brief File descriptor signalled by the client when a request is pending
+ */
+int esdm_rpcs_shm_doorbell(struct esdm_rpcs_shm *shm);
+
+/**
+ * @brief Process all requests pending in the shared memory transport
+ *
+ * @param [in] shm Shared memory transport
+ * @param [in] acct Account of the peer whose rate limits are applied or NULL
+ * @param [in] buf Buffer of ESDM_RPC_MAX_DATA bytes for the generated data -
+ *		   only the used part of it is zeroized after each request
+ *
+ * @return 0 on success, < 0 when the transport is unusable and the connection
+ *	   shall be closed
+ */
+int esdm_rpcs_shm_process(struct esdm_rpcs_shm *shm,
+			  struct esdm_rpcs_acct *acct, uint8_t *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESDM_RPC_SERVER_SHM_H */
@@ -20,8 +20,10 @@
 #include <string.h>
 
 #include "esdm.h"
+#include "esdm_rpc_server.h"
 #include "esdm_rpc_service.h"
 #include "math_helper.h"
+#include "memset_secure.h"
 #include "unpriv_access.pb-c.h"
 
 void esdm_rpc_status(UnprivAccess_Service *service,
@@ -30,17 +32,20 @@ void esdm_rpc_status(UnprivAccess_Service *service,
 		     void *closure_data)
 {
 	StatusResponse response = STATUS_RESPONSE__INIT;
-	char status[ESDM_RPC_MAX_MSG_SIZE];
+	char *status = esdm_rpc_server_data_buf(closure_data);
 	(void) service;
 
 	if (request == NULL) {
-		response.ret = -(int32_t)sizeof(status);
+		response.ret = -(int32_t)ESDM_RPC_MAX_DATA;
 		closure (&response, closure_data);
 	} else {
-		esdm_status(status, min_uint32(request->maxlen,
-					       ESDM_RPC_MAX_MSG_SIZE));
+		uint32_t used = min_uint32(request->maxlen, ESDM_RPC_MAX_DATA);
+
+		esdm_status(status, used);
 		response.ret = 0;
 		response.buffer = status;
 		closure (&response, closure_data);
+
+		memset_secure(status, 0, used);
 	}
 }
@@ -73,6 +73,17 @@ typedef enum
 	PROTOBUF_C_RPC_STATUS_CODE_TOO_MANY_PENDING
 } ProtobufC_RPC_Status_Code;
 
+/*
+ * A request of a client exceeding its rate limits is answered with a
+ * PROTOBUF_C_RPC_STATUS_CODE_TOO_MANY_PENDING header carrying the method
+ * index and request ID of the request followed by this structure. The client
+ * should not send further requests before the given time passed.
+ */
+struct esdm_rpc_proto_throttle {
+	/* Milliseconds until requests are accepted again, little-endian */
+	uint32_t retry_ms;
+} __attribute__((packed));
+
 void set_fd_nonblocking(int fd);
 
 int
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef ESDM_RPC_RAW_H
+#define ESDM_RPC_RAW_H
+
+#include <stdint.h>
+
+#include "esdm_rpc_service.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Raw encoding of the random bytes and seed requests
+ * ==================================================
+ *
+ * A client connected to the unprivileged socket may send the requests listed
+ * in enum esdm_rpc_raw_method with the method index ESDM_RPC_RAW and
+ * struct esdm_rpc_raw_req as payload instead of a Protobuf-C message. The
+ * server answers with a PROTOBUF_C_RPC_STATUS_CODE_SUCCESS header with the
+ * method index ESDM_RPC_RAW and the request ID of the request followed by
+ * struct esdm_rpc_raw_resp and the returned data. The return code and the
+ * data are identical to the fields ret and randval of the Protobuf-C response
+ * of the requested method. The length of the data is the message length
+ * minus the size of struct esdm_rpc_raw_resp.
+ *
+ * Header and payload are transmitted with one system call in each direction
+ * and none of them is processed by Protobuf-C.
+ *
+ * A server not offering the requested method in the raw encoding answers
+ * with a PROTOBUF_C_RPC_STATUS_CODE_SERVICE_FAILED header without payload.
+ * The client then uses the Protobuf-C encoding for the remainder of the
+ * connection.
+ *
+ * All values are little-endian. Older servers not supporting the encoding at
+ * all close the connection on a raw request. As a connection may be closed
+ * for other reasons as well, the client only uses the Protobuf-C encoding on
+ * the new connection the request is resent on and tries the raw encoding
+ * again on the following connection.
+ */
+#define ESDM_RPC_RAW				0xfffffffc
+
+/*
+ * Requests served with the raw encoding. The values are identical to the
+ * method indexes of the unprivileged Protobuf-C service.
+ */
+enum esdm_rpc_raw_method {
+	esdm_rpc_raw_get_random_bytes_full = 1,
+	esdm_rpc_raw_get_random_bytes_min = 2,
+	esdm_rpc_raw_get_random_bytes_pr = 3,
+	esdm_rpc_raw_get_random_bytes = 4,
+	esdm_rpc_raw_get_seed = 5,
+};
+
+struct esdm_rpc_raw_req {
+	uint32_t method_index;
+	uint32_t flags;
+	uint64_t len;
+} __attribute__((packed));
+
+struct esdm_rpc_raw_resp {
+	int64_t ret;
+} __attribute__((packed));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESDM_RPC_RAW_H */
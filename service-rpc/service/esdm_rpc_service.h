@@ -20,8 +20,11 @@
 #ifndef ESDM_RPC_SERVICE_H
 #define ESDM_RPC_SERVICE_H
 
+#include <errno.h>
+#include <string.h>
 #include <sys/ipc.h>
 
+#include "atomic.h"
 #include "atomic_bool.h"
 #include "config.h"
 #include "esdm_rpc_protocol.h"
@@ -47,8 +50,6 @@ extern "C"
 # define ESDM_SHM_NAME "/"
 # define ESDM_SHM_STATUS 0x6573646d
 
-# define ESDM_SEM_NAME "esdm-shm-status-semaphore-testmode"
-
 #else /* ESDM_TESTMODE */
 
 # define ESDM_RPC_UNPRIV_SOCKET "/var/run/esdm-rpc-unpriv.socket"
@@ -58,12 +59,51 @@ extern "C"
 # define ESDM_SHM_NAME "/"
 # define ESDM_SHM_STATUS 0x6d647365
 
-# define ESDM_SEM_NAME "esdm-shm-status-semaphore"
-
 #endif /* ESDM_TESTMODE */
 
-#define ESDM_SHM_STATUS_VERSION	1
+#define ESDM_SHM_STATUS_VERSION	4
 #define ESDM_SHM_STATUS_INFO_SIZE	1536
+#define ESDM_SHM_STATUS_MAX_DRNGS	64
+#define ESDM_SHM_STATUS_MAX_ES		8
+#define ESDM_SHM_STATUS_ES_NAME_SIZE	16
+
+/* Seed state of one regular DRNG instance */
+struct esdm_shm_status_drng {
+	/* Number of successful (re)seeds */
+	uint32_t reseed_gen;
+	/* Generate requests since the last (re)seed */
+	uint32_t requests;
+	/* Generate requests since the DRNG was last fully seeded */
+	uint32_t requests_since_fully_seeded;
+	/* Is the DRNG fully seeded? */
+	uint32_t fully_seeded;
+	/* Time of last (re)seed in seconds since the epoch */
+	int64_t last_seeded;
+};
+
+/*
+ * Binary snapshot of the ESDM state.
+ *
+ * The snapshot is protected by a sequence lock: the server increments seq
+ * before and after updating the snapshot. A reader must discard the data it
+ * read if seq was odd or changed while reading - see
+ * esdm_shm_status_snapshot_read.
+ */
+struct esdm_shm_status_snapshot {
+	uint32_t seq;
+
+	/* Time of the update in seconds since the epoch */
+	int64_t updated;
+
+	/* Available entropy in bits per entropy source */
+	uint32_t num_es;
+	uint32_t es_entropy[ESDM_SHM_STATUS_MAX_ES];
+	char es_name[ESDM_SHM_STATUS_MAX_ES][ESDM_SHM_STATUS_ES_NAME_SIZE];
+
+	/* Regular DRNGs: the initial DRNG followed by the node DRNGs */
+	uint32_t num_drngs;
+	struct esdm_shm_status_drng drng[ESDM_SHM_STATUS_MAX_DRNGS];
+};
 
 struct esdm_shm_status {
 	/* Monotonic increasing version */
@@ -80,6 +120,19 @@ struct esdm_shm_status {
 	atomic_bool_t operational;
 	/* Do we need new entropy? */
 	atomic_bool_t need_entropy;
+
+	/*
+	 * Change indicator incremented by the server after changing the
+	 * status. It is a futex word: clients wait with FUTEX_WAIT for it to
+	 * differ from the value they saw last, the server wakes all of them.
+	 */
+	uint32_t change_seq;
+
+	/* Incremented whenever the regular DRNGs are reseeded */
+	atomic_t reseed_epoch;
+
+	/* Binary state information */
+	struct esdm_shm_status_snapshot snapshot;
 };
 
 static inline key_t esdm_ftok(const char *pathname, int proj_id)
@@ -87,6 +140,40 @@ static inline key_t esdm_ftok(const char *pathname, int proj_id)
 	return ftok(pathname, proj_id);
 }
 
+/**
+ * @brief Obtain a consistent copy of the binary state information
+ *
+ * @param [in] status Status shared memory segment
+ * @param [out] snapshot Buffer receiving the copy
+ *
+ * @return 0 on success, -EAGAIN if the server updated the snapshot during
+ *	   all read attempts
+ */
+static inline int
+esdm_shm_status_snapshot_read(const struct esdm_shm_status *status,
+			      struct esdm_shm_status_snapshot *snapshot)
+{
+	const struct esdm_shm_status_snapshot *shared = &status->snapshot;
+	unsigned int i;
+
+	for (i = 0; i < 100; i++) {
+		uint32_t seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+
+		if (seq & 1)
+			continue;
+
+		memcpy(snapshot, shared, sizeof(*snapshot));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) == seq) {
+			snapshot->seq = seq;
+			return 0;
+		}
+	}
+
+	return -EAGAIN;
+}
+
 /******************************************************************************
  * Service functions wrapping the ESDM library
  *
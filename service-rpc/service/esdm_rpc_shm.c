@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "esdm_rpc_shm.h"
+#include "memset_secure.h"
+
+/*
+ * The peer has write access to the ring meta data. Thus, the values are read
+ * exactly once and are validated before use.
+ */
+static inline uint32_t esdm_rpc_shm_load(uint32_t *ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void esdm_rpc_shm_store(uint32_t *ptr, uint32_t val)
+{
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+int esdm_rpc_shm_ring_write(struct esdm_rpc_shm_ring *ring, uint8_t *data,
+			    uint32_t mask, const uint8_t *buf, uint32_t buflen,
+			    bool commit, uint32_t *off)
+{
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	uint32_t tail = esdm_rpc_shm_load(&ring->tail);
+	uint32_t used = head - tail, pos, todo;
+
+	if (used > mask + 1)
+		return -EFAULT;
+	if (buflen > mask + 1 - used - *off)
+		return -EAGAIN;
+
+	pos = (head + *off) & mask;
+	todo = mask + 1 - pos;
+	if (todo > buflen)
+		todo = buflen;
+
+	memcpy(data + pos, buf, todo);
+	if (buflen > todo)
+		memcpy(data, buf + todo, buflen - todo);
+
+	*off += buflen;
+
+	if (commit) {
+		esdm_rpc_shm_store(&ring->head, head + *off);
+		*off = 0;
+	}
+
+	return 0;
+}
+
+int esdm_rpc_shm_ring_read(struct esdm_rpc_shm_ring *ring, uint8_t *data,
+			   uint32_t mask, uint8_t *buf, uint32_t buflen)
+{
+	uint32_t head = esdm_rpc_shm_load(&ring->head);
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	uint32_t avail = head - tail, pos, todo;
+
+	if (avail > mask + 1)
+		return -EFAULT;
+	if (buflen > avail)
+		return -EAGAIN;
+
+	pos = tail & mask;
+	todo = mask + 1 - pos;
+	if (todo > buflen)
+		todo = buflen;
+
+	memcpy(buf, data + pos, todo);
+	memset_secure(data + pos, 0, todo);
+	if (buflen > todo) {
+		memcpy(buf + todo, data, buflen - todo);
+		memset_secure(data, 0, buflen - todo);
+	}
+
+	esdm_rpc_shm_store(&ring->tail, tail + buflen);
+
+	return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef ESDM_RPC_SHM_H
+#define ESDM_RPC_SHM_H
+
+#include <stdint.h>
+
+#include "bool.h"
+#include "esdm_rpc_service.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Shared memory transport for random bytes
+ * ========================================
+ *
+ * A client connected to the unprivileged socket may request a shared memory
+ * transport by sending a request with the method index
+ * ESDM_RPC_SHM_NEGOTIATE and no payload. If the server grants the request,
+ * it answers with a PROTOBUF_C_RPC_STATUS_CODE_SUCCESS header and passes
+ * the following file descriptors via SCM_RIGHTS in that order:
+ *
+ *	1. a sealed memfd holding struct esdm_rpc_shm,
+ *	2. an eventfd the client signals after adding a request (doorbell to
+ *	   the server),
+ *	3. an eventfd the server signals after adding a response (doorbell to
+ *	   the client).
+ *
+ * The memory holds two single-producer/single-consumer rings: the client
+ * produces struct esdm_rpc_shm_req records into the cs ring and the server
+ * produces struct esdm_rpc_shm_resp records followed by the random bytes into
+ * the sc ring. The head is only written by the producer, the tail is only
+ * written by the consumer. Both are free-running counters.
+ *
+ * The shared memory transport is bound to the lifetime of the socket
+ * connection it was negotiated on. A server not supporting the transport
+ * rejects the request which lets the client fall back to the socket path.
+ */
+#define ESDM_RPC_SHM_NEGOTIATE			0xffffffff
+
+#define ESDM_RPC_SHM_VERSION			1
+#define ESDM_RPC_SHM_NUM_FDS			3
+#define ESDM_RPC_SHM_CS_SIZE			4096
+#define ESDM_RPC_SHM_SC_SIZE			ESDM_RPC_MAX_MSG_SIZE
+
+/* The ring sizes must be a power of 2 */
+#define ESDM_RPC_SHM_CS_MASK			(ESDM_RPC_SHM_CS_SIZE - 1)
+#define ESDM_RPC_SHM_SC_MASK			(ESDM_RPC_SHM_SC_SIZE - 1)
+
+struct esdm_rpc_shm_ring {
+	/* Separate cache lines to avoid false sharing between the peers */
+	uint32_t head __attribute__((aligned(64)));
+	uint32_t tail __attribute__((aligned(64)));
+};
+
+struct esdm_rpc_shm {
+	uint32_t version;
+	struct esdm_rpc_shm_ring cs;
+	struct esdm_rpc_shm_ring sc;
+	uint8_t cs_data[ESDM_RPC_SHM_CS_SIZE] __attribute__((aligned(64)));
+	uint8_t sc_data[ESDM_RPC_SHM_SC_SIZE] __attribute__((aligned(64)));
+};
+
+/*
+ * Requests served by the shared memory transport. The values are identical to
+ * the method indexes of the unprivileged Protobuf-C service.
+ */
+enum esdm_rpc_shm_method {
+	esdm_rpc_shm_get_random_bytes_full = 1,
+	esdm_rpc_shm_get_random_bytes_min = 2,
+	esdm_rpc_shm_get_random_bytes = 4,
+};
+
+/* Request record in the cs ring */
+struct esdm_rpc_shm_req {
+	uint32_t method_index;
+	uint32_t request_id;
+	uint64_t len;
+};
+
+/* Response record in the sc ring - it is followed by ret bytes if ret > 0 */
+struct esdm_rpc_shm_resp {
+	uint32_t method_index;
+	uint32_t request_id;
+	int64_t ret;
+};
+
+/**
+ * @brief Write data into a ring
+ *
+ * @param [in] ring Ring meta data
+ * @param [in] data Ring data buffer
+ * @param [in] mask Size of the data buffer minus one
+ * @param [in] buf Data to be written
+ * @param [in] buflen Length of the data
+ * @param [in] commit Shall the data be made visible to the consumer (true) or
+ *		      shall further data be added to the same record (false)
+ * @param [in,out] off Offset relative to the head where data is written,
+ *		       it must be 0 at the beginning of a record.
+ *
+ * @return 0 on success, -EAGAIN if the ring has insufficient space, -EFAULT
+ *	   if the peer corrupted the ring
+ */
+int esdm_rpc_shm_ring_write(struct esdm_rpc_shm_ring *ring, uint8_t *data,
+			    uint32_t mask, const uint8_t *buf, uint32_t buflen,
+			    bool commit, uint32_t *off);
+
+/**
+ * @brief Read data from a ring
+ *
+ * The read data is wiped from the ring.
+ *
+ * @param [in] ring Ring meta data
+ * @param [in] data Ring data buffer
+ * @param [in] mask Size of the data buffer minus one
+ * @param [out] buf Buffer receiving the data
+ * @param [in] buflen Length of the data to read
+ *
+ * @return 0 on success, -EAGAIN if the ring does not hold sufficient data,
+ *	   -EFAULT if the peer corrupted the ring
+ */
+int esdm_rpc_shm_ring_read(struct esdm_rpc_shm_ring *ring, uint8_t *data,
+			   uint32_t mask, uint8_t *buf, uint32_t buflen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESDM_RPC_SHM_H */
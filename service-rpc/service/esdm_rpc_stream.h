@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef ESDM_RPC_STREAM_H
+#define ESDM_RPC_STREAM_H
+
+#include <stdint.h>
+
+#include "esdm_rpc_service.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Streamed random bytes
+ * =====================
+ *
+ * A client connected to the unprivileged socket may request random bytes
+ * exceeding ESDM_RPC_MAX_DATA with one request carrying the method index
+ * ESDM_RPC_STREAM and struct esdm_rpc_stream_req as payload. The server
+ * answers with successive fragments, each consisting of a
+ * PROTOBUF_C_RPC_STATUS_CODE_SUCCESS header with the method index
+ * ESDM_RPC_STREAM and the request ID of the request followed by up to
+ * ESDM_RPC_MAX_DATA raw random bytes. The stream ends when the requested
+ * number of bytes is delivered.
+ *
+ * Flow control: the request grants the server a window of fragments it may
+ * send. Once it is used up, the server waits for a request with the method
+ * index ESDM_RPC_STREAM_CREDIT and the request ID of the stream carrying
+ * struct esdm_rpc_stream_credit which grants further fragments. The window
+ * of the request must not be 0. A client not granting credits within the I/O
+ * timeout of the server or consuming the stream at a lower rate than the
+ * server's minimum causes the connection to be closed.
+ *
+ * If the server cannot deliver further random bytes, it ends the stream with
+ * a PROTOBUF_C_RPC_STATUS_CODE_SERVICE_FAILED header followed by struct
+ * esdm_rpc_stream_err. The connection remains usable in this case. This also
+ * applies to a request with an invalid length or window and to a client
+ * exceeding the concurrent streams the server allows per peer.
+ *
+ * All values are little-endian. A server not supporting streaming closes
+ * the connection which lets the client fall back to individual requests.
+ */
+#define ESDM_RPC_STREAM				0xfffffffe
+#define ESDM_RPC_STREAM_CREDIT			0xfffffffd
+
+/* Maximum number of fragments in flight */
+#define ESDM_RPC_STREAM_WINDOW			4
+
+/* Maximum number of bytes requested with one stream */
+#define ESDM_RPC_STREAM_MAX_LEN			(1UL << 30)
+
+/*
+ * Requests served by streaming. The values are identical to the method
+ * indexes of the unprivileged Protobuf-C service.
+ */
+enum esdm_rpc_stream_method {
+	esdm_rpc_stream_get_random_bytes_full = 1,
+	esdm_rpc_stream_get_random_bytes_min = 2,
+	esdm_rpc_stream_get_random_bytes = 4,
+};
+
+struct esdm_rpc_stream_req {
+	uint32_t method_index;
+	uint32_t window;
+	uint64_t len;
+} __attribute__((packed));
+
+struct esdm_rpc_stream_credit {
+	uint32_t credits;
+} __attribute__((packed));
+
+struct esdm_rpc_stream_err {
+	int32_t ret;
+} __attribute__((packed));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESDM_RPC_STREAM_H */
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitshift_be.h"
+#include "lc_hash_drbg_sha512.h"
+
+#define HASH_DRBG_BENCH_LOOPS_BYTES	(64UL << 20)
+
+/*
+ * The _ref functions are the generate operation of the Hash DRBG as it was
+ * before the hashgen blocks were calculated in parallel and the addition was
+ * performed word-wise. They are timed on identical work with the current
+ * generate operation.
+ */
+static void drbg_hash_ref(struct lc_drbg_hash_state *drbg,
+			  uint8_t *outval, const struct lc_drbg_string *in)
+{
+	lc_hash_init(&drbg->hash_ctx);
+	for (; in != NULL; in = in->next)
+		lc_hash_update(&drbg->hash_ctx, in->buf, in->len);
+	lc_hash_final(&drbg->hash_ctx, outval);
+}
+
+static void drbg_add_buf_ref(uint8_t *dst, size_t dstlen,
+			     const uint8_t *add, size_t addlen)
+{
+	/* implied: dstlen > addlen */
+	uint8_t *dstptr;
+	const uint8_t *addptr;
+	unsigned int remainder = 0;
+	size_t len = addlen;
+
+	dstptr = dst + (dstlen-1);
+	addptr = add + (addlen-1);
+	while (len) {
+		remainder += *dstptr + *addptr;
+		*dstptr = remainder & 0xff;
+		remainder >>= 8;
+		len--; dstptr--; addptr--;
+	}
+	len = dstlen - addlen;
+	while (len && remainder > 0) {
+		remainder = *dstptr + 1;
+		*dstptr = remainder & 0xff;
+		remainder >>= 8;
+		len--; dstptr--;
+	}
+}
+
+/* Hashgen defined in 10.1.1.4 */
+static size_t drbg_hash_hashgen_ref(struct lc_drbg_hash_state *drbg,
+				    uint8_t *buf, size_t buflen)
+{
+	struct lc_drbg_string data;
+	size_t len = 0;
+	uint8_t *src = drbg->scratchpad;
+	uint8_t *dst = drbg->scratchpad + LC_DRBG_HASH_STATELEN;
+	uint8_t prefix = DRBG_PREFIX1;
+
+	/* 10.1.1.4 step hashgen 2 */
+	memcpy(src, drbg->V, LC_DRBG_HASH_STATELEN);
+	lc_drbg_string_fill(&data, src, LC_DRBG_HASH_STATELEN);
+
+	while (len < buflen) {
+		size_t outlen = 0;
+
+		/* 10.1.1.4 step hashgen 4.1 */
+		drbg_hash_ref(drbg, dst, &data);
+		outlen = (LC_DRBG_HASH_BLOCKLEN < (buflen - len)) ?
+			  LC_DRBG_HASH_BLOCKLEN : (buflen - len);
+
+		/* 10.1.1.4 step hashgen 4.2 */
+		memcpy(buf + len, dst, outlen);
+		len += outlen;
+		/* 10.1.1.4 hashgen step 4.3 */
+		if (len < buflen)
+			drbg_add_buf_ref(src, LC_DRBG_HASH_STATELEN,
+					 &prefix, 1);
+	}
+
+	memset(drbg->scratchpad, 0,
+	       (LC_DRBG_HASH_STATELEN + LC_DRBG_HASH_BLOCKLEN));
+	return len;
+}
+
+/* Generate function as defined in 10.1.1.4 without additional input */
+static size_t drbg_hash_generate_ref(struct lc_drbg_hash_state *drbg,
+				     uint8_t *buf, size_t buflen)
+{
+	struct lc_drbg_string data1, data2;
+	size_t len = 0;
+	uint8_t req[8], prefix = DRBG_PREFIX3;
+
+	drbg->reseed_ctr++;
+
+	/* 10.1.1.4 step 3 */
+	len = drbg_hash_hashgen_ref(drbg, buf, buflen);
+
+	/* 10.1.1.4 step 4 */
+	lc_drbg_string_fill(&data1, &prefix, 1);
+	lc_drbg_string_fill(&data2, drbg->V, LC_DRBG_HASH_STATELEN);
+	data1.next = &data2;
+	drbg_hash_ref(drbg, drbg->scratchpad, &data1);
+
+	/* 10.1.1.4 step 5 */
+	drbg_add_buf_ref(drbg->V, LC_DRBG_HASH_STATELEN,
+			 drbg->scratchpad, LC_DRBG_HASH_BLOCKLEN);
+	drbg_add_buf_ref(drbg->V, LC_DRBG_HASH_STATELEN,
+			 drbg->C, LC_DRBG_HASH_STATELEN);
+	be64_to_ptr(req, drbg->reseed_ctr);
+	drbg_add_buf_ref(drbg->V, LC_DRBG_HASH_STATELEN, req, sizeof(req));
+
+	memset(drbg->scratchpad, 0, LC_DRBG_HASH_BLOCKLEN);
+	return len;
+}
+
+static double hash_drbg_bench_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Both DRBG instances must produce the same output and internal state */
+static int hash_drbg_bench_cmp(struct lc_drbg_hash_state *ref,
+			       struct lc_drbg_hash_state *gen,
+			       const uint8_t *exp, const uint8_t *act,
+			       size_t len)
+{
+	if (!memcmp(exp, act, len) &&
+	    !memcmp(ref->V, gen->V, LC_DRBG_HASH_STATELEN) &&
+	    ref->reseed_ctr == gen->reseed_ctr)
+		return 0;
+
+	printf("Hash DRBG differs from reference generate operation for %zu bytes\n",
+	       len);
+	return 1;
+}
+
+static int hash_drbg_bench_one(struct lc_drbg_state *ref,
+			       struct lc_drbg_state *gen, size_t len)
+{
+	struct lc_drbg_hash_state *ref_hash = (struct lc_drbg_hash_state *)ref;
+	struct lc_drbg_hash_state *gen_hash = (struct lc_drbg_hash_state *)gen;
+	static uint8_t act[1 << 16], exp[1 << 16];
+	size_t i, loops = HASH_DRBG_BENCH_LOOPS_BYTES / len;
+	double start, ref_time, gen_time;
+
+	drbg_hash_generate_ref(ref_hash, exp, len);
+	lc_drbg_hash_generate(gen, act, len, NULL);
+	if (hash_drbg_bench_cmp(ref_hash, gen_hash, exp, act, len))
+		return 1;
+
+	start = hash_drbg_bench_time();
+	for (i = 0; i < loops; i++)
+		drbg_hash_generate_ref(ref_hash, exp, len);
+	ref_time = hash_drbg_bench_time() - start;
+
+	start = hash_drbg_bench_time();
+	for (i = 0; i < loops; i++)
+		lc_drbg_hash_generate(gen, act, len, NULL);
+	gen_time = hash_drbg_bench_time() - start;
+
+	if (hash_drbg_bench_cmp(ref_hash, gen_hash, exp, act, len))
+		return 1;
+
+	printf("%6zu bytes: reference generate %8.1f MB/s, Hash DRBG generate %8.1f MB/s\n",
+	       len, (double)(loops * len) / ref_time / 1e6,
+	       (double)(loops * len) / gen_time / 1e6);
+
+	return 0;
+}
+
+/*
+ * Compare the throughput of the Hash DRBG generate operation with the
+ * reference generate operation for small, page-sized and maximum requests.
+ * Both DRBG instances are seeded identically and perform the same requests.
+ */
+static int hash_drbg_bench(void)
+{
+	static const size_t lens[] = { 32, 4096, 65536 };
+	uint8_t seed[64];
+	size_t i;
+	int ret = 0;
+	LC_DRBG_HASH_CTX_ON_STACK(ref);
+	LC_DRBG_HASH_CTX_ON_STACK(gen);
+
+	for (i = 0; i < sizeof(seed); i++)
+		seed[i] = (uint8_t)i;
+
+	if (lc_drbg_seed(ref, seed, sizeof(seed), NULL, 0) ||
+	    lc_drbg_seed(gen, seed, sizeof(seed), NULL, 0))
+		return 1;
+
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+		ret |= hash_drbg_bench_one(ref, gen, lens[i]);
+
+	lc_drbg_zero(ref);
+	lc_drbg_zero(gen);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+	return hash_drbg_bench();
+}
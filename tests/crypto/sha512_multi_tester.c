@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lc_sha512.h"
+
+#define SHA512_MULTI_TESTER_MAX_NUM	9
+#define SHA512_MULTI_TESTER_MAX_LEN	300
+
+/*
+ * Compare the multi-message digest calculation with the digest of each
+ * message calculated individually. The message lengths cover zero, one and
+ * two padding blocks as well as multiple full blocks, the number of messages
+ * covers partially used lanes.
+ */
+static int sha512_multi_tester(void)
+{
+	static uint8_t msg[SHA512_MULTI_TESTER_MAX_NUM *
+			   SHA512_MULTI_TESTER_MAX_LEN];
+	uint8_t act[SHA512_MULTI_TESTER_MAX_NUM * LC_SHA512_SIZE_DIGEST];
+	uint8_t exp[LC_SHA512_SIZE_DIGEST];
+	size_t i, len, num;
+	int ret = 0;
+	LC_HASH_CTX_ON_STACK(ctx512, lc_sha512);
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = (uint8_t)(i * 7 + (i >> 8));
+
+	for (len = 0; len <= SHA512_MULTI_TESTER_MAX_LEN; len++) {
+		for (num = 1; num <= SHA512_MULTI_TESTER_MAX_NUM; num++) {
+			lc_sha512_multi(msg, len, num, act);
+
+			for (i = 0; i < num; i++) {
+				lc_hash_init(ctx512);
+				lc_hash_update(ctx512, msg + i * len, len);
+				lc_hash_final(ctx512, exp);
+
+				if (memcmp(act + i * LC_SHA512_SIZE_DIGEST,
+					   exp, sizeof(exp))) {
+					printf("SHA-512 multi message digest mismatch: length %zu, number %zu, message %zu\n",
+					       len, num, i);
+					ret = 1;
+				}
+			}
+		}
+	}
+
+	lc_hash_zero(ctx512);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+	return sha512_multi_tester();
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esdm_config.h"
+#include "esdm_definitions.h"
+#include "esdm_es_aux.h"
+#include "esdm_es_mgr.h"
+#include "logger.h"
+
+#define ES_JENT_COLLECTORS	2
+
+static int es_jent_collectors_getdata(uint8_t *out)
+{
+	struct entropy_es eb_es;
+	uint8_t zero[ESDM_DRNG_INIT_SEED_SIZE_BYTES];
+
+	memset(&eb_es, 0, sizeof(eb_es));
+	memset(zero, 0, sizeof(zero));
+	esdm_es[esdm_ext_es_jitter]->get_ent(&eb_es,
+					     ESDM_DRNG_INIT_SEED_SIZE_BITS,
+					     true);
+	if (!eb_es.e_bits ||
+	    !memcmp(eb_es.e, zero, ESDM_DRNG_INIT_SEED_SIZE_BYTES)) {
+		printf("ES Jitter RNG collectors - fail: get_ent failed to deliver data\n");
+		return 1;
+	}
+
+	memcpy(out, eb_es.e, ESDM_DRNG_INIT_SEED_SIZE_BYTES);
+	return 0;
+}
+
+static unsigned int es_jent_collectors_buffered(void)
+{
+	char buf[500], *p;
+	unsigned int buffered = 0, collectors = 0;
+
+	memset(buf, 0, sizeof(buf));
+	esdm_es[esdm_ext_es_jitter]->state(buf, sizeof(buf));
+
+	p = strstr(buf, "Collectors: ");
+	if (p)
+		sscanf(p, "Collectors: %u", &collectors);
+	p = strstr(buf, "Buffered blocks: ");
+	if (p)
+		sscanf(p, "Buffered blocks: %u", &buffered);
+
+	if (collectors != ES_JENT_COLLECTORS)
+		return 0;
+	return buffered;
+}
+
+/* The collectors serve distinct blocks from their rings */
+static int es_jent_collectors_distinct(void)
+{
+	uint8_t data[16][ESDM_DRNG_INIT_SEED_SIZE_BYTES];
+	unsigned int i, j;
+
+	for (i = 0; i < 16; i++) {
+		if (es_jent_collectors_getdata(data[i]))
+			return 1;
+
+		for (j = 0; j < i; j++) {
+			if (!memcmp(data[i], data[j], sizeof(data[i]))) {
+				printf("ES Jitter RNG collectors - fail: block %u delivered twice\n",
+				       j);
+				return 1;
+			}
+		}
+	}
+
+	printf("ES Jitter RNG collectors - pass: distinct blocks delivered\n");
+
+	return 0;
+}
+
+/* The rings of the collectors are filled in the background */
+static int es_jent_collectors_fill(void)
+{
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 10000000 };
+	unsigned int i, buffered = 0;
+
+	for (i = 0; i < 1000; i++) {
+		buffered = es_jent_collectors_buffered();
+		if (buffered)
+			break;
+		nanosleep(&ts, NULL);
+	}
+
+	if (!buffered) {
+		printf("ES Jitter RNG collectors - fail: rings are not filled\n");
+		return 1;
+	}
+
+	printf("ES Jitter RNG collectors - pass: %u blocks buffered\n",
+	       buffered);
+
+	return 0;
+}
+
+/*
+ * A child process starts its own collectors and must not obtain the blocks
+ * buffered by the parent.
+ */
+static int es_jent_collectors_fork(void)
+{
+	uint8_t parent[ESDM_DRNG_INIT_SEED_SIZE_BYTES],
+		child[ESDM_DRNG_INIT_SEED_SIZE_BYTES];
+	int status, fds[2];
+	pid_t pid;
+
+	if (pipe(fds))
+		return 1;
+
+	pid = fork();
+	if (pid < 0)
+		return 1;
+	if (!pid) {
+		close(fds[0]);
+		if (es_jent_collectors_getdata(child))
+			_exit(1);
+		if (write(fds[1], child, sizeof(child)) != sizeof(child))
+			_exit(1);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	if (es_jent_collectors_getdata(parent) ||
+	    read(fds[0], child, sizeof(child)) != sizeof(child) ||
+	    waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		printf("ES Jitter RNG collectors - fail: fork test failed\n");
+		close(fds[0]);
+		return 1;
+	}
+	close(fds[0]);
+
+	if (!memcmp(parent, child, sizeof(parent))) {
+		printf("ES Jitter RNG collectors - fail: child obtained buffered block of parent\n");
+		return 1;
+	}
+
+	printf("ES Jitter RNG collectors - pass: child uses its own collectors\n");
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+	logger_set_verbosity(LOGGER_DEBUG);
+
+	esdm_config_es_jent_collectors_set(ES_JENT_COLLECTORS);
+	ret = esdm_es[esdm_ext_es_jitter]->init();
+	if (ret) {
+		printf("ES Jitter RNG collectors - fail: init failed: %d\n", ret);
+		return 1;
+	}
+
+	/* The collectors are started with the first request */
+	ret = es_jent_collectors_distinct();
+	ret += es_jent_collectors_fill();
+	ret += es_jent_collectors_fork();
+
+	esdm_es[esdm_ext_es_jitter]->fini();
+
+	return ret;
+}
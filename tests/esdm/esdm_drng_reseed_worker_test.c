@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esdm.h"
+#include "logger.h"
+
+/* Generate long enough to pass several time-based reseed thresholds */
+#define ESDM_RESEED_WORKER_TEST_SECS	4
+
+static void *esdm_reseed_worker_test_thread(void *arg)
+{
+	int *ret = arg;
+
+	*ret = esdm_init_reseed_worker();
+
+	return NULL;
+}
+
+static int esdm_reseed_worker_test_gen(void)
+{
+	uint8_t buf[64], zero[sizeof(buf)];
+	time_t start = time(NULL);
+
+	memset(zero, 0, sizeof(zero));
+
+	while (time(NULL) - start < ESDM_RESEED_WORKER_TEST_SECS) {
+		memset(buf, 0, sizeof(buf));
+		if (esdm_get_random_bytes_full(buf, sizeof(buf)) !=
+		    (ssize_t)sizeof(buf))
+			return 1;
+		if (!memcmp(zero, buf, sizeof(buf))) {
+			printf("output buffer is zero!\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t worker;
+	int ret, worker_ret = -1;
+
+	(void)argc;
+	(void)argv;
+
+#ifndef ESDM_TESTMODE
+	if (getuid()) {
+		printf("Program must be started as root\n");
+		return 77;
+	}
+#endif
+
+	logger_set_verbosity(LOGGER_DEBUG);
+	ret = esdm_init();
+	if (ret)
+		return ret;
+
+	/* Let the time-based reseed be triggered every second */
+	esdm_set_reseed_max_time(1);
+
+	ret = pthread_create(&worker, NULL, esdm_reseed_worker_test_thread,
+			     &worker_ret);
+	if (ret) {
+		esdm_fini();
+		return ret;
+	}
+
+	ret = esdm_reseed_worker_test_gen();
+
+	/* The worker must terminate when the ESDM is finalized */
+	esdm_fini();
+	pthread_join(worker, NULL);
+	if (worker_ret) {
+		printf("reseed worker failed: %d\n", worker_ret);
+		ret = 1;
+	}
+
+	return ret;
+}
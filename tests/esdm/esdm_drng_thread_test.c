@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esdm.h"
+#include "esdm_config.h"
+#include "logger.h"
+
+#define ESDM_DRNG_THREAD_TEST_THREADS	4
+
+struct esdm_drng_thread_test {
+	pthread_t thread;
+	uint8_t first[32];
+	uint8_t second[32];
+	int ret;
+};
+
+static int esdm_drng_thread_test_gen(uint8_t *buf, size_t buflen)
+{
+	uint8_t large[65536];
+	uint8_t zero[sizeof(large)];
+
+	memset(zero, 0, sizeof(zero));
+	memset(large, 0, sizeof(large));
+
+	/* Large request spanning multiple generate operations */
+	if (esdm_get_random_bytes_full(large, sizeof(large)) !=
+	    (ssize_t)sizeof(large))
+		return 1;
+	if (!memcmp(zero, large, sizeof(large))) {
+		printf("output buffer is zero!\n");
+		return 1;
+	}
+
+	if (esdm_get_random_bytes_full(buf, buflen) != (ssize_t)buflen)
+		return 1;
+
+	return 0;
+}
+
+static void *esdm_drng_thread_test_one(void *arg)
+{
+	struct esdm_drng_thread_test *t = arg;
+
+	t->ret = esdm_drng_thread_test_gen(t->first, sizeof(t->first));
+	if (t->ret)
+		return NULL;
+
+	/* A forced reseed must not disrupt the thread-local DRNG */
+	esdm_drng_force_reseed();
+
+	t->ret = esdm_drng_thread_test_gen(t->second, sizeof(t->second));
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct esdm_drng_thread_test t[ESDM_DRNG_THREAD_TEST_THREADS];
+	unsigned int i, j;
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+#ifndef ESDM_TESTMODE
+	if (getuid()) {
+		printf("Program must be started as root\n");
+		return 77;
+	}
+#endif
+
+	logger_set_verbosity(LOGGER_DEBUG);
+	esdm_config_drng_per_thread_set(1);
+	ret = esdm_init();
+	if (ret)
+		return ret;
+
+	memset(t, 0, sizeof(t));
+
+	for (i = 0; i < ESDM_DRNG_THREAD_TEST_THREADS; i++) {
+		ret = pthread_create(&t[i].thread, NULL,
+				     esdm_drng_thread_test_one, &t[i]);
+		if (ret)
+			goto out;
+	}
+
+	for (i = 0; i < ESDM_DRNG_THREAD_TEST_THREADS; i++) {
+		pthread_join(t[i].thread, NULL);
+		if (t[i].ret) {
+			printf("thread %u failed to obtain random data\n", i);
+			ret = 1;
+		}
+	}
+	if (ret)
+		goto out;
+
+	/* Each thread-local DRNG must produce a distinct stream */
+	for (i = 0; i < ESDM_DRNG_THREAD_TEST_THREADS; i++) {
+		if (!memcmp(t[i].first, t[i].second, sizeof(t[i].first))) {
+			printf("thread %u produced identical output\n", i);
+			ret = 1;
+		}
+
+		for (j = i + 1; j < ESDM_DRNG_THREAD_TEST_THREADS; j++) {
+			if (!memcmp(t[i].first, t[j].first,
+				    sizeof(t[i].first))) {
+				printf("threads %u and %u produced identical output\n",
+				       i, j);
+				ret = 1;
+			}
+		}
+	}
+
+out:
+	esdm_fini();
+	return ret;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "esdm_es_mgr.h"
+#include "logger.h"
+
+static long esdm_es_entropy_wait_elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* Without a notification, the waiter returns after its timeout */
+static int esdm_es_entropy_wait_timeout(void)
+{
+	struct timespec start, timeout = { .tv_sec = 0, .tv_nsec = 200000000 };
+	long elapsed;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = esdm_es_entropy_wait(esdm_es_entropy_seq_get(), &timeout);
+	elapsed = esdm_es_entropy_wait_elapsed_ms(&start);
+
+	if (ret != -ETIMEDOUT || elapsed < 190) {
+		printf("Entropy wait timeout - fail: returned %d after %ld ms\n",
+		       ret, elapsed);
+		return 1;
+	}
+
+	printf("Entropy wait timeout - pass: returned after %ld ms\n",
+	       elapsed);
+	return 0;
+}
+
+/* A notification before the wait is not lost */
+static int esdm_es_entropy_wait_missed(void)
+{
+	struct timespec start, timeout = { .tv_sec = 5, .tv_nsec = 0 };
+	long elapsed;
+	int ret, seq = esdm_es_entropy_seq_get();
+
+	esdm_es_entropy_notify();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = esdm_es_entropy_wait(seq, &timeout);
+	elapsed = esdm_es_entropy_wait_elapsed_ms(&start);
+
+	if (ret || elapsed > 100) {
+		printf("Entropy wait prior notification - fail: returned %d after %ld ms\n",
+		       ret, elapsed);
+		return 1;
+	}
+
+	printf("Entropy wait prior notification - pass\n");
+	return 0;
+}
+
+static void *esdm_es_entropy_wait_notifier(void *arg)
+{
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 100000000 };
+
+	(void)arg;
+
+	nanosleep(&ts, NULL);
+	esdm_es_entropy_notify();
+
+	return NULL;
+}
+
+/* A notification wakes the waiter long before its timeout */
+static int esdm_es_entropy_wait_wakeup(void)
+{
+	struct timespec start, timeout = { .tv_sec = 5, .tv_nsec = 0 };
+	pthread_t notifier;
+	long elapsed;
+	int ret, seq = esdm_es_entropy_seq_get();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (pthread_create(&notifier, NULL, esdm_es_entropy_wait_notifier,
+			   NULL))
+		return 1;
+	ret = esdm_es_entropy_wait(seq, &timeout);
+	elapsed = esdm_es_entropy_wait_elapsed_ms(&start);
+	pthread_join(notifier, NULL);
+
+	if (ret || elapsed < 90 || elapsed > 2000) {
+		printf("Entropy wait wakeup - fail: returned %d after %ld ms\n",
+		       ret, elapsed);
+		return 1;
+	}
+
+	printf("Entropy wait wakeup - pass: woken after %ld ms\n", elapsed);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+	logger_set_verbosity(LOGGER_DEBUG);
+
+	ret = esdm_es_entropy_wait_timeout();
+	ret += esdm_es_entropy_wait_missed();
+	ret += esdm_es_entropy_wait_wakeup();
+
+	return ret;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esdm.h"
+#include "esdm_config.h"
+#include "logger.h"
+
+int main(int argc, char *argv[])
+{
+	uint8_t rnd[64], zero[sizeof(rnd)];
+	unsigned int i;
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+#ifndef ESDM_TESTMODE
+	if (getuid()) {
+		printf("Program must be started as root\n");
+		return 77;
+	}
+#endif
+
+	logger_set_verbosity(LOGGER_DEBUG);
+	esdm_config_es_parallel_set(1);
+	ret = esdm_init();
+	if (ret)
+		return ret;
+
+	/* Every reseed of the DRNG collects the entropy concurrently */
+	memset(zero, 0, sizeof(zero));
+	for (i = 0; i < 4; i++) {
+		esdm_drng_force_reseed();
+		memset(rnd, 0, sizeof(rnd));
+		if (esdm_get_random_bytes_full(rnd, sizeof(rnd)) !=
+		    (ssize_t)sizeof(rnd) ||
+		    !memcmp(rnd, zero, sizeof(rnd))) {
+			printf("obtaining random data failed\n");
+			ret = 1;
+			goto out;
+		}
+	}
+
+out:
+	esdm_fini();
+	return ret;
+}
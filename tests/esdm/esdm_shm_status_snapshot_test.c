@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "esdm_rpc_service.h"
+
+#define ESDM_SHM_STATUS_SNAPSHOT_READS	200000
+
+static struct esdm_shm_status esdm_shm_status_test;
+static int esdm_shm_status_test_stop = 0;
+
+/* Update the snapshot like the server: odd sequence number while writing */
+static void esdm_shm_status_test_write(uint32_t val)
+{
+	struct esdm_shm_status_snapshot *snapshot =
+						&esdm_shm_status_test.snapshot;
+	uint32_t i;
+
+	__atomic_store_n(&snapshot->seq, snapshot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	snapshot->updated = val;
+	snapshot->num_es = val;
+	for (i = 0; i < ESDM_SHM_STATUS_MAX_ES; i++)
+		snapshot->es_entropy[i] = val;
+	snapshot->num_drngs = val;
+	for (i = 0; i < ESDM_SHM_STATUS_MAX_DRNGS; i++) {
+		snapshot->drng[i].reseed_gen = val;
+		snapshot->drng[i].requests = val;
+	}
+
+	__atomic_store_n(&snapshot->seq, snapshot->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* All fields of a consistent snapshot carry the same value */
+static int esdm_shm_status_test_consistent(
+			const struct esdm_shm_status_snapshot *snapshot)
+{
+	uint32_t val = (uint32_t)snapshot->updated, i;
+
+	if (snapshot->num_es != val || snapshot->num_drngs != val)
+		return 0;
+	for (i = 0; i < ESDM_SHM_STATUS_MAX_ES; i++) {
+		if (snapshot->es_entropy[i] != val)
+			return 0;
+	}
+	for (i = 0; i < ESDM_SHM_STATUS_MAX_DRNGS; i++) {
+		if (snapshot->drng[i].reseed_gen != val ||
+		    snapshot->drng[i].requests != val)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* A stable snapshot is returned with its sequence number */
+static int esdm_shm_status_test_stable(void)
+{
+	struct esdm_shm_status_snapshot snapshot;
+	int ret;
+
+	esdm_shm_status_test_write(42);
+
+	memset(&snapshot, 0, sizeof(snapshot));
+	ret = esdm_shm_status_snapshot_read(&esdm_shm_status_test, &snapshot);
+	if (ret || snapshot.seq != esdm_shm_status_test.snapshot.seq ||
+	    !esdm_shm_status_test_consistent(&snapshot) ||
+	    snapshot.updated != 42) {
+		printf("Snapshot stable - fail: returned %d\n", ret);
+		return 1;
+	}
+
+	printf("Snapshot stable - pass\n");
+	return 0;
+}
+
+/* The reader does not return data while an update is in progress */
+static int esdm_shm_status_test_odd(void)
+{
+	struct esdm_shm_status_snapshot snapshot;
+	uint32_t seq = esdm_shm_status_test.snapshot.seq;
+	int ret;
+
+	esdm_shm_status_test.snapshot.seq = seq | 1;
+	ret = esdm_shm_status_snapshot_read(&esdm_shm_status_test, &snapshot);
+	esdm_shm_status_test.snapshot.seq = (seq | 1) + 1;
+
+	if (ret != -EAGAIN) {
+		printf("Snapshot odd sequence - fail: returned %d\n", ret);
+		return 1;
+	}
+
+	printf("Snapshot odd sequence - pass\n");
+	return 0;
+}
+
+static void *esdm_shm_status_test_writer(void *arg)
+{
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000 };
+	uint32_t val = 0;
+
+	(void)arg;
+
+	/* Leave the reader a window between two updates */
+	while (!__atomic_load_n(&esdm_shm_status_test_stop, __ATOMIC_RELAXED)) {
+		esdm_shm_status_test_write(++val);
+		nanosleep(&ts, NULL);
+	}
+
+	return NULL;
+}
+
+/*
+ * With a concurrent writer, the reader retries if the sequence number was odd
+ * or changed during the read and thus only returns consistent snapshots.
+ */
+static int esdm_shm_status_test_concurrent(void)
+{
+	struct esdm_shm_status_snapshot snapshot;
+	pthread_t writer;
+	unsigned int i, ok = 0, again = 0, torn = 0;
+	int ret;
+
+	if (pthread_create(&writer, NULL, esdm_shm_status_test_writer, NULL)) {
+		printf("Snapshot concurrent writer - fail: no writer thread\n");
+		return 1;
+	}
+
+	for (i = 0; i < ESDM_SHM_STATUS_SNAPSHOT_READS; i++) {
+		ret = esdm_shm_status_snapshot_read(&esdm_shm_status_test,
+						    &snapshot);
+		if (ret == -EAGAIN) {
+			again++;
+			continue;
+		}
+		if (ret || (snapshot.seq & 1) ||
+		    !esdm_shm_status_test_consistent(&snapshot))
+			torn++;
+		else
+			ok++;
+	}
+
+	__atomic_store_n(&esdm_shm_status_test_stop, 1, __ATOMIC_RELAXED);
+	pthread_join(writer, NULL);
+
+	if (torn || !ok) {
+		printf("Snapshot concurrent writer - fail: %u consistent, %u inconsistent, %u retries exhausted\n",
+		       ok, torn, again);
+		return 1;
+	}
+
+	printf("Snapshot concurrent writer - pass: %u consistent, %u retries exhausted\n",
+	       ok, again);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+	ret = esdm_shm_status_test_stable();
+	ret += esdm_shm_status_test_odd();
+	ret += esdm_shm_status_test_concurrent();
+
+	return ret;
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "threading_support.h"
+
+/* Upper bound of jobs submitted until the queue of the group overflows */
+#define ESDM_THREADING_TEST_MAX_JOBS 1024
+
+static pthread_mutex_t esdm_threading_test_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t esdm_threading_test_cv = PTHREAD_COND_INITIALIZER;
+static int esdm_threading_test_gate = 1;
+static unsigned int esdm_threading_test_done = 0;
+
+static void esdm_threading_test_close(void)
+{
+	pthread_mutex_lock(&esdm_threading_test_lock);
+	esdm_threading_test_gate = 0;
+	pthread_mutex_unlock(&esdm_threading_test_lock);
+}
+
+static void esdm_threading_test_open(void)
+{
+	pthread_mutex_lock(&esdm_threading_test_lock);
+	esdm_threading_test_gate = 1;
+	pthread_cond_broadcast(&esdm_threading_test_cv);
+	pthread_mutex_unlock(&esdm_threading_test_lock);
+}
+
+/* Job blocking until the gate opens */
+static int esdm_threading_test_job(void *arg)
+{
+	pthread_t *self = arg;
+
+	if (self)
+		*self = pthread_self();
+
+	pthread_mutex_lock(&esdm_threading_test_lock);
+	while (!esdm_threading_test_gate)
+		pthread_cond_wait(&esdm_threading_test_cv,
+				  &esdm_threading_test_lock);
+	esdm_threading_test_done++;
+	pthread_mutex_unlock(&esdm_threading_test_lock);
+
+	return 0;
+}
+
+static unsigned int esdm_threading_test_completed(void)
+{
+	unsigned int done;
+
+	pthread_mutex_lock(&esdm_threading_test_lock);
+	done = esdm_threading_test_done;
+	esdm_threading_test_done = 0;
+	pthread_mutex_unlock(&esdm_threading_test_lock);
+
+	return done;
+}
+
+/* A completed worker is parked and receives the next job */
+static int esdm_threading_test_handoff(void)
+{
+	pthread_t first, second;
+	int ret;
+
+	ret = thread_start(esdm_threading_test_job, &first, 0, NULL);
+	ret |= thread_wait();
+
+	/* Allow the worker to park */
+	usleep(100000);
+
+	ret |= thread_start(esdm_threading_test_job, &second, 0, NULL);
+	ret |= thread_wait();
+
+	if (ret || esdm_threading_test_completed() != 2 ||
+	    !pthread_equal(first, second)) {
+		printf("Hand-off to parked thread - fail\n");
+		return 1;
+	}
+
+	printf("Hand-off to parked thread - pass\n");
+	return 0;
+}
+
+/* Jobs exceeding the busy pool are rejected unless the group queues them */
+static int esdm_threading_test_overflow(void)
+{
+	unsigned int i, queued = 0;
+	int ret, err = 0;
+
+	esdm_threading_test_close();
+
+	for (i = 0; i < 2; i++) {
+		unsigned int retries = 0;
+
+		/*
+		 * The thread of the previous job may not have parked yet - it
+		 * is not available until then.
+		 */
+		while ((ret = thread_start(esdm_threading_test_job, NULL, 0,
+					   NULL)) == -EAGAIN &&
+		       retries++ < 100)
+			usleep(10000);
+		if (ret) {
+			printf("Starting job %u failed: %d\n", i, ret);
+			err = 1;
+		}
+	}
+
+	ret = thread_start(esdm_threading_test_job, NULL, 0, NULL);
+	if (ret != -EAGAIN) {
+		printf("Job exceeding busy pool: %d - fail\n", ret);
+		err = 1;
+	} else {
+		printf("Job exceeding busy pool rejected - pass\n");
+	}
+
+	thread_group_set_queueing(0, true);
+
+	for (i = 0; i < ESDM_THREADING_TEST_MAX_JOBS; i++) {
+		ret = thread_start(esdm_threading_test_job, NULL, 0, NULL);
+		if (ret)
+			break;
+		queued++;
+	}
+
+	if (ret != -EAGAIN || !queued) {
+		printf("Queue of %u jobs overflowing with %d - fail\n", queued,
+		       ret);
+		err = 1;
+	} else {
+		printf("Queue of %u jobs overflowing - pass\n", queued);
+	}
+
+	esdm_threading_test_open();
+
+	ret = thread_wait();
+	i = esdm_threading_test_completed();
+	if (ret || i != queued + 2) {
+		printf("Queued jobs completed: %u of %u (%d) - fail\n", i,
+		       queued + 2, ret);
+		err = 1;
+	} else {
+		printf("Queued jobs completed - pass\n");
+	}
+
+	thread_group_set_queueing(0, false);
+
+	return err;
+}
+
+static void *esdm_threading_test_mother(void *arg)
+{
+	int *ret = arg;
+
+	*ret = thread_start(esdm_threading_test_job, NULL, 0, NULL);
+
+	return NULL;
+}
+
+/* A job outlives the mother thread that started it */
+static int esdm_threading_test_orphan(void)
+{
+	pthread_t mother;
+	unsigned int i;
+	int ret = -EFAULT;
+
+	esdm_threading_test_close();
+
+	if (pthread_create(&mother, NULL, esdm_threading_test_mother, &ret))
+		return 1;
+	pthread_join(mother, NULL);
+
+	esdm_threading_test_open();
+
+	for (i = 0; i < 100 && !esdm_threading_test_done; i++)
+		usleep(10000);
+
+	if (ret || esdm_threading_test_completed() != 1) {
+		printf("Job of terminated mother thread - fail\n");
+		return 1;
+	}
+
+	printf("Job of terminated mother thread - pass\n");
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+	ret = thread_init(1);
+	if (ret)
+		return ret;
+
+	ret = thread_group_set_limits(0, 0, 2);
+	if (ret)
+		goto out;
+
+	ret = esdm_threading_test_handoff();
+	ret += esdm_threading_test_overflow();
+	ret += esdm_threading_test_orphan();
+
+out:
+	thread_release(false, true);
+	return ret;
+}
@@ -101,3 +101,11 @@ int env_init(void)
 out:
 	return ret;
 }
+
+uint64_t env_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
@@ -25,9 +25,14 @@ extern "C"
 {
 #endif
 
+#include <stdint.h>
+
 void env_fini(void);
 int env_init(void);
 
+/* Current time in milliseconds (CLOCK_MONOTONIC) */
+uint64_t env_now_ms(void);
+
 #ifdef __cplusplus
 }
 #endif
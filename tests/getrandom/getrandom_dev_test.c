@@ -0,0 +1,191 @@
+/* getrandom system call tester
+ *
+ * Copyright (C) 2021, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "env.h"
+
+/*
+ * Tests of the random device interposition enabled with ESDM_GETRANDOM_DEV:
+ * both device files deliver random numbers through all interposed entry
+ * points, a non-blocking read from /dev/random returns promptly and a file
+ * descriptor closed behind the back of the library and reused for another
+ * file delivers the data of that file.
+ */
+
+#define GETRANDOM_DEV_LEN	32
+
+/* Fortified entry points the compiler selects with _FORTIFY_SOURCE */
+ssize_t __read_chk(int fd, void *buf, size_t nbytes, size_t buflen);
+int __open_2(const char *file, int oflag);
+
+static const char *getrandom_dev_paths[] = { "/dev/urandom", "/dev/random" };
+
+static int getrandom_dev_check(const uint8_t *buf1, ssize_t ret1,
+			       const uint8_t *buf2, ssize_t ret2,
+			       const char *path, const char *name)
+{
+	if (ret1 != GETRANDOM_DEV_LEN || ret2 != GETRANDOM_DEV_LEN) {
+		printf("%s via %s - fail: returned %zd / %zd\n", path, name,
+		       ret1, ret2);
+		return 1;
+	}
+	if (!memcmp(buf1, buf2, GETRANDOM_DEV_LEN)) {
+		printf("%s via %s - fail: identical output\n", path, name);
+		return 1;
+	}
+
+	printf("%s via %s - pass\n", path, name);
+	return 0;
+}
+
+static int getrandom_dev_read(const char *path, int flags, const char *name)
+{
+	uint8_t buf1[GETRANDOM_DEV_LEN], buf2[GETRANDOM_DEV_LEN];
+	uint64_t start = env_now_ms();
+	ssize_t ret1, ret2;
+	int fd = open(path, O_RDONLY | flags);
+
+	if (fd < 0) {
+		printf("%s via %s - fail: open\n", path, name);
+		return 1;
+	}
+	ret1 = read(fd, buf1, sizeof(buf1));
+	ret2 = read(fd, buf2, sizeof(buf2));
+	close(fd);
+
+	if ((flags & O_NONBLOCK) && env_now_ms() - start > 2000) {
+		printf("%s via %s - fail: read blocked\n", path, name);
+		return 1;
+	}
+
+	return getrandom_dev_check(buf1, ret1, buf2, ret2, path, name);
+}
+
+static int getrandom_dev_read_chk(const char *path)
+{
+	uint8_t buf1[GETRANDOM_DEV_LEN], buf2[GETRANDOM_DEV_LEN];
+	ssize_t ret1, ret2;
+	int fd = __open_2(path, O_RDONLY);
+
+	if (fd < 0) {
+		printf("%s via __open_2 - fail: open\n", path);
+		return 1;
+	}
+	ret1 = __read_chk(fd, buf1, sizeof(buf1), sizeof(buf1));
+	ret2 = __read_chk(fd, buf2, sizeof(buf2), sizeof(buf2));
+	close(fd);
+
+	return getrandom_dev_check(buf1, ret1, buf2, ret2, path,
+				   "__open_2/__read_chk");
+}
+
+static int getrandom_dev_fread(const char *path)
+{
+	uint8_t buf1[GETRANDOM_DEV_LEN], buf2[GETRANDOM_DEV_LEN];
+	ssize_t ret1, ret2;
+	FILE *fp = fopen(path, "r");
+
+	if (!fp) {
+		printf("%s via fopen/fread - fail: fopen\n", path);
+		return 1;
+	}
+	ret1 = (ssize_t)fread(buf1, 1, sizeof(buf1), fp);
+	ret2 = (ssize_t)fread(buf2, 1, sizeof(buf2), fp);
+	fclose(fp);
+
+	return getrandom_dev_check(buf1, ret1, buf2, ret2, path,
+				   "fopen/fread");
+}
+
+/* A file descriptor closed by fclose(3) is reused for a pipe */
+static int getrandom_dev_reuse(const char *path)
+{
+	static const uint8_t data[] = { 0x11, 0x22, 0x33, 0x44 };
+	uint8_t buf[sizeof(data)];
+	ssize_t ret;
+	int fd = open(path, O_RDONLY), fds[2];
+	FILE *fp;
+
+	if (fd < 0)
+		return 1;
+	fp = fdopen(fd, "r");
+	if (!fp) {
+		close(fd);
+		return 1;
+	}
+	fclose(fp);
+
+	if (pipe(fds))
+		return 1;
+	if (write(fds[1], data, sizeof(data)) != (ssize_t)sizeof(data)) {
+		close(fds[0]);
+		close(fds[1]);
+		return 1;
+	}
+	ret = read(fds[0], buf, sizeof(buf));
+	close(fds[0]);
+	close(fds[1]);
+
+	if (ret != (ssize_t)sizeof(data) || memcmp(buf, data, sizeof(data))) {
+		printf("%s reused file descriptor %d after fclose - fail: returned %zd\n",
+		       path, fd, ret);
+		return 1;
+	}
+
+	printf("%s reused file descriptor %d after fclose - pass\n", path,
+	       fd);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+	ret = env_init();
+	if (ret)
+		return ret;
+
+	for (i = 0; i < sizeof(getrandom_dev_paths) /
+			sizeof(getrandom_dev_paths[0]); i++) {
+		const char *path = getrandom_dev_paths[i];
+
+		ret += getrandom_dev_read(path, 0, "open/read");
+		ret += getrandom_dev_read(path, O_NONBLOCK,
+					  "open(O_NONBLOCK)/read");
+		ret += getrandom_dev_read_chk(path);
+		ret += getrandom_dev_fread(path);
+		ret += getrandom_dev_reuse(path);
+	}
+
+	env_fini();
+
+	return ret;
+}
@@ -0,0 +1,169 @@
+/* getrandom system call tester
+ *
+ * Copyright (C) 2021, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "env.h"
+#include "getrandom.h"
+
+/*
+ * Tests of the client-side DRNG enabled with ESDM_GETRANDOM_DRNG: the
+ * non-blocking flags return promptly and a child process reseeds its DRNG
+ * instead of continuing the output stream of the parent.
+ */
+
+#define GETRANDOM_DRNG_LEN	32
+
+static int getrandom_drng_nonblock(unsigned int flags)
+{
+	uint8_t buf1[GETRANDOM_DRNG_LEN], buf2[GETRANDOM_DRNG_LEN];
+	uint64_t start = env_now_ms();
+	ssize_t ret1, ret2;
+
+	ret1 = getrandom(buf1, sizeof(buf1), flags);
+	ret2 = getrandom(buf2, sizeof(buf2), flags);
+	if (ret1 != sizeof(buf1) || ret2 != sizeof(buf2)) {
+		printf("Non-blocking flags 0x%x - fail: returned %zd / %zd\n",
+		       flags, ret1, ret2);
+		return 1;
+	}
+	if (!memcmp(buf1, buf2, sizeof(buf1))) {
+		printf("Non-blocking flags 0x%x - fail: identical output\n",
+		       flags);
+		return 1;
+	}
+	if (env_now_ms() - start > 2000) {
+		printf("Non-blocking flags 0x%x - fail: call blocked\n", flags);
+		return 1;
+	}
+
+	printf("Non-blocking flags 0x%x - pass\n", flags);
+	return 0;
+}
+
+static int getrandom_drng_fork_check(const uint8_t *parent,
+				     const uint8_t *child, const char *name)
+{
+	if (!memcmp(parent, child, GETRANDOM_DRNG_LEN)) {
+		printf("Reseed after fork (%s) - fail: child repeats parent output\n",
+		       name);
+		return 1;
+	}
+
+	printf("Reseed after fork (%s) - pass\n", name);
+	return 0;
+}
+
+static void *getrandom_drng_thread(void *arg)
+{
+	uint8_t *buf = arg;
+
+	/* The thread exit releases the DRNG state of a child process */
+	if (getrandom(buf, GETRANDOM_DRNG_LEN, 0) != GETRANDOM_DRNG_LEN)
+		memset(buf, 0, GETRANDOM_DRNG_LEN);
+	return NULL;
+}
+
+static int getrandom_drng_fork(void)
+{
+	uint8_t parent[GETRANDOM_DRNG_LEN], child[2 * GETRANDOM_DRNG_LEN];
+	int status, fds[2], ret = 0;
+	pid_t pid;
+
+	/* Seed the DRNG of this thread before forking */
+	if (getrandom(parent, sizeof(parent), 0) != sizeof(parent)) {
+		printf("Reseed after fork - fail: seeding the parent DRNG\n");
+		return 1;
+	}
+
+	if (pipe(fds))
+		return 1;
+
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return 1;
+	}
+	if (pid == 0) {
+		pthread_t thread;
+
+		close(fds[0]);
+		memset(child, 0, sizeof(child));
+		if (getrandom(child, GETRANDOM_DRNG_LEN, 0) !=
+		    GETRANDOM_DRNG_LEN)
+			_exit(1);
+		if (pthread_create(&thread, NULL, getrandom_drng_thread,
+				   child + GETRANDOM_DRNG_LEN))
+			_exit(1);
+		pthread_join(thread, NULL);
+		if (write(fds[1], child, sizeof(child)) !=
+		    (ssize_t)sizeof(child))
+			_exit(1);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	if (getrandom(parent, sizeof(parent), 0) != sizeof(parent))
+		ret = 1;
+	if (read(fds[0], child, sizeof(child)) != (ssize_t)sizeof(child))
+		ret = 1;
+	close(fds[0]);
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		ret = 1;
+	if (ret) {
+		printf("Reseed after fork - fail: child process failed\n");
+		return ret;
+	}
+
+	ret += getrandom_drng_fork_check(parent, child, "main thread");
+	ret += getrandom_drng_fork_check(child, child + GETRANDOM_DRNG_LEN,
+					 "new thread");
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+	ret = env_init();
+	if (ret)
+		return ret;
+
+	ret = getrandom_drng_nonblock(GRND_INSECURE);
+	ret += getrandom_drng_nonblock(GRND_NONBLOCK);
+	ret += getrandom_drng_fork();
+
+	env_fini();
+
+	return ret;
+}
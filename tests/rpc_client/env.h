@@ -25,10 +25,21 @@ extern "C"
 {
 #endif
 
+#include <time.h>
+
 void env_fini(void);
 int env_init(void);
 void env_kill_server(void);
 
+/*
+ * Listen on the given Unix domain socket in place of the ESDM server.
+ * Returns the listening file descriptor or < 0 on error.
+ */
+int env_listen(const char *path);
+
+/* Milliseconds passed since start (CLOCK_MONOTONIC) */
+long env_elapsed_ms(const struct timespec *start);
+
 #ifdef __cplusplus
 }
 #endif
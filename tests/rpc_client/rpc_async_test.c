@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "conv_be_le.h"
+#include "env.h"
+#include "esdm_rpc_client.h"
+#include "esdm_rpc_protocol.h"
+#include "esdm_rpc_raw.h"
+#include "esdm_rpc_service.h"
+
+/*
+ * Test of the asynchronous API driven by poll(2): a fake server listening on
+ * the unprivileged socket does not read the requests for a while so that the
+ * socket of the client becomes full. All submissions must nonetheless be
+ * accepted without blocking and complete once the server answers. Without a
+ * server, a submission must fail immediately.
+ */
+
+#define RPC_ASYNC_REQUESTS	1024
+#define RPC_ASYNC_MAX_LEN	32
+
+struct rpc_async_res {
+	uint8_t buf[RPC_ASYNC_MAX_LEN];
+	size_t len;
+	ssize_t ret;
+	int done;
+};
+
+static struct rpc_async_res rpc_async_res[RPC_ASYNC_REQUESTS];
+static int rpc_async_listen_fd = -1;
+
+static void *rpc_async_server(void *arg)
+{
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 200000000 };
+	struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+	long ret = 1;
+	int fd, i;
+
+	(void)arg;
+
+	fd = accept(rpc_async_listen_fd, NULL, NULL);
+	if (fd < 0)
+		return (void *)ret;
+
+	/* Do not wait forever for requests the client failed to submit */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	/* Let the client fill its socket */
+	nanosleep(&ts, NULL);
+
+	for (i = 0; i < RPC_ASYNC_REQUESTS; i++) {
+		struct esdm_rpc_proto_cs_header cs_header;
+		struct esdm_rpc_proto_sc_header sc_header;
+		struct esdm_rpc_raw_req raw;
+		struct esdm_rpc_raw_resp resp;
+		uint8_t buf[sizeof(sc_header) + sizeof(resp) +
+			    RPC_ASYNC_MAX_LEN];
+		uint64_t len;
+		size_t sclen;
+
+		if (recv(fd, buf, sizeof(cs_header) + sizeof(raw), 0) !=
+		    (ssize_t)(sizeof(cs_header) + sizeof(raw)))
+			goto out;
+		memcpy(&cs_header, buf, sizeof(cs_header));
+		memcpy(&raw, buf + sizeof(cs_header), sizeof(raw));
+		len = le_bswap64(raw.len);
+		if (le_bswap32(cs_header.method_index) != ESDM_RPC_RAW ||
+		    len > RPC_ASYNC_MAX_LEN)
+			goto out;
+
+		/* Answer with the requested number of bytes set to the length */
+		sc_header.status_code =
+			le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SUCCESS);
+		sc_header.method_index = le_bswap32(ESDM_RPC_RAW);
+		sc_header.message_length =
+			le_bswap32((uint32_t)(sizeof(resp) + len));
+		sc_header.request_id = cs_header.request_id;
+		resp.ret = (int64_t)le_bswap64(len);
+		memcpy(buf, &sc_header, sizeof(sc_header));
+		memcpy(buf + sizeof(sc_header), &resp, sizeof(resp));
+		memset(buf + sizeof(sc_header) + sizeof(resp), (int)len, len);
+
+		sclen = sizeof(sc_header) + sizeof(resp) + len;
+		if (send(fd, buf, sclen, MSG_NOSIGNAL) != (ssize_t)sclen)
+			goto out;
+	}
+
+	ret = 0;
+
+out:
+	close(fd);
+	return (void *)ret;
+}
+
+static void rpc_async_cb(ssize_t ret, void *cb_data)
+{
+	struct rpc_async_res *res = cb_data;
+
+	res->ret = ret;
+	res->done++;
+}
+
+static int rpc_async_poll(struct esdm_rpcc_async *ctx)
+{
+	struct pollfd pfd = { .fd = esdm_rpcc_async_get_fd(ctx),
+			      .events = POLLIN };
+	unsigned int i, completed = 0, wakeups = 0;
+	int ret;
+
+	for (i = 0; i < RPC_ASYNC_REQUESTS; i++) {
+		struct rpc_async_res *res = &rpc_async_res[i];
+
+		res->len = 1 + i % RPC_ASYNC_MAX_LEN;
+		res->ret = 0;
+		res->done = 0;
+		ret = esdm_rpcc_async_get_random_bytes(ctx, res->buf, res->len,
+						       rpc_async_cb, res);
+		if (ret) {
+			printf("Asynchronous submission - fail: request %u returned %d\n",
+			       i, ret);
+			return 1;
+		}
+	}
+	printf("Asynchronous submission - pass: %u requests accepted\n", i);
+
+	while (completed < RPC_ASYNC_REQUESTS) {
+		ret = poll(&pfd, 1, 5000);
+		if (ret <= 0) {
+			printf("Asynchronous completion - fail: %u of %u requests completed\n",
+			       completed, RPC_ASYNC_REQUESTS);
+			return 1;
+		}
+
+		ret = esdm_rpcc_async_process(ctx);
+		if (ret < 0) {
+			printf("Asynchronous completion - fail: processing returned %d\n",
+			       ret);
+			return 1;
+		}
+		completed += (unsigned int)ret;
+		wakeups++;
+	}
+
+	for (i = 0; i < RPC_ASYNC_REQUESTS; i++) {
+		struct rpc_async_res *res = &rpc_async_res[i];
+		size_t j;
+
+		if (res->done != 1 || res->ret != (ssize_t)res->len)
+			break;
+		for (j = 0; j < res->len; j++) {
+			if (res->buf[j] != (uint8_t)res->len)
+				break;
+		}
+		if (j < res->len)
+			break;
+	}
+	if (i < RPC_ASYNC_REQUESTS) {
+		printf("Asynchronous completion - fail: request %u returned %zd\n",
+		       i, rpc_async_res[i].ret);
+		return 1;
+	}
+
+	printf("Asynchronous completion - pass: %u wakeups\n", wakeups);
+	return 0;
+}
+
+/* Without a server, the submission fails without waiting */
+static int rpc_async_no_server(struct esdm_rpcc_async *ctx)
+{
+	struct pollfd pfd = { .fd = esdm_rpcc_async_get_fd(ctx),
+			      .events = POLLIN };
+	struct rpc_async_res *res = &rpc_async_res[0];
+	struct timespec start;
+	long elapsed;
+	int ret;
+
+	/* Detect the connection closed by the server */
+	while (poll(&pfd, 1, 1000) > 0) {
+		if (esdm_rpcc_async_process(ctx) < 0)
+			break;
+		if (poll(&pfd, 1, 0) <= 0)
+			break;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = esdm_rpcc_async_get_random_bytes(ctx, res->buf, 1, rpc_async_cb,
+					       res);
+	elapsed = env_elapsed_ms(&start);
+
+	if (ret >= 0 || elapsed > 100) {
+		printf("Asynchronous submission without server - fail: returned %d after %ld ms\n",
+		       ret, elapsed);
+		return 1;
+	}
+
+	printf("Asynchronous submission without server - pass: returned %d\n",
+	       ret);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct esdm_rpcc_async *ctx = NULL;
+	pthread_t server;
+	void *res;
+	int ret = 0;
+
+	(void)argc;
+	(void)argv;
+
+	if (getuid()) {
+		printf("Program must be started as root\n");
+		return 77;
+	}
+
+	rpc_async_listen_fd = env_listen(ESDM_RPC_UNPRIV_SOCKET);
+	if (rpc_async_listen_fd < 0) {
+		printf("Asynchronous requests - fail: cannot listen on %s\n",
+		       ESDM_RPC_UNPRIV_SOCKET);
+		return 1;
+	}
+	if (pthread_create(&server, NULL, rpc_async_server, NULL)) {
+		ret = 1;
+		goto out;
+	}
+
+	if (esdm_rpcc_async_init(&ctx, RPC_ASYNC_REQUESTS)) {
+		ret = 1;
+		goto join;
+	}
+
+	ret += rpc_async_poll(ctx);
+
+join:
+	/* Wake up the server if the client never connected */
+	shutdown(rpc_async_listen_fd, SHUT_RDWR);
+	pthread_join(server, &res);
+	if (res) {
+		printf("Fake server - fail: unexpected requests\n");
+		ret++;
+	}
+
+	close(rpc_async_listen_fd);
+	rpc_async_listen_fd = -1;
+	unlink(ESDM_RPC_UNPRIV_SOCKET);
+
+	if (ctx) {
+		ret += rpc_async_no_server(ctx);
+		esdm_rpcc_async_fini(ctx);
+	}
+
+out:
+	if (rpc_async_listen_fd >= 0) {
+		close(rpc_async_listen_fd);
+		unlink(ESDM_RPC_UNPRIV_SOCKET);
+	}
+	return ret;
+}
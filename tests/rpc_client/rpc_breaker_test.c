@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atomic_bool.h"
+#include "bool.h"
+#include "conv_be_le.h"
+#include "env.h"
+#include "esdm_rpc_client.h"
+#include "esdm_rpc_protocol.h"
+#include "esdm_rpc_raw.h"
+#include "esdm_rpc_service.h"
+
+/*
+ * Test of the circuit breaker of the client. While the socket of the server
+ * is missing, the first request fails and opens the breaker. All further
+ * requests must fail promptly with -EHOSTDOWN and only the probes after the
+ * back-off time contact the server - also when the status segment reports
+ * changes. When the server is restarted, i.e. it
+ * removes the status segment of its predecessor and creates a new operational
+ * one, the next request must probe the server before the back-off time
+ * expired. The successful probe closes the breaker again.
+ */
+
+#define RPC_BREAKER_LEN		16
+#define RPC_BREAKER_PROBES	6
+#define RPC_BREAKER_REQUESTS	2
+
+static int rpc_breaker_listen_fd = -1;
+
+/* Create the status segment as the server does */
+static int rpc_breaker_shm_create(bool operational)
+{
+	struct esdm_shm_status *status;
+	key_t key = esdm_ftok(ESDM_SHM_NAME, ESDM_SHM_STATUS);
+	int shmid;
+
+	shmid = shmget(key, sizeof(struct esdm_shm_status),
+		       IPC_CREAT | IPC_EXCL | 0644);
+	if (shmid < 0)
+		return -errno;
+
+	status = shmat(shmid, NULL, 0);
+	if (status == (void *)-1)
+		return -errno;
+
+	status->version = ESDM_SHM_STATUS_VERSION;
+	status->change_seq = 1;
+	atomic_bool_set(&status->operational, operational);
+	shmdt(status);
+
+	return shmid;
+}
+
+/*
+ * Report a status change as a running server does which may happen while
+ * its socket is not accepting connections.
+ */
+static int rpc_breaker_shm_change(void)
+{
+	struct esdm_shm_status *status;
+	key_t key = esdm_ftok(ESDM_SHM_NAME, ESDM_SHM_STATUS);
+	int shmid = shmget(key, sizeof(struct esdm_shm_status), 0);
+
+	if (shmid < 0)
+		return -errno;
+
+	status = shmat(shmid, NULL, 0);
+	if (status == (void *)-1)
+		return -errno;
+
+	atomic_bool_set(&status->operational, true);
+	__atomic_add_fetch(&status->change_seq, 1, __ATOMIC_RELEASE);
+	shmdt(status);
+
+	return 0;
+}
+
+/* Remove the status segment as a terminating server does */
+static void rpc_breaker_shm_delete(void)
+{
+	key_t key = esdm_ftok(ESDM_SHM_NAME, ESDM_SHM_STATUS);
+	int shmid = shmget(key, sizeof(struct esdm_shm_status), 0);
+
+	if (shmid >= 0)
+		shmctl(shmid, IPC_RMID, NULL);
+}
+
+/* Answer the raw get_random_bytes requests */
+static void *rpc_breaker_server(void *arg)
+{
+	struct timeval tv = { .tv_sec = 10, .tv_usec = 0 };
+	struct esdm_rpc_proto_cs_header cs_header;
+	struct esdm_rpc_proto_sc_header sc_header;
+	struct esdm_rpc_raw_req raw;
+	struct esdm_rpc_raw_resp resp;
+	uint8_t buf[sizeof(sc_header) + sizeof(resp) + RPC_BREAKER_LEN];
+	long ret = 1;
+	unsigned int i;
+	int fd;
+
+	(void)arg;
+
+	fd = accept(rpc_breaker_listen_fd, NULL, NULL);
+	if (fd < 0)
+		return (void *)ret;
+
+	/* Do not wait forever for requests the client failed to send */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	for (i = 0; i < RPC_BREAKER_REQUESTS; i++) {
+		if (recv(fd, buf, sizeof(cs_header) + sizeof(raw), 0) !=
+		    (ssize_t)(sizeof(cs_header) + sizeof(raw)))
+			goto out;
+		memcpy(&cs_header, buf, sizeof(cs_header));
+		memcpy(&raw, buf + sizeof(cs_header), sizeof(raw));
+		if (le_bswap32(cs_header.method_index) != ESDM_RPC_RAW ||
+		    le_bswap64(raw.len) != RPC_BREAKER_LEN)
+			goto out;
+
+		sc_header.status_code =
+			le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SUCCESS);
+		sc_header.method_index = le_bswap32(ESDM_RPC_RAW);
+		sc_header.message_length =
+			le_bswap32(sizeof(resp) + RPC_BREAKER_LEN);
+		sc_header.request_id = cs_header.request_id;
+		resp.ret = (int64_t)le_bswap64(RPC_BREAKER_LEN);
+
+		memcpy(buf, &sc_header, sizeof(sc_header));
+		memcpy(buf + sizeof(sc_header), &resp, sizeof(resp));
+		memset(buf + sizeof(sc_header) + sizeof(resp), 0x5a,
+		       RPC_BREAKER_LEN);
+		if (send(fd, buf, sizeof(buf), MSG_NOSIGNAL) !=
+		    (ssize_t)sizeof(buf))
+			goto out;
+	}
+
+	ret = 0;
+
+out:
+	close(fd);
+	return (void *)ret;
+}
+
+/* Closed: the first request contacts the server and opens the breaker */
+static int rpc_breaker_test_open(void)
+{
+	uint8_t buf[RPC_BREAKER_LEN];
+	ssize_t rc = esdm_rpcc_get_random_bytes(buf, sizeof(buf));
+
+	if (rc >= 0 || rc == -EHOSTDOWN) {
+		printf("Closed breaker contacts server - fail: returned %zd\n",
+		       rc);
+		return 1;
+	}
+
+	printf("Closed breaker contacts server - pass: returned %zd\n", rc);
+	return 0;
+}
+
+/*
+ * Open: requests fail promptly without contacting the server, status changes
+ * of the server do not bypass the back-off time
+ */
+static int rpc_breaker_test_fail_fast(void)
+{
+	uint8_t buf[RPC_BREAKER_LEN];
+	struct timespec start;
+	unsigned int i, probes = 0;
+	long elapsed;
+	ssize_t rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < 100; i++) {
+		if (rpc_breaker_shm_change()) {
+			printf("Open breaker fails fast - fail: status segment missing\n");
+			return 1;
+		}
+		rc = esdm_rpcc_get_random_bytes(buf, sizeof(buf));
+		if (rc != -EHOSTDOWN)
+			probes++;
+	}
+	elapsed = env_elapsed_ms(&start);
+
+	/* The back-off time is at least 5 ms - one probe may happen */
+	if (probes > 1 || elapsed > 100) {
+		printf("Open breaker fails fast - fail: %u probes in %ld ms\n",
+		       probes, elapsed);
+		return 1;
+	}
+
+	printf("Open breaker fails fast - pass: 100 requests in %ld ms\n",
+	       elapsed);
+	return 0;
+}
+
+/* Half-open: probes after the back-off time fail and extend the back-off */
+static int rpc_breaker_test_probe(void)
+{
+	uint8_t buf[RPC_BREAKER_LEN];
+	struct timespec start;
+	unsigned int probes = 0;
+	ssize_t rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (probes < RPC_BREAKER_PROBES &&
+	       env_elapsed_ms(&start) < 10000) {
+		rc = esdm_rpcc_get_random_bytes(buf, sizeof(buf));
+		if (rc != -EHOSTDOWN)
+			probes++;
+		else
+			usleep(1000);
+	}
+
+	if (probes < RPC_BREAKER_PROBES) {
+		printf("Half-open breaker probes server - fail: %u probes\n",
+		       probes);
+		return 1;
+	}
+
+	printf("Half-open breaker probes server - pass: %u probes in %ld ms\n",
+	       probes, env_elapsed_ms(&start));
+	return 0;
+}
+
+/* A restarted server closes the breaker before the back-off time expired */
+static int rpc_breaker_test_restart(void)
+{
+	uint8_t buf[RPC_BREAKER_LEN];
+	struct timespec start;
+	unsigned int i;
+	long elapsed;
+	ssize_t rc;
+	int ret = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < RPC_BREAKER_REQUESTS; i++) {
+		rc = esdm_rpcc_get_random_bytes(buf, sizeof(buf));
+		if (rc != RPC_BREAKER_LEN || buf[0] != 0x5a)
+			ret = 1;
+	}
+	elapsed = env_elapsed_ms(&start);
+
+	/* The back-off time after the probes is at least 320 ms */
+	if (ret || elapsed > 100) {
+		printf("Restarted server closes breaker - fail: returned %zd after %ld ms\n",
+		       rc, elapsed);
+		return 1;
+	}
+
+	printf("Restarted server closes breaker - pass: %ld ms\n", elapsed);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t server;
+	void *res;
+	int ret = 0;
+
+	(void)argc;
+	(void)argv;
+
+	if (getuid()) {
+		printf("Program must be started as root\n");
+		return 77;
+	}
+
+	/* Server terminated: the socket is missing, the segment remains */
+	unlink(ESDM_RPC_UNPRIV_SOCKET);
+	rpc_breaker_shm_delete();
+	if (rpc_breaker_shm_create(false) < 0) {
+		printf("Creating status segment failed\n");
+		return 1;
+	}
+
+	if (esdm_rpcc_init_unpriv_service(NULL)) {
+		ret = 1;
+		goto out;
+	}
+
+	ret += rpc_breaker_test_open();
+	ret += rpc_breaker_test_fail_fast();
+	ret += rpc_breaker_test_probe();
+	if (ret)
+		goto fini;
+
+	/* Restart the server which replaces the status segment */
+	rpc_breaker_shm_delete();
+	rpc_breaker_listen_fd = env_listen(ESDM_RPC_UNPRIV_SOCKET);
+	if (rpc_breaker_shm_create(true) < 0 || rpc_breaker_listen_fd < 0) {
+		printf("Restarting server failed\n");
+		ret = 1;
+		goto fini;
+	}
+	if (pthread_create(&server, NULL, rpc_breaker_server, NULL)) {
+		ret = 1;
+		goto fini;
+	}
+
+	ret += rpc_breaker_test_restart();
+
+	/* Wake up the server if the client never connected */
+	shutdown(rpc_breaker_listen_fd, SHUT_RDWR);
+	pthread_join(server, &res);
+	if (res) {
+		printf("Fake server - fail: unexpected requests\n");
+		ret++;
+	}
+
+fini:
+	esdm_rpcc_fini_unpriv_service();
+
+out:
+	if (rpc_breaker_listen_fd >= 0)
+		close(rpc_breaker_listen_fd);
+	unlink(ESDM_RPC_UNPRIV_SOCKET);
+	rpc_breaker_shm_delete();
+	return ret;
+}
@@ -29,16 +29,18 @@ int main(int argc, char *argv[])
 	uint8_t buf[1024 * 1024];
 	uint8_t zero[sizeof(buf)];
 	size_t len = sizeof(buf);
+	enum esdm_rpcc_transport transport = esdm_rpcc_transport_socket;
 	int ret;
 
-	(void)argc;
-	(void)argv;
+	/* Optionally use the shared memory transport */
+	if (argc > 1 && !strcmp(argv[1], "shm"))
+		transport = esdm_rpcc_transport_shm;
 
 	ret = env_init();
 	if (ret)
 		return ret;
 
-	ret = esdm_rpcc_init_unpriv_service(NULL);
+	ret = esdm_rpcc_init_unpriv_service_transport(NULL, transport);
 	if (ret) {
 		ret = 1;
 		goto out;
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "conv_be_le.h"
+#include "env.h"
+#include "esdm_rpc_client.h"
+#include "esdm_rpc_protocol.h"
+#include "esdm_rpc_raw.h"
+#include "esdm_rpc_service.h"
+
+/*
+ * Test of the pipelining of requests on one client connection. A fake server
+ * listening on the unprivileged socket receives all requests of several
+ * threads before it answers them in reverse order. Every thread must receive
+ * the response carrying its request ID. Afterwards, the server does not answer
+ * a request which must fail with -ETIMEDOUT. Its late response must be
+ * discarded by the client. Finally, the server closes the connection after
+ * receiving a request - the request must fail without being sent again.
+ */
+
+#define RPC_PIPELINE_THREADS	4
+#define RPC_PIPELINE_LEN	16
+
+struct rpc_pipeline_req {
+	uint32_t request_id;
+	uint64_t len;
+};
+
+static int rpc_pipeline_listen_fd = -1;
+
+static int rpc_pipeline_recv(int fd, struct rpc_pipeline_req *req)
+{
+	struct esdm_rpc_proto_cs_header header;
+	struct esdm_rpc_raw_req raw;
+	uint8_t buf[sizeof(header) + sizeof(raw)];
+	ssize_t rc;
+
+	rc = recv(fd, buf, sizeof(buf), 0);
+	if (rc != (ssize_t)sizeof(buf))
+		return -EFAULT;
+
+	memcpy(&header, buf, sizeof(header));
+	memcpy(&raw, buf + sizeof(header), sizeof(raw));
+	if (le_bswap32(header.method_index) != ESDM_RPC_RAW ||
+	    le_bswap32(raw.method_index) != esdm_rpc_raw_get_random_bytes)
+		return -EFAULT;
+
+	req->request_id = le_bswap32(header.request_id);
+	req->len = le_bswap64(raw.len);
+	return 0;
+}
+
+/* Answer with the requested number of bytes all set to the given value */
+static int rpc_pipeline_send(int fd, const struct rpc_pipeline_req *req,
+			     uint8_t val)
+{
+	struct esdm_rpc_proto_sc_header header;
+	struct esdm_rpc_raw_resp resp;
+	uint8_t buf[sizeof(header) + sizeof(resp) + 256];
+	size_t len = sizeof(header) + sizeof(resp) + req->len;
+
+	if (req->len > 256)
+		return -EINVAL;
+
+	header.status_code = le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SUCCESS);
+	header.method_index = le_bswap32(ESDM_RPC_RAW);
+	header.message_length = le_bswap32((uint32_t)(sizeof(resp) +
+						      req->len));
+	header.request_id = le_bswap32(req->request_id);
+	resp.ret = (int64_t)le_bswap64(req->len);
+
+	memcpy(buf, &header, sizeof(header));
+	memcpy(buf + sizeof(header), &resp, sizeof(resp));
+	memset(buf + sizeof(header) + sizeof(resp), val, req->len);
+
+	if (send(fd, buf, len, MSG_NOSIGNAL) != (ssize_t)len)
+		return -EFAULT;
+	return 0;
+}
+
+static void *rpc_pipeline_server(void *arg)
+{
+	struct rpc_pipeline_req reqs[RPC_PIPELINE_THREADS], stale, req;
+	struct timeval tv = { .tv_sec = 10, .tv_usec = 0 };
+	struct pollfd pfd = { .fd = rpc_pipeline_listen_fd, .events = POLLIN };
+	long ret = 1;
+	int fd, i;
+
+	(void)arg;
+
+	fd = accept(rpc_pipeline_listen_fd, NULL, NULL);
+	if (fd < 0)
+		return (void *)ret;
+
+	/* Do not wait forever for requests the client failed to send */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	/* All requests are in flight before the first one is answered */
+	for (i = 0; i < RPC_PIPELINE_THREADS; i++) {
+		if (rpc_pipeline_recv(fd, &reqs[i]))
+			goto out;
+	}
+	for (i = RPC_PIPELINE_THREADS - 1; i >= 0; i--) {
+		if (rpc_pipeline_send(fd, &reqs[i], (uint8_t)reqs[i].len))
+			goto out;
+	}
+
+	/* This request is not answered until the client gave up */
+	if (rpc_pipeline_recv(fd, &stale) || rpc_pipeline_recv(fd, &req))
+		goto out;
+	if (rpc_pipeline_send(fd, &stale, 0xff) ||
+	    rpc_pipeline_send(fd, &req, (uint8_t)req.len))
+		goto out;
+
+	/* The connection breaks after the request was received */
+	if (rpc_pipeline_recv(fd, &req))
+		goto out;
+	close(fd);
+	fd = -1;
+
+	/* The request must not arrive a second time on a new connection */
+	if (poll(&pfd, 1, 1000) > 0) {
+		fd = accept(rpc_pipeline_listen_fd, NULL, NULL);
+		if (fd >= 0)
+			goto out;
+	}
+
+	ret = 0;
+
+out:
+	if (fd >= 0)
+		close(fd);
+	return (void *)ret;
+}
+
+static int rpc_pipeline_check(const uint8_t *buf, ssize_t rc, size_t len)
+{
+	size_t i;
+
+	if (rc != (ssize_t)len)
+		return 1;
+	for (i = 0; i < len; i++) {
+		if (buf[i] != (uint8_t)len)
+			return 1;
+	}
+	return 0;
+}
+
+static void *rpc_pipeline_client(void *arg)
+{
+	uint8_t buf[RPC_PIPELINE_LEN + RPC_PIPELINE_THREADS];
+	size_t len = RPC_PIPELINE_LEN + (size_t)(long)arg;
+
+	return (void *)(long)rpc_pipeline_check(
+		buf, esdm_rpcc_get_random_bytes(buf, len), len);
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t server, clients[RPC_PIPELINE_THREADS];
+	uint8_t buf[RPC_PIPELINE_LEN];
+	struct timespec start;
+	ssize_t rc;
+	long elapsed;
+	void *res;
+	int ret = 0, failed = 0;
+	long i;
+
+	(void)argc;
+	(void)argv;
+
+	if (getuid()) {
+		printf("Program must be started as root\n");
+		return 77;
+	}
+
+	rpc_pipeline_listen_fd = env_listen(ESDM_RPC_UNPRIV_SOCKET);
+	if (rpc_pipeline_listen_fd < 0) {
+		printf("Pipelined requests - fail: cannot listen on %s\n",
+		       ESDM_RPC_UNPRIV_SOCKET);
+		return 1;
+	}
+	if (pthread_create(&server, NULL, rpc_pipeline_server, NULL)) {
+		ret = 1;
+		goto out;
+	}
+
+	/* All threads share one connection */
+	esdm_rpcc_set_max_online_nodes(1);
+	if (esdm_rpcc_init_unpriv_service(NULL)) {
+		ret = 1;
+		goto join;
+	}
+
+	for (i = 0; i < RPC_PIPELINE_THREADS; i++) {
+		if (pthread_create(&clients[i], NULL, rpc_pipeline_client,
+				   (void *)i))
+			break;
+	}
+	failed = RPC_PIPELINE_THREADS - (int)i;
+	while (i-- > 0) {
+		pthread_join(clients[i], &res);
+		failed += (res != NULL);
+	}
+	if (failed) {
+		printf("Pipelined requests - fail: %d responses not matched\n",
+		       failed);
+		ret++;
+	} else {
+		printf("Pipelined requests - pass: responses matched by request ID\n");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rc = esdm_rpcc_get_random_bytes(buf, RPC_PIPELINE_LEN);
+	elapsed = env_elapsed_ms(&start);
+	if (rc != -ETIMEDOUT || elapsed > 10000) {
+		printf("Unanswered request - fail: returned %zd after %ld ms\n",
+		       rc, elapsed);
+		ret++;
+	} else {
+		printf("Unanswered request - pass: timed out after %ld ms\n",
+		       elapsed);
+	}
+
+	rc = esdm_rpcc_get_random_bytes(buf, RPC_PIPELINE_LEN - 1);
+	if (rpc_pipeline_check(buf, rc, RPC_PIPELINE_LEN - 1)) {
+		printf("Late response discarded - fail: returned %zd\n", rc);
+		ret++;
+	} else {
+		printf("Late response discarded - pass\n");
+	}
+
+	rc = esdm_rpcc_get_random_bytes(buf, RPC_PIPELINE_LEN);
+	if (rc >= 0) {
+		printf("Severed request - fail: returned %zd\n", rc);
+		ret++;
+	} else {
+		printf("Severed request - pass: failed with %zd\n", rc);
+	}
+
+	esdm_rpcc_fini_unpriv_service();
+
+join:
+	/* Wake up the server if the client never connected */
+	shutdown(rpc_pipeline_listen_fd, SHUT_RDWR);
+	pthread_join(server, &res);
+	if (res) {
+		printf("Fake server - fail: unexpected or resent requests\n");
+		ret++;
+	}
+
+out:
+	close(rpc_pipeline_listen_fd);
+	unlink(ESDM_RPC_UNPRIV_SOCKET);
+	return ret;
+}
@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "conv_be_le.h"
+#include "env.h"
+#include "esdm_rpc_client.h"
+#include "esdm_rpc_protocol.h"
+#include "esdm_rpc_raw.h"
+#include "esdm_rpc_service.h"
+#include "unpriv_access.pb-c.h"
+
+/*
+ * Test of the fallback from the raw encoding to the Protobuf-C encoding
+ * against a fake server listening on the unprivileged socket:
+ *
+ *	* a server rejecting the raw encoding with an explicit status gets the
+ *	  request resent with the Protobuf-C encoding on the same connection,
+ *
+ *	* a server closing the connection on a raw request gets the request
+ *	  resent with the Protobuf-C encoding on a new connection - the
+ *	  connection after uses the raw encoding again.
+ */
+
+#define RPC_RAW_LEN	32
+#define RPC_RAW_VAL	0x5a
+
+enum rpc_raw_answer {
+	rpc_raw_reject,
+	rpc_raw_reset,
+	rpc_raw_serve,
+};
+
+static int rpc_raw_listen_fd = -1;
+static sem_t rpc_raw_closed;
+
+/* Receive one request and return 1 if it uses the raw encoding */
+static int rpc_raw_recv(int fd, struct esdm_rpc_proto_cs_header *header)
+{
+	uint8_t buf[ESDM_RPC_MAX_MSG_SIZE];
+	struct esdm_rpc_raw_req req;
+	ssize_t rc;
+
+	rc = recv(fd, buf, sizeof(buf), MSG_TRUNC);
+	if (rc < (ssize_t)sizeof(*header) || rc > (ssize_t)sizeof(buf))
+		return -EFAULT;
+
+	memcpy(header, buf, sizeof(*header));
+	header->method_index = le_bswap32(header->method_index);
+	header->message_length = le_bswap32(header->message_length);
+	header->request_id = le_bswap32(header->request_id);
+
+	if (header->message_length != (uint32_t)rc - sizeof(*header))
+		return -EFAULT;
+
+	if (header->method_index != ESDM_RPC_RAW)
+		return (header->method_index ==
+			esdm_rpc_raw_get_random_bytes) ? 0 : -EFAULT;
+
+	memcpy(&req, buf + sizeof(*header), sizeof(req));
+	if (header->message_length != sizeof(req) ||
+	    le_bswap32(req.method_index) != esdm_rpc_raw_get_random_bytes ||
+	    le_bswap64(req.len) != RPC_RAW_LEN)
+		return -EFAULT;
+
+	return 1;
+}
+
+static int rpc_raw_send(int fd, uint32_t status, uint32_t method_index,
+			uint32_t request_id, const void *data, size_t len)
+{
+	struct esdm_rpc_proto_sc_header header;
+	uint8_t buf[sizeof(header) + 128];
+
+	header.status_code = le_bswap32(status);
+	header.method_index = le_bswap32(method_index);
+	header.message_length = le_bswap32((uint32_t)len);
+	header.request_id = le_bswap32(request_id);
+
+	memcpy(buf, &header, sizeof(header));
+	memcpy(buf + sizeof(header), data, len);
+	len += sizeof(header);
+
+	if (send(fd, buf, len, MSG_NOSIGNAL) != (ssize_t)len)
+		return -EFAULT;
+	return 0;
+}
+
+/* Answer the request with the expected encoding */
+static int rpc_raw_answer(int fd, int raw, enum rpc_raw_answer answer)
+{
+	struct esdm_rpc_proto_cs_header header;
+	uint8_t rnd[RPC_RAW_LEN], buf[sizeof(struct esdm_rpc_raw_resp) +
+				     RPC_RAW_LEN];
+	size_t len;
+
+	memset(rnd, RPC_RAW_VAL, sizeof(rnd));
+
+	if (rpc_raw_recv(fd, &header) != raw)
+		return -EFAULT;
+
+	if (!raw) {
+		GetRandomBytesResponse resp = GET_RANDOM_BYTES_RESPONSE__INIT;
+
+		resp.ret = RPC_RAW_LEN;
+		resp.randval.data = rnd;
+		resp.randval.len = sizeof(rnd);
+		len = get_random_bytes_response__pack(&resp, buf);
+
+		return rpc_raw_send(fd, PROTOBUF_C_RPC_STATUS_CODE_SUCCESS,
+				    header.method_index, header.request_id,
+				    buf, len);
+	}
+
+	switch (answer) {
+	case rpc_raw_reject:
+		return rpc_raw_send(fd,
+				    PROTOBUF_C_RPC_STATUS_CODE_SERVICE_FAILED,
+				    ESDM_RPC_RAW, header.request_id, NULL, 0);
+	case rpc_raw_reset:
+		return 0;
+	case rpc_raw_serve:
+	default:
+		break;
+	}
+
+	{
+		struct esdm_rpc_raw_resp resp = {
+			.ret = (int64_t)le_bswap64(RPC_RAW_LEN)
+		};
+
+		memcpy(buf, &resp, sizeof(resp));
+		memcpy(buf + sizeof(resp), rnd, sizeof(rnd));
+	}
+
+	return rpc_raw_send(fd, PROTOBUF_C_RPC_STATUS_CODE_SUCCESS,
+			    ESDM_RPC_RAW, header.request_id, buf, sizeof(buf));
+}
+
+static int rpc_raw_accept(void)
+{
+	struct timeval tv = { .tv_sec = 10, .tv_usec = 0 };
+	int fd = accept(rpc_raw_listen_fd, NULL, NULL);
+
+	/* Do not wait forever for requests the client failed to send */
+	if (fd >= 0)
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	return fd;
+}
+
+static void *rpc_raw_server(void *arg)
+{
+	long ret = 1;
+	int fd;
+
+	(void)arg;
+
+	/* The rejected raw request is resent on the same connection */
+	fd = rpc_raw_accept();
+	if (fd < 0)
+		return (void *)ret;
+	if (rpc_raw_answer(fd, 1, rpc_raw_reject) ||
+	    rpc_raw_answer(fd, 0, rpc_raw_serve) ||
+	    rpc_raw_answer(fd, 0, rpc_raw_serve))
+		goto out;
+	close(fd);
+	sem_post(&rpc_raw_closed);
+
+	/* The raw request is resent on a new connection */
+	fd = rpc_raw_accept();
+	if (fd < 0)
+		return (void *)ret;
+	if (rpc_raw_answer(fd, 1, rpc_raw_reset))
+		goto out;
+	close(fd);
+
+	fd = rpc_raw_accept();
+	if (fd < 0)
+		return (void *)ret;
+	if (rpc_raw_answer(fd, 0, rpc_raw_serve))
+		goto out;
+	close(fd);
+	sem_post(&rpc_raw_closed);
+
+	/* The reset did not disable the raw encoding permanently */
+	fd = rpc_raw_accept();
+	if (fd < 0)
+		return (void *)ret;
+	if (rpc_raw_answer(fd, 1, rpc_raw_serve))
+		goto out;
+
+	ret = 0;
+
+out:
+	close(fd);
+	sem_post(&rpc_raw_closed);
+	return (void *)ret;
+}
+
+static int rpc_raw_check(const char *name, const uint8_t *buf, ssize_t rc)
+{
+	size_t i;
+
+	if (rc != RPC_RAW_LEN)
+		goto fail;
+	for (i = 0; i < RPC_RAW_LEN; i++) {
+		if (buf[i] != RPC_RAW_VAL)
+			goto fail;
+	}
+
+	printf("%s - pass\n", name);
+	return 0;
+
+fail:
+	printf("%s - fail: returned %zd\n", name, rc);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t buf[RPC_RAW_LEN];
+	pthread_t server;
+	ssize_t rc;
+	void *res;
+	int ret = 0;
+
+	(void)argc;
+	(void)argv;
+
+	if (getuid()) {
+		printf("Program must be started as root\n");
+		return 77;
+	}
+
+	if (sem_init(&rpc_raw_closed, 0, 0))
+		return 1;
+
+	rpc_raw_listen_fd = env_listen(ESDM_RPC_UNPRIV_SOCKET);
+	if (rpc_raw_listen_fd < 0) {
+		printf("Raw encoding fallback - fail: cannot listen on %s\n",
+		       ESDM_RPC_UNPRIV_SOCKET);
+		ret = 1;
+		goto out;
+	}
+	if (pthread_create(&server, NULL, rpc_raw_server, NULL)) {
+		ret = 1;
+		goto out;
+	}
+
+	if (esdm_rpcc_init_unpriv_service(NULL)) {
+		ret = 1;
+		goto join;
+	}
+
+	memset(buf, 0, sizeof(buf));
+	rc = esdm_rpcc_get_random_bytes(buf, sizeof(buf));
+	ret += rpc_raw_check("Raw encoding rejected by server", buf, rc);
+
+	memset(buf, 0, sizeof(buf));
+	rc = esdm_rpcc_get_random_bytes(buf, sizeof(buf));
+	ret += rpc_raw_check("Protobuf-C encoding for remainder of connection",
+			     buf, rc);
+
+	/* The next request finds the connection closed */
+	sem_wait(&rpc_raw_closed);
+
+	memset(buf, 0, sizeof(buf));
+	rc = esdm_rpcc_get_random_bytes(buf, sizeof(buf));
+	ret += rpc_raw_check("Connection reset by raw request", buf, rc);
+
+	sem_wait(&rpc_raw_closed);
+
+	memset(buf, 0, sizeof(buf));
+	rc = esdm_rpcc_get_random_bytes(buf, sizeof(buf));
+	ret += rpc_raw_check("Raw encoding used on next connection", buf, rc);
+
+	esdm_rpcc_fini_unpriv_service();
+
+join:
+	/* Wake up the server if the client never connected */
+	shutdown(rpc_raw_listen_fd, SHUT_RDWR);
+	pthread_join(server, &res);
+	if (res) {
+		printf("Fake server - fail: unexpected requests\n");
+		ret++;
+	}
+
+out:
+	if (rpc_raw_listen_fd >= 0)
+		close(rpc_raw_listen_fd);
+	unlink(ESDM_RPC_UNPRIV_SOCKET);
+	sem_destroy(&rpc_raw_closed);
+	return ret;
+}
@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "conv_be_le.h"
+#include "env.h"
+#include "esdm_rpc_client.h"
+#include "esdm_rpc_protocol.h"
+#include "esdm_rpc_raw.h"
+#include "esdm_rpc_service.h"
+#include "esdm_rpc_stream.h"
+
+/*
+ * Test of the streaming protocol of the client against a fake server
+ * listening on the unprivileged socket:
+ *
+ *	* a request larger than ESDM_RPC_MAX_DATA is streamed - the client must
+ *	  request a valid window and grant credits so that the granted
+ *	  fragments never exceed the window nor the fragments still needed,
+ *
+ *	* a stream terminated by the server with an error leaves the
+ *	  connection usable - the client fetches the remainder with individual
+ *	  requests on it.
+ */
+
+#define RPC_STREAM_LEN		(10 * ESDM_RPC_MAX_DATA + 17)
+#define RPC_STREAM_ERR_LEN	(3 * ESDM_RPC_MAX_DATA + 5)
+#define RPC_STREAM_RAW_LEN	4096
+#define RPC_STREAM_RAW_VAL	0xaa
+
+static int rpc_stream_listen_fd = -1;
+static uint8_t rpc_stream_buf[ESDM_RPC_MAX_MSG_SIZE];
+
+/* Receive one request and return its payload length or < 0 on error */
+static ssize_t rpc_stream_recv(int fd, struct esdm_rpc_proto_cs_header *header,
+			       void *data, size_t len)
+{
+	uint8_t buf[sizeof(*header) + sizeof(struct esdm_rpc_raw_req)];
+	ssize_t rc;
+
+	rc = recv(fd, buf, sizeof(buf), MSG_TRUNC);
+	if (rc < (ssize_t)sizeof(*header) || rc > (ssize_t)sizeof(buf))
+		return -EFAULT;
+
+	memcpy(header, buf, sizeof(*header));
+	header->method_index = le_bswap32(header->method_index);
+	header->message_length = le_bswap32(header->message_length);
+	header->request_id = le_bswap32(header->request_id);
+
+	rc -= (ssize_t)sizeof(*header);
+	if (header->message_length != (uint32_t)rc || (size_t)rc != len)
+		return -EFAULT;
+	memcpy(data, buf + sizeof(*header), len);
+
+	return rc;
+}
+
+/* Receive the request of a stream */
+static int rpc_stream_recv_req(int fd, uint64_t len, uint32_t *window)
+{
+	struct esdm_rpc_proto_cs_header header;
+	struct esdm_rpc_stream_req req;
+
+	if (rpc_stream_recv(fd, &header, &req, sizeof(req)) < 0 ||
+	    header.method_index != ESDM_RPC_STREAM || header.request_id ||
+	    le_bswap32(req.method_index) != esdm_rpc_stream_get_random_bytes ||
+	    le_bswap64(req.len) != len)
+		return -EFAULT;
+
+	*window = le_bswap32(req.window);
+	return 0;
+}
+
+/* Send a fragment of a stream filled with the given value */
+static int rpc_stream_send_frag(int fd, size_t len, uint8_t val)
+{
+	struct esdm_rpc_proto_sc_header header;
+
+	header.status_code = le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SUCCESS);
+	header.method_index = le_bswap32(ESDM_RPC_STREAM);
+	header.message_length = le_bswap32((uint32_t)len);
+	header.request_id = 0;
+
+	memcpy(rpc_stream_buf, &header, sizeof(header));
+	memset(rpc_stream_buf + sizeof(header), val, len);
+	len += sizeof(header);
+
+	if (send(fd, rpc_stream_buf, len, MSG_NOSIGNAL) != (ssize_t)len)
+		return -EFAULT;
+	return 0;
+}
+
+/* Terminate a stream with an error */
+static int rpc_stream_send_err(int fd, int32_t ret)
+{
+	struct {
+		struct esdm_rpc_proto_sc_header header;
+		struct esdm_rpc_stream_err err;
+	} __attribute__((packed)) msg;
+
+	msg.header.status_code =
+		le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SERVICE_FAILED);
+	msg.header.method_index = le_bswap32(ESDM_RPC_STREAM);
+	msg.header.message_length = le_bswap32(sizeof(msg.err));
+	msg.header.request_id = 0;
+	msg.err.ret = (int32_t)le_bswap32((uint32_t)ret);
+
+	if (send(fd, &msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg))
+		return -EFAULT;
+	return 0;
+}
+
+/* Serve a stream and check the flow control of the client */
+static int rpc_stream_serve(int fd)
+{
+	struct esdm_rpc_proto_cs_header header;
+	struct esdm_rpc_stream_credit credit;
+	uint32_t credits, frags, sent = 0;
+	size_t len = RPC_STREAM_LEN;
+
+	if (rpc_stream_recv_req(fd, RPC_STREAM_LEN, &credits) || !credits ||
+	    credits > ESDM_RPC_STREAM_WINDOW)
+		return -EFAULT;
+
+	frags = (RPC_STREAM_LEN + ESDM_RPC_MAX_DATA - 1) / ESDM_RPC_MAX_DATA;
+
+	while (len) {
+		size_t todo = len < ESDM_RPC_MAX_DATA ? len : ESDM_RPC_MAX_DATA;
+
+		while (!credits) {
+			if (rpc_stream_recv(fd, &header, &credit,
+					    sizeof(credit)) < 0 ||
+			    header.method_index != ESDM_RPC_STREAM_CREDIT ||
+			    header.request_id)
+				return -EFAULT;
+			credits = le_bswap32(credit.credits);
+		}
+
+		/* Granted fragments exceed the window or the stream */
+		if (credits > ESDM_RPC_STREAM_WINDOW || sent + credits > frags)
+			return -EFAULT;
+
+		if (rpc_stream_send_frag(fd, todo, (uint8_t)(sent + 1)))
+			return -EFAULT;
+
+		len -= todo;
+		sent++;
+		credits--;
+	}
+
+	return 0;
+}
+
+/* Answer the raw requests for the remainder of a terminated stream */
+static int rpc_stream_serve_raw(int fd, size_t len)
+{
+	struct esdm_rpc_proto_cs_header header;
+	struct esdm_rpc_proto_sc_header sc_header;
+	struct esdm_rpc_raw_req req;
+	struct esdm_rpc_raw_resp resp;
+	uint8_t *buf = rpc_stream_buf;
+	size_t todo, msglen;
+
+	while (len) {
+		if (rpc_stream_recv(fd, &header, &req, sizeof(req)) < 0 ||
+		    header.method_index != ESDM_RPC_RAW ||
+		    le_bswap32(req.method_index) !=
+		    esdm_rpc_raw_get_random_bytes ||
+		    le_bswap64(req.len) != len)
+			return -EFAULT;
+
+		todo = len < RPC_STREAM_RAW_LEN ? len : RPC_STREAM_RAW_LEN;
+		msglen = sizeof(resp) + todo;
+
+		sc_header.status_code =
+			le_bswap32(PROTOBUF_C_RPC_STATUS_CODE_SUCCESS);
+		sc_header.method_index = le_bswap32(ESDM_RPC_RAW);
+		sc_header.message_length = le_bswap32((uint32_t)msglen);
+		sc_header.request_id = le_bswap32(header.request_id);
+		resp.ret = (int64_t)le_bswap64(todo);
+
+		memcpy(buf, &sc_header, sizeof(sc_header));
+		memcpy(buf + sizeof(sc_header), &resp, sizeof(resp));
+		memset(buf + sizeof(sc_header) + sizeof(resp),
+		       RPC_STREAM_RAW_VAL, todo);
+		msglen += sizeof(sc_header);
+
+		if (send(fd, buf, msglen, MSG_NOSIGNAL) != (ssize_t)msglen)
+			return -EFAULT;
+
+		len -= todo;
+	}
+
+	return 0;
+}
+
+static void *rpc_stream_server(void *arg)
+{
+	struct timeval tv = { .tv_sec = 10, .tv_usec = 0 };
+	uint32_t window;
+	long ret = 1;
+	int fd;
+
+	(void)arg;
+
+	fd = accept(rpc_stream_listen_fd, NULL, NULL);
+	if (fd < 0)
+		return (void *)ret;
+
+	/* Do not wait forever for requests the client failed to send */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	if (rpc_stream_serve(fd))
+		goto out;
+
+	/* The stream ends after its first fragment */
+	if (rpc_stream_recv_req(fd, RPC_STREAM_ERR_LEN, &window) ||
+	    rpc_stream_send_frag(fd, ESDM_RPC_MAX_DATA, 1) ||
+	    rpc_stream_send_err(fd, -EAGAIN))
+		goto out;
+
+	/* The stream for the remainder fails right away */
+	if (rpc_stream_recv_req(fd, RPC_STREAM_ERR_LEN - ESDM_RPC_MAX_DATA,
+				&window) ||
+	    rpc_stream_send_err(fd, -EAGAIN))
+		goto out;
+
+	if (rpc_stream_serve_raw(fd, RPC_STREAM_ERR_LEN - ESDM_RPC_MAX_DATA))
+		goto out;
+
+	ret = 0;
+
+out:
+	close(fd);
+	return (void *)ret;
+}
+
+static int rpc_stream_check(const uint8_t *buf, ssize_t rc, size_t len,
+			    size_t streamed)
+{
+	size_t i;
+
+	if (rc != (ssize_t)len)
+		return 1;
+	for (i = 0; i < len; i++) {
+		uint8_t val = (i < streamed) ?
+			(uint8_t)(i / ESDM_RPC_MAX_DATA + 1) :
+			RPC_STREAM_RAW_VAL;
+
+		if (buf[i] != val)
+			return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t server;
+	uint8_t *buf;
+	ssize_t rc;
+	void *res;
+	int ret = 0;
+
+	(void)argc;
+	(void)argv;
+
+	if (getuid()) {
+		printf("Program must be started as root\n");
+		return 77;
+	}
+
+	buf = malloc(RPC_STREAM_LEN);
+	if (!buf)
+		return 1;
+
+	rpc_stream_listen_fd = env_listen(ESDM_RPC_UNPRIV_SOCKET);
+	if (rpc_stream_listen_fd < 0) {
+		printf("Streamed requests - fail: cannot listen on %s\n",
+		       ESDM_RPC_UNPRIV_SOCKET);
+		ret = 1;
+		goto out;
+	}
+	if (pthread_create(&server, NULL, rpc_stream_server, NULL)) {
+		ret = 1;
+		goto out;
+	}
+
+	if (esdm_rpcc_init_unpriv_service(NULL)) {
+		ret = 1;
+		goto join;
+	}
+
+	rc = esdm_rpcc_get_random_bytes(buf, RPC_STREAM_LEN);
+	if (rpc_stream_check(buf, rc, RPC_STREAM_LEN, RPC_STREAM_LEN)) {
+		printf("Streamed request with flow control - fail: returned %zd\n",
+		       rc);
+		ret++;
+	} else {
+		printf("Streamed request with flow control - pass\n");
+	}
+
+	rc = esdm_rpcc_get_random_bytes(buf, RPC_STREAM_ERR_LEN);
+	if (rpc_stream_check(buf, rc, RPC_STREAM_ERR_LEN, ESDM_RPC_MAX_DATA)) {
+		printf("Stream terminated by server - fail: returned %zd\n",
+		       rc);
+		ret++;
+	} else {
+		printf("Stream terminated by server - pass: remainder fetched with individual requests\n");
+	}
+
+	esdm_rpcc_fini_unpriv_service();
+
+join:
+	/* Wake up the server if the client never connected */
+	shutdown(rpc_stream_listen_fd, SHUT_RDWR);
+	pthread_join(server, &res);
+	if (res) {
+		printf("Fake server - fail: unexpected requests\n");
+		ret++;
+	}
+
+out:
+	if (rpc_stream_listen_fd >= 0)
+		close(rpc_stream_listen_fd);
+	unlink(ESDM_RPC_UNPRIV_SOCKET);
+	free(buf);
+	return ret;
+}
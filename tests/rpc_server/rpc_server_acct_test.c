@@ -0,0 +1,383 @@
+/*
+ * Copyright (C) 2022, Stephan Mueller <smueller@chronox.de>
+ *
+ * License: see LICENSE file in root directory
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, ALL OF
+ * WHICH ARE HEREBY DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF NOT ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "esdm_rpc_server.h"
+#include "esdm_rpc_server_acct.h"
+
+/*
+ * Test of the accounting of unprivileged RPC clients against a fake clock and
+ * a fixed number of workers. The peers are child processes connecting with
+ * their own UID:
+ *
+ *	* the token buckets throttle requests and bytes and refill with time,
+ *
+ *	* an account uses at most its share of the workers, connections
+ *	  exceeding it are parked and resumed in FIFO order,
+ *
+ *	* the concurrent streams of an account are limited,
+ *
+ *	* an unused account is only reclaimed once its buckets are full.
+ */
+
+#define RPC_ACCT_UID_A		65534
+#define RPC_ACCT_UID_B		65533
+#define RPC_ACCT_WORKERS	2
+#define RPC_ACCT_SEC		1000000000ULL
+
+struct rpc_acct_peer {
+	pid_t pid;
+	int fd;
+};
+
+static int rpc_acct_listen_fd = -1;
+static uint64_t rpc_acct_now = RPC_ACCT_SEC;
+
+static void rpc_acct_clock_advance(uint64_t ns)
+{
+	rpc_acct_now += ns;
+	esdm_rpcs_acct_test_clock_set(rpc_acct_now);
+}
+
+static int rpc_acct_listen(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	/* Abstract socket name */
+	snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+		 "esdm-rpc-acct-test-%d", (int)getpid());
+
+	rpc_acct_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (rpc_acct_listen_fd < 0)
+		return -errno;
+	if (bind(rpc_acct_listen_fd, (struct sockaddr *)&addr,
+		 sizeof(addr)) < 0 ||
+	    listen(rpc_acct_listen_fd, 4) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* Connect a child process with the given UID and accept its connection */
+static int rpc_acct_connect(struct rpc_acct_peer *peer, uid_t uid)
+{
+	struct sockaddr_un addr;
+	socklen_t len = sizeof(addr);
+	char c;
+
+	if (getsockname(rpc_acct_listen_fd, (struct sockaddr *)&addr, &len))
+		return -errno;
+
+	peer->pid = fork();
+	if (peer->pid < 0)
+		return -errno;
+	if (!peer->pid) {
+		int fd;
+
+		if (setuid(uid))
+			_exit(1);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr *)&addr, len))
+			_exit(1);
+
+		/* Keep the connection until the parent closes it */
+		while (read(fd, &c, 1) > 0)
+			;
+		_exit(0);
+	}
+
+	peer->fd = accept(rpc_acct_listen_fd, NULL, NULL);
+	if (peer->fd < 0)
+		return -errno;
+
+	return 0;
+}
+
+static void rpc_acct_disconnect(struct rpc_acct_peer *peer)
+{
+	/* Later children inherited the file descriptor */
+	if (peer->fd >= 0) {
+		shutdown(peer->fd, SHUT_RDWR);
+		close(peer->fd);
+	}
+	if (peer->pid > 0)
+		waitpid(peer->pid, NULL, 0);
+	peer->fd = -1;
+	peer->pid = 0;
+}
+
+static int rpc_acct_get(struct rpc_acct_peer *peer, uid_t uid,
+			struct esdm_rpcs_acct **acct)
+{
+	if (rpc_acct_connect(peer, uid) || esdm_rpcs_acct_get(peer->fd, acct) ||
+	    !*acct) {
+		printf("Obtaining account for UID %u failed\n",
+		       (unsigned int)uid);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Token buckets for requests and bytes */
+static int rpc_acct_test_admit(struct esdm_rpcs_acct *acct)
+{
+	uint32_t retry_ms = 0;
+	unsigned int i;
+	int ret = 0;
+
+	esdm_rpc_server_limit_requests_set(10);
+
+	/* A full bucket admits the requests of one second */
+	for (i = 0; i < 10; i++)
+		ret |= esdm_rpcs_acct_admit(acct, 1, &retry_ms);
+	if (ret || esdm_rpcs_acct_admit(acct, 1, &retry_ms) != -EBUSY ||
+	    retry_ms != 100) {
+		printf("Request limit - fail: retry after %u ms\n", retry_ms);
+		return 1;
+	}
+
+	rpc_acct_clock_advance(RPC_ACCT_SEC / 10);
+	if (esdm_rpcs_acct_admit(acct, 1, &retry_ms)) {
+		printf("Request limit refill - fail\n");
+		return 1;
+	}
+	printf("Request limit - pass\n");
+
+	esdm_rpc_server_limit_requests_set(0);
+	esdm_rpc_server_limit_bytes_set(1000);
+
+	/* The bytes sent are paid for by the following requests */
+	esdm_rpcs_acct_charge(acct, 3000);
+	if (esdm_rpcs_acct_admit(acct, 1, &retry_ms) != -EBUSY ||
+	    retry_ms != 2000) {
+		printf("Byte limit - fail: retry after %u ms\n", retry_ms);
+		return 1;
+	}
+
+	rpc_acct_clock_advance(2 * RPC_ACCT_SEC);
+	if (esdm_rpcs_acct_admit(acct, 1, &retry_ms)) {
+		printf("Byte limit refill - fail\n");
+		return 1;
+	}
+	printf("Byte limit - pass\n");
+
+	esdm_rpc_server_limit_bytes_set(0);
+
+	return 0;
+}
+
+/* Share of the workers, FIFO parking and resumption */
+static int rpc_acct_test_share(struct esdm_rpcs_acct *a,
+			       struct esdm_rpcs_acct *b)
+{
+	struct esdm_rpcs_acct_wait wa[4], wb[2], *w;
+	int ret = 0;
+
+	memset(wa, 0, sizeof(wa));
+	memset(wb, 0, sizeof(wb));
+
+	/* Alone, A uses all workers, further connections are parked */
+	if (!esdm_rpcs_acct_enter(a, &wa[0]) ||
+	    !esdm_rpcs_acct_enter(a, &wa[1]) ||
+	    esdm_rpcs_acct_enter(a, &wa[2]) ||
+	    esdm_rpcs_acct_enter(a, &wa[3])) {
+		printf("Single account uses all workers - fail\n");
+		return 1;
+	}
+
+	/* B obtains its share although A is saturated */
+	if (!esdm_rpcs_acct_enter(b, &wb[0]) ||
+	    esdm_rpcs_acct_enter(b, &wb[1])) {
+		printf("Second account obtains its share - fail\n");
+		return 1;
+	}
+
+	/* A is still at its share while B is active */
+	if (esdm_rpcs_acct_leave(a)) {
+		printf("Parked connection exceeding share resumed - fail\n");
+		ret = 1;
+	}
+
+	/* B resumes its parked connection which is served again */
+	w = esdm_rpcs_acct_leave(b);
+	if (w != &wb[1] || !esdm_rpcs_acct_enter(b, w)) {
+		printf("Resumption of parked connection - fail\n");
+		ret = 1;
+	}
+
+	/* The parked connections of A are resumed in FIFO order */
+	w = esdm_rpcs_acct_leave(a);
+	if (w != &wa[2] || !esdm_rpcs_acct_enter(a, w)) {
+		printf("First parked connection resumed first - fail\n");
+		ret = 1;
+	}
+	w = esdm_rpcs_acct_leave(a);
+	if (w != &wa[3] || !esdm_rpcs_acct_enter(a, w)) {
+		printf("Second parked connection resumed second - fail\n");
+		ret = 1;
+	}
+
+	if (esdm_rpcs_acct_leave(a) || esdm_rpcs_acct_leave(b)) {
+		printf("Completion without parked connections - fail\n");
+		ret = 1;
+	}
+
+	if (!ret)
+		printf("Fair share of workers with FIFO parking - pass\n");
+	return ret;
+}
+
+/* Concurrent streams of an account */
+static int rpc_acct_test_streams(struct esdm_rpcs_acct *a,
+				 struct esdm_rpcs_acct *b)
+{
+	unsigned int i, admitted = 0;
+
+	while (admitted < 16 && !esdm_rpcs_acct_stream_enter(a))
+		admitted++;
+
+	/* The streams of A do not count for B */
+	if (!admitted || admitted >= 16 || esdm_rpcs_acct_stream_enter(b)) {
+		printf("Concurrent streams limited - fail: %u admitted\n",
+		       admitted);
+		return 1;
+	}
+	esdm_rpcs_acct_stream_leave(b);
+
+	/* A completed stream allows the next one */
+	esdm_rpcs_acct_stream_leave(a);
+	if (esdm_rpcs_acct_stream_enter(a) != 0 ||
+	    esdm_rpcs_acct_stream_enter(a) != -EBUSY) {
+		printf("Stream admitted after completion - fail\n");
+		return 1;
+	}
+
+	for (i = 0; i < admitted; i++)
+		esdm_rpcs_acct_stream_leave(a);
+
+	printf("Concurrent streams limited to %u - pass\n", admitted);
+	return 0;
+}
+
+/* A throttled account survives reconnecting, an unused one is reclaimed */
+static int rpc_acct_test_reclaim(void)
+{
+	struct rpc_acct_peer peer = { .pid = 0, .fd = -1 };
+	struct esdm_rpcs_acct *acct;
+	uint32_t retry_ms;
+	unsigned int i;
+	int ret = 0;
+
+	esdm_rpc_server_limit_requests_set(1);
+
+	if (rpc_acct_get(&peer, RPC_ACCT_UID_A, &acct))
+		return 1;
+	for (i = 0; i < 2; i++)
+		esdm_rpcs_acct_admit(acct, 1, &retry_ms);
+	esdm_rpcs_acct_put(acct);
+	rpc_acct_disconnect(&peer);
+
+	if (esdm_rpcs_acct_test_accounts() != 1) {
+		printf("Throttled account kept - fail\n");
+		ret = 1;
+	}
+
+	/* Reconnecting does not reset the limits */
+	if (rpc_acct_get(&peer, RPC_ACCT_UID_A, &acct))
+		return 1;
+	if (esdm_rpcs_acct_admit(acct, 1, &retry_ms) != -EBUSY) {
+		printf("Limits kept after reconnect - fail\n");
+		ret = 1;
+	}
+
+	rpc_acct_clock_advance(2 * RPC_ACCT_SEC);
+	esdm_rpcs_acct_put(acct);
+	rpc_acct_disconnect(&peer);
+
+	if (esdm_rpcs_acct_test_accounts()) {
+		printf("Unused account reclaimed - fail\n");
+		ret = 1;
+	}
+
+	esdm_rpc_server_limit_requests_set(0);
+
+	if (!ret)
+		printf("Account reclaim - pass\n");
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct rpc_acct_peer peer_a = { .pid = 0, .fd = -1 },
+			     peer_b = { .pid = 0, .fd = -1 };
+	struct esdm_rpcs_acct *a = NULL, *b = NULL;
+	unsigned int i;
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+	if (getuid()) {
+		printf("Program must be started as root\n");
+		return 77;
+	}
+
+	esdm_rpcs_acct_test_clock_set(rpc_acct_now);
+	for (i = 0; i < RPC_ACCT_WORKERS; i++)
+		esdm_rpcs_acct_add_worker();
+
+	if (rpc_acct_listen())
+		return 1;
+
+	ret = rpc_acct_get(&peer_a, RPC_ACCT_UID_A, &a);
+	ret += rpc_acct_get(&peer_b, RPC_ACCT_UID_B, &b);
+	if (ret)
+		goto out;
+
+	ret = rpc_acct_test_admit(a);
+	ret += rpc_acct_test_share(a, b);
+	ret += rpc_acct_test_streams(a, b);
+
+	/* The buckets of A are full again */
+	rpc_acct_clock_advance(2 * RPC_ACCT_SEC);
+	esdm_rpcs_acct_put(a);
+	esdm_rpcs_acct_put(b);
+	a = b = NULL;
+	rpc_acct_disconnect(&peer_a);
+	rpc_acct_disconnect(&peer_b);
+
+	ret += rpc_acct_test_reclaim();
+
+out:
+	esdm_rpcs_acct_put(a);
+	esdm_rpcs_acct_put(b);
+	rpc_acct_disconnect(&peer_a);
+	rpc_acct_disconnect(&peer_b);
+	close(rpc_acct_listen_fd);
+	return ret;
+}